@@ -0,0 +1,177 @@
+#include <time.h>
+
+#include "internal.h"
+
+/// \file
+/// \brief Measures macro expansion time for deeply nested macros that evaluate their arguments several times and for
+///        Boost.PP-style repetition.
+/// \details Usage: cushion_benchmark_macro_expansion [depth] [lines_count] [iterations]
+///          In evaluated case, every line nests `depth` levels of CAT(A(x), B(x))-style macros, where every level
+///          evaluates its argument twice through __CUSHION_EVALUATED_ARGUMENT__. When every occurrence is evaluated
+///          separately, work grows exponentially with depth, while memoized evaluation keeps it linear. This case
+///          requires evaluated argument extension.
+///          In repeat case, every line unrolls REPEAT_N, which calls REPEAT_N-1 and then given macro, and passes state
+///          through WHILE_N chain of distinct macros, so expansion depth grows linearly with their counts.
+///          Input and output files are created in working directory and removed afterwards.
+
+#define DEFAULT_DEPTH 12u
+#define DEFAULT_LINES_COUNT 200u
+#define DEFAULT_ITERATIONS 10u
+
+#define REPEAT_COUNT 256u
+#define WHILE_DEPTH 2048u
+
+#define EVALUATED_INPUT_FILE_NAME "cushion_benchmark_macro_expansion_evaluated_input.c"
+#define REPEAT_INPUT_FILE_NAME "cushion_benchmark_macro_expansion_repeat_input.c"
+#define OUTPUT_FILE_NAME "cushion_benchmark_macro_expansion_output.c"
+
+static uint64_t get_time_ns (void)
+{
+    struct timespec time;
+    timespec_get (&time, TIME_UTC);
+    return ((uint64_t) time.tv_sec) * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+static int generate_evaluated_input (unsigned int depth, unsigned int lines_count)
+{
+    FILE *input = fopen (EVALUATED_INPUT_FILE_NAME, "wb");
+    if (!input)
+    {
+        fprintf (stderr, "Failed to open \"%s\" for writing synthetic input.\n", EVALUATED_INPUT_FILE_NAME);
+        return 0;
+    }
+
+    fprintf (input, "#define CAT_IMPL(a, b) a ## b\n"
+                    "#define CAT(a, b) CAT_IMPL (__CUSHION_EVALUATED_ARGUMENT__ (a), "
+                    "__CUSHION_EVALUATED_ARGUMENT__ (b))\n"
+                    "#define A(x) x\n"
+                    "#define B(x) _\n");
+
+    for (unsigned int level = 1u; level <= depth; ++level)
+    {
+        fprintf (input,
+                 "#define LEVEL_%u(x) CAT (A (__CUSHION_EVALUATED_ARGUMENT__ (x)), "
+                 "B (__CUSHION_EVALUATED_ARGUMENT__ (x)))\n",
+                 level);
+    }
+
+    for (unsigned int line = 0u; line < lines_count; ++line)
+    {
+        fprintf (input, "int value_%u = ", line);
+        for (unsigned int level = depth; level > 0u; --level)
+        {
+            fprintf (input, "LEVEL_%u (", level);
+        }
+
+        fprintf (input, "value_%u", line);
+        for (unsigned int level = 0u; level < depth; ++level)
+        {
+            fputc (')', input);
+        }
+
+        fprintf (input, ";\n");
+    }
+
+    fclose (input);
+    return 1;
+}
+
+static int generate_repeat_input (unsigned int lines_count)
+{
+    FILE *input = fopen (REPEAT_INPUT_FILE_NAME, "wb");
+    if (!input)
+    {
+        fprintf (stderr, "Failed to open \"%s\" for writing synthetic input.\n", REPEAT_INPUT_FILE_NAME);
+        return 0;
+    }
+
+    fprintf (input, "#define ITEM(index, name) name ## _ ## index,\n"
+                    "#define REPEAT_0(macro, name)\n");
+
+    for (unsigned int count = 1u; count <= REPEAT_COUNT; ++count)
+    {
+        fprintf (input, "#define REPEAT_%u(macro, name) REPEAT_%u (macro, name) macro (%u, name)\n", count,
+                 count - 1u, count - 1u);
+    }
+
+    for (unsigned int level = 0u; level < WHILE_DEPTH; ++level)
+    {
+        fprintf (input, "#define WHILE_%u(state) WHILE_%u (state)\n", level, level + 1u);
+    }
+
+    fprintf (input, "#define WHILE_%u(state) state\n", WHILE_DEPTH);
+    for (unsigned int line = 0u; line < lines_count; ++line)
+    {
+        fprintf (input, "int values_%u[] = {REPEAT_%u (ITEM, value_%u)};\n", line, REPEAT_COUNT, line);
+        fprintf (input, "int state_%u = WHILE_0 (%u);\n", line, line);
+    }
+
+    fclose (input);
+    return 1;
+}
+
+/// \brief Executes given input several times and prints total time. Returns zero if execution failed.
+static int run_case (const char *name,
+                     const char *input_file_name,
+                     unsigned int evaluated_argument,
+                     unsigned int lines_count,
+                     unsigned int iterations)
+{
+    uint64_t total_ns = 0u;
+    for (unsigned int iteration = 0u; iteration < iterations; ++iteration)
+    {
+        cushion_context_t context = cushion_context_create ();
+        if (evaluated_argument)
+        {
+            cushion_context_configure_feature (context, CUSHION_FEATURE_EVALUATED_ARGUMENT, 1u);
+        }
+
+        cushion_context_configure_input (context, input_file_name);
+        cushion_context_configure_output (context, OUTPUT_FILE_NAME);
+
+        const uint64_t start_ns = get_time_ns ();
+        const enum cushion_result_t result = cushion_context_execute (context);
+        total_ns += get_time_ns () - start_ns;
+        cushion_context_destroy (context);
+
+        if (result != CUSHION_RESULT_OK)
+        {
+            fprintf (stderr, "Execution of %s case failed with result %u, benchmark results are not valid.\n", name,
+                     (unsigned int) result);
+            return 0;
+        }
+    }
+
+    const double seconds = (double) total_ns / 1000000000.0;
+    printf ("%-16s %10.3f ms %14.0f lines/s\n", name, (double) total_ns / 1000000.0,
+            seconds > 0.0 ? (double) lines_count * (double) iterations / seconds : 0.0);
+    return 1;
+}
+
+int main (int argc, char **argv)
+{
+    const unsigned int depth = argc > 1 ? (unsigned int) strtoul (argv[1u], NULL, 10) : DEFAULT_DEPTH;
+    const unsigned int lines_count = argc > 2 ? (unsigned int) strtoul (argv[2u], NULL, 10) : DEFAULT_LINES_COUNT;
+    const unsigned int iterations = argc > 3 ? (unsigned int) strtoul (argv[3u], NULL, 10) : DEFAULT_ITERATIONS;
+
+    if (depth == 0u || lines_count == 0u || iterations == 0u)
+    {
+        fprintf (stderr, "Usage: %s [depth] [lines_count] [iterations]\n", argv[0u]);
+        return -1;
+    }
+
+    if (!generate_evaluated_input (depth, lines_count) || !generate_repeat_input (lines_count))
+    {
+        remove (EVALUATED_INPUT_FILE_NAME);
+        return -1;
+    }
+
+    printf ("Depth: %u, lines: %u, iterations: %u.\n", depth, lines_count, iterations);
+    const int succeeded = run_case ("evaluated", EVALUATED_INPUT_FILE_NAME, 1u, lines_count, iterations) &&
+                          run_case ("repeat", REPEAT_INPUT_FILE_NAME, 0u, lines_count, iterations);
+
+    remove (EVALUATED_INPUT_FILE_NAME);
+    remove (REPEAT_INPUT_FILE_NAME);
+    remove (OUTPUT_FILE_NAME);
+    return succeeded ? 0 : -1;
+}
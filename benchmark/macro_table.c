@@ -0,0 +1,191 @@
+#include <time.h>
+
+#include "internal.h"
+
+/// \file
+/// \brief Compares macro search throughput of the instance symbol table with the chained hash map it replaced.
+/// \details Usage: cushion_benchmark_macro_table [macros_count] [lookups_count]
+///          Lookups are mixed: one in four identifiers is a macro, others are not, which roughly corresponds to
+///          usual code where most identifiers are not macros. Symbol table is measured twice: search by name, which
+///          is used for strings from configuration, and search by symbol that tokenizer has already interned.
+
+#define CHAINED_TABLE_BUCKETS 1024u
+#define DEFAULT_MACROS_COUNT 50000u
+#define DEFAULT_LOOKUPS_COUNT 20000000u
+#define NAME_BUFFER_SIZE 64u
+
+/// \brief Node of chained table, has the same layout as macro nodes had before symbol table.
+struct chained_table_node_t
+{
+    struct chained_table_node_t *next;
+    unsigned int name_hash;
+    const char *name;
+    struct cushion_macro_node_t *macro;
+};
+
+/// \brief Fixed bucket chained table, the same as macro table was before switching to open addressing.
+struct chained_table_t
+{
+    struct chained_table_node_t *buckets[CHAINED_TABLE_BUCKETS];
+};
+
+static void chained_table_insert (struct chained_table_t *table, struct chained_table_node_t *node)
+{
+    node->name_hash = cushion_hash_djb2_null_terminated (node->name);
+    node->next = table->buckets[node->name_hash % CHAINED_TABLE_BUCKETS];
+    table->buckets[node->name_hash % CHAINED_TABLE_BUCKETS] = node;
+}
+
+static struct cushion_macro_node_t *chained_table_search (struct chained_table_t *table,
+                                                          const char *name_begin,
+                                                          const char *name_end)
+{
+    const unsigned int name_hash = cushion_hash_djb2_char_sequence (name_begin, name_end);
+    struct chained_table_node_t *list = table->buckets[name_hash % CHAINED_TABLE_BUCKETS];
+
+    while (list)
+    {
+        if (list->name_hash == name_hash && strlen (list->name) == (size_t) (name_end - name_begin) &&
+            strncmp (list->name, name_begin, name_end - name_begin) == 0)
+        {
+            return list->macro;
+        }
+
+        list = list->next;
+    }
+
+    return NULL;
+}
+
+struct lookup_name_t
+{
+    const char *begin;
+    const char *end;
+    unsigned int symbol;
+};
+
+static uint64_t get_time_ns (void)
+{
+    struct timespec time;
+    timespec_get (&time, TIME_UTC);
+    return ((uint64_t) time.tv_sec) * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+static void print_result (const char *name, uint64_t time_ns, unsigned int lookups_count, unsigned int found_count)
+{
+    const double seconds = (double) time_ns / 1000000000.0;
+    printf ("%-16s %10.3f ms %14.0f lookups/s (found %u)\n", name, (double) time_ns / 1000000.0,
+            seconds > 0.0 ? (double) lookups_count / seconds : 0.0, found_count);
+}
+
+int main (int argc, char **argv)
+{
+    const unsigned int macros_count = argc > 1 ? (unsigned int) strtoul (argv[1u], NULL, 10) : DEFAULT_MACROS_COUNT;
+    const unsigned int lookups_count = argc > 2 ? (unsigned int) strtoul (argv[2u], NULL, 10) : DEFAULT_LOOKUPS_COUNT;
+
+    if (macros_count == 0u || lookups_count == 0u)
+    {
+        fprintf (stderr, "Usage: %s [macros_count] [lookups_count]\n", argv[0u]);
+        return -1;
+    }
+
+    struct cushion_instance_t *instance = malloc (sizeof (struct cushion_instance_t));
+    cushion_instance_init (instance);
+
+    struct chained_table_t *chained_table = calloc (1u, sizeof (struct chained_table_t));
+    char name_buffer[NAME_BUFFER_SIZE];
+
+    for (unsigned int index = 0u; index < macros_count; ++index)
+    {
+        snprintf (name_buffer, NAME_BUFFER_SIZE, "BENCHMARK_PLATFORM_MACRO_%u", index);
+        struct cushion_macro_node_t *node = cushion_allocator_allocate (
+            &instance->allocator, sizeof (struct cushion_macro_node_t), _Alignof (struct cushion_macro_node_t),
+            CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+        node->name =
+            cushion_instance_copy_null_terminated_inside (instance, name_buffer, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+        node->flags = CUSHION_MACRO_FLAG_NONE;
+        node->replacement_list = NULL;
+        node->parameters_first = NULL;
+        node->program = NULL;
+        node->expansion = NULL;
+
+        cushion_instance_macro_add (instance, node,
+                                    (struct cushion_error_context_t) {
+                                        .file = "benchmark",
+                                        .line = 1u,
+                                        .column = 1u,
+                                    });
+
+        struct chained_table_node_t *chained_node = cushion_allocator_allocate (
+            &instance->allocator, sizeof (struct chained_table_node_t), _Alignof (struct chained_table_node_t),
+            CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+        chained_node->name = node->name;
+        chained_node->macro = node;
+        chained_table_insert (chained_table, chained_node);
+    }
+
+    // Distinct lookup names are limited to keep them in memory, lookups cycle through them.
+    const unsigned int names_count = macros_count * 4u;
+    struct lookup_name_t *names = malloc (sizeof (struct lookup_name_t) * names_count);
+
+    for (unsigned int index = 0u; index < names_count; ++index)
+    {
+        if (index % 4u == 0u)
+        {
+            // Scatter hits over all the macros instead of checking them in insertion order.
+            const unsigned int macro_index = (unsigned int) ((index / 4u * 7919ull) % macros_count);
+            snprintf (name_buffer, NAME_BUFFER_SIZE, "BENCHMARK_PLATFORM_MACRO_%u", macro_index);
+        }
+        else
+        {
+            snprintf (name_buffer, NAME_BUFFER_SIZE, "benchmark_identifier_%u", index);
+        }
+
+        const char *copied =
+            cushion_instance_copy_null_terminated_inside (instance, name_buffer, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+        names[index].begin = copied;
+        names[index].end = copied + strlen (copied);
+
+        // Tokenizer interns every identifier, so symbol table contains all of them, not only macros.
+        names[index].symbol = cushion_instance_symbol_intern (instance, names[index].begin, names[index].end);
+    }
+
+    printf ("Macros: %u, lookups: %u.\n", macros_count, lookups_count);
+    unsigned int found_count = 0u;
+    uint64_t start_ns = get_time_ns ();
+
+    for (unsigned int index = 0u; index < lookups_count; ++index)
+    {
+        const struct lookup_name_t *name = &names[index % names_count];
+        found_count += chained_table_search (chained_table, name->begin, name->end) ? 1u : 0u;
+    }
+
+    print_result ("chained", get_time_ns () - start_ns, lookups_count, found_count);
+    found_count = 0u;
+    start_ns = get_time_ns ();
+
+    for (unsigned int index = 0u; index < lookups_count; ++index)
+    {
+        const struct lookup_name_t *name = &names[index % names_count];
+        found_count += cushion_instance_macro_search (instance, name->begin, name->end) ? 1u : 0u;
+    }
+
+    print_result ("symbol by name", get_time_ns () - start_ns, lookups_count, found_count);
+    found_count = 0u;
+    start_ns = get_time_ns ();
+
+    for (unsigned int index = 0u; index < lookups_count; ++index)
+    {
+        const struct lookup_name_t *name = &names[index % names_count];
+        found_count += cushion_instance_macro_search_symbol (instance, name->symbol) ? 1u : 0u;
+    }
+
+    print_result ("symbol by id", get_time_ns () - start_ns, lookups_count, found_count);
+    free (names);
+    free (chained_table);
+    cushion_instance_shutdown (instance);
+    free (instance);
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <time.h>
+
+#include "internal.h"
+
+/// \file
+/// \brief Measures tokenizer throughput in bytes per second in regular and skip regular modes.
+/// \details Usage: cushion_benchmark_tokenizer [input_file] [iterations]
+///          When input file is not given, synthetic source with code, comments, literals and directives is generated.
+///          Only tokenization is measured, reading the file into memory is done before timing.
+
+#define DEFAULT_ITERATIONS 20u
+#define SYNTHETIC_CHUNKS_COUNT 20000u
+
+static const char *synthetic_chunk =
+    "/* Multiline comment that describes the function below\n"
+    " * and spans over several lines. */\n"
+    "#if defined(BENCHMARK_OPTION) && BENCHMARK_OPTION > 2\n"
+    "static inline unsigned int benchmark_function (struct benchmark_state_t *state, const char *name)\n"
+    "{\n"
+    "    // Line comment before the loop.\n"
+    "    for (unsigned int index = 0u; index < state->count; ++index)\n"
+    "    {\n"
+    "        if (state->values[index] == 0x1F2Eu || strcmp (name, \"benchmark string literal\") == 0)\n"
+    "        {\n"
+    "            state->sum += state->values[index] * 3.5f + 'c';\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    return state->sum >> 2u;\n"
+    "}\n"
+    "#endif\n"
+    "\n";
+
+static uint64_t get_time_ns (void)
+{
+    struct timespec time;
+    timespec_get (&time, TIME_UTC);
+    return ((uint64_t) time.tv_sec) * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+static void run_mode (struct cushion_instance_t *instance,
+                      struct cushion_tokenization_state_t *state,
+                      FILE *input,
+                      const char *name,
+                      enum cushion_tokenization_flags_t flags,
+                      unsigned int iterations)
+{
+    uint64_t total_ns = 0u;
+    uint64_t total_bytes = 0u;
+    unsigned int tokens_count = 0u;
+
+    for (unsigned int iteration = 0u; iteration < iterations; ++iteration)
+    {
+        struct cushion_allocator_transient_marker_t transient_marker =
+            cushion_allocator_get_transient_marker (&instance->allocator);
+
+        rewind (input);
+        cushion_tokenization_state_init_for_file (state, "benchmark", input, &instance->allocator,
+                                                  CUSHION_ALLOCATION_CLASS_TRANSIENT);
+
+        if (!state->input_file_content)
+        {
+            fprintf (stderr, "Input file cannot be read as a whole, benchmark expects regular file.\n");
+            exit (-1);
+        }
+
+        state->flags = flags;
+        tokens_count = 0u;
+        struct cushion_token_t token;
+        const uint64_t start_ns = get_time_ns ();
+
+        do
+        {
+            cushion_tokenization_next_token (instance, state, &token);
+            ++tokens_count;
+        } while (token.type != CUSHION_TOKEN_TYPE_END_OF_FILE && !cushion_instance_is_error_signaled (instance));
+
+        total_ns += get_time_ns () - start_ns;
+        total_bytes += (uint64_t) (state->limit - state->input_file_content);
+        cushion_tokenization_state_shutdown (state);
+        cushion_allocator_reset_transient (&instance->allocator, transient_marker);
+
+        if (cushion_instance_is_error_signaled (instance))
+        {
+            fprintf (stderr, "Tokenization failed, benchmark results are not valid.\n");
+            exit (-1);
+        }
+    }
+
+    const double seconds = (double) total_ns / 1000000000.0;
+    printf ("%-16s %10.3f ms %10.2f MiB/s (%u tokens per iteration)\n", name, (double) total_ns / 1000000.0,
+            seconds > 0.0 ? (double) total_bytes / (1024.0 * 1024.0) / seconds : 0.0, tokens_count);
+}
+
+int main (int argc, char **argv)
+{
+    const unsigned int iterations = argc > 2 ? (unsigned int) strtoul (argv[2u], NULL, 10) : DEFAULT_ITERATIONS;
+    if (iterations == 0u)
+    {
+        fprintf (stderr, "Usage: %s [input_file] [iterations]\n", argv[0u]);
+        return -1;
+    }
+
+    FILE *input = NULL;
+    if (argc > 1)
+    {
+        input = fopen (argv[1u], "rb");
+        if (!input)
+        {
+            fprintf (stderr, "Failed to open input file \"%s\".\n", argv[1u]);
+            return -1;
+        }
+    }
+    else
+    {
+        input = tmpfile ();
+        if (!input)
+        {
+            fprintf (stderr, "Failed to create temporary file for synthetic input.\n");
+            return -1;
+        }
+
+        for (unsigned int index = 0u; index < SYNTHETIC_CHUNKS_COUNT; ++index)
+        {
+            fputs (synthetic_chunk, input);
+        }
+
+        fflush (input);
+    }
+
+    struct cushion_instance_t *instance = malloc (sizeof (struct cushion_instance_t));
+    cushion_instance_init (instance);
+
+    // Tokenization state is quite big due to input buffer, therefore it is not placed on stack.
+    struct cushion_tokenization_state_t *state = malloc (sizeof (struct cushion_tokenization_state_t));
+    printf ("Iterations: %u.\n", iterations);
+
+    run_mode (instance, state, input, "regular", CUSHION_TOKENIZATION_FLAGS_NONE, iterations);
+    run_mode (instance, state, input, "skip regular", CUSHION_TOKENIZATION_FLAGS_SKIP_REGULAR, iterations);
+
+    free (state);
+    fclose (input);
+    cushion_instance_shutdown (instance);
+    free (instance);
+    return 0;
+}
@@ -1,9 +1,22 @@
+#include <limits.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <cushion.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#    define SERVER_UNIX
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
 enum argument_mode_t
 {
     ARGUMENT_MODE_NONE = 0u,
@@ -15,8 +28,18 @@ enum argument_mode_t
     ARGUMENT_MODE_DEFINE,
     ARGUMENT_MODE_INCLUDE_FULL,
     ARGUMENT_MODE_INCLUDE_SCAN,
+    ARGUMENT_MODE_PREFIX_SCAN,
+    ARGUMENT_MODE_MACRO_SNAPSHOT,
+    ARGUMENT_MODE_BATCH,
+    ARGUMENT_MODE_JOBS,
+    ARGUMENT_MODE_CACHE,
+    ARGUMENT_MODE_CACHE_MAX_SIZE,
 };
 
+#define BATCH_MANIFEST_LINE_MAX 16384u
+#define SERVER_REQUEST_MAX (1024u * 1024u)
+#define SERVER_BUSY_TIMEOUT_MS 100
+
 static const char help_message[] =
     "Cushion " CUSHION_VERSION_STRING
     "\n"
@@ -35,6 +58,16 @@ static const char help_message[] =
     "    --options          Any argument after this one is option. Supported:\n"
     "                           forbid-macro-redefinition    Ignore macro redefinitions and print error\n"
     "                                                        when one is encountered.\n"
+    "                           index-include-directories    List include directories once and use these lists\n"
+    "                                                        to avoid probing for headers that are not there.\n"
+    "                           write-only-changed           Keep output and cmake depfile untouched when their\n"
+    "                                                        content is the same, so their modification time is\n"
+    "                                                        kept. Changed files are atomically replaced.\n"
+    "                           skip-up-to-date              Skip jobs with cmake depfile when their output is\n"
+    "                                                        newer than all dependencies from previous depfile\n"
+    "                                                        and configuration has not changed.\n"
+    "                           cache-tokens                 Keep token streams of lexed files in memory and\n"
+    "                                                        replay them instead of tokenizing files again.\n"
     "\n"
     "    --input            Any argument after this one is an input file for preprocessing.\n"
     "                       Multiple input files are treated like one file that includes all the inputs.\n"
@@ -55,23 +88,150 @@ static const char help_message[] =
     "\n"
     "    --include-scan     Any argument after this one is a scan-only include path.\n"
     "\n"
-    "For proper execution, at least one input and output must be specified. Other arguments are optional.\n";
+    "    --prefix-scan      Any argument after this one is a header that is scanned for macros before inputs of\n"
+    "                       every job, like scan-only forced include. Nothing from it is written to output.\n"
+    "\n"
+    "    --macro-snapshot   Any argument after this one is a macro snapshot file. Only one file is supported.\n"
+    "                       Macros from defines and prefix scan headers are loaded from it when configuration and\n"
+    "                       contents of scanned files are the same, otherwise snapshot is rebuilt.\n"
+    "\n"
+    "    --batch            Any argument after this one is a batch manifest file. Every non-empty manifest line is\n"
+    "                       a job in \"<input>;<output>\" or \"<input>;<output>;<cmake depfile>\" format. All jobs\n"
+    "                       share the rest of the configuration and are executed one after another.\n"
+    "\n"
+    "    --jobs             Any argument after this one is a maximum count of threads for executing batch jobs.\n"
+    "                       Only one count is supported. Errors are still reported in the order of jobs.\n"
+    "\n"
+    "    --cache            Any argument after this one is a local output cache directory. Only one directory is\n"
+    "                       supported. Jobs with the same configuration and the same content of all read files\n"
+    "                       restore their output and cmake depfile from cache instead of preprocessing.\n"
+    "\n"
+    "    --cache-max-size   Any argument after this one is a maximum cache size in megabytes. Least recently used\n"
+    "                       cache files are removed when cache grows bigger. Cache is unlimited by default.\n"
+    "\n"
+    "    --cache-statistics Print cache hits, misses and other statistics after execution.\n"
+    "\n"
+    "    --watch            Execute and then keep watching files that were read by the jobs. When some of them\n"
+    "                       change, only the jobs that read them are executed again. Stops on interrupt signal.\n"
+    "\n"
+    "Server mode keeps caches warm between invocations, which is useful for build systems that run cushion for\n"
+    "every file separately. Served requests always keep token streams of lexed files in memory, like with\n"
+    "cache-tokens option. Requests are executed one after another. Client that is not accepted in 100 milliseconds,\n"
+    "because server is busy with other request, executes arguments in-process instead of waiting. Only supported on\n"
+    "Unix platforms.\n"
+    "\n"
+    "    cushion --server <socket>              Listen for requests on given Unix domain socket until interrupted.\n"
+    "    cushion --connect <socket> <arguments> Forward arguments to the server listening on given socket.\n"
+    "                                           Arguments are executed in-process when there is no server or\n"
+    "                                           when it is busy.\n"
+    "\n"
+    "For proper execution, at least one input and output or batch manifest must be specified.\n"
+    "Other arguments are optional.\n";
 
-int main (int argc, char **argv)
+static int read_batch_manifest (cushion_context_t context, const char *path)
 {
-    if (argc == 1 || (argc == 2 && (strcmp (argv[1u], "--help") == 0 || strcmp (argv[1u], "-help") == 0 ||
-                                    strcmp (argv[1u], "/?") == 0)))
+    FILE *manifest = fopen (path, "r");
+    if (!manifest)
     {
-        fprintf (stdout, "%s\n", help_message);
+        fprintf (stderr, "Failed to open batch manifest \"%s\".\n", path);
         return 0;
     }
 
-    cushion_context_t context = cushion_context_create ();
+    char line[BATCH_MANIFEST_LINE_MAX];
+    unsigned int line_number = 0u;
+    int successful = 1;
+
+    while (fgets (line, BATCH_MANIFEST_LINE_MAX, manifest))
+    {
+        ++line_number;
+        size_t length = strlen (line);
+
+        if (length > 0u && line[length - 1u] != '\n' && !feof (manifest))
+        {
+            fprintf (stderr, "Batch manifest \"%s\" line %u is too long.\n", path, line_number);
+            successful = 0;
+            break;
+        }
+
+        while (length > 0u && (line[length - 1u] == '\n' || line[length - 1u] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+
+        if (length == 0u)
+        {
+            continue;
+        }
+
+        char *fields[3u] = {line, NULL, NULL};
+        unsigned int fields_count = 1u;
+
+        for (char *cursor = line; *cursor; ++cursor)
+        {
+            if (*cursor == ';')
+            {
+                if (fields_count == 3u)
+                {
+                    fields_count = 4u;
+                    break;
+                }
+
+                *cursor = '\0';
+                fields[fields_count] = cursor + 1u;
+                ++fields_count;
+            }
+        }
+
+        if (fields_count < 2u || fields_count > 3u || !*fields[0u] || !*fields[1u] ||
+            (fields_count == 3u && !*fields[2u]))
+        {
+            fprintf (stderr,
+                     "Batch manifest \"%s\" line %u is malformed: expected \"<input>;<output>\" or "
+                     "\"<input>;<output>;<cmake depfile>\".\n",
+                     path, line_number);
+            successful = 0;
+            break;
+        }
+
+        cushion_context_configure_batch_job (context, fields[0u], fields[1u], fields[2u]);
+    }
+
+    fclose (manifest);
+    return successful;
+}
+
+static volatile sig_atomic_t watch_interrupted = 0;
+
+static void watch_interrupt_handler (int signal_number)
+{
+    (void) signal_number;
+    watch_interrupted = 1;
+}
+
+static unsigned int watch_should_continue (void *user_data)
+{
+    (void) user_data;
+    return !watch_interrupted;
+}
+
+/// \brief Configures context using command line arguments and executes it.
+/// \details First argument is skipped like program name. Execution flag is set when context was executed, which
+///          means that context configuration has been reset and context can be reused.
+static int execute_arguments (cushion_context_t context, unsigned int argc, char **argv, uint8_t *executed)
+{
+    *executed = 0u;
     enum argument_mode_t argument_mode = ARGUMENT_MODE_NONE;
     uint8_t has_output = 0u;
     uint8_t has_cmake_depfile = 0u;
+    uint8_t has_jobs = 0u;
+    uint8_t has_cache_max_size = 0u;
+    uint8_t print_cache_statistics = 0u;
+    uint8_t watch = 0u;
+    const char *cache_directory = NULL;
+    unsigned long long cache_max_size = 0u;
+    uint8_t has_macro_snapshot = 0u;
 
-    for (unsigned int index = 1u; index < (unsigned int) argc; ++index)
+    for (unsigned int index = 1u; index < argc; ++index)
     {
         char *argument = argv[index];
         if (strcmp (argument, "--features") == 0)
@@ -114,12 +274,54 @@ int main (int argc, char **argv)
             argument_mode = ARGUMENT_MODE_INCLUDE_SCAN;
             continue;
         }
+        else if (strcmp (argument, "--prefix-scan") == 0)
+        {
+            argument_mode = ARGUMENT_MODE_PREFIX_SCAN;
+            continue;
+        }
+        else if (strcmp (argument, "--macro-snapshot") == 0)
+        {
+            argument_mode = ARGUMENT_MODE_MACRO_SNAPSHOT;
+            continue;
+        }
+        else if (strcmp (argument, "--batch") == 0)
+        {
+            argument_mode = ARGUMENT_MODE_BATCH;
+            continue;
+        }
+        else if (strcmp (argument, "--jobs") == 0)
+        {
+            argument_mode = ARGUMENT_MODE_JOBS;
+            continue;
+        }
+        else if (strcmp (argument, "--cache") == 0)
+        {
+            argument_mode = ARGUMENT_MODE_CACHE;
+            continue;
+        }
+        else if (strcmp (argument, "--cache-max-size") == 0)
+        {
+            argument_mode = ARGUMENT_MODE_CACHE_MAX_SIZE;
+            continue;
+        }
+        else if (strcmp (argument, "--cache-statistics") == 0)
+        {
+            // Switch without arguments, therefore arguments after it are not expected.
+            print_cache_statistics = 1u;
+            argument_mode = ARGUMENT_MODE_NONE;
+            continue;
+        }
+        else if (strcmp (argument, "--watch") == 0)
+        {
+            watch = 1u;
+            argument_mode = ARGUMENT_MODE_NONE;
+            continue;
+        }
 
         switch (argument_mode)
         {
         case ARGUMENT_MODE_NONE:
             fprintf (stderr, "Encountered argument without any argument switch before that.\n");
-            cushion_context_destroy (context);
             return -1;
 
         case ARGUMENT_MODE_FEATURES:
@@ -150,7 +352,6 @@ int main (int argc, char **argv)
             else
             {
                 fprintf (stderr, "Encountered unknown feature \"%s\".\n", argument);
-                cushion_context_destroy (context);
                 return -1;
             }
 
@@ -161,10 +362,25 @@ int main (int argc, char **argv)
             {
                 cushion_context_configure_option (context, CUSHION_OPTION_FORBID_MACRO_REDEFINITION, 1u);
             }
+            else if (strcmp (argument, "index-include-directories") == 0)
+            {
+                cushion_context_configure_option (context, CUSHION_OPTION_INDEX_INCLUDE_DIRECTORIES, 1u);
+            }
+            else if (strcmp (argument, "write-only-changed") == 0)
+            {
+                cushion_context_configure_option (context, CUSHION_OPTION_WRITE_ONLY_CHANGED, 1u);
+            }
+            else if (strcmp (argument, "skip-up-to-date") == 0)
+            {
+                cushion_context_configure_option (context, CUSHION_OPTION_SKIP_UP_TO_DATE, 1u);
+            }
+            else if (strcmp (argument, "cache-tokens") == 0)
+            {
+                cushion_context_configure_option (context, CUSHION_OPTION_CACHE_TOKENS, 1u);
+            }
             else
             {
                 fprintf (stderr, "Encountered unknown option \"%s\".\n", argument);
-                cushion_context_destroy (context);
                 return -1;
             }
 
@@ -178,7 +394,6 @@ int main (int argc, char **argv)
             if (has_output)
             {
                 fprintf (stderr, "Encountered output more that once.\n");
-                cushion_context_destroy (context);
                 return -1;
             }
             else
@@ -193,7 +408,6 @@ int main (int argc, char **argv)
             if (has_cmake_depfile)
             {
                 fprintf (stderr, "Encountered cmake depfile more that once.\n");
-                cushion_context_destroy (context);
                 return -1;
             }
             else
@@ -233,10 +447,606 @@ int main (int argc, char **argv)
         case ARGUMENT_MODE_INCLUDE_SCAN:
             cushion_context_configure_include_scan_only (context, argument);
             break;
+
+        case ARGUMENT_MODE_PREFIX_SCAN:
+            cushion_context_configure_prefix_scan (context, argument);
+            break;
+
+        case ARGUMENT_MODE_MACRO_SNAPSHOT:
+            if (has_macro_snapshot)
+            {
+                fprintf (stderr, "Encountered macro snapshot more that once.\n");
+                return -1;
+            }
+
+            cushion_context_configure_macro_snapshot (context, argument);
+            has_macro_snapshot = 1u;
+            break;
+
+        case ARGUMENT_MODE_BATCH:
+            if (!read_batch_manifest (context, argument))
+            {
+                return -1;
+            }
+
+            break;
+
+        case ARGUMENT_MODE_JOBS:
+        {
+            char *count_end = argument;
+            const unsigned long count = strtoul (argument, &count_end, 10);
+
+            if (has_jobs)
+            {
+                fprintf (stderr, "Encountered jobs count more that once.\n");
+                return -1;
+            }
+            else if (count_end == argument || *count_end || count == 0u || count > UINT_MAX)
+            {
+                fprintf (stderr, "Encountered invalid jobs count \"%s\".\n", argument);
+                return -1;
+            }
+
+            cushion_context_configure_threads (context, (unsigned int) count);
+            has_jobs = 1u;
+            break;
+        }
+
+        case ARGUMENT_MODE_CACHE:
+            if (cache_directory)
+            {
+                fprintf (stderr, "Encountered cache directory more that once.\n");
+                return -1;
+            }
+
+            cache_directory = argument;
+            break;
+
+        case ARGUMENT_MODE_CACHE_MAX_SIZE:
+        {
+            char *size_end = argument;
+            const unsigned long long size = strtoull (argument, &size_end, 10);
+
+            if (has_cache_max_size)
+            {
+                fprintf (stderr, "Encountered cache maximum size more that once.\n");
+                return -1;
+            }
+            else if (size_end == argument || *size_end || size > ULLONG_MAX / (1024u * 1024u))
+            {
+                fprintf (stderr, "Encountered invalid cache maximum size \"%s\".\n", argument);
+                return -1;
+            }
+
+            cache_max_size = size * 1024u * 1024u;
+            has_cache_max_size = 1u;
+            break;
+        }
         }
     }
 
-    enum cushion_result_t result = cushion_context_execute (context);
+    if (cache_directory)
+    {
+        cushion_context_configure_cache (context, cache_directory, cache_max_size);
+    }
+    else if (has_cache_max_size)
+    {
+        fprintf (stderr, "Encountered cache maximum size without cache directory.\n");
+        return -1;
+    }
+
+    enum cushion_result_t result;
+    if (watch)
+    {
+        watch_interrupted = 0;
+        signal (SIGINT, watch_interrupt_handler);
+        result = cushion_context_watch (context, watch_should_continue, NULL);
+        signal (SIGINT, SIG_DFL);
+    }
+    else
+    {
+        result = cushion_context_execute (context);
+    }
+
+    *executed = 1u;
+    if (print_cache_statistics)
+    {
+        const struct cushion_cache_statistics_t statistics = cushion_context_get_cache_statistics (context);
+        fprintf (stdout, "Cache hits: %u, misses: %u, stored: %u, uncacheable: %u, evicted files: %u.\n",
+                 statistics.hits, statistics.misses, statistics.stored, statistics.uncacheable,
+                 statistics.evicted_files);
+    }
+
+    return (int) result;
+}
+
+#if defined(SERVER_UNIX)
+static volatile sig_atomic_t server_interrupted = 0;
+
+static void server_interrupt_handler (int signal_number)
+{
+    (void) signal_number;
+    server_interrupted = 1;
+}
+
+static int socket_address_init (struct sockaddr_un *address, const char *path)
+{
+    const size_t length = strlen (path);
+    if (length >= sizeof (address->sun_path))
+    {
+        fprintf (stderr, "Socket path \"%s\" is too long.\n", path);
+        return 0;
+    }
+
+    memset (address, 0, sizeof (struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    memcpy (address->sun_path, path, length + 1u);
+    return 1;
+}
+
+static int socket_write_all (int socket_descriptor, const void *data, size_t size)
+{
+    const uint8_t *cursor = data;
+    while (size > 0u)
+    {
+        const ssize_t written = write (socket_descriptor, cursor, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            return 0;
+        }
+
+        cursor += written;
+        size -= (size_t) written;
+    }
+
+    return 1;
+}
+
+static int socket_read_all (int socket_descriptor, void *data, size_t size)
+{
+    uint8_t *cursor = data;
+    while (size > 0u)
+    {
+        const ssize_t received = read (socket_descriptor, cursor, size);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (received <= 0)
+        {
+            return 0;
+        }
+
+        cursor += received;
+        size -= (size_t) received;
+    }
+
+    return 1;
+}
+
+/// \brief Request is sent as payload size, descriptors of standard output and error as ancillary data and payload.
+/// \details Payload is a sequence of null terminated strings: working directory and then arguments.
+static int client_send_request (int socket_descriptor, unsigned int argc, char **argv)
+{
+    char working_directory[PATH_MAX];
+    if (!getcwd (working_directory, PATH_MAX))
+    {
+        return 0;
+    }
+
+    size_t payload_size = strlen (working_directory) + 1u;
+    for (unsigned int index = 0u; index < argc; ++index)
+    {
+        payload_size += strlen (argv[index]) + 1u;
+    }
+
+    if (payload_size > SERVER_REQUEST_MAX)
+    {
+        return 0;
+    }
+
+    uint32_t header = (uint32_t) payload_size;
+    struct iovec header_vector = {
+        .iov_base = &header,
+        .iov_len = sizeof (header),
+    };
+
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE (sizeof (int) * 2u)];
+    } control;
+
+    memset (&control, 0, sizeof (control));
+    struct msghdr message = {
+        .msg_iov = &header_vector,
+        .msg_iovlen = 1u,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof (control.buffer),
+    };
+
+    struct cmsghdr *control_message = CMSG_FIRSTHDR (&message);
+    control_message->cmsg_level = SOL_SOCKET;
+    control_message->cmsg_type = SCM_RIGHTS;
+    control_message->cmsg_len = CMSG_LEN (sizeof (int) * 2u);
+    const int descriptors[2u] = {STDOUT_FILENO, STDERR_FILENO};
+    memcpy (CMSG_DATA (control_message), descriptors, sizeof (descriptors));
+
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg (socket_descriptor, &message, 0);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent != (ssize_t) sizeof (header) ||
+        !socket_write_all (socket_descriptor, working_directory, strlen (working_directory) + 1u))
+    {
+        return 0;
+    }
+
+    for (unsigned int index = 0u; index < argc; ++index)
+    {
+        if (!socket_write_all (socket_descriptor, argv[index], strlen (argv[index]) + 1u))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/// \brief Server sends one byte right after accepting connection, so client knows that request will be handled now.
+static int client_wait_for_acceptance (int socket_descriptor)
+{
+    struct pollfd poll_descriptor = {
+        .fd = socket_descriptor,
+        .events = POLLIN,
+    };
+
+    int ready;
+    do
+    {
+        ready = poll (&poll_descriptor, 1u, SERVER_BUSY_TIMEOUT_MS);
+    } while (ready < 0 && errno == EINTR);
+
+    uint8_t acceptance;
+    return ready > 0 && socket_read_all (socket_descriptor, &acceptance, sizeof (acceptance));
+}
+
+/// \brief Forwards arguments to the server. Returns zero without side effects when server is not available or busy.
+static int client_execute (const char *socket_path, unsigned int argc, char **argv, int *result)
+{
+    struct sockaddr_un address;
+    if (!socket_address_init (&address, socket_path))
+    {
+        return 0;
+    }
+
+    const int socket_descriptor = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (socket_descriptor < 0)
+    {
+        return 0;
+    }
+
+    // Connection to busy server is queued without error, therefore acceptance is awaited before sending the request.
+    // If server accepts connection after client has given up, it just receives no request.
+    if (connect (socket_descriptor, (struct sockaddr *) &address, sizeof (address)) != 0 ||
+        !client_wait_for_acceptance (socket_descriptor) || !client_send_request (socket_descriptor, argc, argv))
+    {
+        close (socket_descriptor);
+        return 0;
+    }
+
+    // Request is sent, therefore server might be executing it already and falling back is no longer safe.
+    int32_t response;
+    if (!socket_read_all (socket_descriptor, &response, sizeof (response)))
+    {
+        fprintf (stderr, "Lost connection to cushion server at \"%s\" during execution.\n", socket_path);
+        response = -1;
+    }
+
+    close (socket_descriptor);
+    *result = (int) response;
+    return 1;
+}
+
+static int server_receive_request (int connection, char **payload, int descriptors[2u])
+{
+    uint32_t header;
+    struct iovec header_vector = {
+        .iov_base = &header,
+        .iov_len = sizeof (header),
+    };
+
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE (sizeof (int) * 2u)];
+    } control;
+
+    struct msghdr message = {
+        .msg_iov = &header_vector,
+        .msg_iovlen = 1u,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof (control.buffer),
+    };
+
+    ssize_t received;
+    do
+    {
+        received = recvmsg (connection, &message, 0);
+    } while (received < 0 && errno == EINTR);
+
+    struct cmsghdr *control_message = CMSG_FIRSTHDR (&message);
+    if (control_message && control_message->cmsg_level == SOL_SOCKET && control_message->cmsg_type == SCM_RIGHTS &&
+        control_message->cmsg_len == CMSG_LEN (sizeof (int) * 2u))
+    {
+        memcpy (descriptors, CMSG_DATA (control_message), sizeof (int) * 2u);
+    }
+
+    if (received != (ssize_t) sizeof (header) || descriptors[0u] < 0 || descriptors[1u] < 0 || header == 0u ||
+        header > SERVER_REQUEST_MAX)
+    {
+        return 0;
+    }
+
+    *payload = malloc (header + 1u);
+    if (!socket_read_all (connection, *payload, header))
+    {
+        return 0;
+    }
+
+    // Guarantees that the last string is terminated even if client sent garbage.
+    (*payload)[header] = '\0';
+    return (int) header + 1;
+}
+
+static int server_execute_request (cushion_context_t *context, char *payload, int payload_size, int descriptors[2u])
+{
+    unsigned int strings_count = 0u;
+    for (int index = 0; index < payload_size; ++index)
+    {
+        if (payload[index] == '\0')
+        {
+            ++strings_count;
+        }
+    }
+
+    // Working directory is the first string, then arguments follow with the first one being skipped as program name.
+    char **argv = malloc (sizeof (char *) * strings_count);
+    unsigned int argc = 0u;
+    const char *working_directory = payload;
+    char *cursor = payload + strlen (payload) + 1u;
+
+    while (cursor < payload + payload_size - 1)
+    {
+        argv[argc++] = cursor;
+        cursor += strlen (cursor) + 1u;
+    }
+
+    if (argc == 0u || chdir (working_directory) != 0)
+    {
+        free (argv);
+        dprintf (descriptors[1u], "Cushion server failed to enter working directory \"%s\".\n", working_directory);
+        return -1;
+    }
+
+    // Served context lives through many requests, so keeping token streams of unchanged files is always beneficial.
+    cushion_context_configure_option (*context, CUSHION_OPTION_CACHE_TOKENS, 1u);
+
+    fflush (stdout);
+    fflush (stderr);
+    const int saved_output = dup (STDOUT_FILENO);
+    const int saved_error = dup (STDERR_FILENO);
+    dup2 (descriptors[0u], STDOUT_FILENO);
+    dup2 (descriptors[1u], STDERR_FILENO);
+
+    uint8_t executed;
+    const int result = execute_arguments (*context, argc, argv, &executed);
+
+    fflush (stdout);
+    fflush (stderr);
+    dup2 (saved_output, STDOUT_FILENO);
+    dup2 (saved_error, STDERR_FILENO);
+    close (saved_output);
+    close (saved_error);
+    free (argv);
+
+    if (!executed)
+    {
+        // Context was partially configured and there is no way to reset it, therefore it is recreated.
+        cushion_context_destroy (*context);
+        *context = cushion_context_create ();
+    }
+
+    return result;
+}
+
+static int server_run (const char *socket_path)
+{
+    struct sockaddr_un address;
+    if (!socket_address_init (&address, socket_path))
+    {
+        return -1;
+    }
+
+    const int listener = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        fprintf (stderr, "Failed to create server socket.\n");
+        return -1;
+    }
+
+    // Socket file left by server that was killed prevents binding, but live server must not be replaced.
+    if (connect (listener, (struct sockaddr *) &address, sizeof (address)) == 0)
+    {
+        fprintf (stderr, "Other cushion server is already listening on \"%s\".\n", socket_path);
+        close (listener);
+        return -1;
+    }
+
+    close (listener);
+    const int server_socket = socket (AF_UNIX, SOCK_STREAM, 0);
+    unlink (socket_path);
+
+    if (server_socket < 0 || bind (server_socket, (struct sockaddr *) &address, sizeof (address)) != 0 ||
+        listen (server_socket, SOMAXCONN) != 0)
+    {
+        fprintf (stderr, "Failed to listen on socket \"%s\".\n", socket_path);
+        if (server_socket >= 0)
+        {
+            close (server_socket);
+        }
+
+        return -1;
+    }
+
+    // Requests change working directory, so we need a way to go back for removing the socket.
+    const int initial_directory = open (".", O_RDONLY);
+    struct sigaction interrupt_action;
+    memset (&interrupt_action, 0, sizeof (interrupt_action));
+    interrupt_action.sa_handler = server_interrupt_handler;
+    sigemptyset (&interrupt_action.sa_mask);
+
+    // No restart flag, so accept is interrupted by signals and server can exit gracefully.
+    sigaction (SIGINT, &interrupt_action, NULL);
+    sigaction (SIGTERM, &interrupt_action, NULL);
+
+    // Clients might exit before reading their output, server should not be killed by that.
+    signal (SIGPIPE, SIG_IGN);
+
+    // The same context is reused for all requests, so its memory and directory indices are kept warm.
+    cushion_context_t context = cushion_context_create ();
+    fprintf (stdout, "Cushion server is listening on \"%s\".\n", socket_path);
+    fflush (stdout);
+
+    while (!server_interrupted)
+    {
+        const int connection = accept (server_socket, NULL, NULL);
+        if (connection < 0)
+        {
+            continue;
+        }
+
+        const uint8_t acceptance = 1u;
+        char *payload = NULL;
+        int descriptors[2u] = {-1, -1};
+        int payload_size = 0;
+        int32_t response = -1;
+
+        if (socket_write_all (connection, &acceptance, sizeof (acceptance)))
+        {
+            payload_size = server_receive_request (connection, &payload, descriptors);
+        }
+
+        if (payload_size > 0)
+        {
+            response = (int32_t) server_execute_request (&context, payload, payload_size, descriptors);
+            fprintf (stdout, "Cushion server executed request with result %d.\n", (int) response);
+            fflush (stdout);
+        }
+
+        socket_write_all (connection, &response, sizeof (response));
+        free (payload);
+
+        if (descriptors[0u] >= 0)
+        {
+            close (descriptors[0u]);
+        }
+
+        if (descriptors[1u] >= 0)
+        {
+            close (descriptors[1u]);
+        }
+
+        close (connection);
+    }
+
+    cushion_context_destroy (context);
+    close (server_socket);
+
+    if (initial_directory >= 0)
+    {
+        if (fchdir (initial_directory) == 0)
+        {
+            unlink (socket_path);
+        }
+
+        close (initial_directory);
+    }
+
+    return 0;
+}
+#endif
+
+int main (int argc, char **argv)
+{
+    if (argc == 1 || (argc == 2 && (strcmp (argv[1u], "--help") == 0 || strcmp (argv[1u], "-help") == 0 ||
+                                    strcmp (argv[1u], "/?") == 0)))
+    {
+        fprintf (stdout, "%s\n", help_message);
+        return 0;
+    }
+
+    if (strcmp (argv[1u], "--server") == 0)
+    {
+        if (argc != 3)
+        {
+            fprintf (stderr, "Server mode expects exactly one argument: socket path.\n");
+            return -1;
+        }
+
+#if defined(SERVER_UNIX)
+        return server_run (argv[2u]);
+#else
+        fprintf (stderr, "Server mode is only supported on Unix platforms.\n");
+        return -1;
+#endif
+    }
+
+    // Socket path takes place of the program name, so the rest is the same as usual command line.
+    unsigned int arguments_count = (unsigned int) argc;
+    char **arguments = argv;
+
+    if (strcmp (argv[1u], "--connect") == 0)
+    {
+        if (argc < 3)
+        {
+            fprintf (stderr, "Connect mode expects socket path and arguments to forward.\n");
+            return -1;
+        }
+
+        arguments_count = (unsigned int) argc - 2u;
+        arguments = argv + 2u;
+
+#if defined(SERVER_UNIX)
+        // Watch would occupy the server forever, therefore it is always executed in-process.
+        uint8_t forward = 1u;
+        for (unsigned int index = 1u; index < arguments_count; ++index)
+        {
+            if (strcmp (arguments[index], "--watch") == 0)
+            {
+                forward = 0u;
+            }
+        }
+
+        int result;
+        if (forward && client_execute (argv[2u], arguments_count, arguments, &result))
+        {
+            return result;
+        }
+#endif
+    }
+
+    cushion_context_t context = cushion_context_create ();
+    uint8_t executed;
+    const int result = execute_arguments (context, arguments_count, arguments, &executed);
     cushion_context_destroy (context);
     return result;
 }
@@ -41,6 +41,36 @@ enum cushion_feature_t
 enum cushion_option_t
 {
     CUSHION_OPTION_FORBID_MACRO_REDEFINITION = 0u,
+
+    /// \brief Lazily list include directories and check these lists before probing paths inside them.
+    /// \details Every directory is listed once per job, which turns lookups for headers that are not in given
+    ///          include directory into hash probes instead of failing file system calls. Expects include directories
+    ///          to stay unchanged during execution and file names to be case sensitive.
+    CUSHION_OPTION_INDEX_INCLUDE_DIRECTORIES,
+
+    /// \brief Only replace output and cmake depfile when their new content differs from the existing one.
+    /// \details Content is written into temporary file next to the target while being compared with the existing
+    ///          file. Identical files are left untouched and keep their modification time, so build systems that
+    ///          check it after command execution (like Ninja with restat) can skip dependent steps. Changed files
+    ///          are atomically renamed into place.
+    CUSHION_OPTION_WRITE_ONLY_CHANGED,
+
+    /// \brief Skip jobs which outputs are up to date according to cmake depfiles written on the previous execution.
+    /// \details Only jobs with cmake depfile are checked. After every successful job, fingerprint of configuration
+    ///          (features, options, defines, includes, inputs and outputs) is saved next to depfile with
+    ///          ".cushion-fingerprint" suffix. Job is skipped when output exists, saved fingerprint matches and
+    ///          every dependency from depfile is older than saved fingerprint file. Headers that are added later
+    ///          and would shadow the previously included ones are not detected, same as with other depfile-based
+    ///          dependency tracking.
+    CUSHION_OPTION_SKIP_UP_TO_DATE,
+
+    /// \brief Keep token streams of lexed files in memory and replay them when files are lexed again.
+    /// \details Every file is fully tokenized once into compact token array with interned identifiers, then later
+    ///          inclusions from any job of the same execution or of the next watch rounds replay that array instead
+    ///          of tokenizing the file again. Entries are invalidated when identity, modification time or size of
+    ///          the file changes. Useful for batch jobs and watch, as headers are usually included by many inputs.
+    ///          Increases memory usage, every thread has its own cache with size limit.
+    CUSHION_OPTION_CACHE_TOKENS,
 };
 
 enum cushion_result_t
@@ -51,6 +81,28 @@ enum cushion_result_t
     CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES,
     CUSHION_RESULT_FAILED_TO_OPEN_OUTPUT,
     CUSHION_RESULT_LEX_FAILED,
+    CUSHION_RESULT_FAILED_TO_WATCH,
+};
+
+/// \brief Statistics of output cache usage during the last execution.
+struct cushion_cache_statistics_t
+{
+    /// \brief Count of jobs which output and depfile were restored from cache.
+    unsigned int hits;
+
+    /// \brief Count of jobs that were not found in cache and were executed.
+    unsigned int misses;
+
+    /// \brief Count of executed jobs which results were saved to cache.
+    unsigned int stored;
+
+    /// \brief Count of executed jobs that could not be saved to cache.
+    /// \details Job cannot be saved if it has failed, if its output depends on execution time through
+    ///          __CUSHION_START_NS_X64__ or if its dependencies were modified during execution.
+    unsigned int uncacheable;
+
+    /// \brief Count of cache files that were removed to keep cache size under the limit.
+    unsigned int evicted_files;
 };
 
 cushion_context_t cushion_context_create (void);
@@ -61,6 +113,12 @@ void cushion_context_configure_feature (cushion_context_t context,
 
 void cushion_context_configure_option (cushion_context_t context, enum cushion_option_t option, unsigned int enabled);
 
+/// \brief Sets maximum count of threads that are used to execute jobs in parallel, including calling thread.
+/// \details Every thread has its own memory and macro tables and only reads shared configuration. Output files are
+///          the same as in sequential execution and errors are printed after execution in the order of jobs.
+///          Zero and one mean sequential execution, which is the default.
+void cushion_context_configure_threads (cushion_context_t context, unsigned int threads_count);
+
 void cushion_context_configure_input (cushion_context_t context, const char *path);
 
 /// \warning Overrides previous output value if any!
@@ -69,14 +127,71 @@ void cushion_context_configure_output (cushion_context_t context, const char *pa
 /// \warning Overrides previous cmake depfile value if any!
 void cushion_context_configure_cmake_depfile (cushion_context_t context, const char *path);
 
+/// \details Value is lexed and validated only when macro is used for the first time, therefore errors in unused
+///          defines are not reported and errors in used ones fail the jobs that use them. Lexed values are kept by
+///          context, so executions and watch rounds that reuse context do not lex them again.
 void cushion_context_configure_define (cushion_context_t context, const char *name, const char *value);
 
 void cushion_context_configure_include_full (cushion_context_t context, const char *path);
 
 void cushion_context_configure_include_scan_only (cushion_context_t context, const char *path);
 
+/// \brief Adds header that is lexed in scan only mode before inputs of every job, like forced include.
+/// \details Prefix scan headers are lexed only once per execution, macros from them are added to configured macros
+///          and every file that was read by them is added to dependencies of every job. Pragma once and include
+///          guards of these files are applied to every job, so including them from inputs through scan only include
+///          is almost free. Nothing is written to output, therefore compiler must still include these headers.
+///          Changes in prefix scan headers are not picked up by watch, it needs to be restarted.
+void cushion_context_configure_prefix_scan (cushion_context_t context, const char *path);
+
+/// \brief Enables macro snapshot file that stores configured macros produced by defines and prefix scan headers.
+/// \details When snapshot matches configuration and every file that was read by prefix scan headers still has the
+///          same content, macros are loaded from it instead of lexing defines and prefix scan headers. Otherwise,
+///          snapshot is rebuilt after lexing them. Snapshot is not saved when configured macros use preserve,
+///          wrapper macro or snippet features, as they depend on lexer state.
+void cushion_context_configure_macro_snapshot (cushion_context_t context, const char *path);
+
+/// \brief Adds batch job that preprocesses given input into given output during execution.
+/// \details Batch jobs share features, options, defines and include paths with each other and with the job that is
+///          configured through inputs and output, if any. Shared configuration is prepared only once per execution,
+///          while macros, pragma once and depfile data are reset between jobs, therefore every job produces the same
+///          result as separate execution. Inputs and output are optional when at least one batch job is added.
+///          Cmake depfile is optional and can be NULL.
+void cushion_context_configure_batch_job (cushion_context_t context,
+                                          const char *input,
+                                          const char *output,
+                                          const char *cmake_depfile);
+
+/// \brief Enables local output cache in given directory, which is created if it does not exist.
+/// \details Cache is keyed by configuration (features, options, defines and includes), absolute paths and contents
+///          of inputs and contents of all the files that were read by the job, including scan-only headers.
+///          On hit, output and cmake depfile are restored from cache without lexing. Cache directory can be
+///          shared between build directories and processes. When maximum size is not zero, least recently used
+///          cache files are removed after execution once cache grows bigger than that. Like other depfile-based
+///          dependency tracking, cache does not detect headers that are added later and would shadow the
+///          previously included ones.
+/// \warning Overrides previous cache configuration if any!
+void cushion_context_configure_cache (cushion_context_t context, const char *directory, unsigned long long max_size);
+
 enum cushion_result_t cushion_context_execute (cushion_context_t context);
 
+/// \brief Called by watch execution after every round of jobs and periodically while waiting for changes.
+/// \details Watch execution stops when callback returns zero.
+typedef unsigned int (*cushion_watch_callback_t) (void *user_data);
+
+/// \brief Executes configured jobs like cushion_context_execute and then keeps watching their dependencies,
+///        executing again only the jobs which dependencies were changed, until callback requests to stop.
+/// \details Dependencies are the same files that are written to cmake depfile, even if there is no depfile.
+///          Context memory, configured macros and directory indices are reused between rounds. Jobs are never
+///          skipped as up to date during watch, because their dependencies are needed to watch them.
+///          Returns result of the last round.
+enum cushion_result_t cushion_context_watch (cushion_context_t context,
+                                             cushion_watch_callback_t callback,
+                                             void *user_data);
+
+/// \brief Returns statistics of output cache usage during the last execution.
+struct cushion_cache_statistics_t cushion_context_get_cache_statistics (cushion_context_t context);
+
 void cushion_context_destroy (cushion_context_t context);
 
 CUSHION_HEADER_END
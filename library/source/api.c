@@ -1,12 +1,13 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <time.h>
+
 #include "internal.h"
 
 cushion_context_t cushion_context_create (void)
 {
     struct cushion_instance_t *instance = malloc (sizeof (struct cushion_instance_t));
-    cushion_allocator_init (&instance->allocator);
-    cushion_instance_clean_configuration (instance);
+    cushion_instance_init (instance);
 
     cushion_context_t result = {.value = instance};
     return result;
@@ -42,6 +43,12 @@ void cushion_context_configure_option (cushion_context_t context, enum cushion_o
     }
 }
 
+void cushion_context_configure_threads (cushion_context_t context, unsigned int threads_count)
+{
+    struct cushion_instance_t *instance = context.value;
+    instance->threads_count = threads_count > 0u ? threads_count : 1u;
+}
+
 void cushion_context_configure_input (cushion_context_t context, const char *path)
 {
     struct cushion_instance_t *instance = context.value;
@@ -90,6 +97,8 @@ void cushion_context_configure_define (cushion_context_t context, const char *na
     new_node->value =
         cushion_instance_copy_null_terminated_inside (instance, value, CUSHION_ALLOCATION_CLASS_PERSISTENT);
     new_node->parameters_first = NULL;
+    new_node->program = NULL;
+    new_node->expansion = NULL;
 
     new_node->next = instance->unresolved_macros_first;
     instance->unresolved_macros_first = new_node;
@@ -119,124 +128,347 @@ void cushion_context_configure_include_scan_only (cushion_context_t context, con
     cushion_instance_includes_add (instance, node);
 }
 
-enum cushion_result_t cushion_context_execute (cushion_context_t context)
+void cushion_context_configure_prefix_scan (cushion_context_t context, const char *path)
 {
     struct cushion_instance_t *instance = context.value;
-    enum cushion_result_t result = CUSHION_RESULT_OK;
-    instance->state_flags = CUSHION_INSTANCE_STATE_FLAG_EXECUTION;
+    struct cushion_input_node_t *node =
+        cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_input_node_t),
+                                    _Alignof (struct cushion_input_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
 
-    if (!instance->inputs_first)
+    node->path = cushion_instance_copy_null_terminated_inside (instance, path, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    node->next = NULL;
+
+    if (instance->prefix_scans_last)
+    {
+        instance->prefix_scans_last->next = node;
+        instance->prefix_scans_last = node;
+    }
+    else
     {
-        fprintf (stderr, "Missing inputs in configuration.\n");
-        result = CUSHION_RESULT_PARTIAL_CONFIGURATION;
+        instance->prefix_scans_first = node;
+        instance->prefix_scans_last = node;
     }
+}
+
+void cushion_context_configure_macro_snapshot (cushion_context_t context, const char *path)
+{
+    struct cushion_instance_t *instance = context.value;
+    instance->macro_snapshot_path =
+        cushion_instance_copy_null_terminated_inside (instance, path, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+}
 
-    if (!instance->output_path)
+void cushion_context_configure_batch_job (cushion_context_t context,
+                                          const char *input,
+                                          const char *output,
+                                          const char *cmake_depfile)
+{
+    struct cushion_instance_t *instance = context.value;
+    struct cushion_input_node_t *input_node =
+        cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_input_node_t),
+                                    _Alignof (struct cushion_input_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    input_node->path =
+        cushion_instance_copy_null_terminated_inside (instance, input, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    input_node->next = NULL;
+
+    struct cushion_job_node_t *job_node =
+        cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_job_node_t),
+                                    _Alignof (struct cushion_job_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    job_node->next = NULL;
+    job_node->inputs_first = input_node;
+    job_node->output_path =
+        cushion_instance_copy_null_terminated_inside (instance, output, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    job_node->cmake_depfile_path = NULL;
+    job_node->watch_job = NULL;
+
+    if (cmake_depfile)
     {
-        fprintf (stderr, "Missing output path in configuration.\n");
-        result = CUSHION_RESULT_PARTIAL_CONFIGURATION;
+        job_node->cmake_depfile_path =
+            cushion_instance_copy_null_terminated_inside (instance, cmake_depfile, CUSHION_ALLOCATION_CLASS_PERSISTENT);
     }
 
-#if !defined(CUSHION_EXTENSIONS)
-    if (instance->features)
+    if (instance->jobs_last)
     {
-        fprintf (stderr, "Received feature selection in clean build (Cushion was built without extensions).\n");
-        result = CUSHION_RESULT_UNSUPPORTED_FEATURES;
+        instance->jobs_last->next = job_node;
+        instance->jobs_last = job_node;
     }
+    else
+    {
+        instance->jobs_first = job_node;
+        instance->jobs_last = job_node;
+    }
+}
+
+void cushion_context_configure_cache (cushion_context_t context, const char *directory, unsigned long long max_size)
+{
+    struct cushion_instance_t *instance = context.value;
+    instance->cache_directory =
+        cushion_instance_copy_null_terminated_inside (instance, directory, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    instance->cache_max_size = max_size;
+}
+
+static struct cushion_hash_t compute_configuration_fingerprint (struct cushion_instance_t *instance)
+{
+    struct cushion_hash_t fingerprint = cushion_hash_initial ();
+#if defined(CUSHION_EXTENSIONS)
+    cushion_hash_append_string (&fingerprint, "extensions");
 #endif
 
-    if (result == CUSHION_RESULT_OK)
+    // Options that do not change output content are not a part of fingerprint.
+    const unsigned int options =
+        instance->options &
+        ~((1u << CUSHION_OPTION_INDEX_INCLUDE_DIRECTORIES) | (1u << CUSHION_OPTION_WRITE_ONLY_CHANGED) |
+          (1u << CUSHION_OPTION_SKIP_UP_TO_DATE) | (1u << CUSHION_OPTION_CACHE_TOKENS));
+
+    cushion_hash_append (&fingerprint, &instance->features, sizeof (instance->features));
+    cushion_hash_append (&fingerprint, &options, sizeof (options));
+    struct cushion_macro_node_t *macro_node = instance->unresolved_macros_first;
+
+    while (macro_node)
     {
-        struct cushion_macro_node_t *macro_node = instance->unresolved_macros_first;
-        instance->unresolved_macros_first = NULL;
+        cushion_hash_append_string (&fingerprint, macro_node->name);
+        cushion_hash_append_string (&fingerprint, macro_node->value);
+        macro_node = macro_node->next;
+    }
 
-        while (macro_node)
-        {
-            struct cushion_macro_node_t *next = macro_node->next;
-            struct cushion_tokenization_state_t tokenization_state;
+    struct cushion_include_node_t *include_node = instance->includes_first;
+    while (include_node)
+    {
+        cushion_hash_append_string (&fingerprint, include_node->type == INCLUDE_TYPE_FULL ? "F" : "S");
+        cushion_hash_append_string (&fingerprint, include_node->path);
+        include_node = include_node->next;
+    }
 
-            struct cushion_allocator_transient_marker_t transient_marker =
-                cushion_allocator_get_transient_marker (&instance->allocator);
+    struct cushion_input_node_t *prefix_scan_node = instance->prefix_scans_first;
+    while (prefix_scan_node)
+    {
+        cushion_hash_append_string (&fingerprint, "P");
+        cushion_hash_append_string (&fingerprint, prefix_scan_node->path);
+        prefix_scan_node = prefix_scan_node->next;
+    }
 
-            cushion_tokenization_state_init_for_argument_string (
-                &tokenization_state, macro_node->value, &instance->allocator, CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    return fingerprint;
+}
 
-            enum cushion_lex_replacement_list_result_t lex_result = cushion_lex_replacement_list_from_tokenization (
-                instance, &tokenization_state, &macro_node->replacement_list_first, &macro_node->flags);
+static struct cushion_hash_t compute_job_fingerprint (struct cushion_instance_t *instance,
+                                                      struct cushion_job_node_t *job)
+{
+    struct cushion_hash_t fingerprint = instance->configuration_fingerprint;
+    struct cushion_input_node_t *input_node = job->inputs_first;
 
-            if (cushion_instance_is_error_signaled (instance))
-            {
-                fprintf (stderr, "Failed to lex object macro \"%s\" from arguments.\n", macro_node->name);
-                result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
-            }
-            else if (tokenization_state.cursor != tokenization_state.limit)
+    while (input_node)
+    {
+        cushion_hash_append_string (&fingerprint, input_node->path);
+        input_node = input_node->next;
+    }
+
+    cushion_hash_append_string (&fingerprint, job->output_path);
+    cushion_hash_append_string (&fingerprint, job->cmake_depfile_path);
+    return fingerprint;
+}
+
+static enum cushion_internal_result_t build_fingerprint_path (struct cushion_job_node_t *job, char *output)
+{
+    static const char fingerprint_suffix[] = ".cushion-fingerprint";
+    const size_t path_length = strlen (job->cmake_depfile_path);
+
+    if (path_length + sizeof (fingerprint_suffix) > CUSHION_PATH_BUFFER_SIZE)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    memcpy (output, job->cmake_depfile_path, path_length);
+    memcpy (output + path_length, fingerprint_suffix, sizeof (fingerprint_suffix));
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+/// \brief Checks that every dependency from depfile content is older than given time.
+/// \details Expects depfile in format that is written by cushion_instance_output_depfile_target and
+///          cushion_instance_output_depfile_entry: paths are separated by spaces, spaces inside paths are escaped.
+static unsigned int are_depfile_dependencies_older (char *content, long long reference_time)
+{
+    char path[CUSHION_PATH_MAX];
+    unsigned int target_separator_found = 0u;
+    unsigned int dependencies_count = 0u;
+
+    while (*content)
+    {
+        while (*content == ' ' || *content == '\n' || *content == '\r' || *content == '\t')
+        {
+            ++content;
+        }
+
+        if (!*content)
+        {
+            break;
+        }
+
+        char *path_end = path;
+        while (*content && *content != ' ' && *content != '\n' && *content != '\r' && *content != '\t')
+        {
+            if (*content == '\\' && content[1u] == ' ')
             {
-                fprintf (stderr,
-                         "Object macro \"%s\" from arguments cannot be fully lexed: argument string contains new "
-                         "line in the middle. It is a warning for most compilers (they just ignore everything "
-                         "after new line usually), but Cushion thinks that it is an obvious error as arguments "
-                         "must be properly formatted.\n",
-                         macro_node->name);
-                result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
+                ++content;
             }
-#if defined(CUSHION_EXTENSIONS)
-            else if (macro_node->flags & CUSHION_MACRO_FLAG_WRAPPED)
+
+            if (path_end == path + CUSHION_PATH_MAX - 1u)
             {
-                fprintf (stderr,
-                         "Object macro \"%s\" from arguments cannot use __CUSHION_WRAPPED__, this feature is only "
-                         "supported for macro defined in code.\n",
-                         macro_node->name);
-                result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
+                return 0u;
             }
-#endif
-            else
-            {
-                switch (lex_result)
-                {
-                case CUSHION_LEX_REPLACEMENT_LIST_RESULT_REGULAR:
-                    cushion_instance_macro_add (instance, macro_node,
-                                                (struct cushion_error_context_t) {
-                                                    .file = "<arguments>",
-                                                    .line = 1u,
-                                                    .column = UINT_MAX,
-                                                });
-                    break;
 
-                case CUSHION_LEX_REPLACEMENT_LIST_RESULT_PRESERVED:
-                    fprintf (stderr,
-                             "Encountered __CUSHION_PRESERVE__ while lexing macro \"%s\" from arguments, which is not "
-                             "supported.\n",
-                             macro_node->name);
-                    result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
-                    break;
-                }
-            }
+            *path_end = *content;
+            ++path_end;
+            ++content;
+        }
+
+        *path_end = '\0';
+        if (!target_separator_found)
+        {
+            target_separator_found = strcmp (path, ":") == 0;
+            continue;
+        }
 
-            cushion_allocator_reset_transient (&instance->allocator, transient_marker);
-            macro_node = next;
+        struct cushion_file_status_t status;
+        // Dependencies modified during the same second as fingerprint are treated as changed to stay on safe side.
+        if (cushion_file_status_query (path, &status) != CUSHION_INTERNAL_RESULT_OK ||
+            status.modification_time >= reference_time)
+        {
+            return 0u;
         }
+
+        ++dependencies_count;
     }
 
-    if (result == CUSHION_RESULT_OK)
+    return dependencies_count > 0u;
+}
+
+static unsigned int is_job_up_to_date (struct cushion_job_node_t *job,
+                                       const char *fingerprint_path,
+                                       struct cushion_hash_t job_fingerprint)
+{
+    struct cushion_file_status_t fingerprint_status;
+    struct cushion_file_status_t output_status;
+
+    if (cushion_file_status_query (fingerprint_path, &fingerprint_status) != CUSHION_INTERNAL_RESULT_OK ||
+        cushion_file_status_query (job->output_path, &output_status) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        return 0u;
+    }
+
+    FILE *fingerprint_file = fopen (fingerprint_path, "r");
+    if (!fingerprint_file)
+    {
+        return 0u;
+    }
+
+    char saved_fingerprint_hex[CUSHION_HASH_HEX_LENGTH + 1u];
+    struct cushion_hash_t saved_fingerprint;
+    const size_t read = fread (saved_fingerprint_hex, 1u, CUSHION_HASH_HEX_LENGTH, fingerprint_file);
+    fclose (fingerprint_file);
+
+    if (read != CUSHION_HASH_HEX_LENGTH ||
+        cushion_hash_parse (saved_fingerprint_hex, &saved_fingerprint) != CUSHION_INTERNAL_RESULT_OK ||
+        !cushion_hash_equal (saved_fingerprint, job_fingerprint))
+    {
+        return 0u;
+    }
+
+    FILE *depfile = fopen (job->cmake_depfile_path, "rb");
+    if (!depfile)
+    {
+        return 0u;
+    }
+
+    unsigned int up_to_date = 0u;
+    long size;
+
+    if (fseek (depfile, 0, SEEK_END) == 0 && (size = ftell (depfile)) > 0 && fseek (depfile, 0, SEEK_SET) == 0)
     {
-        instance->output = fopen (instance->output_path, "w");
-        if (instance->cmake_depfile_path)
+        // Depfiles for big projects can be bigger than allocator page, therefore heap is used directly.
+        char *content = malloc ((size_t) size + 1u);
+        if (fread (content, 1u, (size_t) size, depfile) == (size_t) size)
         {
-            instance->cmake_depfile_output = fopen (instance->cmake_depfile_path, "w");
-            if (instance->cmake_depfile_output)
-            {
-                cushion_instance_output_depfile_target (instance);
-            }
-            else
-            {
-                fprintf (stderr, "Failed to open depfile output file \"%s\".\n", instance->cmake_depfile_path);
-                result = CUSHION_RESULT_FAILED_TO_OPEN_OUTPUT;
-            }
+            content[size] = '\0';
+            up_to_date = are_depfile_dependencies_older (content, fingerprint_status.modification_time);
+        }
+
+        free (content);
+    }
+
+    fclose (depfile);
+    return up_to_date;
+}
+
+/// \brief Executes job from clean state with configured macros.
+/// \details Does not reset allocator, caller is expected to discard everything job has allocated.
+static enum cushion_result_t execute_job (struct cushion_instance_t *instance, struct cushion_job_node_t *job)
+{
+    enum cushion_result_t result = CUSHION_RESULT_OK;
+    char fingerprint_path[CUSHION_PATH_BUFFER_SIZE];
+    struct cushion_hash_t job_fingerprint = cushion_hash_initial ();
+
+    const unsigned int save_fingerprint = cushion_instance_has_option (instance, CUSHION_OPTION_SKIP_UP_TO_DATE) &&
+                                          job->cmake_depfile_path &&
+                                          build_fingerprint_path (job, fingerprint_path) == CUSHION_INTERNAL_RESULT_OK;
+
+    if (save_fingerprint)
+    {
+        job_fingerprint = compute_job_fingerprint (instance, job);
+        if (!job->watch_job && is_job_up_to_date (job, fingerprint_path, job_fingerprint))
+        {
+            return CUSHION_RESULT_OK;
+        }
+
+        // Fingerprint is removed until job succeeds, so failed or interrupted job is never treated as up to date.
+        remove (fingerprint_path);
+    }
+
+    cushion_instance_clean_job_state (instance);
+    cushion_instance_macro_restore_configured (instance);
+
+    instance->state_flags = CUSHION_INSTANCE_STATE_FLAG_EXECUTION;
+    instance->output_path = job->output_path;
+    instance->cmake_depfile_path = job->cmake_depfile_path;
+
+    struct cushion_cache_job_t cache_job;
+    unsigned int restored_from_cache = 0u;
+
+    if (instance->cache_directory || job->watch_job)
+    {
+        instance->state_flags |= CUSHION_INSTANCE_STATE_FLAG_RECORD_DEPENDENCIES;
+    }
+
+    const enum cushion_output_writer_flags_t writer_flags =
+        cushion_instance_has_option (instance, CUSHION_OPTION_WRITE_ONLY_CHANGED) ?
+            CUSHION_OUTPUT_WRITER_FLAG_ONLY_CHANGED :
+            CUSHION_OUTPUT_WRITER_FLAG_NONE;
+
+    const enum cushion_internal_result_t output_open_result =
+        cushion_output_writer_open (&instance->output, instance->output_path, writer_flags);
+
+    if (instance->cmake_depfile_path)
+    {
+        if (cushion_output_writer_open (&instance->cmake_depfile_output, instance->cmake_depfile_path, writer_flags) ==
+            CUSHION_INTERNAL_RESULT_OK)
+        {
+            cushion_instance_output_depfile_target (instance);
+        }
+        else
+        {
+            cushion_instance_error_output (instance, "Failed to open depfile output file \"%s\".\n",
+                                           instance->cmake_depfile_path);
+            result = CUSHION_RESULT_FAILED_TO_OPEN_OUTPUT;
         }
+    }
 
-        if (instance->output)
+    if (output_open_result == CUSHION_INTERNAL_RESULT_OK)
+    {
+        restored_from_cache = instance->cache_directory && cushion_cache_restore (instance, job, &cache_job);
+        if (!restored_from_cache)
         {
-            struct cushion_input_node_t *input_node = instance->inputs_first;
+            cushion_instance_restore_configured_files (instance);
+            struct cushion_input_node_t *input_node = job->inputs_first;
             while (input_node)
             {
                 cushion_lex_root_file (instance, input_node->path, CUSHION_LEX_FILE_FLAG_NONE);
@@ -252,40 +484,527 @@ enum cushion_result_t cushion_context_execute (cushion_context_t context)
 #if defined(CUSHION_EXTENSIONS)
             cushion_lex_finalize_statement_accumulators (instance);
             cushion_output_finalize (instance);
+#endif
+        }
+
+        if (cushion_instance_is_error_signaled (instance))
+        {
+            result = CUSHION_RESULT_LEX_FAILED;
+        }
+
+        if (cushion_output_writer_close (&instance->output) != CUSHION_INTERNAL_RESULT_OK &&
+            !cushion_instance_is_error_signaled (instance))
+        {
+            cushion_instance_error_output (instance, "Failed to output preprocessed code.\n");
+            cushion_instance_signal_error (instance);
+            result = CUSHION_RESULT_LEX_FAILED;
+        }
+    }
+    else
+    {
+        cushion_instance_error_output (instance, "Failed to open output file \"%s\".\n", instance->output_path);
+        result = CUSHION_RESULT_FAILED_TO_OPEN_OUTPUT;
+    }
+
+    if (cushion_output_writer_is_open (&instance->cmake_depfile_output) &&
+        cushion_output_writer_close (&instance->cmake_depfile_output) != CUSHION_INTERNAL_RESULT_OK &&
+        result == CUSHION_RESULT_OK)
+    {
+        cushion_instance_error_output (instance, "Failed to write depfile output file \"%s\".\n",
+                                       instance->cmake_depfile_path);
+        result = CUSHION_RESULT_FAILED_TO_OPEN_OUTPUT;
+    }
+
+    if (instance->cache_directory && output_open_result == CUSHION_INTERNAL_RESULT_OK && !restored_from_cache)
+    {
+        if (result == CUSHION_RESULT_OK)
+        {
+            cushion_cache_store (instance, job, &cache_job);
+        }
+        else
+        {
+            ++instance->cache_statistics.uncacheable;
+        }
+    }
+
+    if (save_fingerprint && result == CUSHION_RESULT_OK)
+    {
+        char job_fingerprint_hex[CUSHION_HASH_HEX_LENGTH + 1u];
+        cushion_hash_format (job_fingerprint, job_fingerprint_hex);
+
+        FILE *fingerprint_file = fopen (fingerprint_path, "w");
+        if (!fingerprint_file || fprintf (fingerprint_file, "%s\n", job_fingerprint_hex) < 0)
+        {
+            // Not an error: job is just going to be executed next time too.
+            cushion_instance_error_output (instance, "Failed to save configuration fingerprint to \"%s\".\n",
+                                           fingerprint_path);
+        }
 
+        if (fingerprint_file)
+        {
+            fclose (fingerprint_file);
+        }
+    }
+
+    if (job->watch_job)
+    {
+        cushion_watch_record_job (instance, job->watch_job);
+    }
+
+    return result;
+}
+
+static inline unsigned int is_job_selected (struct cushion_job_node_t *job)
+{
+    return !job->watch_job || job->watch_job->dirty;
+}
+
+struct parallel_job_slot_t
+{
+    struct cushion_job_node_t *job;
+    enum cushion_result_t result;
+    struct cushion_error_buffer_t errors;
+};
+
+struct parallel_execution_t
+{
+    struct cushion_mutex_t mutex;
+    struct parallel_job_slot_t *slots;
+    unsigned int slots_count;
+    unsigned int next_slot;
+};
+
+struct parallel_worker_t
+{
+    struct parallel_execution_t *execution;
+    struct cushion_instance_t *instance;
+    struct cushion_thread_t thread;
+    unsigned int thread_started;
+};
+
+static void parallel_worker_execute (void *argument)
+{
+    struct parallel_worker_t *worker = argument;
+    struct parallel_execution_t *execution = worker->execution;
+    struct cushion_instance_t *instance = worker->instance;
+
+    struct cushion_allocator_persistent_marker_t job_marker =
+        cushion_allocator_get_persistent_marker (&instance->allocator);
+
+    while (1)
+    {
+        cushion_mutex_lock (&execution->mutex);
+        const unsigned int slot_index = execution->next_slot;
+
+        if (slot_index < execution->slots_count)
+        {
+            ++execution->next_slot;
+        }
+
+        cushion_mutex_unlock (&execution->mutex);
+        if (slot_index >= execution->slots_count)
+        {
+            break;
+        }
+
+        // Errors are buffered per job, so they can be printed in job order after execution.
+        struct parallel_job_slot_t *slot = &execution->slots[slot_index];
+        instance->error_buffer = &slot->errors;
+
+        slot->result = execute_job (instance, slot->job);
+        cushion_allocator_reset_persistent (&instance->allocator, job_marker);
+    }
+
+    instance->error_buffer = NULL;
+}
+
+/// \brief Executes jobs using given count of workers, one of which is calling thread that uses given instance.
+/// \details Other workers use their own instances that only share read-only configuration with given instance.
+static enum cushion_result_t execute_jobs_parallel (struct cushion_instance_t *instance,
+                                                    unsigned int jobs_count,
+                                                    unsigned int workers_count)
+{
+    struct parallel_execution_t execution;
+    execution.slots = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct parallel_job_slot_t) * jobs_count, _Alignof (struct parallel_job_slot_t),
+        CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    execution.slots_count = jobs_count;
+    execution.next_slot = 0u;
+
+    struct cushion_job_node_t *job_node = instance->jobs_first;
+    for (unsigned int index = 0u; index < jobs_count; ++index)
+    {
+        while (!is_job_selected (job_node))
+        {
+            job_node = job_node->next;
+        }
+
+        execution.slots[index].job = job_node;
+        execution.slots[index].result = CUSHION_RESULT_OK;
+        execution.slots[index].errors.data = NULL;
+        execution.slots[index].errors.size = 0u;
+        execution.slots[index].errors.capacity = 0u;
+        job_node = job_node->next;
+    }
+
+    struct parallel_worker_t *workers = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct parallel_worker_t) * workers_count, _Alignof (struct parallel_worker_t),
+        CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    for (unsigned int index = 0u; index < workers_count; ++index)
+    {
+        workers[index].execution = &execution;
+        workers[index].thread_started = 0u;
+
+        if (index == 0u)
+        {
+            workers[index].instance = instance;
+            continue;
+        }
+
+        // Configuration data is only read by workers, therefore it is safe to share it without copying.
+        struct cushion_instance_t *worker_instance = malloc (sizeof (struct cushion_instance_t));
+        cushion_instance_init (worker_instance);
+
+        worker_instance->features = instance->features;
+        worker_instance->options = instance->options;
+        worker_instance->includes_first = instance->includes_first;
+        worker_instance->includes_last = instance->includes_last;
+        worker_instance->includes_hash = instance->includes_hash;
+        worker_instance->configured_macros_first = instance->configured_macros_first;
+        worker_instance->configured_files_first = instance->configured_files_first;
+        worker_instance->configuration_fingerprint = instance->configuration_fingerprint;
+        worker_instance->cache_directory = instance->cache_directory;
+        worker_instance->cache_max_size = instance->cache_max_size;
+        cushion_instance_symbol_copy_configured (worker_instance, instance);
+#if defined(CUSHION_EXTENSIONS)
+        worker_instance->start_ns_x64 = instance->start_ns_x64;
+#endif
+        workers[index].instance = worker_instance;
+    }
+
+    cushion_mutex_init (&execution.mutex);
+    for (unsigned int index = 1u; index < workers_count; ++index)
+    {
+        // If thread cannot be started, its jobs are just picked up by other workers.
+        workers[index].thread_started = cushion_thread_start (&workers[index].thread, parallel_worker_execute,
+                                                              &workers[index]) == CUSHION_INTERNAL_RESULT_OK;
+    }
+
+    parallel_worker_execute (&workers[0u]);
+    for (unsigned int index = 1u; index < workers_count; ++index)
+    {
+        if (workers[index].thread_started)
+        {
+            cushion_thread_join (&workers[index].thread);
+        }
+
+        struct cushion_cache_statistics_t *statistics = &instance->cache_statistics;
+        const struct cushion_cache_statistics_t *worker_statistics = &workers[index].instance->cache_statistics;
+        statistics->hits += worker_statistics->hits;
+        statistics->misses += worker_statistics->misses;
+        statistics->stored += worker_statistics->stored;
+        statistics->uncacheable += worker_statistics->uncacheable;
+        cushion_instance_shutdown (workers[index].instance);
+        free (workers[index].instance);
+    }
+
+    cushion_mutex_shutdown (&execution.mutex);
+    enum cushion_result_t result = CUSHION_RESULT_OK;
+
+    for (unsigned int index = 0u; index < jobs_count; ++index)
+    {
+        struct parallel_job_slot_t *slot = &execution.slots[index];
+        if (slot->errors.size > 0u)
+        {
+            fwrite (slot->errors.data, 1u, slot->errors.size, stderr);
+        }
+
+        free (slot->errors.data);
+        if (result == CUSHION_RESULT_OK)
+        {
+            result = slot->result;
+        }
+    }
+
+    return result;
+}
+
+/// \brief Registers configured defines as lazy macros, their values are lexed and validated on the first use.
+static void register_configured_defines (struct cushion_instance_t *instance)
+{
+    struct cushion_macro_node_t *macro_node = instance->unresolved_macros_first;
+    instance->unresolved_macros_first = NULL;
+
+    while (macro_node)
+    {
+        struct cushion_macro_node_t *next = macro_node->next;
+        struct cushion_macro_lazy_replacement_t *lazy = cushion_allocator_allocate (
+            &instance->allocator, sizeof (struct cushion_macro_lazy_replacement_t),
+            _Alignof (struct cushion_macro_lazy_replacement_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+        // Value lives in configuration memory, so there is no need to copy it.
+        lazy->origin = CUSHION_MACRO_LAZY_ORIGIN_ARGUMENTS;
+        lazy->text = macro_node->value;
+        lazy->file = "<argument-string>";
+        lazy->line = 1u;
+        lazy->column = 1u;
+
+        macro_node->flags |= CUSHION_MACRO_FLAG_LAZY;
+        macro_node->lazy_replacement = lazy;
+
+        cushion_instance_macro_add (instance, macro_node,
+                                    (struct cushion_error_context_t) {
+                                        .file = "<arguments>",
+                                        .line = 1u,
+                                        .column = UINT_MAX,
+                                    });
+
+        macro_node = next;
+    }
+}
+
+/// \brief Lexes prefix scan headers, their macros become configured macros and files become configured files.
+static enum cushion_result_t lex_prefix_scans (struct cushion_instance_t *instance)
+{
+    // Dependencies are only recorded to be saved as configured files, job state is cleaned before every job anyway.
+    instance->state_flags |= CUSHION_INSTANCE_STATE_FLAG_RECORD_DEPENDENCIES;
+    struct cushion_input_node_t *prefix_scan_node = instance->prefix_scans_first;
+
+    while (prefix_scan_node)
+    {
+        cushion_lex_root_file (instance, prefix_scan_node->path, CUSHION_LEX_FILE_FLAG_SCAN_ONLY);
+        if (cushion_instance_is_error_signaled (instance))
+        {
+            fprintf (stderr, "Failed to lex prefix scan header \"%s\".\n", prefix_scan_node->path);
+            return CUSHION_RESULT_LEX_FAILED;
+        }
+
+        prefix_scan_node = prefix_scan_node->next;
+    }
+
+    cushion_instance_save_configured_files (instance);
+    instance->state_flags &= ~CUSHION_INSTANCE_STATE_FLAG_RECORD_DEPENDENCIES;
+    return CUSHION_RESULT_OK;
+}
+
+/// \brief Validates configuration, lexes configured defines and adds regular configuration as the first job.
+static enum cushion_result_t prepare_execution (struct cushion_instance_t *instance)
+{
+    enum cushion_result_t result = CUSHION_RESULT_OK;
+    instance->state_flags = CUSHION_INSTANCE_STATE_FLAG_EXECUTION;
+    instance->cache_statistics = (struct cushion_cache_statistics_t) {0u};
+
+    // Regular input and output configuration is optional when there are batch jobs, but it must be full if present.
+    if (instance->inputs_first || instance->output_path || !instance->jobs_first)
+    {
+        if (!instance->inputs_first)
+        {
+            fprintf (stderr, "Missing inputs in configuration.\n");
+            result = CUSHION_RESULT_PARTIAL_CONFIGURATION;
+        }
+
+        if (!instance->output_path)
+        {
+            fprintf (stderr, "Missing output path in configuration.\n");
+            result = CUSHION_RESULT_PARTIAL_CONFIGURATION;
+        }
+    }
+
+#if !defined(CUSHION_EXTENSIONS)
+    if (instance->features)
+    {
+        fprintf (stderr, "Received feature selection in clean build (Cushion was built without extensions).\n");
+        result = CUSHION_RESULT_UNSUPPORTED_FEATURES;
+    }
+#endif
+
+    if (result == CUSHION_RESULT_OK)
+    {
+        // Fingerprint is calculated from configuration as it was passed, before defines are lexed.
+        instance->configuration_fingerprint = compute_configuration_fingerprint (instance);
+
+        if (instance->macro_snapshot_path && cushion_snapshot_load (instance))
+        {
+            // Snapshot already contains lexed defines and everything from prefix scan headers.
+            instance->unresolved_macros_first = NULL;
+        }
+        else if (cushion_instance_is_error_signaled (instance))
+        {
+            fprintf (stderr, "Failed to lex macros from snapshot \"%s\".\n", instance->macro_snapshot_path);
+            result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
+        }
+        else
+        {
+            register_configured_defines (instance);
             if (cushion_instance_is_error_signaled (instance))
             {
-                result = CUSHION_RESULT_LEX_FAILED;
+                // Only possible when the same define is configured twice with redefinition forbidden.
+                result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
+            }
+            else if (instance->prefix_scans_first)
+            {
+                result = lex_prefix_scans (instance);
             }
-#endif
 
-            fclose (instance->output);
+            if (result == CUSHION_RESULT_OK && instance->macro_snapshot_path)
+            {
+                cushion_snapshot_save (instance);
+                if (cushion_instance_is_error_signaled (instance))
+                {
+                    // Snapshot needs all lazy replacement lists, so invalid defines and macros are only found here.
+                    fprintf (stderr, "Failed to lex configured macros for macro snapshot.\n");
+                    result = CUSHION_RESULT_FAILED_TO_LEX_CONFIGURED_DEFINES;
+                }
+            }
         }
-        else
+    }
+
+    if (result == CUSHION_RESULT_OK)
+    {
+        // Configured macros are lexed only once and then restored for every job.
+        cushion_instance_macro_save_configured (instance);
+
+        if (instance->inputs_first)
         {
-            fprintf (stderr, "Failed to open output file \"%s\".\n", instance->output_path);
-            result = CUSHION_RESULT_FAILED_TO_OPEN_OUTPUT;
+            // Regular configuration is executed as the first job.
+            struct cushion_job_node_t *job_node =
+                cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_job_node_t),
+                                            _Alignof (struct cushion_job_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+            job_node->next = instance->jobs_first;
+            job_node->inputs_first = instance->inputs_first;
+            job_node->output_path = instance->output_path;
+            job_node->cmake_depfile_path = instance->cmake_depfile_path;
+            job_node->watch_job = NULL;
+            instance->jobs_first = job_node;
         }
+    }
+
+    return result;
+}
+
+/// \brief Executes selected jobs, which are all the jobs unless it is a watch.
+static enum cushion_result_t execute_selected_jobs (struct cushion_instance_t *instance)
+{
+    enum cushion_result_t result = CUSHION_RESULT_OK;
+    const unsigned int stored_before = instance->cache_statistics.stored;
+    unsigned int jobs_count = 0u;
+    struct cushion_job_node_t *job_node = instance->jobs_first;
 
-        if (instance->cmake_depfile_output)
+    while (job_node)
+    {
+        if (is_job_selected (job_node))
         {
-            fclose (instance->cmake_depfile_output);
+            ++jobs_count;
         }
+
+        job_node = job_node->next;
     }
 
+    // Everything allocated by jobs is discarded after them, so memory pages are reused by the next job.
+    struct cushion_allocator_persistent_marker_t job_marker =
+        cushion_allocator_get_persistent_marker (&instance->allocator);
+
+    const unsigned int workers_count = instance->threads_count < jobs_count ? instance->threads_count : jobs_count;
+    if (workers_count > 1u)
+    {
+        result = execute_jobs_parallel (instance, jobs_count, workers_count);
+        cushion_allocator_reset_persistent (&instance->allocator, job_marker);
+    }
+    else
+    {
+        job_node = instance->jobs_first;
+        while (job_node)
+        {
+            if (is_job_selected (job_node))
+            {
+                // Failed jobs do not stop execution of other jobs, but result always reports the first failure.
+                enum cushion_result_t job_result = execute_job (instance, job_node);
+                if (result == CUSHION_RESULT_OK)
+                {
+                    result = job_result;
+                }
+
+                cushion_allocator_reset_persistent (&instance->allocator, job_marker);
+            }
+
+            job_node = job_node->next;
+        }
+    }
+
+    if (instance->cache_directory && instance->cache_max_size > 0u && instance->cache_statistics.stored > stored_before)
+    {
+        cushion_cache_evict (instance);
+    }
+
+    return result;
+}
+
+static void finish_execution (struct cushion_instance_t *instance)
+{
     // Reset all the configuration.
     cushion_instance_clean_configuration (instance);
 
     // Shrink and reset memory usage.
     cushion_allocator_shrink (&instance->allocator);
     cushion_allocator_reset_all (&instance->allocator);
+}
 
+enum cushion_result_t cushion_context_execute (cushion_context_t context)
+{
+    struct cushion_instance_t *instance = context.value;
+    enum cushion_result_t result = prepare_execution (instance);
+
+    if (result == CUSHION_RESULT_OK)
+    {
+        result = execute_selected_jobs (instance);
+    }
+
+    finish_execution (instance);
     return result;
 }
 
+enum cushion_result_t cushion_context_watch (cushion_context_t context,
+                                             cushion_watch_callback_t callback,
+                                             void *user_data)
+{
+    struct cushion_instance_t *instance = context.value;
+    enum cushion_result_t result = prepare_execution (instance);
+    struct cushion_watch_t watch;
+
+    if (result == CUSHION_RESULT_OK)
+    {
+        if (cushion_watch_init (instance, &watch) == CUSHION_INTERNAL_RESULT_OK)
+        {
+            do
+            {
+                watch.round_start_time = (long long) time (NULL);
+                result = execute_selected_jobs (instance);
+                cushion_watch_subscribe (instance, &watch);
+            } while (callback (user_data) && cushion_watch_wait (&watch, callback, user_data));
+
+            cushion_watch_shutdown (&watch);
+        }
+        else
+        {
+            result = CUSHION_RESULT_FAILED_TO_WATCH;
+        }
+    }
+
+    finish_execution (instance);
+    return result;
+}
+
+struct cushion_cache_statistics_t cushion_context_get_cache_statistics (cushion_context_t context)
+{
+    struct cushion_instance_t *instance = context.value;
+    return instance->cache_statistics;
+}
+
 void cushion_context_destroy (cushion_context_t context)
 {
     struct cushion_instance_t *instance = context.value;
-    cushion_allocator_shutdown (&instance->allocator);
+    cushion_instance_shutdown (instance);
     free (instance);
 }
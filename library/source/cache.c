@@ -0,0 +1,681 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <time.h>
+
+#include "internal.h"
+
+#if defined(CUSHION_FILE_STAT_UNIX)
+#    include <utime.h>
+#else
+#    include <direct.h>
+#    include <process.h>
+#    include <sys/utime.h>
+#endif
+
+/// \file
+/// \brief Local content-addressed cache of job results.
+/// \details Cache works in two steps, because files that are read by the job are only known after lexing.
+///          Manifest is named by the hash of configuration, absolute paths and contents of inputs. It lists cache
+///          entries: every entry has a list of dependencies with their sizes and content hashes and a key of result.
+///          Result is named by the hash of manifest key and all the dependencies, it stores dependency paths for
+///          depfile and the output itself. Files are always written under temporary names and then renamed, so
+///          cache directory can be safely shared between processes.
+
+#define CACHE_FORMAT_TAG "cushion-cache-1"
+#define CACHE_MANIFEST_ENTRIES_MAX 8u
+#define CACHE_READ_CHUNK_SIZE 65536u
+
+/// \brief Eviction removes files until cache size is not bigger than this percent of maximum size.
+#define CACHE_EVICTION_TARGET_PERCENT 90u
+
+static enum cushion_internal_result_t cache_build_path (struct cushion_instance_t *instance,
+                                                        struct cushion_hash_t key,
+                                                        const char *extension,
+                                                        char *output)
+{
+    char key_hex[CUSHION_HASH_HEX_LENGTH + 1u];
+    cushion_hash_format (key, key_hex);
+
+    const int printed = snprintf (output, CUSHION_PATH_MAX, "%s/%s.%s", instance->cache_directory, key_hex, extension);
+    return printed > 0 && printed < CUSHION_PATH_MAX ? CUSHION_INTERNAL_RESULT_OK : CUSHION_INTERNAL_RESULT_FAILED;
+}
+
+/// \brief Writes given parts into cache file through temporary file, so readers never see partially written files.
+static enum cushion_internal_result_t cache_write_file (struct cushion_instance_t *instance,
+                                                        const char *path,
+                                                        const char *header,
+                                                        size_t header_size,
+                                                        const char *content,
+                                                        size_t content_size)
+{
+    char temporary_path[CUSHION_PATH_MAX];
+#if defined(CUSHION_FILE_STAT_UNIX)
+    const unsigned long process_id = (unsigned long) getpid ();
+#else
+    const unsigned long process_id = (unsigned long) _getpid ();
+#endif
+
+    // Instance address makes name unique between threads of one process.
+    const int printed = snprintf (temporary_path, CUSHION_PATH_MAX, "%s.%lu-%llx.tmp", path, process_id,
+                                  (unsigned long long) (uintptr_t) instance);
+
+    if (printed <= 0 || printed >= CUSHION_PATH_MAX)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    FILE *file = fopen (temporary_path, "wb");
+    if (!file)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    unsigned int failed = fwrite (header, 1u, header_size, file) != header_size ||
+                          fwrite (content, 1u, content_size, file) != content_size;
+    failed |= fclose (file) != 0;
+
+    if (failed || cushion_file_replace (temporary_path, path) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        remove (temporary_path);
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+static void cache_touch (const char *path)
+{
+    // Modification time is used as last usage time for eviction.
+#if defined(CUSHION_FILE_STAT_UNIX)
+    utime (path, NULL);
+#else
+    _utime (path, NULL);
+#endif
+}
+
+/// \brief Skips given count of lines, returns NULL if content ends before that.
+static const char *cache_skip_lines (const char *cursor, unsigned long count)
+{
+    while (count > 0u)
+    {
+        cursor = strchr (cursor, '\n');
+        if (!cursor)
+        {
+            return NULL;
+        }
+
+        ++cursor;
+        --count;
+    }
+
+    return cursor;
+}
+
+/// \brief Parses "<hash> <number>" or, when number goes first, "<number> <hash>" prefix of manifest line.
+/// \return Pointer after parsed prefix or NULL on failure.
+static const char *cache_parse_hash_and_number (const char *cursor,
+                                                struct cushion_hash_t *hash,
+                                                unsigned long long *number,
+                                                unsigned int number_first)
+{
+    char *number_end;
+    if (number_first)
+    {
+        *number = strtoull (cursor, &number_end, 10);
+        if (number_end == cursor || *number_end != ' ' ||
+            strnlen (number_end + 1u, CUSHION_HASH_HEX_LENGTH) != CUSHION_HASH_HEX_LENGTH ||
+            cushion_hash_parse (number_end + 1u, hash) != CUSHION_INTERNAL_RESULT_OK)
+        {
+            return NULL;
+        }
+
+        return number_end + 1u + CUSHION_HASH_HEX_LENGTH;
+    }
+
+    if (strnlen (cursor, CUSHION_HASH_HEX_LENGTH) != CUSHION_HASH_HEX_LENGTH ||
+        cushion_hash_parse (cursor, hash) != CUSHION_INTERNAL_RESULT_OK ||
+        cursor[CUSHION_HASH_HEX_LENGTH] != ' ')
+    {
+        return NULL;
+    }
+
+    cursor += CUSHION_HASH_HEX_LENGTH + 1u;
+    *number = strtoull (cursor, &number_end, 10);
+    return number_end == cursor ? NULL : number_end;
+}
+
+/// \brief Checks whether all dependencies of manifest entry have the same content as when entry was saved.
+/// \param cursor Points to the first dependency line of the entry.
+static unsigned int cache_are_dependencies_matching (const char *cursor, unsigned long long dependencies_count)
+{
+    char path[CUSHION_PATH_MAX];
+    for (unsigned long long index = 0u; index < dependencies_count; ++index)
+    {
+        struct cushion_hash_t saved_hash;
+        unsigned long long saved_size;
+        cursor = cache_parse_hash_and_number (cursor, &saved_hash, &saved_size, 1u);
+
+        if (!cursor || *cursor != ' ')
+        {
+            return 0u;
+        }
+
+        ++cursor;
+        const char *path_end = strchr (cursor, '\n');
+
+        if (!path_end || (size_t) (path_end - cursor) >= CUSHION_PATH_MAX)
+        {
+            return 0u;
+        }
+
+        memcpy (path, cursor, path_end - cursor);
+        path[path_end - cursor] = '\0';
+        cursor = path_end + 1u;
+
+        // Size check is much cheaper than hashing and filters out most of the changed files.
+        struct cushion_file_status_t status;
+        struct cushion_hash_t current_hash;
+        unsigned long long current_size;
+
+        if (cushion_file_status_query (path, &status) != CUSHION_INTERNAL_RESULT_OK || status.size != saved_size ||
+            cushion_file_hash_content (path, &current_hash, &current_size) != CUSHION_INTERNAL_RESULT_OK ||
+            current_size != saved_size || !cushion_hash_equal (current_hash, saved_hash))
+        {
+            return 0u;
+        }
+    }
+
+    return 1u;
+}
+
+/// \brief Searches manifest for entry which dependencies match current file contents.
+static enum cushion_internal_result_t cache_find_result (const char *manifest, struct cushion_hash_t *result_key)
+{
+    const char *cursor = cache_skip_lines (manifest, 1u);
+    if (strncmp (manifest, CACHE_FORMAT_TAG "\n", sizeof (CACHE_FORMAT_TAG)) != 0)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    while (cursor && *cursor)
+    {
+        unsigned long long dependencies_count;
+        const char *entry_end = cache_parse_hash_and_number (cursor, result_key, &dependencies_count, 0u);
+
+        if (!entry_end || *entry_end != '\n')
+        {
+            return CUSHION_INTERNAL_RESULT_FAILED;
+        }
+
+        cursor = entry_end + 1u;
+        if (cache_are_dependencies_matching (cursor, dependencies_count))
+        {
+            return CUSHION_INTERNAL_RESULT_OK;
+        }
+
+        cursor = cache_skip_lines (cursor, (unsigned long) dependencies_count);
+    }
+
+    return CUSHION_INTERNAL_RESULT_FAILED;
+}
+
+/// \brief Restores output and depfile from result file content.
+static enum cushion_internal_result_t cache_restore_result (struct cushion_instance_t *instance,
+                                                            const char *result,
+                                                            size_t result_size)
+{
+    const char *cursor = cache_skip_lines (result, 1u);
+    if (strncmp (result, CACHE_FORMAT_TAG "\n", sizeof (CACHE_FORMAT_TAG)) != 0 || !cursor)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    char *count_end;
+    const unsigned long dependencies_count = strtoul (cursor, &count_end, 10);
+
+    if (count_end == cursor || *count_end != '\n')
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    const char *dependencies_begin = count_end + 1u;
+    const char *output_begin = cache_skip_lines (dependencies_begin, dependencies_count);
+
+    if (!output_begin)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    // Depfile target is already written, only dependencies are left. Paths are copied, because depfile
+    // entries are expected to be null terminated.
+    char path[CUSHION_PATH_MAX];
+    cursor = dependencies_begin;
+
+    while (cursor != output_begin)
+    {
+        const char *path_end = strchr (cursor, '\n');
+        if ((size_t) (path_end - cursor) >= CUSHION_PATH_MAX)
+        {
+            return CUSHION_INTERNAL_RESULT_FAILED;
+        }
+
+        memcpy (path, cursor, path_end - cursor);
+        path[path_end - cursor] = '\0';
+        cushion_instance_output_depfile_entry (instance, path);
+        cursor = path_end + 1u;
+    }
+
+    if (cushion_output_writer_append (&instance->output, output_begin, result + result_size - output_begin) !=
+        CUSHION_INTERNAL_RESULT_OK)
+    {
+        cushion_instance_error_output (instance, "Failed to output preprocessed code.\n");
+        cushion_instance_signal_error (instance);
+    }
+
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+unsigned int cushion_cache_restore (struct cushion_instance_t *instance,
+                                    struct cushion_job_node_t *job,
+                                    struct cushion_cache_job_t *cache_job)
+{
+    cache_job->valid = 0u;
+    cache_job->start_time = (long long) time (NULL);
+    cache_job->manifest_key = cushion_hash_initial ();
+
+    cushion_hash_append_string (&cache_job->manifest_key, CACHE_FORMAT_TAG);
+    cushion_hash_append (&cache_job->manifest_key, &instance->configuration_fingerprint,
+                         sizeof (instance->configuration_fingerprint));
+
+    char path[CUSHION_PATH_MAX];
+    struct cushion_input_node_t *input_node = job->inputs_first;
+
+    while (input_node)
+    {
+        // Absolute paths of inputs are a part of the key, because they are written into line directives.
+        struct cushion_hash_t content_hash;
+        unsigned long long content_size;
+
+        if (cushion_convert_path_to_absolute (input_node->path, path) != CUSHION_INTERNAL_RESULT_OK ||
+            cushion_file_hash_content (path, &content_hash, &content_size) != CUSHION_INTERNAL_RESULT_OK)
+        {
+            // Let the regular execution report the error.
+            ++instance->cache_statistics.misses;
+            return 0u;
+        }
+
+        cushion_hash_append_string (&cache_job->manifest_key, path);
+        cushion_hash_append (&cache_job->manifest_key, &content_hash, sizeof (content_hash));
+        input_node = input_node->next;
+    }
+
+    cache_job->valid = 1u;
+    if (cache_build_path (instance, cache_job->manifest_key, "manifest", path) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        ++instance->cache_statistics.misses;
+        return 0u;
+    }
+
+    size_t manifest_size;
+    char *manifest = cushion_file_read_content (path, "rb", &manifest_size);
+    struct cushion_hash_t result_key;
+
+    if (!manifest || cache_find_result (manifest, &result_key) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        free (manifest);
+        ++instance->cache_statistics.misses;
+        return 0u;
+    }
+
+    free (manifest);
+    cache_touch (path);
+
+    size_t result_size;
+    char *result = NULL;
+
+    if (cache_build_path (instance, result_key, "result", path) != CUSHION_INTERNAL_RESULT_OK ||
+        !(result = cushion_file_read_content (path, "rb", &result_size)) ||
+        cache_restore_result (instance, result, result_size) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        // Result might have been evicted by other process, so it is just a miss.
+        free (result);
+        ++instance->cache_statistics.misses;
+        return 0u;
+    }
+
+    free (result);
+    cache_touch (path);
+    ++instance->cache_statistics.hits;
+    return 1u;
+}
+
+/// \brief Appends data to heap allocated buffer, growing it when needed.
+static void cache_buffer_append (char **buffer, size_t *size, size_t *capacity, const char *data, size_t data_size)
+{
+    if (*size + data_size > *capacity)
+    {
+        while (*size + data_size > *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2u : CACHE_READ_CHUNK_SIZE;
+        }
+
+        *buffer = realloc (*buffer, *capacity);
+    }
+
+    memcpy (*buffer + *size, data, data_size);
+    *size += data_size;
+}
+
+void cushion_cache_store (struct cushion_instance_t *instance,
+                          struct cushion_job_node_t *job,
+                          struct cushion_cache_job_t *cache_job)
+{
+    if (!cache_job->valid || (instance->state_flags & CUSHION_INSTANCE_STATE_FLAG_UNCACHEABLE))
+    {
+        ++instance->cache_statistics.uncacheable;
+        return;
+    }
+
+    // Manifest entry and result header are built together, as both of them list dependencies.
+    char *entry = NULL;
+    size_t entry_size = 0u;
+    size_t entry_capacity = 0u;
+
+    char *result_header = NULL;
+    size_t result_header_size = 0u;
+    size_t result_header_capacity = 0u;
+
+    unsigned long dependencies_count = 0u;
+    struct cushion_hash_t result_key = cache_job->manifest_key;
+    struct cushion_depfile_dependency_node_t *dependency = instance->dependencies_first;
+    char line[CUSHION_HASH_HEX_LENGTH + 64u];
+
+    while (dependency)
+    {
+        struct cushion_file_status_t status;
+        struct cushion_hash_t content_hash;
+        unsigned long long content_size;
+
+        // File that was modified after job start might have been read in different state than it is now.
+        if (cushion_file_status_query (dependency->path, &status) != CUSHION_INTERNAL_RESULT_OK ||
+            status.modification_time >= cache_job->start_time ||
+            cushion_file_hash_content (dependency->path, &content_hash, &content_size) != CUSHION_INTERNAL_RESULT_OK)
+        {
+            free (entry);
+            free (result_header);
+            ++instance->cache_statistics.uncacheable;
+            return;
+        }
+
+        cushion_hash_append_string (&result_key, dependency->path);
+        cushion_hash_append (&result_key, &content_hash, sizeof (content_hash));
+
+        char content_hash_hex[CUSHION_HASH_HEX_LENGTH + 1u];
+        cushion_hash_format (content_hash, content_hash_hex);
+
+        const int printed = snprintf (line, sizeof (line), "%llu %s ", content_size, content_hash_hex);
+        cache_buffer_append (&entry, &entry_size, &entry_capacity, line, (size_t) printed);
+        cache_buffer_append (&entry, &entry_size, &entry_capacity, dependency->path, strlen (dependency->path));
+        cache_buffer_append (&entry, &entry_size, &entry_capacity, "\n", 1u);
+
+        cache_buffer_append (&result_header, &result_header_size, &result_header_capacity, dependency->path,
+                             strlen (dependency->path));
+        cache_buffer_append (&result_header, &result_header_size, &result_header_capacity, "\n", 1u);
+
+        ++dependencies_count;
+        dependency = dependency->next_dependency;
+    }
+
+#if defined(CUSHION_FILE_STAT_UNIX)
+    mkdir (instance->cache_directory, 0777);
+#else
+    _mkdir (instance->cache_directory);
+#endif
+
+    // Output is read back in text mode, so it has the same new lines as the one written by output writer.
+    size_t output_size;
+    char *output = cushion_file_read_content (job->output_path, "r", &output_size);
+    char path[CUSHION_PATH_MAX];
+    unsigned int stored = 0u;
+
+    if (output && cache_build_path (instance, result_key, "result", path) == CUSHION_INTERNAL_RESULT_OK)
+    {
+        char *full_header = NULL;
+        size_t full_header_size = 0u;
+        size_t full_header_capacity = 0u;
+
+        const int printed = snprintf (line, sizeof (line), CACHE_FORMAT_TAG "\n%lu\n", dependencies_count);
+        cache_buffer_append (&full_header, &full_header_size, &full_header_capacity, line, (size_t) printed);
+
+        if (result_header_size > 0u)
+        {
+            cache_buffer_append (&full_header, &full_header_size, &full_header_capacity, result_header,
+                                 result_header_size);
+        }
+
+        stored = cache_write_file (instance, path, full_header, full_header_size, output, output_size) ==
+                 CUSHION_INTERNAL_RESULT_OK;
+        free (full_header);
+    }
+
+    free (output);
+    free (result_header);
+
+    if (stored && cache_build_path (instance, cache_job->manifest_key, "manifest", path) == CUSHION_INTERNAL_RESULT_OK)
+    {
+        char result_key_hex[CUSHION_HASH_HEX_LENGTH + 1u];
+        cushion_hash_format (result_key, result_key_hex);
+
+        char *header = NULL;
+        size_t header_size = 0u;
+        size_t header_capacity = 0u;
+
+        const int printed =
+            snprintf (line, sizeof (line), CACHE_FORMAT_TAG "\n%s %lu\n", result_key_hex, dependencies_count);
+        cache_buffer_append (&header, &header_size, &header_capacity, line, (size_t) printed);
+
+        if (entry_size > 0u)
+        {
+            cache_buffer_append (&header, &header_size, &header_capacity, entry, entry_size);
+        }
+
+        // New entry goes first and older entries are kept after it, up to the limit. Different entries appear
+        // when the same input is preprocessed with different versions of headers, for example on other branches.
+        size_t previous_size;
+        char *previous = cushion_file_read_content (path, "rb", &previous_size);
+        const char *previous_entries = previous ? cache_skip_lines (previous, 1u) : NULL;
+        const char *previous_end = previous_entries;
+
+        if (previous_entries && strncmp (previous, CACHE_FORMAT_TAG "\n", sizeof (CACHE_FORMAT_TAG)) == 0)
+        {
+            for (unsigned int index = 1u; index < CACHE_MANIFEST_ENTRIES_MAX && previous_end && *previous_end;
+                 ++index)
+            {
+                struct cushion_hash_t previous_key;
+                unsigned long long previous_count;
+                const char *entry_end =
+                    cache_parse_hash_and_number (previous_end, &previous_key, &previous_count, 0u);
+
+                if (!entry_end || *entry_end != '\n')
+                {
+                    break;
+                }
+
+                const char *next = cache_skip_lines (entry_end + 1u, (unsigned long) previous_count);
+                if (!next)
+                {
+                    break;
+                }
+
+                // Entry with the same result is replaced by the new one.
+                if (cushion_hash_equal (previous_key, result_key))
+                {
+                    if (previous_end != previous_entries)
+                    {
+                        cache_buffer_append (&header, &header_size, &header_capacity, previous_entries,
+                                             previous_end - previous_entries);
+                    }
+
+                    previous_entries = next;
+                }
+
+                previous_end = next;
+            }
+        }
+
+        stored = cache_write_file (instance, path, header, header_size, previous_entries ? previous_entries : "",
+                                   previous_entries ? (size_t) (previous_end - previous_entries) : 0u) ==
+                 CUSHION_INTERNAL_RESULT_OK;
+
+        free (previous);
+        free (header);
+    }
+
+    free (entry);
+    if (stored)
+    {
+        ++instance->cache_statistics.stored;
+    }
+    else
+    {
+        ++instance->cache_statistics.uncacheable;
+    }
+}
+
+struct cache_file_t
+{
+    char *path;
+    long long last_usage;
+    unsigned long long size;
+};
+
+static int cache_file_compare_usage (const void *first, const void *second)
+{
+    const struct cache_file_t *first_file = first;
+    const struct cache_file_t *second_file = second;
+    return first_file->last_usage < second_file->last_usage ? -1 :
+           first_file->last_usage > second_file->last_usage ? 1 :
+                                                               0;
+}
+
+static unsigned int cache_is_cache_file_name (const char *name)
+{
+    const size_t length = strlen (name);
+    return (length > 9u && strcmp (name + length - 9u, ".manifest") == 0) ||
+           (length > 7u && strcmp (name + length - 7u, ".result") == 0);
+}
+
+static void cache_add_file (struct cushion_instance_t *instance,
+                            struct cache_file_t **files,
+                            size_t *count,
+                            size_t *capacity,
+                            const char *name,
+                            long long last_usage,
+                            unsigned long long size)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2u : 256u;
+        *files = realloc (*files, sizeof (struct cache_file_t) * *capacity);
+    }
+
+    const size_t path_size = strlen (instance->cache_directory) + 1u + strlen (name) + 1u;
+    struct cache_file_t *file = &(*files)[*count];
+    file->path = malloc (path_size);
+    snprintf (file->path, path_size, "%s/%s", instance->cache_directory, name);
+    file->last_usage = last_usage;
+    file->size = size;
+    ++*count;
+}
+
+void cushion_cache_evict (struct cushion_instance_t *instance)
+{
+    struct cache_file_t *files = NULL;
+    size_t files_count = 0u;
+    size_t files_capacity = 0u;
+    unsigned long long total_size = 0u;
+
+#if defined(CUSHION_DIRECTORY_LIST_UNIX)
+    DIR *directory = opendir (instance->cache_directory);
+    if (!directory)
+    {
+        return;
+    }
+
+    char path[CUSHION_PATH_MAX];
+    struct dirent *entry;
+
+    while ((entry = readdir (directory)))
+    {
+        struct cushion_file_status_t status;
+        const int printed = snprintf (path, CUSHION_PATH_MAX, "%s/%s", instance->cache_directory, entry->d_name);
+
+        if (cache_is_cache_file_name (entry->d_name) && printed > 0 && printed < CUSHION_PATH_MAX &&
+            cushion_file_status_query (path, &status) == CUSHION_INTERNAL_RESULT_OK)
+        {
+            cache_add_file (instance, &files, &files_count, &files_capacity, entry->d_name, status.modification_time,
+                            status.size);
+            total_size += status.size;
+        }
+    }
+
+    closedir (directory);
+#elif defined(CUSHION_DIRECTORY_LIST_WINDOWS)
+    char pattern[CUSHION_PATH_MAX];
+    const int pattern_length = snprintf (pattern, CUSHION_PATH_MAX, "%s/*", instance->cache_directory);
+
+    if (pattern_length < 0 || pattern_length >= CUSHION_PATH_MAX)
+    {
+        return;
+    }
+
+    WIN32_FIND_DATAA entry;
+    HANDLE handle = FindFirstFileA (pattern, &entry);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    do
+    {
+        if (cache_is_cache_file_name (entry.cFileName))
+        {
+            const unsigned long long size =
+                ((unsigned long long) entry.nFileSizeHigh << 32u) | (unsigned long long) entry.nFileSizeLow;
+            const long long last_usage = (long long) (((unsigned long long) entry.ftLastWriteTime.dwHighDateTime
+                                                       << 32u) |
+                                                      (unsigned long long) entry.ftLastWriteTime.dwLowDateTime);
+
+            cache_add_file (instance, &files, &files_count, &files_capacity, entry.cFileName, last_usage, size);
+            total_size += size;
+        }
+    } while (FindNextFileA (handle, &entry));
+
+    FindClose (handle);
+#endif
+
+    if (total_size > instance->cache_max_size)
+    {
+        const unsigned long long target_size = instance->cache_max_size / 100u * CACHE_EVICTION_TARGET_PERCENT;
+        qsort (files, files_count, sizeof (struct cache_file_t), cache_file_compare_usage);
+
+        for (size_t index = 0u; index < files_count && total_size > target_size; ++index)
+        {
+            // Other process might have already removed it, it is not an error.
+            if (remove (files[index].path) == 0)
+            {
+                ++instance->cache_statistics.evicted_files;
+            }
+
+            total_size -= files[index].size;
+        }
+    }
+
+    for (size_t index = 0u; index < files_count; ++index)
+    {
+        free (files[index].path);
+    }
+
+    free (files);
+}
@@ -1,7 +1,12 @@
+#include <errno.h>
 #include <time.h>
 
 #include "internal.h"
 
+#define DEFINE_CACHE_ENTRIES_LIMIT 4096u
+#define FILE_SYSTEM_CACHE_GARBAGE_LIMIT 256u
+#define FILE_READ_CHUNK_SIZE 65536u
+
 void cushion_allocator_init (struct cushion_allocator_t *instance)
 {
     instance->first_page = malloc (sizeof (struct cushion_allocator_page_t));
@@ -104,6 +109,32 @@ void cushion_allocator_reset_transient (struct cushion_allocator_t *allocator,
     }
 }
 
+struct cushion_allocator_persistent_marker_t cushion_allocator_get_persistent_marker (
+    struct cushion_allocator_t *allocator)
+{
+    return (struct cushion_allocator_persistent_marker_t) {
+        .page = allocator->current_page,
+        .top_transient = allocator->current_page->top_transient,
+        .bottom_persistent = allocator->current_page->bottom_persistent,
+    };
+}
+
+void cushion_allocator_reset_persistent (struct cushion_allocator_t *allocator,
+                                         struct cushion_allocator_persistent_marker_t persistent_marker)
+{
+    allocator->current_page = persistent_marker.page;
+    allocator->current_page->top_transient = persistent_marker.top_transient;
+    allocator->current_page->bottom_persistent = persistent_marker.bottom_persistent;
+    struct cushion_allocator_page_t *page = allocator->current_page->next;
+
+    while (page)
+    {
+        page->top_transient = page->data;
+        page->bottom_persistent = page->data + CUSHION_ALLOCATOR_PAGE_SIZE;
+        page = page->next;
+    }
+}
+
 void cushion_allocator_reset_all (struct cushion_allocator_t *allocator)
 {
     struct cushion_allocator_page_t *page = allocator->first_page;
@@ -150,15 +181,428 @@ void cushion_allocator_shutdown (struct cushion_allocator_t *allocator)
     }
 }
 
+enum cushion_internal_result_t cushion_file_identity_query (const char *path,
+                                                            char *path_buffer,
+                                                            struct cushion_file_identity_t *output)
+{
+#if defined(CUSHION_FILE_STAT_UNIX)
+    (void) path_buffer;
+    struct stat file_stat;
+
+    if (stat (path, &file_stat) != 0)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    output->device = (unsigned long long) file_stat.st_dev;
+    output->inode = (unsigned long long) file_stat.st_ino;
+    output->path = NULL;
+    output->hash = (unsigned int) (output->inode ^ (output->inode >> 32u)) * 31u +
+                   (unsigned int) (output->device ^ (output->device >> 32u));
+    return CUSHION_INTERNAL_RESULT_OK;
+#else
+    // Inode is not provided by stat on Windows, therefore canonical path is used.
+    struct _stat64 file_stat;
+    if (_stat64 (path, &file_stat) != 0 ||
+        cushion_convert_path_to_absolute (path, path_buffer) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    output->device = 0u;
+    output->inode = 0u;
+    output->path = path_buffer;
+    output->hash = cushion_hash_djb2_null_terminated (path_buffer);
+    return CUSHION_INTERNAL_RESULT_OK;
+#endif
+}
+
+enum cushion_internal_result_t cushion_file_status_query (const char *path, struct cushion_file_status_t *output)
+{
+#if defined(CUSHION_FILE_STAT_UNIX)
+    struct stat file_stat;
+    if (stat (path, &file_stat) != 0)
+#else
+    struct _stat64 file_stat;
+    if (_stat64 (path, &file_stat) != 0)
+#endif
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    output->modification_time = (long long) file_stat.st_mtime;
+    output->size = (unsigned long long) file_stat.st_size;
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+enum cushion_internal_result_t cushion_file_replace (const char *source, const char *target)
+{
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+    return rename (source, target) == 0 ? CUSHION_INTERNAL_RESULT_OK : CUSHION_INTERNAL_RESULT_FAILED;
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+    return MoveFileExA (source, target, MOVEFILE_REPLACE_EXISTING) ? CUSHION_INTERNAL_RESULT_OK :
+                                                                    CUSHION_INTERNAL_RESULT_FAILED;
+#endif
+}
+
+enum cushion_internal_result_t cushion_file_hash_content (const char *path,
+                                                          struct cushion_hash_t *hash,
+                                                          unsigned long long *size)
+{
+    FILE *file = fopen (path, "rb");
+    if (!file)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    char buffer[FILE_READ_CHUNK_SIZE];
+    *hash = cushion_hash_initial ();
+    *size = 0u;
+    size_t read;
+
+    while ((read = fread (buffer, 1u, FILE_READ_CHUNK_SIZE, file)) > 0u)
+    {
+        cushion_hash_append (hash, buffer, read);
+        *size += read;
+    }
+
+    const unsigned int failed = ferror (file);
+    fclose (file);
+    return failed ? CUSHION_INTERNAL_RESULT_FAILED : CUSHION_INTERNAL_RESULT_OK;
+}
+
+char *cushion_file_read_content (const char *path, const char *mode, size_t *size)
+{
+    FILE *file = fopen (path, mode);
+    if (!file)
+    {
+        return NULL;
+    }
+
+    size_t capacity = FILE_READ_CHUNK_SIZE;
+    char *data = malloc (capacity + 1u);
+    *size = 0u;
+    size_t read;
+
+    // Size is not queried beforehand as text mode reading on Windows can return less than file size.
+    while ((read = fread (data + *size, 1u, capacity - *size, file)) > 0u)
+    {
+        *size += read;
+        if (*size == capacity)
+        {
+            capacity *= 2u;
+            data = realloc (data, capacity + 1u);
+        }
+    }
+
+    if (ferror (file))
+    {
+        free (data);
+        fclose (file);
+        return NULL;
+    }
+
+    fclose (file);
+    data[*size] = '\0';
+    return data;
+}
+
+#if defined(CUSHION_THREADS_WINDOWS)
+static DWORD WINAPI thread_entry (LPVOID argument)
+{
+    struct cushion_thread_t *thread = argument;
+    thread->function (thread->argument);
+    return 0u;
+}
+#elif defined(CUSHION_THREADS_PTHREAD)
+static void *thread_entry (void *argument)
+{
+    struct cushion_thread_t *thread = argument;
+    thread->function (thread->argument);
+    return NULL;
+}
+#endif
+
+enum cushion_internal_result_t cushion_thread_start (struct cushion_thread_t *thread,
+                                                     cushion_thread_function_t function,
+                                                     void *argument)
+{
+    thread->function = function;
+    thread->argument = argument;
+
+#if defined(CUSHION_THREADS_WINDOWS)
+    thread->handle = CreateThread (NULL, 0u, thread_entry, thread, 0u, NULL);
+    if (thread->handle)
+    {
+        return CUSHION_INTERNAL_RESULT_OK;
+    }
+#elif defined(CUSHION_THREADS_PTHREAD)
+    if (pthread_create (&thread->handle, NULL, thread_entry, thread) == 0)
+    {
+        return CUSHION_INTERNAL_RESULT_OK;
+    }
+#endif
+
+    return CUSHION_INTERNAL_RESULT_FAILED;
+}
+
+void cushion_thread_join (struct cushion_thread_t *thread)
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    WaitForSingleObject (thread->handle, INFINITE);
+    CloseHandle (thread->handle);
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_join (thread->handle, NULL);
+#endif
+}
+
+void cushion_mutex_init (struct cushion_mutex_t *mutex)
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    InitializeCriticalSection (&mutex->handle);
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_mutex_init (&mutex->handle, NULL);
+#endif
+}
+
+void cushion_mutex_lock (struct cushion_mutex_t *mutex)
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    EnterCriticalSection (&mutex->handle);
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_mutex_lock (&mutex->handle);
+#endif
+}
+
+void cushion_mutex_unlock (struct cushion_mutex_t *mutex)
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    LeaveCriticalSection (&mutex->handle);
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_mutex_unlock (&mutex->handle);
+#endif
+}
+
+void cushion_mutex_shutdown (struct cushion_mutex_t *mutex)
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    DeleteCriticalSection (&mutex->handle);
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_mutex_destroy (&mutex->handle);
+#endif
+}
+
+static inline unsigned int symbol_table_start_index (const struct cushion_symbol_table_t *table,
+                                                     unsigned int name_hash)
+{
+    // Names that only differ in the last characters have sequential djb2 hashes, which results in long clusters
+    // under linear probing. Fibonacci hashing spreads them and takes the best mixed high bits.
+    return (unsigned int) ((uint32_t) (name_hash * 2654435769u) >> table->index_shift);
+}
+
+/// \brief Returns index of the slot with requested symbol or index of empty slot where it should be inserted.
+static inline unsigned int symbol_table_find (const struct cushion_symbol_table_t *table,
+                                              unsigned int name_hash,
+                                              const char *name,
+                                              unsigned int name_length)
+{
+    unsigned int index = symbol_table_start_index (table, name_hash);
+    while (1u)
+    {
+        const struct cushion_symbol_table_slot_t *slot = &table->slots[index];
+        if (slot->symbol == CUSHION_SYMBOL_NONE ||
+            (slot->name_hash == name_hash && slot->name_length == name_length &&
+             memcmp (table->symbols[slot->symbol].name, name, name_length) == 0))
+        {
+            return index;
+        }
+
+        index = (index + 1u) & (table->capacity - 1u);
+    }
+}
+
+/// \brief Inserts slot for the symbol that is known to be absent from slots.
+static inline void symbol_table_insert_slot (struct cushion_symbol_table_t *table, unsigned int symbol)
+{
+    unsigned int index = symbol_table_start_index (table, table->symbols[symbol].name_hash);
+    while (table->slots[index].symbol != CUSHION_SYMBOL_NONE)
+    {
+        index = (index + 1u) & (table->capacity - 1u);
+    }
+
+    table->slots[index].name_hash = table->symbols[symbol].name_hash;
+    table->slots[index].name_length = table->symbols[symbol].name_length;
+    table->slots[index].symbol = symbol;
+}
+
+static void symbol_table_grow (struct cushion_symbol_table_t *table)
+{
+    struct cushion_symbol_table_slot_t *old_slots = table->slots;
+    const unsigned int old_capacity = table->capacity;
+
+    table->capacity *= 2u;
+    --table->index_shift;
+    table->slots = calloc (table->capacity, sizeof (struct cushion_symbol_table_slot_t));
+
+    for (unsigned int old_index = 0u; old_index < old_capacity; ++old_index)
+    {
+        if (old_slots[old_index].symbol != CUSHION_SYMBOL_NONE)
+        {
+            symbol_table_insert_slot (table, old_slots[old_index].symbol);
+        }
+    }
+
+    free (old_slots);
+}
+
+/// \brief Drops symbols that were interned after configuration and macros of configured symbols.
+/// \details Names of dropped symbols were allocated by the job and are discarded with its memory.
+static void symbol_table_reset_to_configured (struct cushion_symbol_table_t *table)
+{
+    table->symbols_count = table->configured_symbols_count;
+    memset (table->slots, 0, sizeof (struct cushion_symbol_table_slot_t) * table->capacity);
+
+    for (unsigned int symbol = CUSHION_SYMBOL_NONE + 1u; symbol < table->symbols_count; ++symbol)
+    {
+        table->symbols[symbol].macro = NULL;
+        symbol_table_insert_slot (table, symbol);
+    }
+}
+
+_Static_assert (CUSHION_SYMBOL_TABLE_INITIAL_CAPACITY > 1u &&
+                    (CUSHION_SYMBOL_TABLE_INITIAL_CAPACITY & (CUSHION_SYMBOL_TABLE_INITIAL_CAPACITY - 1u)) == 0u,
+                "Symbol table capacity must be a power of two that is greater than one.");
+
+_Static_assert (CUSHION_SYMBOL_NONE == 0u, "Zeroed symbol table slots must be empty.");
+
+void cushion_instance_init (struct cushion_instance_t *instance)
+{
+    cushion_allocator_init (&instance->allocator);
+    cushion_allocator_init (&instance->file_system_cache_allocator);
+    instance->file_system_cache_garbage_count = 0u;
+    instance->file_system_cache_working_directory = NULL;
+    instance->job_index = 0u;
+
+    instance->includes_hash = 0u;
+
+    for (unsigned int index = 0u; index < CUSHION_INCLUDE_RESOLUTION_BUCKETS; ++index)
+    {
+        instance->include_resolution_buckets[index] = NULL;
+    }
+
+    for (unsigned int index = 0u; index < CUSHION_FILE_IDENTITY_CACHE_BUCKETS; ++index)
+    {
+        instance->file_identity_cache_buckets[index] = NULL;
+    }
+
+    for (unsigned int index = 0u; index < CUSHION_DIRECTORY_INDEX_BUCKETS; ++index)
+    {
+        instance->directory_index_buckets[index] = NULL;
+    }
+
+    for (unsigned int index = 0u; index < CUSHION_TOKEN_CACHE_BUCKETS; ++index)
+    {
+        instance->token_cache_buckets[index] = NULL;
+    }
+
+    instance->token_cache_size = 0u;
+    for (unsigned int index = 0u; index < CUSHION_DEFINE_CACHE_BUCKETS; ++index)
+    {
+        instance->define_cache_buckets[index] = NULL;
+    }
+
+    instance->define_cache_entries_count = 0u;
+    struct cushion_symbol_table_t *table = &instance->symbol_table;
+    table->capacity = CUSHION_SYMBOL_TABLE_INITIAL_CAPACITY;
+    table->index_shift = 32u;
+
+    for (unsigned int capacity = table->capacity; capacity > 1u; capacity >>= 1u)
+    {
+        --table->index_shift;
+    }
+
+    table->slots = malloc (sizeof (struct cushion_symbol_table_slot_t) * table->capacity);
+    table->symbols_capacity = table->capacity / 2u;
+    table->symbols = malloc (sizeof (struct cushion_symbol_t) * table->symbols_capacity);
+
+    table->symbols[CUSHION_SYMBOL_NONE].name = "";
+    table->symbols[CUSHION_SYMBOL_NONE].name_hash = 0u;
+    table->symbols[CUSHION_SYMBOL_NONE].name_length = 0u;
+    table->symbols[CUSHION_SYMBOL_NONE].macro = NULL;
+    table->symbols[CUSHION_SYMBOL_NONE].macro_generation = 0u;
+    table->symbols_count = 1u;
+
+    cushion_output_writer_init (&instance->output);
+    cushion_output_writer_init (&instance->cmake_depfile_output);
+    instance->cache_statistics = (struct cushion_cache_statistics_t) {0u};
+    cushion_instance_clean_configuration (instance);
+}
+
+void cushion_instance_shutdown (struct cushion_instance_t *instance)
+{
+    assert (!cushion_output_writer_is_open (&instance->output));
+    assert (!cushion_output_writer_is_open (&instance->cmake_depfile_output));
+    cushion_output_writer_shutdown (&instance->output);
+    cushion_output_writer_shutdown (&instance->cmake_depfile_output);
+    free (instance->symbol_table.slots);
+    free (instance->symbol_table.symbols);
+    cushion_token_cache_clear (instance);
+    cushion_instance_define_cache_clear (instance);
+    cushion_allocator_shutdown (&instance->file_system_cache_allocator);
+    cushion_allocator_shutdown (&instance->allocator);
+}
+
 void cushion_instance_clean_configuration (struct cushion_instance_t *instance)
 {
     instance->state_flags = 0u;
     instance->features = 0u;
     instance->options = 0u;
+    instance->threads_count = 1u;
 
     instance->includes_first = NULL;
     instance->includes_last = NULL;
+    instance->includes_hash = 0u;
+
+#if defined(CUSHION_EXTENSIONS)
+    struct timespec time;
+    timespec_get (&time, TIME_UTC);
+    instance->start_ns_x64 = ((uint64_t) time.tv_sec) * 1000000000u + (uint64_t) time.tv_nsec;
+#endif
+
+    instance->inputs_first = NULL;
+    instance->inputs_last = NULL;
+    instance->output_path = NULL;
+    instance->cmake_depfile_path = NULL;
 
+    instance->jobs_first = NULL;
+    instance->jobs_last = NULL;
+
+    instance->unresolved_macros_first = NULL;
+    instance->configured_macros_first = NULL;
+    instance->prefix_scans_first = NULL;
+    instance->prefix_scans_last = NULL;
+    instance->configured_files_first = NULL;
+    instance->configured_files_last = NULL;
+    instance->macro_snapshot_path = NULL;
+    instance->symbol_table.configured_symbols_count = 1u;
+    instance->error_buffer = NULL;
+    instance->configuration_fingerprint = cushion_hash_initial ();
+    instance->cache_directory = NULL;
+    instance->cache_max_size = 0u;
+    cushion_instance_clean_job_state (instance);
+}
+
+static const char *file_system_cache_copy_string (struct cushion_instance_t *instance, const char *string)
+{
+    const size_t length = strlen (string);
+    char *copied = cushion_allocator_allocate (&instance->file_system_cache_allocator, length + 1u, _Alignof (char),
+                                               CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    memcpy (copied, string, length + 1u);
+    return copied;
+}
+
+void cushion_instance_clean_job_state (struct cushion_instance_t *instance)
+{
 #if defined(CUSHION_EXTENSIONS)
     instance->deferred_output_first = NULL;
     instance->deferred_output_last = NULL;
@@ -169,208 +613,1331 @@ void cushion_instance_clean_configuration (struct cushion_instance_t *instance)
     instance->statement_accumulators_first = NULL;
     instance->statement_accumulator_refs_first = NULL;
 
-    instance->statement_unordered_push_first = NULL;
-    instance->statement_unordered_push_last = NULL;
+    instance->statement_unordered_push_first = NULL;
+    instance->statement_unordered_push_last = NULL;
+
+    instance->macro_replacement_index = 0u;
+#endif
+
+    symbol_table_reset_to_configured (&instance->symbol_table);
+
+    for (unsigned int index = 0u; index < CUSHION_PRAGMA_ONCE_BUCKETS; ++index)
+    {
+        instance->pragma_once_buckets[index] = NULL;
+    }
+
+    for (unsigned int index = 0u; index < CUSHION_DEPFILE_BUCKETS; ++index)
+    {
+        instance->cmake_depfile_buckets[index] = NULL;
+    }
+
+    instance->dependencies_first = NULL;
+    instance->dependencies_last = NULL;
+
+    for (unsigned int index = 0u; index < CUSHION_INCLUDE_GUARD_BUCKETS; ++index)
+    {
+        instance->include_guard_buckets[index] = NULL;
+    }
+
+    ++instance->job_index;
+    char working_directory[CUSHION_PATH_MAX];
+
+    if (cushion_convert_path_to_absolute (".", working_directory) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        working_directory[0u] = '\0';
+    }
+
+    // Cached paths might be relative, therefore caches cannot be used after working directory change. Also, if there
+    // is too much garbage from changed entries, it is easier to drop everything and start from scratch.
+    if (!instance->file_system_cache_working_directory ||
+        strcmp (instance->file_system_cache_working_directory, working_directory) != 0 ||
+        instance->file_system_cache_garbage_count > FILE_SYSTEM_CACHE_GARBAGE_LIMIT)
+    {
+        for (unsigned int index = 0u; index < CUSHION_INCLUDE_RESOLUTION_BUCKETS; ++index)
+        {
+            instance->include_resolution_buckets[index] = NULL;
+        }
+
+        for (unsigned int index = 0u; index < CUSHION_FILE_IDENTITY_CACHE_BUCKETS; ++index)
+        {
+            instance->file_identity_cache_buckets[index] = NULL;
+        }
+
+        for (unsigned int index = 0u; index < CUSHION_DIRECTORY_INDEX_BUCKETS; ++index)
+        {
+            instance->directory_index_buckets[index] = NULL;
+        }
+
+        cushion_allocator_reset_all (&instance->file_system_cache_allocator);
+        instance->file_system_cache_garbage_count = 0u;
+        instance->file_system_cache_working_directory = file_system_cache_copy_string (instance, working_directory);
+    }
+}
+
+void cushion_instance_includes_add (struct cushion_instance_t *instance, struct cushion_include_node_t *node)
+{
+    instance->includes_hash = (instance->includes_hash * 31u + cushion_hash_djb2_null_terminated (node->path)) * 2u +
+                              (node->type == INCLUDE_TYPE_SCAN ? 1u : 0u);
+    node->next = NULL;
+    if (instance->includes_last)
+    {
+        instance->includes_last->next = node;
+        instance->includes_last = node;
+    }
+    else
+    {
+        instance->includes_first = node;
+        instance->includes_last = node;
+    }
+}
+
+unsigned int cushion_instance_symbol_intern (struct cushion_instance_t *instance,
+                                             const char *name_begin,
+                                             const char *name_end)
+{
+    struct cushion_symbol_table_t *table = &instance->symbol_table;
+    const unsigned int name_hash = cushion_hash_djb2_char_sequence (name_begin, name_end);
+    const unsigned int name_length = (unsigned int) (name_end - name_begin);
+    unsigned int index = symbol_table_find (table, name_hash, name_begin, name_length);
+
+    if (table->slots[index].symbol != CUSHION_SYMBOL_NONE)
+    {
+        return table->slots[index].symbol;
+    }
+
+    // None symbol has no slot, therefore symbols count is equal to occupied slots count after insertion.
+    if (table->symbols_count * 2u > table->capacity)
+    {
+        symbol_table_grow (table);
+        index = symbol_table_find (table, name_hash, name_begin, name_length);
+    }
+
+    if (table->symbols_count == table->symbols_capacity)
+    {
+        table->symbols_capacity *= 2u;
+        table->symbols = realloc (table->symbols, sizeof (struct cushion_symbol_t) * table->symbols_capacity);
+    }
+
+    const unsigned int symbol = table->symbols_count++;
+    struct cushion_symbol_t *new_symbol = &table->symbols[symbol];
+    new_symbol->name = cushion_instance_copy_char_sequence_inside (instance, name_begin, name_end,
+                                                                   CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    new_symbol->name_hash = name_hash;
+    new_symbol->name_length = name_length;
+    new_symbol->macro = NULL;
+    new_symbol->macro_generation = 0u;
+
+    table->slots[index].name_hash = name_hash;
+    table->slots[index].name_length = name_length;
+    table->slots[index].symbol = symbol;
+    return symbol;
+}
+
+unsigned int cushion_instance_symbol_search (struct cushion_instance_t *instance,
+                                             const char *name_begin,
+                                             const char *name_end)
+{
+    struct cushion_symbol_table_t *table = &instance->symbol_table;
+    const unsigned int index =
+        symbol_table_find (table, cushion_hash_djb2_char_sequence (name_begin, name_end), name_begin,
+                           (unsigned int) (name_end - name_begin));
+    return table->slots[index].symbol;
+}
+
+void cushion_instance_symbol_copy_configured (struct cushion_instance_t *destination,
+                                              struct cushion_instance_t *source)
+{
+    assert (destination->symbol_table.symbols_count == CUSHION_SYMBOL_NONE + 1u);
+    for (unsigned int symbol = CUSHION_SYMBOL_NONE + 1u; symbol < source->symbol_table.configured_symbols_count;
+         ++symbol)
+    {
+        const struct cushion_symbol_t *source_symbol = &source->symbol_table.symbols[symbol];
+        const unsigned int copied_symbol = cushion_instance_symbol_intern (
+            destination, source_symbol->name, source_symbol->name + source_symbol->name_length);
+
+        // Symbols are unique and interned in the same order, so ids must match.
+        assert (copied_symbol == symbol);
+        (void) copied_symbol;
+    }
+
+    destination->symbol_table.configured_symbols_count = source->symbol_table.configured_symbols_count;
+}
+
+struct cushion_macro_node_t *cushion_instance_macro_search (struct cushion_instance_t *instance,
+                                                            const char *name_begin,
+                                                            const char *name_end)
+{
+    return instance->symbol_table.symbols[cushion_instance_symbol_search (instance, name_begin, name_end)].macro;
+}
+
+static inline unsigned int include_resolution_hash (unsigned int includes_hash,
+                                                    const char *search_start,
+                                                    const char *spelling_begin,
+                                                    const char *spelling_end)
+{
+    const unsigned int spelling_hash = cushion_hash_djb2_char_sequence (spelling_begin, spelling_end) ^ includes_hash;
+    return search_start ? spelling_hash ^ (cushion_hash_djb2_null_terminated (search_start) * 31u) : spelling_hash;
+}
+
+struct cushion_include_resolution_node_t *cushion_instance_include_resolution_search (
+    struct cushion_instance_t *instance,
+    const char *search_start,
+    const char *spelling_begin,
+    const char *spelling_end)
+{
+    const unsigned int hash = include_resolution_hash (instance->includes_hash, search_start, spelling_begin,
+                                                       spelling_end);
+    struct cushion_include_resolution_node_t *node =
+        instance->include_resolution_buckets[hash % CUSHION_INCLUDE_RESOLUTION_BUCKETS];
+
+    while (node)
+    {
+        if (node->hash == hash && node->includes_hash == instance->includes_hash &&
+            node->spelling_end - node->spelling_begin == spelling_end - spelling_begin &&
+            strncmp (node->spelling_begin, spelling_begin, spelling_end - spelling_begin) == 0 &&
+            (node->search_start ? search_start && strcmp (node->search_start, search_start) == 0 : !search_start))
+        {
+            return node;
+        }
+
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+struct cushion_include_resolution_node_t *cushion_instance_include_resolution_add (
+    struct cushion_instance_t *instance,
+    const char *search_start,
+    const char *spelling_begin,
+    const char *spelling_end)
+{
+    struct cushion_include_resolution_node_t *new_node = cushion_allocator_allocate (
+        &instance->file_system_cache_allocator, sizeof (struct cushion_include_resolution_node_t),
+        _Alignof (struct cushion_include_resolution_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    new_node->hash = include_resolution_hash (instance->includes_hash, search_start, spelling_begin, spelling_end);
+    new_node->includes_hash = instance->includes_hash;
+    new_node->search_start = search_start ? file_system_cache_copy_string (instance, search_start) : NULL;
+
+    const size_t spelling_length = spelling_end - spelling_begin;
+    char *spelling = cushion_allocator_allocate (&instance->file_system_cache_allocator, spelling_length + 1u,
+                                                 _Alignof (char), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    memcpy (spelling, spelling_begin, spelling_length);
+    spelling[spelling_length] = '\0';
+    new_node->spelling_begin = spelling;
+    new_node->spelling_end = spelling + spelling_length;
+
+    new_node->validated_job = instance->job_index;
+    new_node->path = NULL;
+    new_node->include_node = NULL;
+
+    new_node->next = instance->include_resolution_buckets[new_node->hash % CUSHION_INCLUDE_RESOLUTION_BUCKETS];
+    instance->include_resolution_buckets[new_node->hash % CUSHION_INCLUDE_RESOLUTION_BUCKETS] = new_node;
+    return new_node;
+}
+
+void cushion_instance_include_resolution_save (struct cushion_instance_t *instance,
+                                               struct cushion_include_resolution_node_t *node,
+                                               const char *path,
+                                               struct cushion_include_node_t *include_node,
+                                               const struct cushion_file_identity_t *file)
+{
+    node->validated_job = instance->job_index;
+    node->include_node = include_node;
+
+    if (!path)
+    {
+        node->path = NULL;
+        return;
+    }
+
+    if (!node->path || strcmp (node->path, path) != 0)
+    {
+        if (node->path)
+        {
+            ++instance->file_system_cache_garbage_count;
+        }
+
+        node->path = file_system_cache_copy_string (instance, path);
+    }
+
+    // Identities are expected to come from identity cache, which shares allocator with resolutions.
+    node->file = *file;
+}
+
+static void file_identity_cache_update (struct cushion_instance_t *instance,
+                                        struct cushion_file_identity_cache_entry_t *entry,
+                                        const struct cushion_file_status_t *status)
+{
+    char path_buffer[CUSHION_PATH_MAX];
+    const char *previous_identity_path = entry->exists ? entry->identity.path : NULL;
+
+    // Time is captured before query, so changes made right after it are never hidden by equal status.
+    entry->queried_time = (long long) time (NULL);
+    entry->exists =
+        cushion_file_identity_query (entry->path, path_buffer, &entry->identity) == CUSHION_INTERNAL_RESULT_OK;
+    entry->status = *status;
+
+    if (entry->exists && entry->identity.path)
+    {
+        if (previous_identity_path && strcmp (previous_identity_path, entry->identity.path) == 0)
+        {
+            entry->identity.path = previous_identity_path;
+        }
+        else
+        {
+            if (previous_identity_path)
+            {
+                ++instance->file_system_cache_garbage_count;
+            }
+
+            entry->identity.path = file_system_cache_copy_string (instance, entry->identity.path);
+        }
+    }
+}
+
+static void file_identity_cache_validate (struct cushion_instance_t *instance,
+                                          struct cushion_file_identity_cache_entry_t *entry)
+{
+    entry->validated_job = instance->job_index;
+    struct cushion_file_status_t status;
+
+    if (cushion_file_status_query (entry->path, &status) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        entry->exists = 0u;
+        return;
+    }
+
+    if (!entry->exists || status.modification_time != entry->status.modification_time ||
+        status.size != entry->status.size || entry->status.modification_time >= entry->queried_time)
+    {
+        file_identity_cache_update (instance, entry, &status);
+    }
+}
+
+enum cushion_internal_result_t cushion_instance_file_identity_query (struct cushion_instance_t *instance,
+                                                                     const char *path,
+                                                                     struct cushion_file_identity_t *output)
+{
+    const unsigned int path_hash = cushion_hash_djb2_null_terminated (path);
+    struct cushion_file_identity_cache_entry_t *entry =
+        instance->file_identity_cache_buckets[path_hash % CUSHION_FILE_IDENTITY_CACHE_BUCKETS];
+
+    while (entry)
+    {
+        if (entry->path_hash == path_hash && strcmp (entry->path, path) == 0)
+        {
+            break;
+        }
+
+        entry = entry->next;
+    }
+
+    if (entry)
+    {
+        if (entry->validated_job != instance->job_index)
+        {
+            file_identity_cache_validate (instance, entry);
+        }
+    }
+    else
+    {
+        // Missing files are not cached, otherwise every failed include search would leave an entry behind.
+        struct cushion_file_status_t status;
+        if (cushion_file_status_query (path, &status) != CUSHION_INTERNAL_RESULT_OK)
+        {
+            return CUSHION_INTERNAL_RESULT_FAILED;
+        }
+
+        entry = cushion_allocator_allocate (
+            &instance->file_system_cache_allocator, sizeof (struct cushion_file_identity_cache_entry_t),
+            _Alignof (struct cushion_file_identity_cache_entry_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+        entry->path_hash = path_hash;
+        entry->path = file_system_cache_copy_string (instance, path);
+        entry->validated_job = instance->job_index;
+        entry->exists = 0u;
+        file_identity_cache_update (instance, entry, &status);
+
+        entry->next = instance->file_identity_cache_buckets[path_hash % CUSHION_FILE_IDENTITY_CACHE_BUCKETS];
+        instance->file_identity_cache_buckets[path_hash % CUSHION_FILE_IDENTITY_CACHE_BUCKETS] = entry;
+    }
+
+    if (!entry->exists)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    *output = entry->identity;
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+static void directory_index_add_entry (struct cushion_instance_t *instance,
+                                       struct cushion_directory_index_t *index,
+                                       const char *name)
+{
+    struct cushion_directory_index_entry_t *entry = cushion_allocator_allocate (
+        &instance->file_system_cache_allocator, sizeof (struct cushion_directory_index_entry_t),
+        _Alignof (struct cushion_directory_index_entry_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    entry->name_hash = cushion_hash_djb2_null_terminated (name);
+    entry->name = file_system_cache_copy_string (instance, name);
+
+    entry->next = index->entry_buckets[entry->name_hash % CUSHION_DIRECTORY_INDEX_ENTRY_BUCKETS];
+    index->entry_buckets[entry->name_hash % CUSHION_DIRECTORY_INDEX_ENTRY_BUCKETS] = entry;
+}
+
+static unsigned int directory_index_list (struct cushion_instance_t *instance, struct cushion_directory_index_t *index)
+{
+#if defined(CUSHION_DIRECTORY_LIST_UNIX)
+    DIR *directory = opendir (index->path);
+    if (!directory)
+    {
+        return 0u;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir (directory)))
+    {
+        directory_index_add_entry (instance, index, entry->d_name);
+    }
+
+    closedir (directory);
+    return 1u;
+#elif defined(CUSHION_DIRECTORY_LIST_WINDOWS)
+    char pattern[CUSHION_PATH_MAX];
+    const int pattern_length = snprintf (pattern, CUSHION_PATH_MAX, "%s/*", index->path);
+
+    if (pattern_length < 0 || pattern_length >= CUSHION_PATH_MAX)
+    {
+        return 0u;
+    }
+
+    WIN32_FIND_DATAA entry;
+    HANDLE handle = FindFirstFileA (pattern, &entry);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return 0u;
+    }
+
+    do
+    {
+        directory_index_add_entry (instance, index, entry.cFileName);
+    } while (FindNextFileA (handle, &entry));
+
+    FindClose (handle);
+    return 1u;
+#endif
+}
+
+static void directory_index_validate (struct cushion_instance_t *instance, struct cushion_directory_index_t *index)
+{
+    index->validated_job = instance->job_index;
+    struct cushion_file_status_t status = {0};
+    const unsigned int status_known =
+        cushion_file_status_query (index->path, &status) == CUSHION_INTERNAL_RESULT_OK;
+
+    if (index->listed && status_known && status.modification_time == index->status.modification_time &&
+        status.size == index->status.size && index->status.modification_time < index->listed_time)
+    {
+        return;
+    }
+
+    if (index->listed)
+    {
+        ++instance->file_system_cache_garbage_count;
+    }
+
+    for (unsigned int bucket = 0u; bucket < CUSHION_DIRECTORY_INDEX_ENTRY_BUCKETS; ++bucket)
+    {
+        index->entry_buckets[bucket] = NULL;
+    }
+
+    // Time is captured before listing, so changes made during listing are never hidden by equal status.
+    index->listed_time = (long long) time (NULL);
+    index->listed = status_known && directory_index_list (instance, index);
+    index->status = status;
+}
+
+static struct cushion_directory_index_t *directory_index_get (struct cushion_instance_t *instance, const char *path)
+{
+    const unsigned int path_hash = cushion_hash_djb2_null_terminated (path);
+    struct cushion_directory_index_t *index =
+        instance->directory_index_buckets[path_hash % CUSHION_DIRECTORY_INDEX_BUCKETS];
+
+    while (index)
+    {
+        if (index->path_hash == path_hash && strcmp (index->path, path) == 0)
+        {
+            if (index->validated_job != instance->job_index)
+            {
+                directory_index_validate (instance, index);
+            }
+
+            return index;
+        }
+
+        index = index->next;
+    }
+
+    index = cushion_allocator_allocate (&instance->file_system_cache_allocator,
+                                        sizeof (struct cushion_directory_index_t),
+                                        _Alignof (struct cushion_directory_index_t),
+                                        CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    index->path_hash = path_hash;
+    index->path = file_system_cache_copy_string (instance, path);
+    index->listed = 0u;
+    directory_index_validate (instance, index);
+    index->next = instance->directory_index_buckets[path_hash % CUSHION_DIRECTORY_INDEX_BUCKETS];
+    instance->directory_index_buckets[path_hash % CUSHION_DIRECTORY_INDEX_BUCKETS] = index;
+    return index;
+}
+
+static unsigned int directory_index_has_entry (struct cushion_directory_index_t *index,
+                                               const char *name_begin,
+                                               const char *name_end)
+{
+    const unsigned int name_hash = cushion_hash_djb2_char_sequence (name_begin, name_end);
+    struct cushion_directory_index_entry_t *entry =
+        index->entry_buckets[name_hash % CUSHION_DIRECTORY_INDEX_ENTRY_BUCKETS];
+
+    while (entry)
+    {
+        if (entry->name_hash == name_hash && strlen (entry->name) == (size_t) (name_end - name_begin) &&
+            strncmp (entry->name, name_begin, name_end - name_begin) == 0)
+        {
+            return 1u;
+        }
+
+        entry = entry->next;
+    }
+
+    return 0u;
+}
+
+unsigned int cushion_instance_directory_index_may_contain (struct cushion_instance_t *instance,
+                                                           const char *directory,
+                                                           const char *relative_begin,
+                                                           const char *relative_end)
+{
+    char path[CUSHION_PATH_MAX];
+    size_t path_size = strlen (directory);
+
+    if (path_size + 1u > CUSHION_PATH_MAX)
+    {
+        return 1u;
+    }
+
+    memcpy (path, directory, path_size + 1u);
+    const char *component_begin = relative_begin;
+
+    while (component_begin < relative_end)
+    {
+        const char *component_end = component_begin;
+        while (component_end < relative_end && *component_end != '/' && *component_end != '\\')
+        {
+            ++component_end;
+        }
+
+        const size_t component_size = component_end - component_begin;
+        if (component_size == 0u || (component_size == 1u && component_begin[0u] == '.') ||
+            (component_size == 2u && component_begin[0u] == '.' && component_begin[1u] == '.'))
+        {
+            // Index cannot answer for special path components without path normalization.
+            return 1u;
+        }
+
+        struct cushion_directory_index_t *index = directory_index_get (instance, path);
+        if (!index->listed)
+        {
+            return 1u;
+        }
+
+        if (!directory_index_has_entry (index, component_begin, component_end))
+        {
+            return 0u;
+        }
+
+        if (component_end == relative_end || path_size + component_size + 2u > CUSHION_PATH_MAX)
+        {
+            break;
+        }
+
+        path[path_size] = '/';
+        memcpy (path + path_size + 1u, component_begin, component_size);
+        path_size += component_size + 1u;
+        path[path_size] = '\0';
+        component_begin = component_end + 1u;
+    }
+
+    return 1u;
+}
+
+void cushion_instance_pragma_once_add (struct cushion_instance_t *instance,
+                                       const struct cushion_file_identity_t *file)
+{
+    struct cushion_pragma_once_file_node_t *new_node = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct cushion_pragma_once_file_node_t),
+        _Alignof (struct cushion_pragma_once_file_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    new_node->file = *file;
+    if (file->path)
+    {
+        new_node->file.path =
+            cushion_instance_copy_null_terminated_inside (instance, file->path, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    }
+
+    new_node->next = instance->pragma_once_buckets[file->hash % CUSHION_PRAGMA_ONCE_BUCKETS];
+    instance->pragma_once_buckets[file->hash % CUSHION_PRAGMA_ONCE_BUCKETS] = new_node;
+}
+
+unsigned int cushion_instance_pragma_once_contains (struct cushion_instance_t *instance,
+                                                    const struct cushion_file_identity_t *file)
+{
+    struct cushion_pragma_once_file_node_t *node =
+        instance->pragma_once_buckets[file->hash % CUSHION_PRAGMA_ONCE_BUCKETS];
+
+    while (node)
+    {
+        if (cushion_file_identity_equals (&node->file, file))
+        {
+            return 1u;
+        }
+
+        node = node->next;
+    }
+
+    return 0u;
+}
+
+void cushion_instance_include_guard_add (struct cushion_instance_t *instance,
+                                         const struct cushion_file_identity_t *file,
+                                         const char *macro_name_begin,
+                                         const char *macro_name_end,
+                                         unsigned int scan_only)
+{
+    struct cushion_include_guard_node_t *new_node = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct cushion_include_guard_node_t),
+        _Alignof (struct cushion_include_guard_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    new_node->file = *file;
+    if (file->path)
+    {
+        new_node->file.path =
+            cushion_instance_copy_null_terminated_inside (instance, file->path, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    }
+
+    new_node->macro_name_begin = cushion_instance_copy_char_sequence_inside (instance, macro_name_begin, macro_name_end,
+                                                                             CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    new_node->macro_name_end = new_node->macro_name_begin + (macro_name_end - macro_name_begin);
+    new_node->scan_only = scan_only;
+
+    new_node->next = instance->include_guard_buckets[file->hash % CUSHION_INCLUDE_GUARD_BUCKETS];
+    instance->include_guard_buckets[file->hash % CUSHION_INCLUDE_GUARD_BUCKETS] = new_node;
+}
+
+unsigned int cushion_instance_include_guard_is_active (struct cushion_instance_t *instance,
+                                                       const struct cushion_file_identity_t *file,
+                                                       unsigned int scan_only)
+{
+    struct cushion_include_guard_node_t *node =
+        instance->include_guard_buckets[file->hash % CUSHION_INCLUDE_GUARD_BUCKETS];
+
+    while (node)
+    {
+        // Same file might have several guards if it was lexed in both modes or its guard macro was undefined.
+        if ((!node->scan_only || scan_only) && cushion_file_identity_equals (&node->file, file) &&
+            cushion_instance_macro_search (instance, node->macro_name_begin, node->macro_name_end))
+        {
+            return 1u;
+        }
+
+        node = node->next;
+    }
+
+    return 0u;
+}
+
+void cushion_instance_macro_add (struct cushion_instance_t *instance,
+                                 struct cushion_macro_node_t *node,
+                                 struct cushion_error_context_t error_context)
+{
+    node->symbol = cushion_instance_symbol_intern (instance, node->name, node->name + strlen (node->name));
+    // To have consistent behavior, intern parameter names here too.
+    struct cushion_macro_parameter_node_t *parameter = node->parameters_first;
+
+    while (parameter)
+    {
+        parameter->symbol =
+            cushion_instance_symbol_intern (instance, parameter->name, parameter->name + strlen (parameter->name));
+        parameter = parameter->next;
+    }
+
+    struct cushion_macro_node_t *already_here = instance->symbol_table.symbols[node->symbol].macro;
+    // Node might be replaced in place below, therefore its cached expansion becomes invalid.
+    ++instance->symbol_table.symbols[node->symbol].macro_generation;
+
+    if (already_here)
+    {
+#if defined(CUSHION_EXTENSIONS)
+        if ((already_here->flags & CUSHION_MACRO_FLAG_SNIPPET) && (node->flags & CUSHION_MACRO_FLAG_SNIPPET))
+        {
+            // Snippets are always replaceable.
+            goto replace_macro;
+        }
+        else if (already_here->flags & CUSHION_MACRO_FLAG_SNIPPET)
+        {
+            cushion_instance_execution_error (
+                instance, error_context, "Caught attempt to replace snippet macro \"%s\" with real macro.", node->name);
+            return;
+        }
+        else if (node->flags & CUSHION_MACRO_FLAG_SNIPPET)
+        {
+            cushion_instance_execution_error (instance, error_context,
+                                              "Caught attempt to replace normal macro \"%s\" with snippet macro.",
+                                              node->name);
+            return;
+        }
+#endif
+        if ((already_here->flags & CUSHION_MACRO_FLAG_FROM_PRESERVED_SCOPE) &&
+            (node->flags & CUSHION_MACRO_FLAG_FROM_PRESERVED_SCOPE))
+        {
+            // If both macros are from preserved scopes, then we cannot treat it as redefinition.
+            // From preserved scope must always be accompanied by preserved flag.
+            assert (node->flags & CUSHION_MACRO_FLAG_PRESERVED);
+            goto replace_macro;
+        }
+
+        if (cushion_instance_has_option (instance, CUSHION_OPTION_FORBID_MACRO_REDEFINITION) &&
+            (instance->state_flags & CUSHION_INSTANCE_STATE_FLAG_EXECUTION))
+        {
+            cushion_instance_execution_error (instance, error_context, "Encountered macro \"%s\" redefinition.",
+                                              node->name);
+            return;
+        }
+
+    replace_macro:
+        // Just replace previous node content and exit. Lazy flag tells how to interpret the content.
+        already_here->flags &= ~CUSHION_MACRO_FLAG_LAZY;
+        already_here->flags |= node->flags & CUSHION_MACRO_FLAG_LAZY;
+        already_here->value = node->value;
+        already_here->parameters_first = node->parameters_first;
+        already_here->program = node->program;
+        return;
+    }
+
+    // New macro, just attach it to the symbol.
+    instance->symbol_table.symbols[node->symbol].macro = node;
+}
+
+void cushion_instance_macro_remove (struct cushion_instance_t *instance, unsigned int symbol)
+{
+    // Removal is just pointer operation, as we keep all the garbage in stack group allocator for simplicity.
+    instance->symbol_table.symbols[symbol].macro = NULL;
+    ++instance->symbol_table.symbols[symbol].macro_generation;
+}
+
+void cushion_instance_macro_save_configured (struct cushion_instance_t *instance)
+{
+    struct cushion_symbol_table_t *table = &instance->symbol_table;
+    instance->configured_macros_first = NULL;
+
+    for (unsigned int symbol = CUSHION_SYMBOL_NONE + 1u; symbol < table->symbols_count; ++symbol)
+    {
+        struct cushion_macro_node_t *node = table->symbols[symbol].macro;
+        if (node)
+        {
+            struct cushion_macro_node_t *saved = cushion_allocator_allocate (
+                &instance->allocator, sizeof (struct cushion_macro_node_t), _Alignof (struct cushion_macro_node_t),
+                CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+            *saved = *node;
+            saved->expansion = NULL;
+            saved->next = instance->configured_macros_first;
+            instance->configured_macros_first = saved;
+        }
+    }
+
+    table->configured_symbols_count = table->symbols_count;
+}
+
+void cushion_instance_macro_restore_configured (struct cushion_instance_t *instance)
+{
+    struct cushion_macro_node_t *saved = instance->configured_macros_first;
+    while (saved)
+    {
+        // Copy is needed as macro nodes are modified in place when macro is redefined.
+        struct cushion_macro_node_t *node =
+            cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_macro_node_t),
+                                        _Alignof (struct cushion_macro_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+        *node = *saved;
+        node->next = NULL;
+        // Expansion is modified in place, therefore it is never shared between jobs and threads.
+        node->expansion = NULL;
+        instance->symbol_table.symbols[node->symbol].macro = node;
+        saved = saved->next;
+    }
+}
+
+size_t cushion_token_array_get_names_size (struct cushion_instance_t *instance,
+                                           const struct cushion_token_array_t *array)
+{
+    size_t names_size = 0u;
+    for (unsigned int index = 0u; index < array->count; ++index)
+    {
+        const struct cushion_token_array_token_t *record = &array->tokens[index];
+        if (record->type == CUSHION_TOKEN_TYPE_IDENTIFIER)
+        {
+            names_size += cushion_instance_symbol_get (instance, record->value)->name_length;
+        }
+    }
+
+    return names_size;
+}
+
+void cushion_token_array_detach (struct cushion_instance_t *instance,
+                                 const struct cushion_token_array_t *array,
+                                 struct cushion_token_array_t *output)
+{
+    output->count = array->count;
+    output->number_values_count = array->number_values_count;
+    output->text_size = array->text_size;
+    cushion_token_array_bind (output);
+    memcpy (output->number_values, array->number_values,
+            cushion_token_array_size (array->count, array->number_values_count, array->text_size) -
+                sizeof (struct cushion_token_array_t));
+
+    uint32_t name_offset = output->text_size;
+    for (unsigned int index = 0u; index < output->count; ++index)
+    {
+        struct cushion_token_array_token_t *record = &output->tokens[index];
+        if (record->type == CUSHION_TOKEN_TYPE_IDENTIFIER)
+        {
+            const struct cushion_symbol_t *symbol = cushion_instance_symbol_get (instance, record->value);
+            memcpy (output->text + name_offset, symbol->name, symbol->name_length);
+            record->begin = name_offset;
+            name_offset += (uint32_t) symbol->name_length;
+            record->end = name_offset;
+            record->value = CUSHION_SYMBOL_NONE;
+        }
+    }
+}
+
+struct cushion_token_array_t *cushion_token_array_attach (struct cushion_instance_t *instance,
+                                                          const struct cushion_token_array_t *detached,
+                                                          enum cushion_allocation_class_t allocation_class)
+{
+    // Identifier names are not copied, attached identifiers use symbol names as usual.
+    const size_t size = cushion_token_array_size (detached->count, detached->number_values_count, detached->text_size);
+    struct cushion_token_array_t *array =
+        cushion_allocator_allocate (&instance->allocator, size, cushion_token_array_alignment (), allocation_class);
+
+    array->count = detached->count;
+    array->number_values_count = detached->number_values_count;
+    array->text_size = detached->text_size;
+    cushion_token_array_bind (array);
+    memcpy (array->number_values, detached->number_values, size - sizeof (struct cushion_token_array_t));
+
+    for (unsigned int index = 0u; index < array->count; ++index)
+    {
+        struct cushion_token_array_token_t *record = &array->tokens[index];
+        if (record->type == CUSHION_TOKEN_TYPE_IDENTIFIER)
+        {
+            record->value =
+                cushion_instance_symbol_intern (instance, detached->text + record->begin, detached->text + record->end);
+            record->begin = 0u;
+            record->end = 0u;
+        }
+    }
+
+    return array;
+}
+
+/// \brief Lexed replacement list of configured define value.
+/// \details Entry, detached token array and value are allocated as one block. Identifier symbols are only valid for
+///          one job, therefore identifiers are interned again when list is restored.
+struct cushion_define_cache_entry_t
+{
+    struct cushion_define_cache_entry_t *next;
+    unsigned int value_hash;
+    unsigned int features;
+    const char *value;
+
+    /// \brief Detached copy of replacement list, NULL if list is empty.
+    struct cushion_token_array_t *replacement_list;
+};
+
+unsigned int cushion_instance_define_cache_restore (struct cushion_instance_t *instance,
+                                                   const char *value,
+                                                   const struct cushion_token_array_t **replacement_list_output)
+{
+    const unsigned int value_hash = cushion_hash_djb2_null_terminated (value);
+    struct cushion_define_cache_entry_t *entry =
+        instance->define_cache_buckets[value_hash % CUSHION_DEFINE_CACHE_BUCKETS];
+
+    while (entry)
+    {
+        if (entry->value_hash == value_hash && entry->features == instance->features &&
+            strcmp (entry->value, value) == 0)
+        {
+            break;
+        }
+
+        entry = entry->next;
+    }
+
+    if (!entry)
+    {
+        return 0u;
+    }
+
+    *replacement_list_output = entry->replacement_list ?
+                                   cushion_token_array_attach (instance, entry->replacement_list,
+                                                               CUSHION_ALLOCATION_CLASS_PERSISTENT) :
+                                   NULL;
+    return 1u;
+}
+
+void cushion_instance_define_cache_add (struct cushion_instance_t *instance,
+                                        const char *value,
+                                        const struct cushion_token_array_t *replacement_list)
+{
+    if (instance->define_cache_entries_count >= DEFINE_CACHE_ENTRIES_LIMIT)
+    {
+        // Configuration with so many distinct defines is unusual, there is no need for anything smarter.
+        cushion_instance_define_cache_clear (instance);
+    }
+
+    const size_t value_size = strlen (value) + 1u;
+    size_t array_size = 0u;
+    size_t names_size = 0u;
+
+    if (replacement_list)
+    {
+        array_size = cushion_token_array_size (replacement_list->count, replacement_list->number_values_count,
+                                               replacement_list->text_size);
+        names_size = cushion_token_array_get_names_size (instance, replacement_list);
 
-    instance->macro_replacement_index = 0u;
+        if (replacement_list->text_size + names_size > UINT32_MAX)
+        {
+            return;
+        }
+    }
 
-    struct timespec time;
-    timespec_get (&time, TIME_UTC);
-    instance->start_ns_x64 = ((uint64_t) time.tv_sec) * 1000000000u + (uint64_t) time.tv_nsec;
-#endif
+    _Static_assert (sizeof (struct cushion_define_cache_entry_t) % _Alignof (unsigned long long) == 0u &&
+                        sizeof (struct cushion_define_cache_entry_t) % _Alignof (struct cushion_token_array_t) == 0u,
+                    "Token array must be properly aligned after define cache entry.");
 
-    instance->inputs_first = NULL;
-    instance->inputs_last = NULL;
-    instance->output_path = NULL;
-    instance->cmake_depfile_path = NULL;
+    struct cushion_define_cache_entry_t *entry =
+        malloc (sizeof (struct cushion_define_cache_entry_t) + array_size + names_size + value_size);
 
-    for (unsigned int index = 0u; index < CUSHION_MACRO_BUCKETS; ++index)
+    if (!entry)
     {
-        instance->macro_buckets[index] = NULL;
+        return;
     }
 
-    for (unsigned int index = 0u; index < CUSHION_PRAGMA_ONCE_BUCKETS; ++index)
+    char *text = (char *) (entry + 1u);
+    entry->replacement_list = NULL;
+
+    if (replacement_list)
     {
-        instance->pragma_once_buckets[index] = NULL;
+        struct cushion_token_array_t *array = (struct cushion_token_array_t *) (entry + 1u);
+        cushion_token_array_detach (instance, replacement_list, array);
+        entry->replacement_list = array;
+        text = array->text + array->text_size + names_size;
     }
 
-    for (unsigned int index = 0u; index < CUSHION_DEPFILE_BUCKETS; ++index)
+    memcpy (text, value, value_size);
+    entry->value = text;
+    entry->value_hash = cushion_hash_djb2_null_terminated (value);
+    entry->features = instance->features;
+
+    entry->next = instance->define_cache_buckets[entry->value_hash % CUSHION_DEFINE_CACHE_BUCKETS];
+    instance->define_cache_buckets[entry->value_hash % CUSHION_DEFINE_CACHE_BUCKETS] = entry;
+    ++instance->define_cache_entries_count;
+}
+
+void cushion_instance_define_cache_clear (struct cushion_instance_t *instance)
+{
+    for (unsigned int bucket = 0u; bucket < CUSHION_DEFINE_CACHE_BUCKETS; ++bucket)
     {
-        instance->cmake_depfile_buckets[index] = NULL;
+        while (instance->define_cache_buckets[bucket])
+        {
+            struct cushion_define_cache_entry_t *next = instance->define_cache_buckets[bucket]->next;
+            free (instance->define_cache_buckets[bucket]);
+            instance->define_cache_buckets[bucket] = next;
+        }
     }
 
-    instance->unresolved_macros_first = NULL;
+    instance->define_cache_entries_count = 0u;
 }
 
-void cushion_instance_includes_add (struct cushion_instance_t *instance, struct cushion_include_node_t *node)
+void cushion_instance_configured_file_add (struct cushion_instance_t *instance,
+                                           const char *absolute_path,
+                                           unsigned int pragma_once,
+                                           const char *guard_macro)
 {
-    node->next = NULL;
-    if (instance->includes_last)
+    struct cushion_configured_file_t *new_node = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct cushion_configured_file_t), _Alignof (struct cushion_configured_file_t),
+        CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    char path_buffer[CUSHION_PATH_MAX];
+    new_node->next = NULL;
+    new_node->path =
+        cushion_instance_copy_null_terminated_inside (instance, absolute_path, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    new_node->identity_known =
+        cushion_file_identity_query (absolute_path, path_buffer, &new_node->identity) == CUSHION_INTERNAL_RESULT_OK;
+
+    if (new_node->identity_known && new_node->identity.path)
     {
-        instance->includes_last->next = node;
-        instance->includes_last = node;
+        new_node->identity.path = cushion_instance_copy_null_terminated_inside (instance, new_node->identity.path,
+                                                                                CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    }
+
+    new_node->pragma_once = pragma_once;
+    new_node->guard_macro =
+        guard_macro ?
+            cushion_instance_copy_null_terminated_inside (instance, guard_macro, CUSHION_ALLOCATION_CLASS_PERSISTENT) :
+            NULL;
+
+    // Order of dependencies is kept, so depfiles list them in the order of discovery.
+    if (instance->configured_files_last)
+    {
+        instance->configured_files_last->next = new_node;
     }
     else
     {
-        instance->includes_first = node;
-        instance->includes_last = node;
+        instance->configured_files_first = new_node;
     }
+
+    instance->configured_files_last = new_node;
 }
 
-static inline struct cushion_macro_node_t *macro_search_in_list (struct cushion_macro_node_t *list,
-                                                                 unsigned int name_hash,
-                                                                 const char *name_begin,
-                                                                 const char *name_end)
+void cushion_instance_save_configured_files (struct cushion_instance_t *instance)
 {
-    while (list)
+    char path_buffer[CUSHION_PATH_MAX];
+    char guard_macro[CUSHION_PATH_MAX];
+    struct cushion_depfile_dependency_node_t *dependency = instance->dependencies_first;
+
+    while (dependency)
     {
-        if (list->name_hash == name_hash && strlen (list->name) == (size_t) (name_end - name_begin) &&
-            strncmp (list->name, name_begin, name_end - name_begin) == 0)
+        struct cushion_file_identity_t identity;
+        unsigned int pragma_once = 0u;
+        const char *found_guard_macro = NULL;
+
+        if (cushion_file_identity_query (dependency->path, path_buffer, &identity) == CUSHION_INTERNAL_RESULT_OK)
         {
-            return list;
+            pragma_once = cushion_instance_pragma_once_contains (instance, &identity);
+            struct cushion_include_guard_node_t *guard =
+                instance->include_guard_buckets[identity.hash % CUSHION_INCLUDE_GUARD_BUCKETS];
+
+            while (guard)
+            {
+                const size_t length = guard->macro_name_end - guard->macro_name_begin;
+                if (cushion_file_identity_equals (&guard->file, &identity) && length < CUSHION_PATH_MAX &&
+                    cushion_instance_macro_search (instance, guard->macro_name_begin, guard->macro_name_end))
+                {
+                    memcpy (guard_macro, guard->macro_name_begin, length);
+                    guard_macro[length] = '\0';
+                    found_guard_macro = guard_macro;
+                    break;
+                }
+
+                guard = guard->next;
+            }
         }
 
-        list = list->next;
+        cushion_instance_configured_file_add (instance, dependency->path, pragma_once, found_guard_macro);
+        dependency = dependency->next_dependency;
     }
+}
 
-    return NULL;
+void cushion_instance_restore_configured_files (struct cushion_instance_t *instance)
+{
+    struct cushion_configured_file_t *file = instance->configured_files_first;
+    while (file)
+    {
+        cushion_instance_output_depfile_entry (instance, file->path);
+        if (file->identity_known)
+        {
+            if (file->pragma_once)
+            {
+                cushion_instance_pragma_once_add (instance, &file->identity);
+            }
+
+            if (file->guard_macro)
+            {
+                // Configured files are only lexed in scan only mode, therefore their guards are scan only too.
+                cushion_instance_include_guard_add (instance, &file->identity, file->guard_macro,
+                                                    file->guard_macro + strlen (file->guard_macro), 1u);
+            }
+        }
+
+        file = file->next;
+    }
 }
 
-struct cushion_macro_node_t *cushion_instance_macro_search (struct cushion_instance_t *instance,
-                                                            const char *name_begin,
-                                                            const char *name_end)
+#if defined(CUSHION_EXTENSIONS)
+struct cushion_output_buffer_node_t *new_cushion_output_buffer_node (struct cushion_instance_t *instance)
+{
+    struct cushion_output_buffer_node_t *allocated;
+    if (instance->free_buffers_first)
+    {
+        allocated = instance->free_buffers_first;
+        instance->free_buffers_first = allocated->next;
+    }
+    else
+    {
+        allocated = cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_output_buffer_node_t),
+                                                _Alignof (struct cushion_output_buffer_node_t),
+                                                CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    }
+
+    allocated->next = NULL;
+    allocated->end = allocated->data;
+    return allocated;
+}
+#endif
+
+/// \brief Size of stack buffer for reading previous output content when writing only changed outputs.
+#define OUTPUT_WRITER_COMPARE_CHUNK_SIZE 16384u
+
+void cushion_output_writer_init (struct cushion_output_writer_t *writer)
 {
-    unsigned int name_hash = cushion_hash_djb2_char_sequence (name_begin, name_end);
-    struct cushion_macro_node_t *list = instance->macro_buckets[name_hash % CUSHION_MACRO_BUCKETS];
-    return macro_search_in_list (list, name_hash, name_begin, name_end);
+    writer->descriptor = -1;
+    writer->previous_descriptor = -1;
+    writer->failed = 0u;
+    writer->flags = CUSHION_OUTPUT_WRITER_FLAG_NONE;
+    writer->target_path = NULL;
+    writer->buffer = malloc (CUSHION_OUTPUT_WRITER_BUFFER_SIZE);
+    writer->used = 0u;
 }
 
-void cushion_instance_macro_add (struct cushion_instance_t *instance,
-                                 struct cushion_macro_node_t *node,
-                                 struct cushion_error_context_t error_context)
+void cushion_output_writer_shutdown (struct cushion_output_writer_t *writer)
 {
-    node->name_hash = cushion_hash_djb2_null_terminated (node->name);
-    // To have consistent behavior, calculate parameter hashes here too.
-    struct cushion_macro_parameter_node_t *parameter = node->parameters_first;
+    free (writer->buffer);
+}
 
-    while (parameter)
+static int output_writer_platform_open_for_write (const char *path)
+{
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+    return open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+    // Text mode to get the same new lines as the output through stdio had.
+    return _open (path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_TEXT, _S_IREAD | _S_IWRITE);
+#endif
+}
+
+static int output_writer_platform_open_for_read (const char *path)
+{
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+    return open (path, O_RDONLY);
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+    // Text mode, so previous content is compared to written content before new line conversion.
+    return _open (path, _O_RDONLY | _O_TEXT);
+#endif
+}
+
+static void output_writer_platform_close (int descriptor)
+{
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+    close (descriptor);
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+    _close (descriptor);
+#endif
+}
+
+/// \brief Reads up to given count of bytes, returns count of read bytes or negative value on error.
+static long long output_writer_platform_read (int descriptor, char *output, size_t count)
+{
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+    ssize_t result;
+    do
     {
-        parameter->name_hash = cushion_hash_djb2_null_terminated (parameter->name);
-        parameter = parameter->next;
-    }
+        result = read (descriptor, output, count);
+    } while (result < 0 && errno == EINTR);
 
-    struct cushion_macro_node_t *bucket_list = instance->macro_buckets[node->name_hash % CUSHION_MACRO_BUCKETS];
-    struct cushion_macro_node_t *already_here =
-        macro_search_in_list (bucket_list, node->name_hash, node->name, node->name + strlen (node->name));
+    return (long long) result;
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+    return (long long) _read (descriptor, output, (unsigned int) (count > INT_MAX ? INT_MAX : count));
+#endif
+}
 
-    if (already_here)
+enum cushion_internal_result_t cushion_output_writer_open (struct cushion_output_writer_t *writer,
+                                                           const char *path,
+                                                           enum cushion_output_writer_flags_t flags)
+{
+    assert (!cushion_output_writer_is_open (writer));
+    writer->previous_descriptor = -1;
+    writer->failed = 0u;
+    writer->flags = flags;
+    writer->target_path = path;
+    writer->used = 0u;
+
+    if (flags & CUSHION_OUTPUT_WRITER_FLAG_ONLY_CHANGED)
     {
-#if defined(CUSHION_EXTENSIONS)
-        if ((already_here->flags & CUSHION_MACRO_FLAG_SNIPPET) && (node->flags & CUSHION_MACRO_FLAG_SNIPPET))
+        static const char temporary_suffix[] = ".cushion-tmp";
+        const size_t path_length = strlen (path);
+
+        if (path_length + sizeof (temporary_suffix) > CUSHION_PATH_BUFFER_SIZE)
         {
-            // Snippets are always replaceable.
-            goto replace_macro;
+            return CUSHION_INTERNAL_RESULT_FAILED;
         }
-        else if (already_here->flags & CUSHION_MACRO_FLAG_SNIPPET)
+
+        memcpy (writer->temporary_path, path, path_length);
+        memcpy (writer->temporary_path + path_length, temporary_suffix, sizeof (temporary_suffix));
+        writer->descriptor = output_writer_platform_open_for_write (writer->temporary_path);
+
+        if (writer->descriptor != -1)
         {
-            cushion_instance_execution_error (
-                instance, error_context, "Caught attempt to replace snippet macro \"%s\" with real macro.", node->name);
-            return;
+            // It is okay if there is no previous file: then content is treated as changed from the start.
+            writer->previous_descriptor = output_writer_platform_open_for_read (path);
         }
-        else if (node->flags & CUSHION_MACRO_FLAG_SNIPPET)
+    }
+    else
+    {
+        writer->descriptor = output_writer_platform_open_for_write (path);
+    }
+
+    return writer->descriptor == -1 ? CUSHION_INTERNAL_RESULT_FAILED : CUSHION_INTERNAL_RESULT_OK;
+}
+
+/// \brief Compares written data with the next part of previous content, stops comparing after first difference.
+static void output_writer_compare_with_previous (struct cushion_output_writer_t *writer,
+                                                 const char *begin,
+                                                 size_t length)
+{
+    char previous[OUTPUT_WRITER_COMPARE_CHUNK_SIZE];
+    while (writer->previous_descriptor != -1 && length > 0u)
+    {
+        const long long read = output_writer_platform_read (
+            writer->previous_descriptor, previous,
+            length < OUTPUT_WRITER_COMPARE_CHUNK_SIZE ? length : OUTPUT_WRITER_COMPARE_CHUNK_SIZE);
+
+        if (read <= 0 || memcmp (previous, begin, (size_t) read) != 0)
         {
-            cushion_instance_execution_error (instance, error_context,
-                                              "Caught attempt to replace normal macro \"%s\" with snippet macro.",
-                                              node->name);
+            output_writer_platform_close (writer->previous_descriptor);
+            writer->previous_descriptor = -1;
             return;
         }
-#endif
-        if ((already_here->flags & CUSHION_MACRO_FLAG_FROM_PRESERVED_SCOPE) &&
-            (node->flags & CUSHION_MACRO_FLAG_FROM_PRESERVED_SCOPE))
+
+        begin += read;
+        length -= (size_t) read;
+    }
+}
+
+static enum cushion_internal_result_t output_writer_write_all (struct cushion_output_writer_t *writer,
+                                                               const char *begin,
+                                                               size_t length)
+{
+    if (writer->failed)
+    {
+        return CUSHION_INTERNAL_RESULT_OK;
+    }
+
+    output_writer_compare_with_previous (writer, begin, length);
+    while (length > 0u)
+    {
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+        const ssize_t written = write (writer->descriptor, begin, length);
+        if (written < 0 && errno == EINTR)
         {
-            // If both macros are from preserved scopes, then we cannot treat it as redefinition.
-            // From preserved scope must always be accompanied by preserved flag.
-            assert (node->flags & CUSHION_MACRO_FLAG_PRESERVED);
-            goto replace_macro;
+            continue;
         }
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+        const int written =
+            _write (writer->descriptor, begin, (unsigned int) (length > INT_MAX ? INT_MAX : length));
+#endif
 
-        if (cushion_instance_has_option (instance, CUSHION_OPTION_FORBID_MACRO_REDEFINITION) &&
-            (instance->state_flags & CUSHION_INSTANCE_STATE_FLAG_EXECUTION))
+        if (written <= 0)
         {
-            cushion_instance_execution_error (instance, error_context, "Encountered macro \"%s\" redefinition.",
-                                              node->name);
-            return;
+            writer->failed = 1u;
+            return CUSHION_INTERNAL_RESULT_FAILED;
         }
 
-    replace_macro:
-        // Just replace previous node content and exit.
-        already_here->value = node->value;
-        already_here->parameters_first = node->parameters_first;
-        return;
+        begin += written;
+        length -= (size_t) written;
     }
 
-    // New macro, just insert it.
-    node->next = bucket_list;
-    instance->macro_buckets[node->name_hash % CUSHION_MACRO_BUCKETS] = node;
+    return CUSHION_INTERNAL_RESULT_OK;
 }
 
-void cushion_instance_macro_remove (struct cushion_instance_t *instance, const char *name_begin, const char *name_end)
+enum cushion_internal_result_t cushion_output_writer_flush (struct cushion_output_writer_t *writer)
 {
-    unsigned int name_hash = cushion_hash_djb2_char_sequence (name_begin, name_end);
-    // Logic is almost the same as for search, but we need to keep previous pointer here for proper removal.
-    struct cushion_macro_node_t *list = instance->macro_buckets[name_hash % CUSHION_MACRO_BUCKETS];
-    struct cushion_macro_node_t *previous = NULL;
+    const size_t used = writer->used;
+    writer->used = 0u;
+    return output_writer_write_all (writer, writer->buffer, used);
+}
 
-    while (list)
+enum cushion_internal_result_t cushion_output_writer_close (struct cushion_output_writer_t *writer)
+{
+    enum cushion_internal_result_t result = cushion_output_writer_flush (writer);
+#if defined(CUSHION_OUTPUT_WRITER_UNIX)
+    if (close (writer->descriptor) != 0)
+#elif defined(CUSHION_OUTPUT_WRITER_WINDOWS)
+    if (_close (writer->descriptor) != 0)
+#endif
     {
-        if (list->name_hash == name_hash && strlen (list->name) == (size_t) (name_end - name_begin) &&
-            strncmp (list->name, name_begin, name_end - name_begin) == 0)
-        {
-            // Found it.
-            // Removal is just pointer operation, as we keep all the garbage in stack group allocator for simplicity.
-
-            if (previous)
-            {
-                previous->next = list->next;
-            }
-            else
-            {
-                instance->macro_buckets[name_hash % CUSHION_MACRO_BUCKETS] = list->next;
-            }
+        writer->failed = 1u;
+        result = CUSHION_INTERNAL_RESULT_FAILED;
+    }
 
-            return;
+    writer->descriptor = -1;
+    if (writer->flags & CUSHION_OUTPUT_WRITER_FLAG_ONLY_CHANGED)
+    {
+        unsigned int changed = 1u;
+        if (writer->previous_descriptor != -1)
+        {
+            // Everything matched so far, content is the same only if previous content has nothing after that.
+            char next_character;
+            changed = output_writer_platform_read (writer->previous_descriptor, &next_character, 1u) != 0;
+            output_writer_platform_close (writer->previous_descriptor);
+            writer->previous_descriptor = -1;
         }
 
-        previous = list;
-        list = list->next;
+        if (writer->failed || !changed)
+        {
+            // Target file is left untouched, so its modification time is kept when content is the same.
+            remove (writer->temporary_path);
+        }
+        else if (cushion_file_replace (writer->temporary_path, writer->target_path) !=
+                 CUSHION_INTERNAL_RESULT_OK)
+        {
+            remove (writer->temporary_path);
+            result = CUSHION_INTERNAL_RESULT_FAILED;
+        }
     }
+
+    return result;
 }
 
-#if defined(CUSHION_EXTENSIONS)
-struct cushion_output_buffer_node_t *new_cushion_output_buffer_node (struct cushion_instance_t *instance)
+enum cushion_internal_result_t cushion_output_writer_append_overflow (struct cushion_output_writer_t *writer,
+                                                                      const char *begin,
+                                                                      size_t length)
 {
-    struct cushion_output_buffer_node_t *allocated;
-    if (instance->free_buffers_first)
+    if (cushion_output_writer_flush (writer) != CUSHION_INTERNAL_RESULT_OK)
     {
-        allocated = instance->free_buffers_first;
-        instance->free_buffers_first = allocated->next;
+        return CUSHION_INTERNAL_RESULT_FAILED;
     }
-    else
+
+    if (length >= CUSHION_OUTPUT_WRITER_BUFFER_SIZE)
     {
-        allocated = cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_output_buffer_node_t),
-                                                _Alignof (struct cushion_output_buffer_node_t),
-                                                CUSHION_ALLOCATION_CLASS_PERSISTENT);
+        // No sense to copy big chunks into buffer, write them right away.
+        return output_writer_write_all (writer, begin, length);
     }
 
-    allocated->next = NULL;
-    allocated->end = allocated->data;
-    return allocated;
+    memcpy (writer->buffer, begin, length);
+    writer->used = length;
+    return CUSHION_INTERNAL_RESULT_OK;
 }
-#endif
 
 void cushion_instance_output_sequence (struct cushion_instance_t *instance, const char *begin, const char *end)
 {
-    if (instance->output)
+    if (cushion_output_writer_is_open (&instance->output))
     {
         size_t length = end - begin;
 
@@ -413,9 +1980,9 @@ void cushion_instance_output_sequence (struct cushion_instance_t *instance, cons
         }
 #endif
 
-        if (fwrite (begin, 1u, length, instance->output) != length)
+        if (cushion_output_writer_append (&instance->output, begin, length) != CUSHION_INTERNAL_RESULT_OK)
         {
-            fprintf (stderr, "Failed to output preprocessed code.\n");
+            cushion_instance_error_output (instance, "Failed to output preprocessed code.\n");
             cushion_instance_signal_error (instance);
         }
     }
@@ -483,9 +2050,9 @@ static void flush_sink (struct cushion_instance_t *instance, struct cushion_defe
         if (buffer->data != buffer->end)
         {
             const size_t length = buffer->end - buffer->data;
-            if (fwrite (buffer->data, 1u, length, instance->output) != length)
+            if (cushion_output_writer_append (&instance->output, buffer->data, length) != CUSHION_INTERNAL_RESULT_OK)
             {
-                fprintf (stderr, "Failed to output preprocessed code.\n");
+                cushion_instance_error_output (instance, "Failed to output preprocessed code.\n");
                 cushion_instance_signal_error (instance);
             }
         }
@@ -536,29 +2103,31 @@ void cushion_output_finalize (struct cushion_instance_t *instance)
     if (instance->deferred_output_first)
     {
         cushion_instance_signal_error (instance);
-        fprintf (stderr,
-                 "Failed to properly write output: some sinks are still unfinished. See errors above for reasons (and "
-                 "if there is no reasons, then it is an internal error).\n");
+        cushion_instance_error_output (
+            instance,
+            "Failed to properly write output: some sinks are still unfinished. See errors above for reasons (and if "
+            "there is no reasons, then it is an internal error).\n");
         struct cushion_deferred_output_node_t *current = instance->deferred_output_first;
 
         while (current)
         {
             if (current->flags & CUSHION_DEFERRED_OUTPUT_NODE_FLAG_UNFINISHED)
             {
-                fprintf (stderr, "    Sink created at \"%s\" line %u is not finished.\n", current->source_file,
-                         (unsigned int) current->source_line);
+                cushion_instance_error_output (instance, "    Sink created at \"%s\" line %u is not finished.\n",
+                                               current->source_file, (unsigned int) current->source_line);
 
                 // Add information to the output file too.
-                cushion_instance_output_formatted (
-                    instance, "\n#line %u \"%s\"\n/* Sink that was created here is not finished properly. */\n",
-                    (unsigned int) current->source_line, current->source_file);
+                cushion_instance_output_null_terminated (instance, "\n");
+                cushion_instance_output_line_marker (instance, current->source_file,
+                                                     (unsigned int) current->source_line);
+                cushion_instance_output_null_terminated (
+                    instance, "/* Sink that was created here is not finished properly. */\n");
 
                 // Restore line number for following sinks.
                 if (current->next)
                 {
-                    cushion_instance_output_formatted (instance, "#line %u \"%s\"\n",
-                                                       (unsigned int) current->next->source_line,
-                                                       current->next->source_file);
+                    cushion_instance_output_line_marker (instance, current->next->source_file,
+                                                         (unsigned int) current->next->source_line);
                 }
 
                 // No need for returning buffers to free list, as we're finalizing everything either way.
@@ -583,8 +2152,9 @@ static void output_depfile_path_name (struct cushion_instance_t *instance, const
 #define CHECK_OUTPUT_BOUNDS                                                                                            \
     if (output >= conversion_buffer + CUSHION_PATH_MAX)                                                                \
     {                                                                                                                  \
-        fprintf (stderr, "Failed to add path name \"%s\" to depfile due to path length overflow,\n",                   \
-                 absolute_path_name);                                                                                  \
+        cushion_instance_error_output (instance,                                                                       \
+                                       "Failed to add path name \"%s\" to depfile due to path length overflow,\n",     \
+                                       absolute_path_name);                                                            \
         cushion_instance_signal_error (instance);                                                                      \
         return;                                                                                                        \
     }
@@ -624,33 +2194,90 @@ static void output_depfile_path_name (struct cushion_instance_t *instance, const
     }
 
     CHECK_OUTPUT_BOUNDS
-    *output = '\0';
+    *output = ' ';
+    ++output;
 
-    if (fprintf (instance->cmake_depfile_output, "%s ", conversion_buffer) == 0)
+    if (cushion_output_writer_append (&instance->cmake_depfile_output, conversion_buffer,
+                                      (size_t) (output - conversion_buffer)) != CUSHION_INTERNAL_RESULT_OK)
     {
-        fprintf (stderr, "Failed to output depfile path name.\n");
+        cushion_instance_error_output (instance, "Failed to output depfile path name.\n");
         cushion_instance_signal_error (instance);
     }
 }
 
+/// \brief Converts output path to absolute even if output file does not exist yet.
+/// \details Output does not exist before the first execution when it is written through temporary file, therefore
+///          only its directory is converted and file name is appended to it as is.
+static enum cushion_internal_result_t convert_output_path_to_absolute (const char *path, char *output)
+{
+    if (cushion_convert_path_to_absolute (path, output) == CUSHION_INTERNAL_RESULT_OK)
+    {
+        return CUSHION_INTERNAL_RESULT_OK;
+    }
+
+    char directory[CUSHION_PATH_MAX];
+    const char *separator = strrchr (path, '/');
+    const char *name = separator ? separator + 1u : path;
+
+    if (!separator)
+    {
+        directory[0u] = '.';
+        directory[1u] = '\0';
+    }
+    else
+    {
+        // Separator is kept for the root directory, so directory path is never empty.
+        const size_t directory_length = separator == path ? 1u : (size_t) (separator - path);
+        if (directory_length >= CUSHION_PATH_MAX)
+        {
+            return CUSHION_INTERNAL_RESULT_FAILED;
+        }
+
+        memcpy (directory, path, directory_length);
+        directory[directory_length] = '\0';
+    }
+
+    if (cushion_convert_path_to_absolute (directory, output) != CUSHION_INTERNAL_RESULT_OK)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    size_t length = strlen (output);
+    const size_t name_length = strlen (name);
+
+    if (length + name_length + 2u > CUSHION_PATH_MAX)
+    {
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+
+    if (length == 0u || output[length - 1u] != '/')
+    {
+        output[length] = '/';
+        ++length;
+    }
+
+    memcpy (output + length, name, name_length + 1u);
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
 void cushion_instance_output_depfile_target (struct cushion_instance_t *instance)
 {
-    if (instance->cmake_depfile_output)
+    if (cushion_output_writer_is_open (&instance->cmake_depfile_output))
     {
         // Convert output path to absolute as it might be relative, but depfile must use absolute paths.
         char absolute_buffer[CUSHION_PATH_MAX];
 
-        if (cushion_convert_path_to_absolute (instance->output_path, absolute_buffer) != CUSHION_INTERNAL_RESULT_OK)
+        if (convert_output_path_to_absolute (instance->output_path, absolute_buffer) != CUSHION_INTERNAL_RESULT_OK)
         {
-            fprintf (stderr, "Failed to convert output path to absolute for depfile.\n");
+            cushion_instance_error_output (instance, "Failed to convert output path to absolute for depfile.\n");
             cushion_instance_signal_error (instance);
             return;
         }
 
         output_depfile_path_name (instance, absolute_buffer);
-        if (fprintf (instance->cmake_depfile_output, ": ") == 0)
+        if (cushion_output_writer_append (&instance->cmake_depfile_output, ": ", 2u) != CUSHION_INTERNAL_RESULT_OK)
         {
-            fprintf (stderr, "Failed to output depfile target separator.\n");
+            cushion_instance_error_output (instance, "Failed to output depfile target separator.\n");
             cushion_instance_signal_error (instance);
         }
     }
@@ -658,7 +2285,8 @@ void cushion_instance_output_depfile_target (struct cushion_instance_t *instance
 
 void cushion_instance_output_depfile_entry (struct cushion_instance_t *instance, const char *absolute_path)
 {
-    if (instance->cmake_depfile_output)
+    const unsigned int depfile_open = cushion_output_writer_is_open (&instance->cmake_depfile_output);
+    if (depfile_open || (instance->state_flags & CUSHION_INSTANCE_STATE_FLAG_RECORD_DEPENDENCIES))
     {
         const unsigned int path_hash = cushion_hash_djb2_null_terminated (absolute_path);
         struct cushion_depfile_dependency_node_t *search_node =
@@ -688,10 +2316,71 @@ void cushion_instance_output_depfile_entry (struct cushion_instance_t *instance,
         new_node->path =
             cushion_instance_copy_null_terminated_inside (instance, absolute_path, CUSHION_ALLOCATION_CLASS_PERSISTENT);
 
-        new_node->next = instance->cmake_depfile_buckets[path_hash % CUSHION_PRAGMA_ONCE_BUCKETS];
-        instance->cmake_depfile_buckets[path_hash % CUSHION_PRAGMA_ONCE_BUCKETS] = new_node;
-        output_depfile_path_name (instance, absolute_path);
+        new_node->next = instance->cmake_depfile_buckets[path_hash % CUSHION_DEPFILE_BUCKETS];
+        instance->cmake_depfile_buckets[path_hash % CUSHION_DEPFILE_BUCKETS] = new_node;
+        new_node->next_dependency = NULL;
+
+        if (instance->dependencies_last)
+        {
+            instance->dependencies_last->next_dependency = new_node;
+        }
+        else
+        {
+            instance->dependencies_first = new_node;
+        }
+
+        instance->dependencies_last = new_node;
+        if (depfile_open)
+        {
+            output_depfile_path_name (instance, absolute_path);
+        }
+    }
+}
+
+void cushion_instance_error_output_internal (struct cushion_instance_t *instance,
+                                             const char *format,
+                                             va_list variadic_arguments)
+{
+    struct cushion_error_buffer_t *buffer = instance->error_buffer;
+    if (!buffer)
+    {
+        vfprintf (stderr, format, variadic_arguments);
+        return;
+    }
+
+    va_list measure_arguments;
+    va_copy (measure_arguments, variadic_arguments);
+    const int required = vsnprintf (NULL, 0u, format, measure_arguments);
+    va_end (measure_arguments);
+
+    if (required <= 0)
+    {
+        return;
+    }
+
+    const size_t required_capacity = buffer->size + (size_t) required + 1u;
+    if (required_capacity > buffer->capacity)
+    {
+        size_t new_capacity = buffer->capacity ? buffer->capacity : 1024u;
+        while (new_capacity < required_capacity)
+        {
+            new_capacity *= 2u;
+        }
+
+        char *new_data = realloc (buffer->data, new_capacity);
+        if (!new_data)
+        {
+            fprintf (stderr, "Internal error: failed to allocate %lu bytes for error buffer.",
+                     (unsigned long) new_capacity);
+            abort ();
+        }
+
+        buffer->data = new_data;
+        buffer->capacity = new_capacity;
     }
+
+    vsnprintf (buffer->data + buffer->size, buffer->capacity - buffer->size, format, variadic_arguments);
+    buffer->size += (size_t) required;
 }
 
 void cushion_instance_execution_error_internal (struct cushion_instance_t *instance,
@@ -701,14 +2390,15 @@ void cushion_instance_execution_error_internal (struct cushion_instance_t *insta
 {
     if (context.column != UINT_MAX)
     {
-        fprintf (stderr, "[%s:%u:%u] ", context.file, (unsigned int) context.line, (unsigned int) context.column);
+        cushion_instance_error_output (instance, "[%s:%u:%u] ", context.file, (unsigned int) context.line,
+                                       (unsigned int) context.column);
     }
     else
     {
-        fprintf (stderr, "[%s:%u] ", context.file, (unsigned int) context.line);
+        cushion_instance_error_output (instance, "[%s:%u] ", context.file, (unsigned int) context.line);
     }
 
-    vfprintf (stderr, format, variadic_arguments);
-    fprintf (stderr, "\n");
+    cushion_instance_error_output_internal (instance, format, variadic_arguments);
+    cushion_instance_error_output (instance, "\n");
     cushion_instance_signal_error (instance);
 }
@@ -19,15 +19,40 @@
 // We need to get absolute path for proper line directives and proper pragma once.
 #if defined(_WIN32) || defined(_WIN64)
 #    define CUSHION_PATH_MAX 4096
+#    include <fcntl.h>
+#    include <io.h>
+#    include <sys/stat.h>
 #    include <windows.h>
 #    define CUSHION_GET_ABSOLUTE_PATH_WINDOWS
+#    define CUSHION_THREADS_WINDOWS
+#    define CUSHION_FILE_STAT_WINDOWS
+#    define CUSHION_DIRECTORY_LIST_WINDOWS
+#    define CUSHION_OUTPUT_WRITER_WINDOWS
 #elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#    include <dirent.h>
+#    include <fcntl.h>
+#    include <pthread.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
 #    define CUSHION_PATH_MAX PATH_MAX
 #    define CUSHION_GET_ABSOLUTE_PATH_UNIX
+#    define CUSHION_THREADS_PTHREAD
+#    define CUSHION_FILE_STAT_UNIX
+#    define CUSHION_DIRECTORY_LIST_UNIX
+#    define CUSHION_OUTPUT_WRITER_UNIX
 #else
 #    error "Cushion has no implementation for getting absolute path for #pragma once on this OS."
 #endif
 
+// Watch uses inotify where it is available and falls back to polling file status otherwise.
+#if defined(__linux__)
+#    include <poll.h>
+#    include <sys/inotify.h>
+#    define CUSHION_WATCH_INOTIFY
+#else
+#    define CUSHION_WATCH_POLL
+#endif
+
 CUSHION_HEADER_BEGIN
 
 // Common generic utility functions.
@@ -71,6 +96,31 @@ enum cushion_internal_result_t
     CUSHION_INTERNAL_RESULT_FAILED = 1u,
 };
 
+/// \brief Maximum count of characters in decimal representation of unsigned int.
+#define CUSHION_UNSIGNED_DECIMAL_MAX 10u
+
+_Static_assert (sizeof (unsigned int) <= 4u, "CUSHION_UNSIGNED_DECIMAL_MAX expects at most 32-bit unsigned int.");
+
+/// \brief Writes decimal representation of given value without null terminator.
+/// \invariant Output must have space for at least CUSHION_UNSIGNED_DECIMAL_MAX characters.
+/// \return Pointer to the character after the last written one.
+static inline char *cushion_format_unsigned (char *output, unsigned int value)
+{
+    char digits[CUSHION_UNSIGNED_DECIMAL_MAX];
+    char *digit = digits + CUSHION_UNSIGNED_DECIMAL_MAX;
+
+    do
+    {
+        --digit;
+        *digit = (char) ('0' + value % 10u);
+        value /= 10u;
+    } while (value != 0u);
+
+    const size_t count = digits + CUSHION_UNSIGNED_DECIMAL_MAX - digit;
+    memcpy (output, digit, count);
+    return output + count;
+}
+
 /// \invariant Output allocation must be at least CUSHION_PATH_MAX bytes.
 static inline enum cushion_internal_result_t cushion_convert_path_to_absolute (const char *input, char *output)
 {
@@ -90,6 +140,155 @@ static inline enum cushion_internal_result_t cushion_convert_path_to_absolute (c
     return CUSHION_INTERNAL_RESULT_FAILED;
 }
 
+/// \brief Identifies file independently of the path that was used to reach it.
+/// \details Device and inode are used when platform provides them, otherwise canonical absolute path is used.
+struct cushion_file_identity_t
+{
+    unsigned int hash;
+    unsigned long long device;
+    unsigned long long inode;
+
+    /// \brief Canonical absolute path, only set when device and inode are not available.
+    const char *path;
+};
+
+/// \brief Queries identity of the file at given path. Fails if file does not exist or is not accessible.
+/// \invariant Path buffer allocation must be at least CUSHION_PATH_MAX bytes. Identity might point to it.
+enum cushion_internal_result_t cushion_file_identity_query (const char *path,
+                                                            char *path_buffer,
+                                                            struct cushion_file_identity_t *output);
+
+struct cushion_file_status_t
+{
+    /// \brief Last modification time in seconds.
+    long long modification_time;
+    unsigned long long size;
+};
+
+/// \brief Queries status of the file at given path. Fails if file does not exist or is not accessible.
+enum cushion_internal_result_t cushion_file_status_query (const char *path, struct cushion_file_status_t *output);
+
+/// \brief Atomically replaces target file with source file.
+enum cushion_internal_result_t cushion_file_replace (const char *source, const char *target);
+
+/// \brief 128-bit hash for fingerprints and cache keys.
+/// \details Consists of two 64-bit lanes: FNV-1a and multiply-rotate hash with different constants, which makes
+///          accidental collisions of configurations and file contents practically impossible, while not being
+///          cryptographically strong. It is not intended to be protection against malicious input.
+struct cushion_hash_t
+{
+    uint64_t first;
+    uint64_t second;
+};
+
+/// \brief Count of characters in hexadecimal representation of the hash without null terminator.
+#define CUSHION_HASH_HEX_LENGTH 32u
+
+static inline struct cushion_hash_t cushion_hash_initial (void)
+{
+    return (struct cushion_hash_t) {
+        .first = 14695981039346656037ull,
+        .second = 0x9E3779B97F4A7C15ull,
+    };
+}
+
+static inline void cushion_hash_append (struct cushion_hash_t *hash, const void *data, size_t size)
+{
+    const unsigned char *cursor = data;
+    const unsigned char *end = cursor + size;
+    uint64_t first = hash->first;
+    uint64_t second = hash->second;
+
+    while (cursor != end)
+    {
+        first = (first ^ *cursor) * 1099511628211ull;
+        second = ((second << 23u | second >> 41u) ^ *cursor) * 0xC2B2AE3D27D4EB4Full;
+        ++cursor;
+    }
+
+    hash->first = first;
+    hash->second = second;
+}
+
+/// \brief Appends string along with its null terminator, so sequential strings are always separated.
+static inline void cushion_hash_append_string (struct cushion_hash_t *hash, const char *string)
+{
+    cushion_hash_append (hash, string, strlen (string) + 1u);
+}
+
+static inline unsigned int cushion_hash_equal (struct cushion_hash_t first, struct cushion_hash_t second)
+{
+    return first.first == second.first && first.second == second.second;
+}
+
+/// \brief Writes hexadecimal representation of the hash with null terminator.
+/// \invariant Output must have space for at least CUSHION_HASH_HEX_LENGTH + 1 characters.
+static inline void cushion_hash_format (struct cushion_hash_t hash, char *output)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (unsigned int index = 0u; index < 16u; ++index)
+    {
+        output[index] = digits[(hash.first >> (60u - index * 4u)) & 15u];
+        output[16u + index] = digits[(hash.second >> (60u - index * 4u)) & 15u];
+    }
+
+    output[CUSHION_HASH_HEX_LENGTH] = '\0';
+}
+
+/// \brief Parses hexadecimal hash representation written by cushion_hash_format.
+static inline enum cushion_internal_result_t cushion_hash_parse (const char *input, struct cushion_hash_t *output)
+{
+    output->first = 0u;
+    output->second = 0u;
+
+    for (unsigned int index = 0u; index < CUSHION_HASH_HEX_LENGTH; ++index)
+    {
+        unsigned int digit;
+        if (input[index] >= '0' && input[index] <= '9')
+        {
+            digit = (unsigned int) (input[index] - '0');
+        }
+        else if (input[index] >= 'a' && input[index] <= 'f')
+        {
+            digit = (unsigned int) (input[index] - 'a' + 10);
+        }
+        else
+        {
+            return CUSHION_INTERNAL_RESULT_FAILED;
+        }
+
+        uint64_t *lane = index < 16u ? &output->first : &output->second;
+        *lane = (*lane << 4u) | digit;
+    }
+
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+static inline unsigned int cushion_file_identity_equals (const struct cushion_file_identity_t *first,
+                                                         const struct cushion_file_identity_t *second)
+{
+    if (first->hash != second->hash || first->device != second->device || first->inode != second->inode)
+    {
+        return 0u;
+    }
+
+    if (first->path || second->path)
+    {
+        return first->path && second->path && strcmp (first->path, second->path) == 0;
+    }
+
+    return 1u;
+}
+
+/// \brief Calculates hash and size of the whole file content.
+enum cushion_internal_result_t cushion_file_hash_content (const char *path,
+                                                          struct cushion_hash_t *hash,
+                                                          unsigned long long *size);
+
+/// \brief Reads the whole file into heap allocated null terminated buffer that must be freed by caller.
+/// \return NULL if file cannot be read.
+char *cushion_file_read_content (const char *path, const char *mode, size_t *size);
+
 // Memory management section: common utility for memory management.
 
 /// \brief We use double stack allocator for everything.
@@ -129,24 +328,173 @@ void *cushion_allocator_allocate (struct cushion_allocator_t *allocator,
                                   uintptr_t alignment,
                                   enum cushion_allocation_class_t class);
 
+/// \brief Marker that captures both transient and persistent allocation state.
+/// \details Used to reuse memory between independent executions that share data allocated before the marker.
+struct cushion_allocator_persistent_marker_t
+{
+    struct cushion_allocator_page_t *page;
+    void *top_transient;
+    void *bottom_persistent;
+};
+
 struct cushion_allocator_transient_marker_t cushion_allocator_get_transient_marker (
     struct cushion_allocator_t *allocator);
 
 void cushion_allocator_reset_transient (struct cushion_allocator_t *allocator,
                                         struct cushion_allocator_transient_marker_t transient_marker);
 
+struct cushion_allocator_persistent_marker_t cushion_allocator_get_persistent_marker (
+    struct cushion_allocator_t *allocator);
+
+/// \brief Resets all allocations, both transient and persistent, that were made after marker creation.
+/// \invariant There should be no transient markers created before persistent marker that are still in use.
+void cushion_allocator_reset_persistent (struct cushion_allocator_t *allocator,
+                                         struct cushion_allocator_persistent_marker_t persistent_marker);
+
 void cushion_allocator_reset_all (struct cushion_allocator_t *allocator);
 
 void cushion_allocator_shrink (struct cushion_allocator_t *allocator);
 
 void cushion_allocator_shutdown (struct cushion_allocator_t *allocator);
 
+// Threading section: minimal platform abstraction for parallel execution.
+
+typedef void (*cushion_thread_function_t) (void *argument);
+
+struct cushion_thread_t
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    HANDLE handle;
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_t handle;
+#endif
+
+    cushion_thread_function_t function;
+    void *argument;
+};
+
+struct cushion_mutex_t
+{
+#if defined(CUSHION_THREADS_WINDOWS)
+    CRITICAL_SECTION handle;
+#elif defined(CUSHION_THREADS_PTHREAD)
+    pthread_mutex_t handle;
+#endif
+};
+
+/// \invariant Thread structure must stay alive and must not be moved until thread is joined.
+enum cushion_internal_result_t cushion_thread_start (struct cushion_thread_t *thread,
+                                                     cushion_thread_function_t function,
+                                                     void *argument);
+
+void cushion_thread_join (struct cushion_thread_t *thread);
+
+void cushion_mutex_init (struct cushion_mutex_t *mutex);
+
+void cushion_mutex_lock (struct cushion_mutex_t *mutex);
+
+void cushion_mutex_unlock (struct cushion_mutex_t *mutex);
+
+void cushion_mutex_shutdown (struct cushion_mutex_t *mutex);
+
 // Context instance generic part.
 
 enum cushion_instance_state_flag_t
 {
     CUSHION_INSTANCE_STATE_FLAG_EXECUTION = 1u << 0u,
     CUSHION_INSTANCE_STATE_FLAG_ERRED = 1u << 1u,
+
+    /// \brief Dependencies are recorded even without depfile output, because output cache needs them.
+    CUSHION_INSTANCE_STATE_FLAG_RECORD_DEPENDENCIES = 1u << 2u,
+
+    /// \brief Output depends on something other than inputs and configuration and must not be cached.
+    CUSHION_INSTANCE_STATE_FLAG_UNCACHEABLE = 1u << 3u,
+};
+
+/// \brief Identifier that was interned into instance symbol table.
+/// \details Every distinct identifier has exactly one symbol, therefore identifiers are compared by symbol ids.
+struct cushion_symbol_t
+{
+    const char *name;
+    unsigned int name_hash;
+    unsigned int name_length;
+
+    /// \brief Macro that is currently defined under this name or NULL.
+    struct cushion_macro_node_t *macro;
+
+    /// \brief Incremented every time macro under this name is defined or undefined, validates cached expansions.
+    unsigned int macro_generation;
+};
+
+/// \brief Slot of symbol table. Hash and name length are stored inline, so probing rarely touches symbols.
+struct cushion_symbol_table_slot_t
+{
+    unsigned int name_hash;
+    unsigned int name_length;
+
+    /// \brief Index of the symbol in symbols array or CUSHION_SYMBOL_NONE if slot is empty.
+    unsigned int symbol;
+};
+
+/// \brief Special symbol id that is never assigned to identifiers, used as "no symbol" value.
+/// \details Symbol with this id exists in symbols array and never has macro, so it can be safely dereferenced.
+#define CUSHION_SYMBOL_NONE 0u
+
+/// \brief Growable open addressing hash table with linear probing that interns identifiers.
+/// \details Slots and symbols are allocated through heap as table grows independently of the jobs. Capacity is
+///          always a power of two and table is kept at most half full, therefore there is always an empty slot.
+///          Symbols that were interned during configuration keep their ids for all the jobs, even in other
+///          instances during parallel execution, therefore configured macros can be shared between them.
+struct cushion_symbol_table_t
+{
+    struct cushion_symbol_table_slot_t *slots;
+    unsigned int capacity;
+
+    /// \brief Shift that leaves log2 (capacity) highest bits of 32-bit value.
+    unsigned int index_shift;
+
+    struct cushion_symbol_t *symbols;
+    unsigned int symbols_count;
+    unsigned int symbols_capacity;
+
+    /// \brief Count of symbols that were interned during configuration and are kept between jobs.
+    unsigned int configured_symbols_count;
+};
+
+enum cushion_output_writer_flags_t
+{
+    CUSHION_OUTPUT_WRITER_FLAG_NONE = 0u,
+
+    /// \brief Write into temporary file and only replace target with it when content is different.
+    /// \details Written content is compared with previous content of the target file on the fly. When it is the
+    ///          same, target file is not touched at all and keeps its modification time, otherwise temporary file
+    ///          is atomically renamed into the target.
+    CUSHION_OUTPUT_WRITER_FLAG_ONLY_CHANGED = 1u << 0u,
+};
+
+/// \brief Buffered writer for output files that flushes its buffer directly to the file descriptor.
+/// \details Output consists of lots of small sequences like tokens, glue and line markers, therefore gathering them
+///          in one big buffer and writing it through one system call is much cheaper than calling stdio for each.
+///          Buffer is owned by writer and is kept between jobs.
+struct cushion_output_writer_t
+{
+    /// \brief Descriptor of opened output file or -1 if writer is closed.
+    int descriptor;
+
+    /// \brief Descriptor of previous target file content or -1 if written content already differs from it.
+    /// \details Only used with CUSHION_OUTPUT_WRITER_FLAG_ONLY_CHANGED.
+    int previous_descriptor;
+
+    /// \brief Set when write has failed once, everything after that is silently discarded.
+    unsigned int failed;
+
+    enum cushion_output_writer_flags_t flags;
+    const char *target_path;
+
+    char *buffer;
+    size_t used;
+
+    char temporary_path[CUSHION_PATH_BUFFER_SIZE];
 };
 
 struct cushion_instance_t
@@ -154,6 +502,7 @@ struct cushion_instance_t
     enum cushion_instance_state_flag_t state_flags;
     unsigned int features;
     unsigned int options;
+    unsigned int threads_count;
 
     struct cushion_include_node_t *includes_first;
     struct cushion_include_node_t *includes_last;
@@ -175,22 +524,96 @@ struct cushion_instance_t
     uint64_t start_ns_x64;
 #endif
 
-    struct cushion_macro_node_t *macro_buckets[CUSHION_MACRO_BUCKETS];
+    struct cushion_symbol_table_t symbol_table;
     struct cushion_pragma_once_file_node_t *pragma_once_buckets[CUSHION_PRAGMA_ONCE_BUCKETS];
     struct cushion_depfile_dependency_node_t *cmake_depfile_buckets[CUSHION_DEPFILE_BUCKETS];
+    struct cushion_depfile_dependency_node_t *dependencies_first;
+    struct cushion_depfile_dependency_node_t *dependencies_last;
+    struct cushion_include_guard_node_t *include_guard_buckets[CUSHION_INCLUDE_GUARD_BUCKETS];
+    struct cushion_include_resolution_node_t *include_resolution_buckets[CUSHION_INCLUDE_RESOLUTION_BUCKETS];
+    struct cushion_file_identity_cache_entry_t *file_identity_cache_buckets[CUSHION_FILE_IDENTITY_CACHE_BUCKETS];
+    struct cushion_directory_index_t *directory_index_buckets[CUSHION_DIRECTORY_INDEX_BUCKETS];
+
+    /// \brief Separate allocator for include resolutions, file identities and directory indices as they outlive jobs
+    ///        and executions.
+    struct cushion_allocator_t file_system_cache_allocator;
+
+    /// \brief Count of relisted indices and changed cache entries, which means that their previous data became garbage.
+    unsigned int file_system_cache_garbage_count;
+
+    /// \brief Working directory for which file system caches were gathered.
+    const char *file_system_cache_working_directory;
+
+    /// \brief Hash of include directories configuration, include resolutions are only reused for the same one.
+    unsigned int includes_hash;
+
+    /// \brief Index of the current job, used to validate file system caches once per job.
+    unsigned int job_index;
+
+    /// \brief Token streams of files for CUSHION_OPTION_CACHE_TOKENS, they outlive jobs and executions.
+    /// \details Entries are allocated on heap as they are freed one by one when their files change.
+    struct cushion_token_cache_entry_t *token_cache_buckets[CUSHION_TOKEN_CACHE_BUCKETS];
+
+    /// \brief Memory used by token cache entries, new files are not recorded once it exceeds the limit.
+    size_t token_cache_size;
+
+    /// \brief Lexed values of configured defines, they outlive jobs and executions.
+    struct cushion_define_cache_entry_t *define_cache_buckets[CUSHION_DEFINE_CACHE_BUCKETS];
+    unsigned int define_cache_entries_count;
 
     struct cushion_allocator_t allocator;
 
     struct cushion_input_node_t *inputs_first;
     struct cushion_input_node_t *inputs_last;
 
-    FILE *output;
-    FILE *cmake_depfile_output;
+    struct cushion_output_writer_t output;
+    struct cushion_output_writer_t cmake_depfile_output;
 
     char *output_path;
     char *cmake_depfile_path;
 
+    struct cushion_job_node_t *jobs_first;
+    struct cushion_job_node_t *jobs_last;
+
     struct cushion_macro_node_t *unresolved_macros_first;
+
+    /// \brief Copies of macros from configuration that were already lexed and are used to initialize every job.
+    struct cushion_macro_node_t *configured_macros_first;
+
+    /// \brief Scan only headers that are lexed once before jobs, see cushion_context_configure_prefix_scan.
+    struct cushion_input_node_t *prefix_scans_first;
+    struct cushion_input_node_t *prefix_scans_last;
+
+    /// \brief Files that were read while preparing configured macros, they are applied to every job.
+    struct cushion_configured_file_t *configured_files_first;
+    struct cushion_configured_file_t *configured_files_last;
+
+    /// \brief Path to macro snapshot file or NULL if snapshot is not used.
+    char *macro_snapshot_path;
+
+    /// \brief If not NULL, error messages are appended to this buffer instead of being printed right away.
+    struct cushion_error_buffer_t *error_buffer;
+
+    /// \brief Hash of configuration that affects output of every job, used for up to date checks and cache keys.
+    struct cushion_hash_t configuration_fingerprint;
+
+    /// \brief Output cache directory or NULL if cache is not used.
+    char *cache_directory;
+
+    /// \brief Maximum size of the cache directory in bytes, zero means unlimited.
+    unsigned long long cache_max_size;
+
+    /// \brief Statistics of the last execution, kept until the next one.
+    struct cushion_cache_statistics_t cache_statistics;
+};
+
+/// \brief Growable buffer for error messages that are printed later.
+/// \details Used by parallel execution to print errors of every job in deterministic order.
+struct cushion_error_buffer_t
+{
+    char *data;
+    size_t size;
+    size_t capacity;
 };
 
 enum cushion_include_type_t
@@ -212,6 +635,21 @@ struct cushion_input_node_t
     char *path;
 };
 
+/// \brief Describes one output that is produced during execution.
+/// \details Jobs share configuration and configured macros, but everything else is reset between them.
+struct cushion_job_node_t
+{
+    struct cushion_job_node_t *next;
+    struct cushion_input_node_t *inputs_first;
+    char *output_path;
+
+    /// \brief Optional, can be NULL.
+    char *cmake_depfile_path;
+
+    /// \brief Watch record of this job, NULL when execution is not a watch.
+    struct cushion_watch_job_t *watch_job;
+};
+
 enum cushion_macro_flags_t
 {
     CUSHION_MACRO_FLAG_NONE = 0u,
@@ -226,19 +664,54 @@ enum cushion_macro_flags_t
     CUSHION_MACRO_FLAG_WRAPPED = 1u << 4u,
     CUSHION_MACRO_FLAG_SNIPPET = 1u << 5u,
 #endif
+
+    /// \brief Replacement list is not lexed yet, macro stores its raw text in lazy replacement instead.
+    /// \details Only used for configured defines and macros from scan only files, which are rarely expanded.
+    ///          Replacement list is lexed on the first expansion, see cushion_instance_macro_search_symbol, and then
+    ///          flag is cleared.
+    CUSHION_MACRO_FLAG_LAZY = 1u << 6u,
+};
+
+enum cushion_macro_lazy_origin_t
+{
+    /// \brief Macro is defined in scan only file.
+    CUSHION_MACRO_LAZY_ORIGIN_SCAN_ONLY = 0u,
+
+    /// \brief Macro is configured through cushion_context_configure_define, therefore its value is checked more
+    ///        strictly and its lexed replacement list is kept in define cache.
+    CUSHION_MACRO_LAZY_ORIGIN_ARGUMENTS,
+};
+
+/// \brief Raw replacement list text of the lazy macro along with its location for error messages.
+struct cushion_macro_lazy_replacement_t
+{
+    enum cushion_macro_lazy_origin_t origin;
+    const char *text;
+    const char *file;
+    unsigned int line;
+    unsigned int column;
 };
 
 struct cushion_macro_parameter_node_t
 {
     struct cushion_macro_parameter_node_t *next;
-    unsigned int name_hash;
+    unsigned int symbol;
     const char *name;
 };
 
+/// \brief Compiled replacement list, defined by lexer.
+struct cushion_macro_program_t;
+
+/// \brief Cached replacement of object-like macro, defined by lexer.
+struct cushion_macro_expansion_t;
+
+struct cushion_token_array_t;
+
 struct cushion_macro_node_t
 {
+    /// \brief Only used for lists of macros outside of symbol table, for example configured macros.
     struct cushion_macro_node_t *next;
-    unsigned int name_hash;
+    unsigned int symbol;
     const char *name;
     enum cushion_macro_flags_t flags;
 
@@ -247,25 +720,153 @@ struct cushion_macro_node_t
         /// \brief String value when we're gathering macro values from configuration.
         const char *value;
 
-        /// \brief Actual replacement list tokens. Produced when execution has started.
-        struct cushion_token_list_item_t *replacement_list_first;
+        /// \brief Actual replacement list tokens, NULL if list is empty. Produced when execution has started.
+        const struct cushion_token_array_t *replacement_list;
+
+        /// \brief Raw replacement list when macro has CUSHION_MACRO_FLAG_LAZY flag.
+        const struct cushion_macro_lazy_replacement_t *lazy_replacement;
     };
 
     struct cushion_macro_parameter_node_t *parameters_first;
+
+    /// \brief Replacement list compiled into instructions for replacement, compiled on the first replacement.
+    const struct cushion_macro_program_t *program;
+
+    /// \brief Cached replacement of object-like macro, valid while it matches macro generation of the symbol.
+    struct cushion_macro_expansion_t *expansion;
 };
 
 struct cushion_pragma_once_file_node_t
 {
     struct cushion_pragma_once_file_node_t *next;
-    unsigned int path_hash;
-    const char *path;
+    struct cushion_file_identity_t file;
 };
 
 struct cushion_depfile_dependency_node_t
 {
     struct cushion_depfile_dependency_node_t *next;
+
+    /// \brief Next dependency in the order of their discovery.
+    struct cushion_depfile_dependency_node_t *next_dependency;
+
+    unsigned int path_hash;
+    const char *path;
+};
+
+/// \brief Records that file content is fully wrapped into classic "#ifndef X #define X ... #endif" include guard.
+/// \details While guard macro is defined, including this file again produces nothing, therefore file is not even
+///          opened. Guards that were found while lexing in scan only mode are only applied to scan only includes,
+///          because regular code outside of the guard is not visible to the lexer in scan only mode.
+struct cushion_include_guard_node_t
+{
+    struct cushion_include_guard_node_t *next;
+    struct cushion_file_identity_t file;
+    const char *macro_name_begin;
+    const char *macro_name_end;
+    unsigned int scan_only;
+};
+
+/// \brief File that was read while preparing configured macros, for example prefix scan header.
+/// \details Such files are reported as dependencies of every job. Their pragma once and include guard are applied to
+///          every job too, so including them again from job inputs does not even open them.
+struct cushion_configured_file_t
+{
+    struct cushion_configured_file_t *next;
+
+    /// \brief Absolute path to the file.
+    const char *path;
+
+    /// \brief Zero if identity cannot be queried, then pragma once and include guard are not applied.
+    unsigned int identity_known;
+    struct cushion_file_identity_t identity;
+
+    unsigned int pragma_once;
+
+    /// \brief Name of the scan only include guard macro or NULL if there is no such guard.
+    const char *guard_macro;
+};
+
+/// \brief Caches where header with given spelling was found when searching from given start.
+/// \details Search start is directory of including file for user includes and NULL for system includes, because
+///          the rest of the search only depends on include directories configuration. Resolutions are kept between
+///          jobs and executions for the same configuration and are validated once per job by repeating the search
+///          with the help of directory indices and file identity cache.
+struct cushion_include_resolution_node_t
+{
+    struct cushion_include_resolution_node_t *next;
+    unsigned int hash;
+    unsigned int includes_hash;
+    const char *search_start;
+    const char *spelling_begin;
+    const char *spelling_end;
+
+    /// \brief Index of the last job that validated this resolution.
+    unsigned int validated_job;
+
+    /// \brief Resolved path or NULL if header was not found.
+    const char *path;
+
+    /// \brief Include directory in which header was found or NULL if it was found through search start or as is.
+    /// \invariant Only valid after validation in current job, as configuration might have been replaced.
+    struct cushion_include_node_t *include_node;
+
+    struct cushion_file_identity_t file;
+};
+
+/// \brief Caches identity of the file at given path between jobs and executions.
+/// \details Entry is validated once per job by comparing file status with the status it had during identity query.
+struct cushion_file_identity_cache_entry_t
+{
+    struct cushion_file_identity_cache_entry_t *next;
+    unsigned int path_hash;
+    const char *path;
+
+    /// \brief Index of the last job that validated this entry.
+    unsigned int validated_job;
+
+    /// \brief Whether file existed during the last validation, identity and status are only valid if it did.
+    unsigned int exists;
+    struct cushion_file_identity_t identity;
+    struct cushion_file_status_t status;
+
+    /// \brief Time in seconds at which identity was queried.
+    /// \details File that was modified during the same second might have been replaced without visible change of its
+    ///          status, therefore such identity is queried again on the next validation.
+    long long queried_time;
+};
+
+struct cushion_directory_index_entry_t
+{
+    struct cushion_directory_index_entry_t *next;
+    unsigned int name_hash;
+    const char *name;
+};
+
+/// \brief Lazily built list of entries of one directory.
+/// \details Indices are kept between jobs and executions of the same instance, so long-lived contexts do not list
+///          the same directories over and over. Index is validated once per job by comparing directory status with
+///          the status it had when it was listed.
+struct cushion_directory_index_t
+{
+    struct cushion_directory_index_t *next;
     unsigned int path_hash;
     const char *path;
+
+    /// \brief Whether directory was successfully listed. Lookups can not rely on index otherwise.
+    unsigned int listed;
+
+    /// \brief Index of the last job that validated this index.
+    unsigned int validated_job;
+
+    /// \brief Directory status at the moment of listing.
+    struct cushion_file_status_t status;
+
+    /// \brief Time in seconds at which listing was started.
+    /// \details Directory that was modified during the same second might have changed after listing without
+    ///          visible change of its modification time, therefore such index is relisted on the next validation.
+    long long listed_time;
+
+    struct cushion_directory_index_entry_t *entry_buckets[CUSHION_DIRECTORY_INDEX_ENTRY_BUCKETS];
 };
 
 #if defined(CUSHION_EXTENSIONS)
@@ -315,12 +916,25 @@ struct cushion_statement_accumulator_t
     struct cushion_deferred_output_node_t *output_node;
 };
 
+/// \brief Code block of statement accumulator push or defer that is output later.
+/// \details Block tokens always come from the file of the push or defer, so file is stored once for the block by its
+///          user and only token lines are stored, as deltas that usually take one byte per token.
+struct cushion_extension_injector_content_t
+{
+    /// \brief Block tokens, NULL if block is empty.
+    const struct cushion_token_array_t *tokens;
+
+    /// \brief For every token, difference from the previous token line or from the block line for the first token
+    ///        with injected macro replacement flag, encoded as variable length integer.
+    const uint8_t *lines;
+};
+
 struct cushion_statement_accumulator_entry_t
 {
     struct cushion_statement_accumulator_entry_t *next;
     const char *source_file;
     unsigned int source_line;
-    struct cushion_token_list_item_t *content_first;
+    struct cushion_extension_injector_content_t content;
 };
 
 struct cushion_statement_accumulator_ref_t
@@ -349,8 +963,17 @@ struct cushion_statement_accumulator_unordered_push_t
 };
 #endif
 
+/// \brief Initializes instance memory and configuration. Used for both contexts and parallel workers.
+void cushion_instance_init (struct cushion_instance_t *instance);
+
+void cushion_instance_shutdown (struct cushion_instance_t *instance);
+
 void cushion_instance_clean_configuration (struct cushion_instance_t *instance);
 
+/// \brief Resets everything that is produced by job execution: macros, symbols, pragma once, include guards, depfile
+///        and output state. Only configured symbols are kept.
+void cushion_instance_clean_job_state (struct cushion_instance_t *instance);
+
 static inline char *cushion_instance_copy_char_sequence_inside (struct cushion_instance_t *instance,
                                                                 const char *begin,
                                                                 const char *end,
@@ -372,10 +995,110 @@ static inline char *cushion_instance_copy_null_terminated_inside (struct cushion
 
 void cushion_instance_includes_add (struct cushion_instance_t *instance, struct cushion_include_node_t *node);
 
+/// \brief Returns id of the symbol for given identifier, creating new symbol if it is not interned yet.
+/// \details New symbols own copy of the name in persistent memory, so it lives until the end of the job.
+unsigned int cushion_instance_symbol_intern (struct cushion_instance_t *instance,
+                                             const char *name_begin,
+                                             const char *name_end);
+
+/// \brief Returns id of the symbol for given identifier or CUSHION_SYMBOL_NONE if it was never interned.
+unsigned int cushion_instance_symbol_search (struct cushion_instance_t *instance,
+                                             const char *name_begin,
+                                             const char *name_end);
+
+static inline const struct cushion_symbol_t *cushion_instance_symbol_get (struct cushion_instance_t *instance,
+                                                                          unsigned int symbol)
+{
+    return &instance->symbol_table.symbols[symbol];
+}
+
+/// \brief Interns configured symbols of the source instance into the clean destination instance in the same order.
+/// \details Used by parallel execution, so configured macros of the source instance can be used as is.
+void cushion_instance_symbol_copy_configured (struct cushion_instance_t *destination,
+                                              struct cushion_instance_t *source);
+
+/// \brief Lexes replacement list of the macro with CUSHION_MACRO_FLAG_LAZY flag and clears that flag.
+/// \details Errors in replacement list are reported using location of the macro definition.
+void cushion_lex_lazy_macro (struct cushion_instance_t *instance, struct cushion_macro_node_t *node);
+
+/// \brief Returns macro for given symbol with lexed replacement list or NULL if macro is not defined.
+static inline struct cushion_macro_node_t *cushion_instance_macro_search_symbol (struct cushion_instance_t *instance,
+                                                                                 unsigned int symbol)
+{
+    struct cushion_macro_node_t *node = instance->symbol_table.symbols[symbol].macro;
+    if (node && (node->flags & CUSHION_MACRO_FLAG_LAZY))
+    {
+        cushion_lex_lazy_macro (instance, node);
+    }
+
+    return node;
+}
+
+/// \brief Checks whether macro is defined without lexing its replacement list if it is lazy.
+static inline unsigned int cushion_instance_macro_is_defined (struct cushion_instance_t *instance, unsigned int symbol)
+{
+    return instance->symbol_table.symbols[symbol].macro ? 1u : 0u;
+}
+
+/// \brief Searches for macro by name. Lazy replacement list is not lexed, therefore it is only suitable for checking
+///        whether macro is defined.
 struct cushion_macro_node_t *cushion_instance_macro_search (struct cushion_instance_t *instance,
                                                             const char *name_begin,
                                                             const char *name_end);
 
+struct cushion_include_resolution_node_t *cushion_instance_include_resolution_search (
+    struct cushion_instance_t *instance,
+    const char *search_start,
+    const char *spelling_begin,
+    const char *spelling_end);
+
+/// \brief Adds unresolved node for given key, resolution result is expected to be filled by the caller.
+struct cushion_include_resolution_node_t *cushion_instance_include_resolution_add (
+    struct cushion_instance_t *instance,
+    const char *search_start,
+    const char *spelling_begin,
+    const char *spelling_end);
+
+/// \brief Saves result of include search into resolution node. Path is NULL if header was not found.
+/// \details Path and identity are only copied if they differ from the ones that were saved before.
+void cushion_instance_include_resolution_save (struct cushion_instance_t *instance,
+                                               struct cushion_include_resolution_node_t *node,
+                                               const char *path,
+                                               struct cushion_include_node_t *include_node,
+                                               const struct cushion_file_identity_t *file);
+
+/// \brief Queries identity of the file at given path through cache that is validated once per job.
+/// \details Identity might point to cache memory, which is kept at least until the next job.
+enum cushion_internal_result_t cushion_instance_file_identity_query (struct cushion_instance_t *instance,
+                                                                     const char *path,
+                                                                     struct cushion_file_identity_t *output);
+
+/// \brief Checks directory indices to find out whether relative path might exist inside given directory.
+/// \details Returns zero only if it is known for sure that there is no such file. Directories along relative path
+///          are listed lazily when they are first needed.
+unsigned int cushion_instance_directory_index_may_contain (struct cushion_instance_t *instance,
+                                                           const char *directory,
+                                                           const char *relative_begin,
+                                                           const char *relative_end);
+
+void cushion_instance_pragma_once_add (struct cushion_instance_t *instance,
+                                       const struct cushion_file_identity_t *file);
+
+unsigned int cushion_instance_pragma_once_contains (struct cushion_instance_t *instance,
+                                                    const struct cushion_file_identity_t *file);
+
+void cushion_instance_include_guard_add (struct cushion_instance_t *instance,
+                                         const struct cushion_file_identity_t *file,
+                                         const char *macro_name_begin,
+                                         const char *macro_name_end,
+                                         unsigned int scan_only);
+
+/// \brief Checks whether file with given identity has include guard that is still active.
+/// \details Only guards that are applicable to include with given scan only status are checked.
+unsigned int cushion_instance_include_guard_is_active (struct cushion_instance_t *instance,
+                                                       const struct cushion_file_identity_t *file,
+                                                       unsigned int scan_only);
+
 struct cushion_error_context_t
 {
     const char *file;
@@ -385,6 +1108,19 @@ struct cushion_error_context_t
     unsigned int column;
 };
 
+void cushion_instance_error_output_internal (struct cushion_instance_t *instance,
+                                             const char *format,
+                                             va_list variadic_arguments);
+
+/// \brief Outputs error message without any context: to error buffer if it is selected, to stderr otherwise.
+static inline void cushion_instance_error_output (struct cushion_instance_t *instance, const char *format, ...)
+{
+    va_list variadic_arguments;
+    va_start (variadic_arguments, format);
+    cushion_instance_error_output_internal (instance, format, variadic_arguments);
+    va_end (variadic_arguments);
+}
+
 void cushion_instance_execution_error_internal (struct cushion_instance_t *instance,
                                                 struct cushion_error_context_t context,
                                                 const char *format,
@@ -427,7 +1163,92 @@ void cushion_instance_macro_add (struct cushion_instance_t *instance,
                                  struct cushion_macro_node_t *node,
                                  struct cushion_error_context_t error_context);
 
-void cushion_instance_macro_remove (struct cushion_instance_t *instance, const char *name_begin, const char *name_end);
+void cushion_instance_macro_remove (struct cushion_instance_t *instance, unsigned int symbol);
+
+/// \brief Saves copies of all currently registered macros as configured macros.
+/// \details Expected to be called after configured defines are registered, so they don't need to be registered for
+///          every job. Symbols that are interned at this point are kept between jobs.
+void cushion_instance_macro_save_configured (struct cushion_instance_t *instance);
+
+/// \brief Registers copies of configured macros, so jobs are free to redefine or undefine them.
+/// \invariant Symbol table must be clean.
+void cushion_instance_macro_restore_configured (struct cushion_instance_t *instance);
+
+/// \brief Copies replacement list of configured define with given value into persistent memory if it was lexed
+///        before with the same features. Returns zero if there is no such entry.
+/// \details Copied identifiers are interned for the current job.
+unsigned int cushion_instance_define_cache_restore (struct cushion_instance_t *instance,
+                                                   const char *value,
+                                                   const struct cushion_token_array_t **replacement_list_output);
+
+/// \brief Saves lexed replacement list of configured define, so it is not lexed again by later jobs and executions.
+/// \details Does nothing if there is no memory for the new entry. Cache is cleared when it grows too big.
+void cushion_instance_define_cache_add (struct cushion_instance_t *instance,
+                                        const char *value,
+                                        const struct cushion_token_array_t *replacement_list);
+
+/// \brief Frees all entries of define cache.
+void cushion_instance_define_cache_clear (struct cushion_instance_t *instance);
+
+/// \brief Appends file to configured files, querying its identity.
+/// \details Path and guard macro are copied into persistent memory.
+void cushion_instance_configured_file_add (struct cushion_instance_t *instance,
+                                           const char *absolute_path,
+                                           unsigned int pragma_once,
+                                           const char *guard_macro);
+
+/// \brief Saves dependencies of the current state as configured files along with their pragma once and guards.
+/// \details Expected to be called after prefix scan headers are lexed.
+void cushion_instance_save_configured_files (struct cushion_instance_t *instance);
+
+/// \brief Reports configured files as dependencies and registers their pragma once and include guards.
+/// \invariant Job state must be clean and depfile, if any, must be already open with target written.
+void cushion_instance_restore_configured_files (struct cushion_instance_t *instance);
+
+/// \brief Allocates writer buffer, writer is closed after initialization.
+void cushion_output_writer_init (struct cushion_output_writer_t *writer);
+
+void cushion_output_writer_shutdown (struct cushion_output_writer_t *writer);
+
+/// \brief Opens file for writing, truncating it if it already exists unless only changed content is written.
+/// \invariant Path must stay alive until writer is closed.
+enum cushion_internal_result_t cushion_output_writer_open (struct cushion_output_writer_t *writer,
+                                                           const char *path,
+                                                           enum cushion_output_writer_flags_t flags);
+
+static inline unsigned int cushion_output_writer_is_open (struct cushion_output_writer_t *writer)
+{
+    return writer->descriptor != -1;
+}
+
+/// \brief Writes everything that was buffered to the file.
+/// \details Failure is only reported once: after it, all the data is silently discarded.
+enum cushion_internal_result_t cushion_output_writer_flush (struct cushion_output_writer_t *writer);
+
+/// \brief Flushes buffered data and closes the file.
+/// \details When only changed content is written, target is replaced here if needed. If writing has failed,
+///          target is left untouched in that mode.
+enum cushion_internal_result_t cushion_output_writer_close (struct cushion_output_writer_t *writer);
+
+/// \brief Slow path of append for data that does not fit into buffer.
+/// \details Flushes the buffer, then writes big chunks directly and copies small ones into the buffer.
+enum cushion_internal_result_t cushion_output_writer_append_overflow (struct cushion_output_writer_t *writer,
+                                                                      const char *begin,
+                                                                      size_t length);
+
+static inline enum cushion_internal_result_t cushion_output_writer_append (struct cushion_output_writer_t *writer,
+                                                                           const char *begin,
+                                                                           size_t length)
+{
+    if (length <= CUSHION_OUTPUT_WRITER_BUFFER_SIZE - writer->used)
+    {
+        memcpy (writer->buffer + writer->used, begin, length);
+        writer->used += length;
+        return CUSHION_INTERNAL_RESULT_OK;
+    }
+
+    return cushion_output_writer_append_overflow (writer, begin, length);
+}
 
 void cushion_instance_output_sequence (struct cushion_instance_t *instance, const char *begin, const char *end);
 
@@ -448,11 +1269,28 @@ static inline void cushion_instance_output_formatted (struct cushion_instance_t
     cushion_instance_output_sequence (instance, buffer, buffer + printed);
 }
 
+static inline void cushion_instance_output_unsigned (struct cushion_instance_t *instance, unsigned int value)
+{
+    char buffer[CUSHION_UNSIGNED_DECIMAL_MAX];
+    cushion_instance_output_sequence (instance, buffer, cushion_format_unsigned (buffer, value));
+}
+
 static inline void cushion_instance_output_line_marker (struct cushion_instance_t *instance,
                                                         const char *file,
                                                         unsigned int line)
 {
-    cushion_instance_output_formatted (instance, "#line %u \"%s\"\n", line, file);
+    // Line markers are written very often, so we format them by hand instead of going through vsnprintf.
+    static const char prefix[] = "#line ";
+    char buffer[sizeof (prefix) - 1u + CUSHION_UNSIGNED_DECIMAL_MAX + 2u];
+
+    memcpy (buffer, prefix, sizeof (prefix) - 1u);
+    char *end = cushion_format_unsigned (buffer + sizeof (prefix) - 1u, line);
+    end[0u] = ' ';
+    end[1u] = '"';
+
+    cushion_instance_output_sequence (instance, buffer, end + 2u);
+    cushion_instance_output_null_terminated (instance, file);
+    cushion_instance_output_sequence (instance, "\"\n", "\"\n" + 2u);
 }
 
 #if defined(CUSHION_EXTENSIONS)
@@ -484,6 +1322,136 @@ void cushion_instance_output_depfile_target (struct cushion_instance_t *instance
 
 void cushion_instance_output_depfile_entry (struct cushion_instance_t *instance, const char *absolute_path);
 
+// Snapshot section: saving and loading configured macros to skip lexing of defines and prefix scan headers.
+
+/// \brief Loads configured macros and files from macro snapshot if it matches configuration and file contents.
+/// \details Macros are registered in symbol table right away, defines are not expected to be lexed after that.
+/// \return Whether snapshot was loaded. Errors that make snapshot unusable are reported, but are not fatal.
+unsigned int cushion_snapshot_load (struct cushion_instance_t *instance);
+
+/// \brief Saves currently registered macros and configured files to macro snapshot.
+/// \details Failure to save is reported, but is not an error, as snapshot is just going to be rebuilt next time.
+///          Lazy macros are lexed before saving, therefore errors in their replacement lists are signaled.
+void cushion_snapshot_save (struct cushion_instance_t *instance);
+
+// Cache section: local content-addressed cache of job results.
+
+/// \brief Cache state of one job between lookup and store.
+struct cushion_cache_job_t
+{
+    /// \brief Hash of configuration, absolute paths and contents of inputs that names manifest file.
+    struct cushion_hash_t manifest_key;
+
+    /// \brief Zero when manifest key could not be calculated, for example when input is not readable.
+    unsigned int valid;
+
+    /// \brief Time when job was started, results that depend on files modified after that are not cached.
+    long long start_time;
+};
+
+/// \brief Calculates cache key for the job and tries to restore its output and depfile from cache.
+/// \invariant Output must be open. Depfile, if any, must be open and its target must be already written.
+/// \return Whether output and depfile were restored.
+unsigned int cushion_cache_restore (struct cushion_instance_t *instance,
+                                    struct cushion_job_node_t *job,
+                                    struct cushion_cache_job_t *cache_job);
+
+/// \brief Saves result of successfully executed job to cache.
+/// \invariant Dependencies must be recorded during execution and output must be already closed.
+void cushion_cache_store (struct cushion_instance_t *instance,
+                          struct cushion_job_node_t *job,
+                          struct cushion_cache_job_t *cache_job);
+
+/// \brief Removes least recently used cache files until cache size fits into configured maximum size.
+void cushion_cache_evict (struct cushion_instance_t *instance);
+
+// Watch section: tracking dependencies of jobs and waiting for their changes.
+
+/// \brief Watch record of one job.
+/// \details Dependencies are allocated on heap as they must outlive the job memory which is reset after the job.
+///          Record is only modified by the worker that executes the job, therefore it needs no synchronization.
+struct cushion_watch_job_t
+{
+    struct cushion_job_node_t *job;
+    unsigned int dirty;
+    unsigned int dependencies_count;
+
+    /// \brief Absolute paths of job inputs and of all files that were read by the job.
+    char **dependencies;
+};
+
+/// \brief Watched file with indices of the jobs that depend on it.
+struct cushion_watch_path_t
+{
+    struct cushion_watch_path_t *next;
+    unsigned int path_hash;
+    char *path;
+
+    /// \brief Whether path has not been watched during the last round.
+    unsigned int fresh;
+
+    unsigned int jobs_count;
+    unsigned int jobs_capacity;
+    unsigned int *jobs;
+
+#if defined(CUSHION_WATCH_INOTIFY)
+    struct cushion_watch_directory_t *directory;
+#elif defined(CUSHION_WATCH_POLL)
+    unsigned int status_known;
+    struct cushion_file_status_t status;
+#endif
+};
+
+#if defined(CUSHION_WATCH_INOTIFY)
+/// \brief Directories are watched instead of files, because editors often save files by replacing them, which
+///        silently removes watches from replaced files.
+struct cushion_watch_directory_t
+{
+    struct cushion_watch_directory_t *next;
+    int descriptor;
+    unsigned int used;
+
+    /// \brief Whether directory was added by the last subscription.
+    unsigned int fresh;
+
+    /// \brief Directory path with trailing separator, so path of entry is a simple concatenation.
+    char *path;
+};
+#endif
+
+struct cushion_watch_t
+{
+    unsigned int jobs_count;
+    struct cushion_watch_job_t *jobs;
+    unsigned int dirty_jobs_count;
+
+    /// \brief Time in seconds at which the last round of jobs was started.
+    long long round_start_time;
+
+    struct cushion_watch_path_t *path_buckets[CUSHION_DEPFILE_BUCKETS];
+
+#if defined(CUSHION_WATCH_INOTIFY)
+    int inotify_descriptor;
+    struct cushion_watch_directory_t *directories_first;
+#endif
+};
+
+/// \brief Creates watch records for all the jobs and marks them dirty, so they are executed in the first round.
+enum cushion_internal_result_t cushion_watch_init (struct cushion_instance_t *instance, struct cushion_watch_t *watch);
+
+/// \brief Replaces dependencies of the job with dependencies recorded by the instance during job execution.
+void cushion_watch_record_job (struct cushion_instance_t *instance, struct cushion_watch_job_t *watch_job);
+
+/// \brief Clears dirty flags after round and subscribes to changes of dependencies of all jobs.
+/// \details Jobs which dependencies were modified during the round are marked dirty right away.
+void cushion_watch_subscribe (struct cushion_instance_t *instance, struct cushion_watch_t *watch);
+
+/// \brief Waits until some jobs become dirty.
+/// \return Zero if callback requested to stop watching.
+unsigned int cushion_watch_wait (struct cushion_watch_t *watch, cushion_watch_callback_t callback, void *user_data);
+
+void cushion_watch_shutdown (struct cushion_watch_t *watch);
+
 // Tokenization section: structs and functions to properly setup for tokenization.
 
 enum cushion_tokenization_mode_t
@@ -508,8 +1476,17 @@ enum cushion_tokenization_flags_t
     /// \details Useful for blazing through scan only headers and conditionally excluded source parts.
     ///          Should be disabled when tokenizing conditional expressions as their expressions are regular tokens.
     CUSHION_TOKENIZATION_FLAGS_SKIP_REGULAR = 1u << 0u,
+
+    /// \brief Tokenization errors are not reported, CUSHION_TOKENIZATION_FLAGS_RECORDING_FAILED is set instead.
+    /// \details Used to record whole token stream for token cache: errors in the code that would be skipped by
+    ///          lexer must not be reported, therefore file that fails to be recorded is tokenized as usual.
+    CUSHION_TOKENIZATION_FLAGS_RECORDING = 1u << 1u,
+
+    CUSHION_TOKENIZATION_FLAGS_RECORDING_FAILED = 1u << 2u,
 };
 
+struct cushion_token_cache_entry_t;
+
 struct cushion_tokenization_state_t
 {
     /// \brief Tokenization file name that can be changed by line directives.
@@ -534,19 +1511,42 @@ struct cushion_tokenization_state_t
 #endif
 
     unsigned int cursor_line;
-    unsigned int cursor_column;
     unsigned int marker_line;
-    unsigned int marker_column;
 
     const char *saved;
     unsigned int saved_line;
-    unsigned int saved_column;
+
+    /// \brief Beginning of the data that is still available in memory.
+    /// \details Columns are not tracked during tokenization as they are only needed for error messages. Instead, they
+    ///          are calculated on demand by searching for line start backwards from the cursor, which stops at origin.
+    const char *origin;
+
+    /// \brief Column of the origin character, is not 1 when refill has discarded the beginning of current line.
+    unsigned int origin_column;
 
     /// \details Separate allocation is needed, unfortunately,
     ///          because size of re2c tags would only be known after re2c generator pass.
     struct re2c_tags_t *tags;
 
+    /// \brief File for streaming tokenization through input buffer refills.
+    /// \details NULL when tokenizing argument string or when file content is read as a whole.
     FILE *input_file_optional;
+
+    /// \brief Whole file content, if it was possible to read it at once. Owned by tokenization state.
+    /// \details Tokenization from whole content never refills, therefore there is no limit on lexeme size.
+    char *input_file_content;
+
+    /// \brief Token cache entry which token stream is replayed instead of tokenizing, NULL for usual tokenization.
+    /// \details Replayed tokens point to entry content, so cursor and origin point to it too.
+    struct cushion_token_cache_entry_t *replay_entry;
+
+    /// \brief Index of the next token to replay.
+    unsigned int replay_index;
+
+    /// \brief Line in file at which last replayed token has ended.
+    /// \details Cursor line is advanced by the difference between recorded lines, so line directives are respected.
+    unsigned int replay_line;
+
     char input_buffer[CUSHION_INPUT_BUFFER_SIZE];
 };
 
@@ -555,12 +1555,25 @@ void cushion_tokenization_state_init_for_argument_string (struct cushion_tokeniz
                                                           struct cushion_allocator_t *allocator,
                                                           enum cushion_allocation_class_t allocation_class);
 
+/// \brief Initializes tokenization for given file.
+/// \details Regular files are read as a whole and tokenized in place, other files like pipes are streamed through
+///          input buffer. Tokenization state must be shut down after usage to release file content.
 void cushion_tokenization_state_init_for_file (struct cushion_tokenization_state_t *state,
                                                const char *path,
                                                FILE *file,
                                                struct cushion_allocator_t *allocator,
                                                enum cushion_allocation_class_t allocation_class);
 
+void cushion_tokenization_state_shutdown (struct cushion_tokenization_state_t *state);
+
+/// \brief Calculates column of the tokenization cursor. Intended to be only used for error messages.
+unsigned int cushion_tokenization_state_get_cursor_column (const struct cushion_tokenization_state_t *state);
+
+/// \brief Skips the rest of the current line, including line continuations and multiline comments.
+/// \details Only supported for in-memory input. Returns end of the skipped line without new line characters,
+///          tokenization continues from the next line.
+const char *cushion_tokenization_skip_line (struct cushion_tokenization_state_t *state);
+
 enum cushion_token_type_t
 {
     CUSHION_TOKEN_TYPE_PREPROCESSOR_IF = 0u,
@@ -752,7 +1765,14 @@ struct cushion_token_t
     union
     {
         struct cushion_token_subsequence_t header_path;
-        enum cushion_identifier_kind_t identifier_kind;
+        struct
+        {
+            enum cushion_identifier_kind_t identifier_kind;
+
+            /// \brief Interned identifier id, identifiers are equal only if their symbols are equal.
+            unsigned int symbol;
+        };
+
         enum cushion_punctuator_kind_t punctuator_kind;
         unsigned long long unsigned_number_value;
         struct cushion_encoded_token_subsequence_t symbolic_literal;
@@ -785,10 +1805,248 @@ struct cushion_token_list_item_t *cushion_save_token_to_memory (struct cushion_i
                                                                 const struct cushion_token_t *token,
                                                                 enum cushion_allocation_class_t allocation_class);
 
+/// \brief Compact token record inside token array that stores offsets inside array text instead of pointers.
+struct cushion_token_array_token_t
+{
+    /// \brief Offsets of token text inside array text. Not used for identifiers as their text is symbol name.
+    uint32_t begin;
+    uint32_t end;
+
+    uint8_t type;
+
+    /// \brief Identifier kind, punctuator kind or literal encoding depending on type.
+    uint8_t kind;
+
+    /// \brief Distances from token begin to header path or literal content begin and from their end to token end.
+    uint8_t subsequence_head;
+    uint8_t subsequence_tail;
+
+    /// \brief Symbol for identifiers or index in number values array for integer numbers.
+    uint32_t value;
+};
+
+/// \brief Saved token sequence that is stored as one block instead of token list, used for replacement lists.
+/// \details Number values, records and text are allocated right after the header. Token array does not store file,
+///          line and flags of tokens, as replacement lists never use them. Identifier symbols are stored directly,
+///          therefore token array can only be used by the job that has created it.
+struct cushion_token_array_t
+{
+    unsigned int count;
+    unsigned int number_values_count;
+    unsigned int text_size;
+
+    unsigned long long *number_values;
+    struct cushion_token_array_token_t *tokens;
+    char *text;
+};
+
+/// \brief Returns size of token array block with given content sizes.
+static inline size_t cushion_token_array_size (unsigned int count,
+                                               unsigned int number_values_count,
+                                               unsigned int text_size)
+{
+    return sizeof (struct cushion_token_array_t) + sizeof (unsigned long long) * number_values_count +
+           sizeof (struct cushion_token_array_token_t) * count + text_size;
+}
+
+/// \brief Returns alignment of token array block, as number values right after the header might need stricter one.
+static inline size_t cushion_token_array_alignment (void)
+{
+    return _Alignof (unsigned long long) > _Alignof (struct cushion_token_array_t) ?
+               _Alignof (unsigned long long) :
+               _Alignof (struct cushion_token_array_t);
+}
+
+/// \brief Points array content pointers to the given content memory, sizes must be already set.
+/// \details Content must be aligned like number values: number values, records and text go one after another.
+static inline void cushion_token_array_bind_content (struct cushion_token_array_t *array, void *content)
+{
+    _Static_assert (sizeof (unsigned long long) % _Alignof (struct cushion_token_array_token_t) == 0u,
+                    "Token records must be properly aligned after number values.");
+
+    array->number_values = (unsigned long long *) content;
+    array->tokens = (struct cushion_token_array_token_t *) (array->number_values + array->number_values_count);
+    array->text = (char *) (array->tokens + array->count);
+}
+
+/// \brief Points array content pointers to the memory right after the header, sizes must be already set.
+static inline void cushion_token_array_bind (struct cushion_token_array_t *array)
+{
+    _Static_assert (sizeof (struct cushion_token_array_t) % _Alignof (unsigned long long) == 0u,
+                    "Number values must be properly aligned after token array header.");
+    cushion_token_array_bind_content (array, array + 1u);
+}
+
+/// \brief Packs token list into token array, returns NULL for empty list.
+struct cushion_token_array_t *cushion_save_token_list_to_array (struct cushion_instance_t *instance,
+                                                                const struct cushion_token_list_item_t *first,
+                                                                enum cushion_allocation_class_t allocation_class);
+
+/// \brief Returns total length of identifier names in token array, detached copy stores them after the text.
+size_t cushion_token_array_get_names_size (struct cushion_instance_t *instance,
+                                           const struct cushion_token_array_t *array);
+
+/// \brief Copies token array into detached form that does not depend on symbols of the current job.
+/// \details Output must have memory for cushion_token_array_size and names size after the header. Identifier names
+///          are stored after array text and identifier records point to them instead of symbols. Detached arrays are
+///          kept by define cache and macro snapshot and are attached again by every job that uses them.
+void cushion_token_array_detach (struct cushion_instance_t *instance,
+                                 const struct cushion_token_array_t *array,
+                                 struct cushion_token_array_t *output);
+
+/// \brief Copies detached token array into the regular one, interning identifier names for the current job.
+struct cushion_token_array_t *cushion_token_array_attach (struct cushion_instance_t *instance,
+                                                          const struct cushion_token_array_t *detached,
+                                                          enum cushion_allocation_class_t allocation_class);
+
+/// \brief Unpacks token with given index from token array, token text points into array or symbol name.
+static inline void cushion_token_array_get (struct cushion_instance_t *instance,
+                                            const struct cushion_token_array_t *array,
+                                            unsigned int index,
+                                            struct cushion_token_t *output)
+{
+    const struct cushion_token_array_token_t *record = &array->tokens[index];
+    output->type = (enum cushion_token_type_t) record->type;
+
+    switch (output->type)
+    {
+    case CUSHION_TOKEN_TYPE_IDENTIFIER:
+    {
+        const struct cushion_symbol_t *symbol = cushion_instance_symbol_get (instance, record->value);
+        output->begin = symbol->name;
+        output->end = symbol->name + symbol->name_length;
+        output->identifier_kind = (enum cushion_identifier_kind_t) record->kind;
+        output->symbol = record->value;
+        return;
+    }
+
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_SYSTEM:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER:
+        output->begin = array->text + record->begin;
+        output->end = array->text + record->end;
+        output->header_path.begin = output->begin + record->subsequence_head;
+        output->header_path.end = output->end - record->subsequence_tail;
+        return;
+
+    case CUSHION_TOKEN_TYPE_PUNCTUATOR:
+        output->punctuator_kind = (enum cushion_punctuator_kind_t) record->kind;
+        break;
+
+    case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
+        output->unsigned_number_value = array->number_values[record->value];
+        break;
+
+    case CUSHION_TOKEN_TYPE_CHARACTER_LITERAL:
+    case CUSHION_TOKEN_TYPE_STRING_LITERAL:
+        output->begin = array->text + record->begin;
+        output->end = array->text + record->end;
+        output->symbolic_literal.encoding = (enum cushion_token_subsequence_encoding_t) record->kind;
+        output->symbolic_literal.begin = output->begin + record->subsequence_head;
+        output->symbolic_literal.end = output->end - record->subsequence_tail;
+        return;
+
+    default:
+        break;
+    }
+
+    output->begin = array->text + record->begin;
+    output->end = array->text + record->end;
+}
+
 void cushion_tokenization_next_token (struct cushion_instance_t *instance,
                                       struct cushion_tokenization_state_t *state,
                                       struct cushion_token_t *output);
 
+// Token cache section: token streams of files that are replayed instead of tokenizing them again.
+
+/// \brief Compact token record that stores offsets inside entry content instead of pointers.
+struct cushion_token_cache_token_t
+{
+    uint32_t begin;
+    uint32_t end;
+
+    /// \brief Line in file at which tokenizer has stopped after this token.
+    uint32_t line;
+
+    uint8_t type;
+
+    /// \brief Identifier kind, punctuator kind or literal encoding depending on type.
+    uint8_t kind;
+
+    /// \brief Distances from token begin to header path or literal content begin and from their end to token end.
+    uint8_t subsequence_head;
+    uint8_t subsequence_tail;
+
+    /// \brief Symbol for identifiers or index in number values array for integer numbers.
+    /// \details Symbols are only valid for the job that has interned them, see symbols_job.
+    uint32_t value;
+};
+
+struct cushion_token_cache_entry_t
+{
+    struct cushion_token_cache_entry_t *next;
+    unsigned int path_hash;
+
+    /// \brief Absolute path, allocated together with entry.
+    const char *path;
+
+    struct cushion_file_identity_t identity;
+    struct cushion_file_status_t status;
+
+    /// \brief Time in seconds at which file was read, status is only trusted if file is older than that.
+    long long recorded_time;
+    unsigned int validated_job;
+
+    /// \brief Index of the job which symbols are stored in identifier tokens.
+    /// \details For other jobs, identifier symbols are reset and then interned again when tokens are replayed.
+    unsigned int symbols_job;
+
+    /// \brief Count of tokenization states that are replaying this entry right now.
+    unsigned int users;
+
+    /// \brief Entry was removed from cache while being replayed and must be freed after the last user.
+    unsigned int detached;
+
+    /// \brief Whole file content, NULL when file could not be recorded and must be tokenized as usual.
+    char *content;
+    size_t content_size;
+
+    struct cushion_token_cache_token_t *tokens;
+    unsigned int tokens_count;
+
+    unsigned long long *number_values;
+    unsigned int number_values_count;
+
+    /// \brief Memory used by this entry, counted towards CUSHION_TOKEN_CACHE_MAX_SIZE.
+    size_t memory_size;
+};
+
+/// \brief Initializes tokenization of given file through token cache.
+/// \details Valid cached token stream is replayed without reading the file. Otherwise, file is tokenized as usual
+///          and regular files that are read as a whole are recorded to cache first, unless cache is full.
+///          Entries are validated once per job by file identity, modification time and size.
+void cushion_token_cache_init_tokenization (struct cushion_instance_t *instance,
+                                            struct cushion_tokenization_state_t *state,
+                                            const char *path,
+                                            FILE *file,
+                                            char *path_buffer,
+                                            struct cushion_allocator_t *allocator,
+                                            enum cushion_allocation_class_t allocation_class);
+
+/// \brief Replays next token from tokenization state replay entry, respecting tokenization flags.
+void cushion_token_cache_next_token (struct cushion_instance_t *instance,
+                                     struct cushion_tokenization_state_t *state,
+                                     struct cushion_token_t *output);
+
+/// \brief Replay alternative for cushion_tokenization_skip_line: skips replayed tokens till the end of the line.
+const char *cushion_token_cache_skip_line (struct cushion_tokenization_state_t *state);
+
+/// \brief Releases token cache entry after replay, called from tokenization state shutdown.
+void cushion_token_cache_entry_release (struct cushion_token_cache_entry_t *entry);
+
+/// \brief Frees all token cache entries, entries that are being replayed are freed after replay.
+void cushion_token_cache_clear (struct cushion_instance_t *instance);
+
 // Lexing section: structs and functions to properly setup for lexing.
 
 enum cushion_lex_replacement_list_result_t
@@ -800,7 +2058,7 @@ enum cushion_lex_replacement_list_result_t
 enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_tokenization (
     struct cushion_instance_t *instance,
     struct cushion_tokenization_state_t *tokenization_state,
-    struct cushion_token_list_item_t **token_list_output,
+    const struct cushion_token_array_t **replacement_list_output,
     enum cushion_macro_flags_t *flags_output);
 
 enum cushion_lex_file_flags_t
@@ -810,6 +2068,21 @@ enum cushion_lex_file_flags_t
     CUSHION_LEX_FILE_FLAG_PROCESSED_PRAGMA_ONCE = 1u << 1u,
 };
 
+enum cushion_lexer_include_guard_state_t
+{
+    /// \brief Nothing significant was found yet, waiting for #ifndef.
+    CUSHION_LEXER_INCLUDE_GUARD_STATE_START = 0u,
+
+    /// \brief Inside include guard #ifndef.
+    CUSHION_LEXER_INCLUDE_GUARD_STATE_INSIDE,
+
+    /// \brief Include guard #endif was found, only insignificant tokens are allowed until the end of file.
+    CUSHION_LEXER_INCLUDE_GUARD_STATE_CLOSED,
+
+    /// \brief File content does not match include guard pattern.
+    CUSHION_LEXER_INCLUDE_GUARD_STATE_INVALID,
+};
+
 struct cushion_lexer_path_buffer_t
 {
     size_t size;
@@ -824,6 +2097,9 @@ struct cushion_lexer_file_state_t
     struct cushion_instance_t *instance;
     struct lexer_token_stack_item_t *token_stack_top;
 
+    /// \brief Token stack items that were already exhausted and can be reused for the next pushes.
+    struct lexer_token_stack_item_t *token_stack_free;
+
     const char *stack_exit_file;
 
     /// \details stack_exit_line along with stack_exit_file makes it easy to properly restore line numbers after
@@ -838,10 +2114,28 @@ struct cushion_lexer_file_state_t
 
     struct lexer_conditional_inclusion_node_t *conditional_inclusion_node;
 
+    /// \brief Tracks whether the whole file is wrapped into include guard, see cushion_include_guard_node_t.
+    enum cushion_lexer_include_guard_state_t include_guard_state;
+
+    /// \brief Conditional inclusion node that was opened by include guard #ifndef.
+    struct lexer_conditional_inclusion_node_t *include_guard_node;
+
+    const char *include_guard_name_begin;
+    const char *include_guard_name_end;
+
 #if defined(CUSHION_EXTENSIONS)
+    /// \brief Count of argument evaluations that are currently in progress, they are nested through C recursion.
+    unsigned int evaluation_nesting;
+
     struct lex_defer_feature_state_t *defer_feature;
 #endif
 
+    /// \brief Tokenization file name for which lazy file name copy was made, see CUSHION_MACRO_FLAG_LAZY.
+    const char *lazy_file_name_source;
+
+    /// \brief Persistent copy of tokenization file name that is shared by lazy macros from this file.
+    const char *lazy_file_name;
+
     /// \brief File name in lexer always points to the actual file using absolute path.
     char file_name[CUSHION_PATH_MAX];
 
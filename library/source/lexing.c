@@ -10,12 +10,24 @@ enum lexer_token_stack_item_flags_t
     LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT = 1u << 0u,
 };
 
+/// \details Item either walks token list or token array. Token arrays are shared between replacements and have no
+///          file and line info, therefore file and line of their tokens are taken from item instead.
 struct lexer_token_stack_item_t
 {
     struct lexer_token_stack_item_t *previous;
     struct cushion_token_list_item_t *tokens_current;
     enum lexer_token_stack_item_flags_t flags;
 
+    const struct cushion_token_array_t *array;
+    unsigned int array_index;
+
+    /// \brief File and line for tokens from token array.
+    const char *file;
+    unsigned int line;
+
+    /// \brief Count of nested macro rescans that produced these tokens, zero for tokens from file.
+    unsigned int depth;
+
 #if defined(CUSHION_EXTENSIONS)
     enum cushion_token_list_item_flags_t last_popped_flags;
 #endif
@@ -48,14 +60,30 @@ static inline unsigned int lexer_file_state_should_continue (struct cushion_lexe
     return state->lexing && !cushion_instance_is_error_signaled (state->instance);
 }
 
-static inline void lexer_file_state_push_tokens (struct cushion_lexer_file_state_t *state,
-                                                 struct cushion_token_list_item_t *tokens,
-                                                 enum lexer_token_stack_item_flags_t flags)
+/// \brief Moves top token stack item into free list, so it can be reused by the next push.
+static inline void lexer_file_state_discard_top (struct cushion_lexer_file_state_t *state)
 {
-    if (!tokens)
+    struct lexer_token_stack_item_t *item = state->token_stack_top;
+    state->token_stack_top = item->previous;
+    item->previous = state->token_stack_free;
+    state->token_stack_free = item;
+}
+
+static inline unsigned int lexer_token_stack_item_is_exhausted (const struct lexer_token_stack_item_t *item)
+{
+    return !item->tokens_current && (!item->array || item->array_index >= item->array->count);
+}
+
+/// \brief Pushes new item without tokens on top of token stack.
+static inline struct lexer_token_stack_item_t *lexer_file_state_push_item (struct cushion_lexer_file_state_t *state,
+                                                                         enum lexer_token_stack_item_flags_t flags,
+                                                                         unsigned int depth)
+{
+    // Pop would skip exhausted items anyway, but dropping them here keeps stack size bounded when every replacement
+    // ends with the next macro call, which is how recursive metaprogramming macros usually look.
+    while (state->token_stack_top && lexer_token_stack_item_is_exhausted (state->token_stack_top))
     {
-        // Can be a macro with empty replacement list, just skip it.
-        return;
+        lexer_file_state_discard_top (state);
     }
 
     // Add stack exit file name and line.
@@ -65,17 +93,62 @@ static inline void lexer_file_state_push_tokens (struct cushion_lexer_file_state
         state->stack_exit_line = state->tokenization.cursor_line;
     }
 
-    struct lexer_token_stack_item_t *item =
-        cushion_allocator_allocate (&state->instance->allocator, sizeof (struct lexer_token_stack_item_t),
-                                    _Alignof (struct lexer_token_stack_item_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    struct lexer_token_stack_item_t *item = state->token_stack_free;
+    if (item)
+    {
+        state->token_stack_free = item->previous;
+    }
+    else
+    {
+        item = cushion_allocator_allocate (&state->instance->allocator, sizeof (struct lexer_token_stack_item_t),
+                                           _Alignof (struct lexer_token_stack_item_t),
+                                           CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    }
 
     item->previous = state->token_stack_top;
-    item->tokens_current = tokens;
+    item->tokens_current = NULL;
     item->flags = flags;
+    item->array = NULL;
+    item->array_index = 0u;
+    item->file = state->tokenization.file_name;
+    item->line = state->tokenization.cursor_line;
+    item->depth = depth;
 #if defined(CUSHION_EXTENSIONS)
     item->last_popped_flags = CUSHION_TOKEN_LIST_ITEM_FLAG_NONE;
 #endif
     state->token_stack_top = item;
+    return item;
+}
+
+static inline void lexer_file_state_push_tokens (struct cushion_lexer_file_state_t *state,
+                                                 struct cushion_token_list_item_t *tokens,
+                                                 enum lexer_token_stack_item_flags_t flags,
+                                                 unsigned int depth)
+{
+    if (!tokens)
+    {
+        // Can be a macro with empty replacement list, just skip it.
+        return;
+    }
+
+    lexer_file_state_push_item (state, flags, depth)->tokens_current = tokens;
+}
+
+/// \brief Pushes all tokens from token array, which tokens are reported to be at given line of current file.
+static inline void lexer_file_state_push_array (struct cushion_lexer_file_state_t *state,
+                                                const struct cushion_token_array_t *array,
+                                                enum lexer_token_stack_item_flags_t flags,
+                                                unsigned int line,
+                                                unsigned int depth)
+{
+    if (!array)
+    {
+        return;
+    }
+
+    struct lexer_token_stack_item_t *item = lexer_file_state_push_item (state, flags, depth);
+    item->array = array;
+    item->line = line;
 }
 
 static inline void lexer_file_state_reinsert_token (struct cushion_lexer_file_state_t *state,
@@ -97,7 +170,8 @@ static inline void lexer_file_state_reinsert_token (struct cushion_lexer_file_st
 #endif
 
     lexer_file_state_push_tokens (
-        state, new_token, state->token_stack_top ? state->token_stack_top->flags : LEXER_TOKEN_STACK_ITEM_FLAG_NONE);
+        state, new_token, state->token_stack_top ? state->token_stack_top->flags : LEXER_TOKEN_STACK_ITEM_FLAG_NONE,
+        state->token_stack_top ? state->token_stack_top->depth : 0u);
 }
 
 struct lexer_pop_token_meta_t
@@ -105,6 +179,7 @@ struct lexer_pop_token_meta_t
     enum lexer_token_stack_item_flags_t flags;
     const char *file;
     unsigned int line;
+    unsigned int depth;
 };
 
 static inline struct cushion_error_context_t lex_error_context (struct cushion_lexer_file_state_t *state,
@@ -119,7 +194,7 @@ static inline struct cushion_error_context_t lex_error_context (struct cushion_l
     if (state->last_token_line == meta->line &&
         (state->last_marked_file == meta->file || strcmp (state->file_name, meta->file) == 0))
     {
-        context.column = state->tokenization.cursor_column;
+        context.column = cushion_tokenization_state_get_cursor_column (&state->tokenization);
     }
 
     return context;
@@ -131,7 +206,7 @@ static inline struct cushion_error_context_t tokenization_error_context (
     return (struct cushion_error_context_t) {
         .file = tokenization_state->file_name,
         .line = tokenization_state->cursor_line,
-        .column = tokenization_state->cursor_column,
+        .column = cushion_tokenization_state_get_cursor_column (tokenization_state),
     };
 }
 
@@ -150,11 +225,11 @@ static inline void cushion_instance_lexer_error (struct cushion_lexer_file_state
 /// \brief Needed to properly simulate flags like CUSHION_TOKENIZATION_FLAGS_SKIP_REGULAR while popping preserved
 ///        tokens out of tokens stack from lexer state.
 static inline unsigned int lexer_should_skip_preserved_token (struct cushion_lexer_file_state_t *state,
-                                                              struct cushion_token_list_item_t *item)
+                                                              enum cushion_token_type_t type)
 {
     if (state->tokenization.flags & CUSHION_TOKENIZATION_FLAGS_SKIP_REGULAR)
     {
-        switch (item->token.type)
+        switch (type)
         {
         case CUSHION_TOKEN_TYPE_PREPROCESSOR_IF:
         case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFDEF:
@@ -188,24 +263,47 @@ static struct lexer_pop_token_meta_t lexer_file_state_pop_token (struct cushion_
         .flags = LEXER_TOKEN_STACK_ITEM_FLAG_NONE,
         .file = state->tokenization.file_name,
         .line = state->tokenization.cursor_line,
+        .depth = 0u,
     };
 
     while (state->token_stack_top)
     {
-        if (state->token_stack_top->tokens_current)
+        struct lexer_token_stack_item_t *top = state->token_stack_top;
+        if (top->array && top->array_index < top->array->count)
+        {
+            if (lexer_should_skip_preserved_token (
+                    state, (enum cushion_token_type_t) top->array->tokens[top->array_index].type))
+            {
+                ++top->array_index;
+                continue;
+            }
+
+            cushion_token_array_get (state->instance, top->array, top->array_index++, output);
+            meta.flags = top->flags;
+            meta.file = top->file;
+            meta.line = top->line;
+            meta.depth = top->depth;
+
+#if defined(CUSHION_EXTENSIONS)
+            top->last_popped_flags = CUSHION_TOKEN_LIST_ITEM_FLAG_NONE;
+#endif
+            goto read_token;
+        }
+        else if (top->tokens_current)
         {
-            struct cushion_token_list_item_t *item = state->token_stack_top->tokens_current;
-            state->token_stack_top->tokens_current = state->token_stack_top->tokens_current->next;
+            struct cushion_token_list_item_t *item = top->tokens_current;
+            top->tokens_current = top->tokens_current->next;
 
-            if (lexer_should_skip_preserved_token (state, item))
+            if (lexer_should_skip_preserved_token (state, item->token.type))
             {
                 continue;
             }
 
             *output = item->token;
-            meta.flags = state->token_stack_top->flags;
+            meta.flags = top->flags;
             meta.file = item->file;
             meta.line = item->line;
+            meta.depth = top->depth;
 
 #if defined(CUSHION_EXTENSIONS)
             if (item->flags & CUSHION_TOKEN_LIST_ITEM_FLAG_WRAPPED_BLOCK)
@@ -214,13 +312,13 @@ static struct lexer_pop_token_meta_t lexer_file_state_pop_token (struct cushion_
                 meta.flags &= ~LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT;
             }
 
-            state->token_stack_top->last_popped_flags = item->flags;
+            top->last_popped_flags = item->flags;
 #endif
             goto read_token;
         }
         else
         {
-            state->token_stack_top = state->token_stack_top->previous;
+            lexer_file_state_discard_top (state);
             if (!state->token_stack_top)
             {
                 meta.file = state->stack_exit_file;
@@ -230,7 +328,14 @@ static struct lexer_pop_token_meta_t lexer_file_state_pop_token (struct cushion_
     }
 
     // No more ready-to-use tokens from replacement lists or other sources, request next token from tokenizer.
-    cushion_tokenization_next_token (state->instance, &state->tokenization, output);
+    if (state->tokenization.replay_entry)
+    {
+        cushion_token_cache_next_token (state->instance, &state->tokenization, output);
+    }
+    else
+    {
+        cushion_tokenization_next_token (state->instance, &state->tokenization, output);
+    }
 
 read_token:
     if (output->type == CUSHION_TOKEN_TYPE_END_OF_FILE)
@@ -243,6 +348,14 @@ read_token:
     return meta;
 }
 
+/// \brief Skips the rest of the current line in file, returns its end. Token stack must be empty.
+static inline const char *lexer_file_state_skip_line (struct cushion_lexer_file_state_t *state)
+{
+    assert (!state->token_stack_top);
+    return state->tokenization.replay_entry ? cushion_token_cache_skip_line (&state->tokenization) :
+                                              cushion_tokenization_skip_line (&state->tokenization);
+}
+
 static inline void lexer_file_state_path_init (struct cushion_lexer_file_state_t *state, const char *data)
 {
     if (!data)
@@ -303,6 +416,7 @@ static inline void lexer_file_state_path_append_sequence (struct cushion_lexer_f
 /// \details We need to be able to properly parse replacement lists from both command line arguments that has only
 ///          tokenization state and from code (has lexer state and it is possible to use directives in
 ///          __CUSHION_WRAPPED__ code). Therefore, we need context and two functions.
+///          Tokens are gathered into transient list and packed into persistent token array when list is done.
 struct cushion_lex_replacement_list_context_t
 {
     struct cushion_instance_t *instance;
@@ -322,7 +436,7 @@ static enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_s
 #define SAVE_AND_APPEND_TOKEN_TO_LIST                                                                                  \
     {                                                                                                                  \
         struct cushion_token_list_item_t *new_token_item = cushion_save_token_to_memory (                              \
-            context->instance, &context->current_token, CUSHION_ALLOCATION_CLASS_PERSISTENT);                          \
+            context->instance, &context->current_token, CUSHION_ALLOCATION_CLASS_TRANSIENT);                           \
                                                                                                                        \
         /* We do not save file and line info in replacement lists as this is not how macros usually work. */           \
         if (context->last)                                                                                             \
@@ -450,7 +564,7 @@ static enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_s
 enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_tokenization (
     struct cushion_instance_t *instance,
     struct cushion_tokenization_state_t *tokenization_state,
-    struct cushion_token_list_item_t **token_list_output,
+    const struct cushion_token_array_t **replacement_list_output,
     enum cushion_macro_flags_t *flags_output)
 {
     struct cushion_lex_replacement_list_context_t context = {
@@ -461,7 +575,7 @@ enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_tok
         .lexing = 1u,
     };
 
-    *token_list_output = NULL;
+    *replacement_list_output = NULL;
     while (context.lexing)
     {
         cushion_tokenization_next_token (instance, tokenization_state, &context.current_token);
@@ -487,14 +601,15 @@ enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_tok
         }
     }
 
-    *token_list_output = context.first;
+    *replacement_list_output =
+        cushion_save_token_list_to_array (instance, context.first, CUSHION_ALLOCATION_CLASS_PERSISTENT);
     return CUSHION_LEX_REPLACEMENT_LIST_RESULT_REGULAR;
 }
 
 enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_lexer (
     struct cushion_instance_t *instance,
     struct cushion_lexer_file_state_t *lexer_state,
-    struct cushion_token_list_item_t **token_list_output,
+    const struct cushion_token_array_t **replacement_list_output,
     enum cushion_macro_flags_t *flags_output)
 {
     struct cushion_lex_replacement_list_context_t context = {
@@ -505,7 +620,7 @@ enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_lex
         .lexing = 1u,
     };
 
-    *token_list_output = NULL;
+    *replacement_list_output = NULL;
     while (context.lexing)
     {
         struct lexer_pop_token_meta_t meta = lexer_file_state_pop_token (lexer_state, &context.current_token);
@@ -531,14 +646,28 @@ enum cushion_lex_replacement_list_result_t cushion_lex_replacement_list_from_lex
         }
     }
 
-    *token_list_output = context.first;
+    *replacement_list_output =
+        cushion_save_token_list_to_array (instance, context.first, CUSHION_ALLOCATION_CLASS_PERSISTENT);
     return CUSHION_LEX_REPLACEMENT_LIST_RESULT_REGULAR;
 }
 
 struct lex_macro_argument_t
 {
     struct lex_macro_argument_t *next;
-    struct cushion_token_list_item_t *tokens_first;
+
+    /// \brief Argument tokens as they were passed to macro invocation, NULL if argument is empty.
+    /// \details Arguments only keep tokens as their location is never used: replacement takes it from invocation.
+    const struct cushion_token_array_t *tokens;
+
+#if defined(CUSHION_EXTENSIONS)
+    /// \brief Whether argument was already evaluated during this invocation and evaluated tokens can be reused.
+    unsigned int evaluated;
+
+    /// \brief Argument tokens after evaluation, saved on the first __CUSHION_EVALUATED_ARGUMENT__ of this argument.
+    /// \details For the first variadic argument, contains evaluation result for the whole __VA_ARGS__ sequence.
+    ///          Never linked into replacement result directly, only copied, as result tokens might be modified.
+    struct cushion_token_list_item_t *evaluated_first;
+#endif
 };
 
 static unsigned int lex_calculate_stringized_internal_size (struct cushion_token_list_item_t *token)
@@ -784,199 +913,682 @@ static enum cushion_identifier_kind_t lex_relculate_identifier_kind (const char
         __VA_ARGS__;                                                                                                   \
     }
 
-struct macro_replacement_token_list_t
+enum macro_instruction_type_t
 {
-    struct cushion_token_list_item_t *first;
-    struct cushion_token_list_item_t *last;
-};
+    /// \brief Appends program tokens as they are.
+    MACRO_INSTRUCTION_TYPE_LITERALS = 0u,
 
-struct macro_replacement_context_t
-{
-    struct cushion_macro_node_t *macro;
-    struct lex_macro_argument_t *arguments;
-    struct cushion_token_list_item_t *wrapped_tokens;
-    struct cushion_token_list_item_t *current_token;
-    unsigned int replacement_line;
-    struct macro_replacement_token_list_t result;
-    struct macro_replacement_token_list_t sub_list;
-#if defined(CUSHION_EXTENSIONS)
-    unsigned int replacement_index;
-#endif
-};
+    /// \brief Appends tokens of the argument with given parameter index.
+    MACRO_INSTRUCTION_TYPE_PARAMETER,
 
-static inline struct cushion_error_context_t macro_replacement_error_context (
-    struct cushion_lexer_file_state_t *state, struct macro_replacement_context_t *context)
-{
-    return (struct cushion_error_context_t) {
-        .file = state->tokenization.file_name,
-        .line = context->replacement_line,
-        .column = UINT_MAX,
-    };
-}
+    /// \brief Appends variadic arguments separated by commas.
+    MACRO_INSTRUCTION_TYPE_VA_ARGS,
 
-static inline struct cushion_token_list_item_t *macro_replacement_token_list_append (
-    struct cushion_lexer_file_state_t *state,
-    struct macro_replacement_token_list_t *list,
-    struct cushion_token_t *token,
-    const char *file,
-    unsigned int line)
-{
-    struct cushion_token_list_item_t *new_token =
-        cushion_allocator_allocate (&state->instance->allocator, sizeof (struct cushion_token_list_item_t),
-                                    _Alignof (struct cushion_token_list_item_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    /// \brief Appends program tokens from __VA_OPT__ if there is any non-empty variadic argument.
+    MACRO_INSTRUCTION_TYPE_VA_OPT,
 
-    // We just copy token value as its string allocations should be already dealt with either through persistent
-    // allocation or manual copy.
-    new_token->token = *token;
-    new_token->next = NULL;
+    /// \brief Stringizes tokens produced by the next instruction.
+    MACRO_INSTRUCTION_TYPE_STRINGIZE,
 
-    new_token->file = file;
-    new_token->line = line;
+    /// \brief Merges the last result token with the first token produced by the next instructions.
+    MACRO_INSTRUCTION_TYPE_PASTE,
 
 #if defined(CUSHION_EXTENSIONS)
-    new_token->flags = CUSHION_TOKEN_LIST_ITEM_FLAG_NONE;
+    MACRO_INSTRUCTION_TYPE_WRAPPED,
+
+    /// \brief Replaces macros inside tokens produced by the next instruction.
+    MACRO_INSTRUCTION_TYPE_EVALUATED_ARGUMENT,
+
+    MACRO_INSTRUCTION_TYPE_REPLACEMENT_INDEX,
 #endif
 
-    if (list->last)
-    {
-        list->last->next = new_token;
-    }
-    else
-    {
-        list->first = new_token;
-    }
+    /// \brief Reports malformed replacement list. Errors are only reported when macro is replaced, like before.
+    MACRO_INSTRUCTION_TYPE_ERROR,
+};
 
-    list->last = new_token;
-    return new_token;
-}
+struct macro_instruction_t
+{
+    enum macro_instruction_type_t type;
 
-struct lex_macro_argument_read_context_t
+    /// \brief Type of the replacement list token that has started this instruction, checked by "##" operator.
+    enum cushion_token_type_t token_type;
+
+    /// \brief Index of the first program token for literals and __VA_OPT__, index of parameter for parameters.
+    unsigned int index;
+
+    /// \brief Count of program tokens for literals and __VA_OPT__.
+    unsigned int count;
+
+    const char *error_message;
+};
+
+struct cushion_macro_program_t
 {
-    struct cushion_macro_node_t *macro;
-    struct lex_macro_argument_t *arguments_first;
-    struct lex_macro_argument_t *arguments_last;
+    struct macro_instruction_t *instructions;
+    unsigned int instructions_count;
 
-    struct cushion_token_t current_token;
-    struct lexer_pop_token_meta_t current_token_meta;
+    /// \brief Replacement list of the macro, its tokens are referenced by instructions.
+    const struct cushion_token_array_t *replacement_list;
 
-    struct cushion_token_list_item_t *argument_tokens_first;
-    struct cushion_token_list_item_t *argument_tokens_last;
+    /// \brief Token records of the replacement list for quick checks during compilation.
+    const struct cushion_token_array_token_t *tokens;
+    unsigned int tokens_count;
 
-    unsigned int argument_token_line;
-    unsigned int parenthesis_counter;
-    struct cushion_macro_parameter_node_t *parameter;
+    /// \brief Index of the first variadic argument.
+    unsigned int parameters_count;
 };
 
-static inline struct lex_macro_argument_read_context_t lex_macro_argument_read_context_init (
-    struct cushion_macro_node_t *macro, unsigned int argument_token_line)
+enum macro_program_compile_result_t
 {
-    struct lex_macro_argument_read_context_t context;
-    context.macro = macro;
-    context.arguments_first = NULL;
-    context.arguments_last = NULL;
+    /// \brief Instructions were added for the identifier.
+    MACRO_PROGRAM_COMPILE_RESULT_ADDED = 0u,
 
-    // Initialize current token with default values so warnings checks do not trigger on it.
-    context.current_token.type = CUSHION_TOKEN_TYPE_NEW_LINE;
-    context.current_token.begin = "\n";
-    context.current_token.end = context.current_token.begin + 1u;
+    /// \brief Identifier is a regular one and should be appended as it is.
+    MACRO_PROGRAM_COMPILE_RESULT_REGULAR,
 
-    context.argument_tokens_first = NULL;
-    context.argument_tokens_last = NULL;
+    /// \brief Error instruction was added, there is no sense to compile further as replacement stops on it.
+    MACRO_PROGRAM_COMPILE_RESULT_ERROR,
+};
 
-    context.argument_token_line = argument_token_line;
-    context.parenthesis_counter = 1u;
-    context.parameter = macro->parameters_first;
-    return context;
+static inline struct macro_instruction_t *macro_program_add_instruction (struct cushion_macro_program_t *program,
+                                                                         enum macro_instruction_type_t type,
+                                                                         enum cushion_token_type_t token_type,
+                                                                         unsigned int index)
+{
+    struct macro_instruction_t *instruction = &program->instructions[program->instructions_count++];
+    instruction->type = type;
+    instruction->token_type = token_type;
+    instruction->index = index;
+    instruction->count = 0u;
+    instruction->error_message = NULL;
+    return instruction;
 }
 
-static void lex_macro_argument_read_step (struct cushion_lexer_file_state_t *state,
-                                          struct lex_macro_argument_read_context_t *context)
+static inline enum macro_program_compile_result_t macro_program_add_error (struct cushion_macro_program_t *program,
+                                                                          enum cushion_token_type_t token_type,
+                                                                          const char *message)
 {
-    const unsigned int parameterless_function_line =
-        !context->parameter && (context->macro->flags & CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS) == 0u;
+    macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_ERROR, token_type, 0u)->error_message = message;
+    return MACRO_PROGRAM_COMPILE_RESULT_ERROR;
+}
 
-    switch (context->current_token.type)
+static inline unsigned int macro_program_is_punctuator (struct cushion_macro_program_t *program,
+                                                        unsigned int index,
+                                                        enum cushion_punctuator_kind_t kind)
+{
+    return index < program->tokens_count && program->tokens[index].type == CUSHION_TOKEN_TYPE_PUNCTUATOR &&
+           program->tokens[index].kind == kind;
+}
+
+/// \brief Compiles identifier at given token index, updating index to the last token used by added instructions.
+static enum macro_program_compile_result_t macro_program_compile_identifier (struct cushion_macro_program_t *program,
+                                                                            struct cushion_macro_node_t *macro,
+                                                                            unsigned int *token_index)
+{
+    const unsigned int start = *token_index;
+    switch ((enum cushion_identifier_kind_t) program->tokens[start].kind)
     {
-    case CUSHION_TOKEN_TYPE_PUNCTUATOR:
-        switch (context->current_token.punctuator_kind)
+    case CUSHION_IDENTIFIER_KIND_VA_ARGS:
+    case CUSHION_IDENTIFIER_KIND_VA_OPT:
+    {
+        if ((macro->flags & CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS) == 0u)
         {
-        case CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS:
-            ++context->parenthesis_counter;
-            goto append_argument_token;
-            break;
+            return macro_program_add_error (program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                            "Caught attempt to use __VA_ARGS__/__VA_OPT__ in non-variadic macro.");
+        }
 
-        case CUSHION_PUNCTUATOR_KIND_RIGHT_PARENTHESIS:
-            --context->parenthesis_counter;
+        if (program->tokens[start].kind == CUSHION_IDENTIFIER_KIND_VA_ARGS)
+        {
+            macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_VA_ARGS, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                           start);
+            return MACRO_PROGRAM_COMPILE_RESULT_ADDED;
+        }
 
-            if (context->parenthesis_counter == 0u && !parameterless_function_line)
-            {
-                goto finalize_argument;
-            }
+        if (!macro_program_is_punctuator (program, start + 1u, CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS))
+        {
+            return macro_program_add_error (program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                            "Expected \"(\" after __VA_OPT__ in replacement list.");
+        }
 
-            goto append_argument_token;
-            break;
+        // Scan internals of the __VA_OPT__ macro call.
+        unsigned int internal_parenthesis = 0u;
+        unsigned int end = start + 2u;
 
-        case CUSHION_PUNCTUATOR_KIND_COMMA:
-            if (context->parenthesis_counter > 1u)
-            {
-                goto append_argument_token;
-            }
-            else
+        while (1u)
+        {
+            if (end >= program->tokens_count)
             {
-                goto finalize_argument;
+                return macro_program_add_error (program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                                "Got to the end of replacement list while lexing __VA_OPT__.");
             }
 
-            break;
-
-        finalize_argument:
-        {
-            if (parameterless_function_line)
+            if (program->tokens[end].type == CUSHION_TOKEN_TYPE_PUNCTUATOR)
             {
-                cushion_instance_lexer_error (state, &context->current_token_meta,
-                                              "Encountered more parameters for function-line macro than expected.");
-                break;
+                if (program->tokens[end].kind == CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS)
+                {
+                    ++internal_parenthesis;
+                }
+                else if (program->tokens[end].kind == CUSHION_PUNCTUATOR_KIND_RIGHT_PARENTHESIS)
+                {
+                    if (internal_parenthesis == 0u)
+                    {
+                        // Whole __VA_OPT__ is lexed.
+                        break;
+                    }
+
+                    --internal_parenthesis;
+                }
             }
 
-            struct lex_macro_argument_t *new_argument =
-                cushion_allocator_allocate (&state->instance->allocator, sizeof (struct lex_macro_argument_t),
-                                            _Alignof (struct lex_macro_argument_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+            ++end;
+        }
 
-            new_argument->next = NULL;
-            new_argument->tokens_first = context->argument_tokens_first;
-            context->argument_tokens_first = NULL;
-            context->argument_tokens_last = NULL;
+        macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_VA_OPT, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                       start + 2u)
+            ->count = end - start - 2u;
+        *token_index = end;
+        return MACRO_PROGRAM_COMPILE_RESULT_ADDED;
+    }
 
-            if (context->arguments_last)
-            {
-                context->arguments_last->next = new_argument;
-            }
-            else
-            {
-                context->arguments_first = new_argument;
-            }
+#if defined(CUSHION_EXTENSIONS)
+    case CUSHION_IDENTIFIER_KIND_CUSHION_WRAPPED:
+        macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_WRAPPED, CUSHION_TOKEN_TYPE_IDENTIFIER, start);
+        return MACRO_PROGRAM_COMPILE_RESULT_ADDED;
 
-            context->arguments_last = new_argument;
-            assert (context->parameter || (context->macro->flags & CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS));
+    case CUSHION_IDENTIFIER_KIND_CUSHION_EVALUATED_ARGUMENT:
+    {
+        if (!macro_program_is_punctuator (program, start + 1u, CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS))
+        {
+            return macro_program_add_error (program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                            "Expected \"(\" after __CUSHION_EVALUATED_ARGUMENT__ in replacement list.");
+        }
 
-            if (context->parameter)
-            {
-                context->parameter = context->parameter->next;
-            }
+        unsigned int argument_index = start + 2u;
+        if (argument_index >= program->tokens_count ||
+            program->tokens[argument_index].type != CUSHION_TOKEN_TYPE_IDENTIFIER)
+        {
+            return macro_program_add_error (
+                program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                "Expected identifier as __CUSHION_EVALUATED_ARGUMENT__ argument in replacement list.");
+        }
+
+        const unsigned int evaluated_instruction = program->instructions_count;
+        macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_EVALUATED_ARGUMENT,
+                                       CUSHION_TOKEN_TYPE_IDENTIFIER, start);
 
+        switch (macro_program_compile_identifier (program, macro, &argument_index))
+        {
+        case MACRO_PROGRAM_COMPILE_RESULT_ADDED:
             break;
+
+        case MACRO_PROGRAM_COMPILE_RESULT_REGULAR:
+            program->instructions_count = evaluated_instruction;
+            return macro_program_add_error (
+                program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                "Expected argument name, __VA_ARGS__ or __VA_OPT__ as __CUSHION_EVALUATED_ARGUMENT__ argument in "
+                "replacement list, but got another identifier.");
+
+        case MACRO_PROGRAM_COMPILE_RESULT_ERROR:
+            return MACRO_PROGRAM_COMPILE_RESULT_ERROR;
         }
 
-        default:
-            goto append_argument_token;
-            break;
+        if (!macro_program_is_punctuator (program, argument_index + 1u, CUSHION_PUNCTUATOR_KIND_RIGHT_PARENTHESIS))
+        {
+            return macro_program_add_error (
+                program, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                "Expected \")\" after __CUSHION_EVALUATED_ARGUMENT__ argument in replacement list.");
         }
 
-        break;
+        *token_index = argument_index + 1u;
+        return MACRO_PROGRAM_COMPILE_RESULT_ADDED;
+    }
 
-    case CUSHION_TOKEN_TYPE_NEW_LINE:
-    case CUSHION_TOKEN_TYPE_GLUE:
-    case CUSHION_TOKEN_TYPE_COMMENT:
-        // Glue and comments are not usually kept in macro arguments.
+    case CUSHION_IDENTIFIER_KIND_CUSHION_REPLACEMENT_INDEX:
+        macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_REPLACEMENT_INDEX,
+                                       CUSHION_TOKEN_TYPE_IDENTIFIER, start);
+        return MACRO_PROGRAM_COMPILE_RESULT_ADDED;
+#endif
+
+    default:
+    {
+        unsigned int parameter_index = 0u;
+        struct cushion_macro_parameter_node_t *parameter = macro->parameters_first;
+
+        while (parameter && parameter->symbol != program->tokens[start].value)
+        {
+            parameter = parameter->next;
+            ++parameter_index;
+        }
+
+        if (!parameter)
+        {
+            return MACRO_PROGRAM_COMPILE_RESULT_REGULAR;
+        }
+
+        macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_PARAMETER, CUSHION_TOKEN_TYPE_IDENTIFIER,
+                                       parameter_index);
+        return MACRO_PROGRAM_COMPILE_RESULT_ADDED;
+    }
+    }
+}
+
+/// \brief Compiles replacement list of the macro into flat instruction array, so parameters are resolved into
+///        indices and operators are found only once instead of doing it on every replacement.
+/// \details Program is allocated in persistent memory, therefore it lives as long as macro node itself.
+static struct cushion_macro_program_t *macro_program_compile (struct cushion_instance_t *instance,
+                                                              struct cushion_macro_node_t *macro)
+{
+    struct cushion_macro_program_t *program =
+        cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_macro_program_t),
+                                    _Alignof (struct cushion_macro_program_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    program->instructions_count = 0u;
+    program->replacement_list = macro->replacement_list;
+    program->tokens = macro->replacement_list ? macro->replacement_list->tokens : NULL;
+    program->tokens_count = macro->replacement_list ? macro->replacement_list->count : 0u;
+    program->parameters_count = 0u;
+
+    for (struct cushion_macro_parameter_node_t *parameter = macro->parameters_first; parameter;
+         parameter = parameter->next)
+    {
+        ++program->parameters_count;
+    }
+
+    // Every token produces at most one instruction, except for error which is always the last instruction.
+    program->instructions = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct macro_instruction_t) * (program->tokens_count + 1u),
+        _Alignof (struct macro_instruction_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    struct macro_instruction_t *literals = NULL;
+    for (unsigned int token_index = 0u; token_index < program->tokens_count; ++token_index)
+    {
+        unsigned int is_literal = 0u;
+        switch ((enum cushion_token_type_t) program->tokens[token_index].type)
+        {
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_IF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFDEF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFNDEF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFDEF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFNDEF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELSE:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ENDIF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_INCLUDE:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_SYSTEM:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_DEFINE:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_UNDEF:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_LINE:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_PRAGMA:
+        case CUSHION_TOKEN_TYPE_NEW_LINE:
+        case CUSHION_TOKEN_TYPE_COMMENT:
+        case CUSHION_TOKEN_TYPE_GLUE:
+        case CUSHION_TOKEN_TYPE_END_OF_FILE:
+            // Must never be a part of valid lexed macro.
+            assert (0);
+            break;
+
+        case CUSHION_TOKEN_TYPE_IDENTIFIER:
+            switch (macro_program_compile_identifier (program, macro, &token_index))
+            {
+            case MACRO_PROGRAM_COMPILE_RESULT_ADDED:
+                break;
+
+            case MACRO_PROGRAM_COMPILE_RESULT_REGULAR:
+                is_literal = 1u;
+                break;
+
+            case MACRO_PROGRAM_COMPILE_RESULT_ERROR:
+                return program;
+            }
+
+            break;
+
+        case CUSHION_TOKEN_TYPE_PUNCTUATOR:
+            switch ((enum cushion_punctuator_kind_t) program->tokens[token_index].kind)
+            {
+            case CUSHION_PUNCTUATOR_KIND_HASH:
+            {
+                // Stringify next argument. Error if next token is not an argument.
+                if (token_index + 1u >= program->tokens_count)
+                {
+                    macro_program_add_error (program, CUSHION_TOKEN_TYPE_PUNCTUATOR,
+                                             "Encountered \"#\" operator as a last token in macro replacement list.");
+                    return program;
+                }
+
+                ++token_index;
+                if (program->tokens[token_index].type != CUSHION_TOKEN_TYPE_IDENTIFIER)
+                {
+                    macro_program_add_error (program, CUSHION_TOKEN_TYPE_PUNCTUATOR,
+                                             "Non-comment token following \"#\" operator is not an identifier.");
+                    return program;
+                }
+
+                const unsigned int stringize_instruction = program->instructions_count;
+                macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_STRINGIZE,
+                                               CUSHION_TOKEN_TYPE_PUNCTUATOR, token_index - 1u);
+
+                switch (macro_program_compile_identifier (program, macro, &token_index))
+                {
+                case MACRO_PROGRAM_COMPILE_RESULT_ADDED:
+                    break;
+
+                case MACRO_PROGRAM_COMPILE_RESULT_REGULAR:
+                    program->instructions_count = stringize_instruction;
+                    macro_program_add_error (program, CUSHION_TOKEN_TYPE_PUNCTUATOR,
+                                             "Expected argument name, __VA_ARGS__ or __VA_OPT__ as \"#\" operand in "
+                                             "replacement list, but got another identifier.");
+                    return program;
+
+                case MACRO_PROGRAM_COMPILE_RESULT_ERROR:
+                    return program;
+                }
+
+                break;
+            }
+
+            case CUSHION_PUNCTUATOR_KIND_DOUBLE_HASH:
+                // Operands are taken from the next instructions during replacement, as they can be empty.
+                macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_PASTE, CUSHION_TOKEN_TYPE_PUNCTUATOR,
+                                               token_index);
+                break;
+
+            default:
+                is_literal = 1u;
+                break;
+            }
+
+            break;
+
+        case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
+        case CUSHION_TOKEN_TYPE_NUMBER_FLOATING:
+        case CUSHION_TOKEN_TYPE_DIGIT_IDENTIFIER_SEQUENCE:
+        case CUSHION_TOKEN_TYPE_CHARACTER_LITERAL:
+        case CUSHION_TOKEN_TYPE_STRING_LITERAL:
+        case CUSHION_TOKEN_TYPE_OTHER:
+            is_literal = 1u;
+            break;
+        }
+
+        if (!is_literal)
+        {
+            literals = NULL;
+        }
+        else if (literals)
+        {
+            // Sequential literals always use sequential tokens as any other token breaks the sequence.
+            ++literals->count;
+        }
+        else
+        {
+            literals = macro_program_add_instruction (program, MACRO_INSTRUCTION_TYPE_LITERALS,
+                                                      (enum cushion_token_type_t) program->tokens[token_index].type,
+                                                      token_index);
+            literals->count = 1u;
+        }
+    }
+
+    return program;
+}
+
+struct macro_replacement_token_list_t
+{
+    struct cushion_token_list_item_t *first;
+    struct cushion_token_list_item_t *last;
+};
+
+struct macro_replacement_context_t
+{
+    struct cushion_macro_node_t *macro;
+    struct lex_macro_argument_t *arguments;
+    struct cushion_token_list_item_t *wrapped_tokens;
+    const struct cushion_macro_program_t *program;
+    unsigned int instruction_index;
+
+    /// \brief Count of tokens at the beginning of current literals instruction that were merged by "##" operator.
+    unsigned int literal_offset;
+
+    unsigned int replacement_line;
+    struct macro_replacement_token_list_t result;
+    struct macro_replacement_token_list_t sub_list;
+#if defined(CUSHION_EXTENSIONS)
+    unsigned int replacement_index;
+#endif
+};
+
+static inline struct cushion_error_context_t macro_replacement_error_context (
+    struct cushion_lexer_file_state_t *state, struct macro_replacement_context_t *context)
+{
+    return (struct cushion_error_context_t) {
+        .file = state->tokenization.file_name,
+        .line = context->replacement_line,
+        .column = UINT_MAX,
+    };
+}
+
+static inline struct cushion_token_list_item_t *macro_replacement_token_list_append (
+    struct cushion_lexer_file_state_t *state,
+    struct macro_replacement_token_list_t *list,
+    struct cushion_token_t *token,
+    const char *file,
+    unsigned int line)
+{
+    struct cushion_token_list_item_t *new_token =
+        cushion_allocator_allocate (&state->instance->allocator, sizeof (struct cushion_token_list_item_t),
+                                    _Alignof (struct cushion_token_list_item_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+
+    // We just copy token value as its string allocations should be already dealt with either through persistent
+    // allocation or manual copy.
+    new_token->token = *token;
+    new_token->next = NULL;
+
+    new_token->file = file;
+    new_token->line = line;
+
+#if defined(CUSHION_EXTENSIONS)
+    new_token->flags = CUSHION_TOKEN_LIST_ITEM_FLAG_NONE;
+#endif
+
+    if (list->last)
+    {
+        list->last->next = new_token;
+    }
+    else
+    {
+        list->first = new_token;
+    }
+
+    list->last = new_token;
+    return new_token;
+}
+
+/// \brief Appends array tokens from given index range to the list as replacement tokens.
+static inline void macro_replacement_token_list_append_array (struct cushion_lexer_file_state_t *state,
+                                                              struct macro_replacement_token_list_t *list,
+                                                              const struct cushion_token_array_t *array,
+                                                              unsigned int begin,
+                                                              unsigned int end,
+                                                              unsigned int line)
+{
+    for (unsigned int index = begin; index < end; ++index)
+    {
+        struct cushion_token_t token;
+        cushion_token_array_get (state->instance, array, index, &token);
+        macro_replacement_token_list_append (state, list, &token, state->tokenization.file_name, line);
+    }
+}
+
+/// \brief Appends program tokens from given index range to the list as replacement tokens.
+static inline void macro_replacement_token_list_append_program (struct cushion_lexer_file_state_t *state,
+                                                                struct macro_replacement_token_list_t *list,
+                                                                const struct cushion_macro_program_t *program,
+                                                                unsigned int begin,
+                                                                unsigned int end,
+                                                                unsigned int line)
+{
+    macro_replacement_token_list_append_array (state, list, program->replacement_list, begin, end, line);
+}
+
+/// \brief Appends all tokens of macro argument to the list as replacement tokens.
+static inline void macro_replacement_token_list_append_argument (struct cushion_lexer_file_state_t *state,
+                                                                 struct macro_replacement_token_list_t *list,
+                                                                 const struct lex_macro_argument_t *argument,
+                                                                 unsigned int line)
+{
+    if (argument && argument->tokens)
+    {
+        macro_replacement_token_list_append_array (state, list, argument->tokens, 0u, argument->tokens->count, line);
+    }
+}
+
+#if defined(CUSHION_EXTENSIONS)
+/// \brief Appends copies of all tokens from given token sequence to the list, keeping their origin and flags.
+static inline void macro_replacement_token_list_copy (struct cushion_lexer_file_state_t *state,
+                                                      struct macro_replacement_token_list_t *list,
+                                                      struct cushion_token_list_item_t *token)
+{
+    while (token)
+    {
+        struct cushion_token_list_item_t *added =
+            macro_replacement_token_list_append (state, list, &token->token, token->file, token->line);
+        added->flags = token->flags;
+        token = token->next;
+    }
+}
+#endif
+
+struct lex_macro_argument_read_context_t
+{
+    struct cushion_macro_node_t *macro;
+    struct lex_macro_argument_t *arguments_first;
+    struct lex_macro_argument_t *arguments_last;
+
+    struct cushion_token_t current_token;
+    struct lexer_pop_token_meta_t current_token_meta;
+
+    struct cushion_token_list_item_t *argument_tokens_first;
+    struct cushion_token_list_item_t *argument_tokens_last;
+
+    unsigned int parenthesis_counter;
+    struct cushion_macro_parameter_node_t *parameter;
+};
+
+static inline struct lex_macro_argument_read_context_t lex_macro_argument_read_context_init (
+    struct cushion_macro_node_t *macro)
+{
+    struct lex_macro_argument_read_context_t context;
+    context.macro = macro;
+    context.arguments_first = NULL;
+    context.arguments_last = NULL;
+
+    // Initialize current token with default values so warnings checks do not trigger on it.
+    context.current_token.type = CUSHION_TOKEN_TYPE_NEW_LINE;
+    context.current_token.begin = "\n";
+    context.current_token.end = context.current_token.begin + 1u;
+
+    context.argument_tokens_first = NULL;
+    context.argument_tokens_last = NULL;
+
+    context.parenthesis_counter = 1u;
+    context.parameter = macro->parameters_first;
+    return context;
+}
+
+static void lex_macro_argument_read_step (struct cushion_lexer_file_state_t *state,
+                                          struct lex_macro_argument_read_context_t *context)
+{
+    const unsigned int parameterless_function_line =
+        !context->parameter && (context->macro->flags & CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS) == 0u;
+
+    switch (context->current_token.type)
+    {
+    case CUSHION_TOKEN_TYPE_PUNCTUATOR:
+        switch (context->current_token.punctuator_kind)
+        {
+        case CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS:
+            ++context->parenthesis_counter;
+            goto append_argument_token;
+            break;
+
+        case CUSHION_PUNCTUATOR_KIND_RIGHT_PARENTHESIS:
+            --context->parenthesis_counter;
+
+            if (context->parenthesis_counter == 0u && !parameterless_function_line)
+            {
+                goto finalize_argument;
+            }
+
+            goto append_argument_token;
+            break;
+
+        case CUSHION_PUNCTUATOR_KIND_COMMA:
+            if (context->parenthesis_counter > 1u)
+            {
+                goto append_argument_token;
+            }
+            else
+            {
+                goto finalize_argument;
+            }
+
+            break;
+
+        finalize_argument:
+        {
+            if (parameterless_function_line)
+            {
+                cushion_instance_lexer_error (state, &context->current_token_meta,
+                                              "Encountered more parameters for function-line macro than expected.");
+                break;
+            }
+
+            struct lex_macro_argument_t *new_argument =
+                cushion_allocator_allocate (&state->instance->allocator, sizeof (struct lex_macro_argument_t),
+                                            _Alignof (struct lex_macro_argument_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+
+            // Argument tokens are gathered into a list as their count is unknown, then packed for replacement.
+            new_argument->next = NULL;
+            new_argument->tokens = cushion_save_token_list_to_array (
+                state->instance, context->argument_tokens_first, CUSHION_ALLOCATION_CLASS_TRANSIENT);
+#if defined(CUSHION_EXTENSIONS)
+            new_argument->evaluated = 0u;
+            new_argument->evaluated_first = NULL;
+#endif
+            context->argument_tokens_first = NULL;
+            context->argument_tokens_last = NULL;
+
+            if (context->arguments_last)
+            {
+                context->arguments_last->next = new_argument;
+            }
+            else
+            {
+                context->arguments_first = new_argument;
+            }
+
+            context->arguments_last = new_argument;
+            assert (context->parameter || (context->macro->flags & CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS));
+
+            if (context->parameter)
+            {
+                context->parameter = context->parameter->next;
+            }
+
+            break;
+        }
+
+        default:
+            goto append_argument_token;
+            break;
+        }
+
+        break;
+
+    case CUSHION_TOKEN_TYPE_NEW_LINE:
+    case CUSHION_TOKEN_TYPE_GLUE:
+    case CUSHION_TOKEN_TYPE_COMMENT:
+        // Glue and comments are not usually kept in macro arguments.
         // New line should either be skipped or be checked by function user and cause appropriate error
         // depending on the context.
         break;
@@ -999,9 +1611,6 @@ static void lex_macro_argument_read_step (struct cushion_lexer_file_state_t *sta
         struct cushion_token_list_item_t *argument_tokens_new_token =
             cushion_save_token_to_memory (state->instance, &context->current_token, CUSHION_ALLOCATION_CLASS_TRANSIENT);
 
-        argument_tokens_new_token->file = state->tokenization.file_name;
-        argument_tokens_new_token->line = context->argument_token_line;
-
         if (context->argument_tokens_last)
         {
             context->argument_tokens_last->next = argument_tokens_new_token;
@@ -1026,18 +1635,38 @@ static struct cushion_token_list_item_t *lex_do_macro_replacement (
     unsigned int replacement_line);
 
 #if defined(CUSHION_EXTENSIONS)
+/// \brief Range of evaluation sub list that was produced by macro replacement and is being rescanned.
+/// \details Evaluation replaces macros in place, so instead of storing depth in every token, we track ranges that are
+///          still ahead of the cursor. Ranges are always nested, and nested range that ends at the same token as its
+///          parent just takes its place.
+struct macro_evaluation_range_t
+{
+    struct macro_evaluation_range_t *previous;
+
+    /// \brief First token after the range, NULL if range lasts until the end of sub list.
+    struct cushion_token_list_item_t *end;
+
+    unsigned int depth;
+};
+
 static inline void macro_replacement_context_evaluate_sub_list (struct cushion_lexer_file_state_t *state,
                                                                 struct macro_replacement_context_t *context)
 {
     struct cushion_token_list_item_t *cursor = context->sub_list.first;
     struct cushion_token_list_item_t *previous = NULL;
+    struct macro_evaluation_range_t *range = NULL;
 
     while (cursor)
     {
+        while (range && range->end == cursor)
+        {
+            range = range->previous;
+        }
+
         if (cursor->token.type == CUSHION_TOKEN_TYPE_IDENTIFIER)
         {
             struct cushion_macro_node_t *macro =
-                cushion_instance_macro_search (state->instance, cursor->token.begin, cursor->token.end);
+                cushion_instance_macro_search_symbol (state->instance, cursor->token.symbol);
 
             if (!macro || (macro->flags & CUSHION_MACRO_FLAG_PRESERVED))
             {
@@ -1050,7 +1679,7 @@ static inline void macro_replacement_context_evaluate_sub_list (struct cushion_l
             if (macro->flags & CUSHION_MACRO_FLAG_FUNCTION)
             {
                 struct lex_macro_argument_read_context_t argument_context =
-                    lex_macro_argument_read_context_init (macro, cursor->line);
+                    lex_macro_argument_read_context_init (macro);
 
                 // Scan for opening parenthesis.
                 cursor = cursor->next;
@@ -1108,8 +1737,20 @@ static inline void macro_replacement_context_evaluate_sub_list (struct cushion_l
                 return;
             }
 
+            const unsigned int depth = range ? range->depth + 1u : 1u;
+            if (depth > CUSHION_MACRO_EXPANSION_DEPTH_LIMIT)
+            {
+                cushion_instance_execution_error (
+                    state->instance, macro_replacement_error_context (state, context),
+                    "Reached macro expansion depth limit %u while evaluating macro %s, it is most likely recursive. "
+                    "Limit can be changed through CUSHION_MACRO_EXPANSION_DEPTH_LIMIT build option.",
+                    (unsigned int) CUSHION_MACRO_EXPANSION_DEPTH_LIMIT, macro->name);
+                return;
+            }
+
             struct cushion_token_list_item_t *replacement_tokens =
                 lex_do_macro_replacement (state, macro, arguments, NULL, replacement_line);
+            LEX_WHEN_ERROR (return)
 
             if (replacement_tokens)
             {
@@ -1129,6 +1770,22 @@ static inline void macro_replacement_context_evaluate_sub_list (struct cushion_l
                 }
 
                 last->next = cursor->next;
+                if (range && range->end == cursor->next)
+                {
+                    range->depth = depth;
+                }
+                else
+                {
+                    struct macro_evaluation_range_t *new_range = cushion_allocator_allocate (
+                        &state->instance->allocator, sizeof (struct macro_evaluation_range_t),
+                        _Alignof (struct macro_evaluation_range_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+
+                    new_range->previous = range;
+                    new_range->end = cursor->next;
+                    new_range->depth = depth;
+                    range = new_range;
+                }
+
                 cursor = replacement_tokens;
             }
             else
@@ -1205,268 +1862,172 @@ static struct cushion_token_t lex_create_unsigned_integer_token (struct cushion_
     };
 }
 
-/// \return 0 if regular identifier that was not replaced and just injected into sublist, 1 if replacement happened.
-static inline unsigned int macro_replacement_context_process_identifier_into_sub_list (
-    struct cushion_lexer_file_state_t *state, struct macro_replacement_context_t *context)
+static inline struct lex_macro_argument_t *macro_replacement_context_get_argument (
+    struct macro_replacement_context_t *context, unsigned int index)
+{
+    struct lex_macro_argument_t *argument = context->arguments;
+    while (index > 0u)
+    {
+        // There should be no fewer arguments than parameters, otherwise call is malformed.
+        assert (argument);
+        argument = argument->next;
+        --index;
+    }
+
+    return argument;
+}
+
+/// \brief Executes current instruction that produces tokens into sub list and moves to the next instruction.
+static void macro_replacement_context_execute_into_sub_list (struct cushion_lexer_file_state_t *state,
+                                                             struct macro_replacement_context_t *context)
 {
+    const struct cushion_macro_program_t *program = context->program;
+    const struct macro_instruction_t *instruction = &program->instructions[context->instruction_index];
+    ++context->instruction_index;
+
     context->sub_list.first = NULL;
     context->sub_list.last = NULL;
 
-    switch (context->current_token->token.identifier_kind)
+    switch (instruction->type)
     {
-    case CUSHION_IDENTIFIER_KIND_VA_ARGS:
-    case CUSHION_IDENTIFIER_KIND_VA_OPT:
-    {
-        if ((context->macro->flags & CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS) == 0u)
-        {
-            cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context),
-                                              "Caught attempt to use __VA_ARGS__/__VA_OPT__ in non-variadic macro.");
-            return 1u;
-        }
+    case MACRO_INSTRUCTION_TYPE_LITERALS:
+    case MACRO_INSTRUCTION_TYPE_STRINGIZE:
+    case MACRO_INSTRUCTION_TYPE_PASTE:
+        // Never an operand, literals and operators are checked before getting here.
+        assert (0);
+        break;
 
-        struct cushion_macro_parameter_node_t *macro_parameter = context->macro->parameters_first;
-        struct lex_macro_argument_t *first_variadic_argument = context->arguments;
+    case MACRO_INSTRUCTION_TYPE_PARAMETER:
+    {
+        macro_replacement_token_list_append_argument (
+            state, &context->sub_list, macro_replacement_context_get_argument (context, instruction->index),
+            context->replacement_line);
+        break;
+    }
 
-        while (macro_parameter)
-        {
-            macro_parameter = macro_parameter->next;
-            // There should be no fewer arguments than parameters, otherwise call is malformed.
-            assert (first_variadic_argument);
-            first_variadic_argument = first_variadic_argument->next;
-        }
+    case MACRO_INSTRUCTION_TYPE_VA_ARGS:
+    {
+        struct lex_macro_argument_t *argument =
+            macro_replacement_context_get_argument (context, program->parameters_count);
 
-        if (context->current_token->token.identifier_kind == CUSHION_IDENTIFIER_KIND_VA_ARGS)
+        while (argument)
         {
-            struct lex_macro_argument_t *argument = first_variadic_argument;
-            while (argument)
+            macro_replacement_token_list_append_argument (state, &context->sub_list, argument,
+                                                          context->replacement_line);
+            argument = argument->next;
+            if (argument)
             {
-                struct cushion_token_list_item_t *argument_token = argument->tokens_first;
-                while (argument_token)
-                {
-                    macro_replacement_token_list_append (state, &context->sub_list, &argument_token->token,
-                                                         state->tokenization.file_name, context->replacement_line);
-                    argument_token = argument_token->next;
-                }
+                static const char *static_token_string_comma = ",";
+                struct cushion_token_t token_comma = {
+                    .type = CUSHION_TOKEN_TYPE_PUNCTUATOR,
+                    .begin = static_token_string_comma,
+                    .end = static_token_string_comma + 1u,
+                    .punctuator_kind = CUSHION_PUNCTUATOR_KIND_COMMA,
+                };
 
-                argument = argument->next;
-                if (argument)
-                {
-                    static const char *static_token_string_comma = ",";
-                    struct cushion_token_t token_comma = {
-                        .type = CUSHION_TOKEN_TYPE_PUNCTUATOR,
-                        .begin = static_token_string_comma,
-                        .end = static_token_string_comma + 1u,
-                        .punctuator_kind = CUSHION_PUNCTUATOR_KIND_COMMA,
-                    };
-
-                    macro_replacement_token_list_append (state, &context->sub_list, &token_comma,
-                                                         state->tokenization.file_name, context->replacement_line);
-                    // No need for glue white space, as they are not preserved in replacement lists at all.
-                }
+                macro_replacement_token_list_append (state, &context->sub_list, &token_comma,
+                                                     state->tokenization.file_name, context->replacement_line);
+                // No need for glue white space, as they are not preserved in replacement lists at all.
             }
         }
-        else
-        {
-            // __VA_OPT__ should only be replaced if variadic arguments have tokens,
-            // empty variadic argument does not enable content of __VA_OPT__ by standard.
-            unsigned int any_variadic = 0u;
-
-            while (first_variadic_argument)
-            {
-                if (first_variadic_argument->tokens_first)
-                {
-                    any_variadic = 1u;
-                    break;
-                }
-
-                first_variadic_argument = first_variadic_argument->next;
-            }
-
-            // Scan for the opening parenthesis.
-            context->current_token = context->current_token->next;
-            // Preprocessor, new line, glue, comment and end of file should never appear here anyway.
-
-            if (!context->current_token || context->current_token->token.type != CUSHION_TOKEN_TYPE_PUNCTUATOR ||
-                context->current_token->token.punctuator_kind != CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS)
-            {
-                cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context),
-                                                  "Expected \"(\" after __VA_OPT__ in replacement list.");
-                return 1u;
-            }
-
-            // Scan internals of the __VA_OPT__ macro call.
-            unsigned int internal_parenthesis = 0u;
-            context->current_token = context->current_token->next;
-
-            while (1u)
-            {
-                if (!context->current_token)
-                {
-                    cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context),
-                                                      "Got to the end of replacement list while lexing __VA_OPT__.");
-                    break;
-                }
-
-                // Preprocessor, new line, glue and end of file should never appear here anyway.
-                if (context->current_token->token.type == CUSHION_TOKEN_TYPE_PUNCTUATOR)
-                {
-                    if (context->current_token->token.punctuator_kind == CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS)
-                    {
-                        ++internal_parenthesis;
-                    }
-                    else if (context->current_token->token.punctuator_kind == CUSHION_PUNCTUATOR_KIND_RIGHT_PARENTHESIS)
-                    {
-                        if (internal_parenthesis == 0u)
-                        {
-                            // Whole __VA_OPT__ is lexed.
-                            break;
-                        }
 
-                        --internal_parenthesis;
-                    }
-                }
+        break;
+    }
 
-                if (any_variadic)
-                {
-                    // Add token inside __VA_OPT__ only if there are any variadic arguments.
-                    macro_replacement_token_list_append (state, &context->sub_list, &context->current_token->token,
-                                                         state->tokenization.file_name, context->replacement_line);
-                }
+    case MACRO_INSTRUCTION_TYPE_VA_OPT:
+    {
+        // __VA_OPT__ should only be replaced if variadic arguments have tokens,
+        // empty variadic argument does not enable content of __VA_OPT__ by standard.
+        struct lex_macro_argument_t *argument =
+            macro_replacement_context_get_argument (context, program->parameters_count);
 
-                context->current_token = context->current_token->next;
-            }
+        while (argument && !argument->tokens)
+        {
+            argument = argument->next;
         }
 
-        return 1u;
-    }
-
-#if defined(CUSHION_EXTENSIONS)
-    case CUSHION_IDENTIFIER_KIND_CUSHION_WRAPPED:
-    {
-        struct cushion_token_list_item_t *wrapped_token = context->wrapped_tokens;
-        while (wrapped_token)
+        if (argument)
         {
-            struct cushion_token_list_item_t *added = macro_replacement_token_list_append (
-                state, &context->sub_list, &wrapped_token->token, wrapped_token->file, wrapped_token->line);
-            added->flags = wrapped_token->flags;
-            wrapped_token = wrapped_token->next;
+            macro_replacement_token_list_append_program (state, &context->sub_list, program, instruction->index,
+                                                         instruction->index + instruction->count,
+                                                         context->replacement_line);
         }
 
-        return 1u;
+        break;
     }
 
-    case CUSHION_IDENTIFIER_KIND_CUSHION_EVALUATED_ARGUMENT:
+#if defined(CUSHION_EXTENSIONS)
+    case MACRO_INSTRUCTION_TYPE_WRAPPED:
+        macro_replacement_token_list_copy (state, &context->sub_list, context->wrapped_tokens);
+        break;
+
+    case MACRO_INSTRUCTION_TYPE_EVALUATED_ARGUMENT:
     {
-        // Scan for the opening parenthesis.
-        context->current_token = context->current_token->next;
-        // Preprocessor, new line, glue, comment and end of file should never appear here anyway.
+        // Arguments and __VA_ARGS__ are evaluated at most once per invocation, like prescan in standard does.
+        // __VA_OPT__ content comes from replacement list and is not memoized as it is rarely evaluated twice.
+        const struct macro_instruction_t *operand = &program->instructions[context->instruction_index];
+        struct lex_macro_argument_t *memoized = NULL;
 
-        if (!context->current_token || context->current_token->token.type != CUSHION_TOKEN_TYPE_PUNCTUATOR ||
-            context->current_token->token.punctuator_kind != CUSHION_PUNCTUATOR_KIND_LEFT_PARENTHESIS)
+        if (operand->type == MACRO_INSTRUCTION_TYPE_PARAMETER)
         {
-            cushion_instance_execution_error (
-                state->instance, macro_replacement_error_context (state, context),
-                "Expected \"(\" after __CUSHION_EVALUATED_ARGUMENT__ in replacement list.");
-            return 1u;
+            memoized = macro_replacement_context_get_argument (context, operand->index);
         }
-
-        context->current_token = context->current_token->next;
-        // Preprocessor, new line, glue, comment and end of file should never appear here anyway.
-
-        if (!context->current_token || context->current_token->token.type != CUSHION_TOKEN_TYPE_IDENTIFIER)
+        else if (operand->type == MACRO_INSTRUCTION_TYPE_VA_ARGS)
         {
-            cushion_instance_execution_error (
-                state->instance, macro_replacement_error_context (state, context),
-                "Expected identifier as __CUSHION_EVALUATED_ARGUMENT__ argument in replacement list.");
-            return 1u;
+            memoized = macro_replacement_context_get_argument (context, program->parameters_count);
         }
 
-        // Gather input argument/__VA_ARGS__/__VA_OPT__ tokens into sublist.
-        if (!macro_replacement_context_process_identifier_into_sub_list (state, context))
+        if (memoized && memoized->evaluated)
         {
-            cushion_instance_execution_error (
-                state->instance, macro_replacement_error_context (state, context),
-                "Expected argument name, __VA_ARGS__ or __VA_OPT__ as __CUSHION_EVALUATED_ARGUMENT__ argument in "
-                "replacement list, but got another identifier.");
-            return 1u;
+            ++context->instruction_index;
+            macro_replacement_token_list_copy (state, &context->sub_list, memoized->evaluated_first);
+            break;
         }
 
-        if (!context->sub_list.first)
+        // Gather input argument/__VA_ARGS__/__VA_OPT__ tokens into sub list and evaluate them if there are any.
+        macro_replacement_context_execute_into_sub_list (state, context);
+        if (context->sub_list.first && !cushion_instance_is_error_signaled (state->instance))
         {
-            // Nothing to evaluate.
-            return 1u;
-        }
+            if (state->evaluation_nesting >= CUSHION_MACRO_EVALUATION_NESTING_LIMIT)
+            {
+                cushion_instance_execution_error (
+                    state->instance, macro_replacement_error_context (state, context),
+                    "Reached nested argument evaluation limit %u while replacing macro %s, it is most likely "
+                    "recursive. Limit can be changed through CUSHION_MACRO_EVALUATION_NESTING_LIMIT build option.",
+                    (unsigned int) CUSHION_MACRO_EVALUATION_NESTING_LIMIT, context->macro->name);
+                break;
+            }
 
-        macro_replacement_context_evaluate_sub_list (state, context);
-        context->current_token = context->current_token->next;
-        // Preprocessor, new line, glue, comment and end of file should never appear here anyway.
+            ++state->evaluation_nesting;
+            macro_replacement_context_evaluate_sub_list (state, context);
+            --state->evaluation_nesting;
+        }
 
-        if (!context->current_token || context->current_token->token.type != CUSHION_TOKEN_TYPE_PUNCTUATOR ||
-            context->current_token->token.punctuator_kind != CUSHION_PUNCTUATOR_KIND_RIGHT_PARENTHESIS)
+        if (memoized && !cushion_instance_is_error_signaled (state->instance))
         {
-            cushion_instance_execution_error (
-                state->instance, macro_replacement_error_context (state, context),
-                "Expected \")\" after __CUSHION_EVALUATED_ARGUMENT__ argument in replacement list.");
-            return 1u;
+            struct macro_replacement_token_list_t evaluated = {NULL, NULL};
+            macro_replacement_token_list_copy (state, &evaluated, context->sub_list.first);
+            memoized->evaluated = 1u;
+            memoized->evaluated_first = evaluated.first;
         }
 
-        return 1u;
+        break;
     }
 
-    case CUSHION_IDENTIFIER_KIND_CUSHION_REPLACEMENT_INDEX:
+    case MACRO_INSTRUCTION_TYPE_REPLACEMENT_INDEX:
     {
         // Other parts of code might expect stringized value of literal, so we need to create it, unfortunately.
         struct cushion_token_t token = lex_create_unsigned_integer_token (state, context->replacement_index);
         macro_replacement_token_list_append (state, &context->sub_list, &token, state->tokenization.file_name,
                                              context->replacement_line);
-        return 1u;
+        break;
     }
 #endif
 
-    default:
-    {
-        struct lex_macro_argument_t *found_argument = context->arguments;
-        struct cushion_macro_parameter_node_t *found_parameter = context->macro->parameters_first;
-
-        if (found_parameter)
-        {
-            const unsigned int hash = cushion_hash_djb2_char_sequence (context->current_token->token.begin,
-                                                                       context->current_token->token.end);
-            const size_t token_length = context->current_token->token.end - context->current_token->token.begin;
-
-            while (found_parameter)
-            {
-                if (found_parameter->name_hash == hash && strlen (found_parameter->name) == token_length &&
-                    strncmp (found_parameter->name, context->current_token->token.begin, token_length) == 0)
-                {
-                    break;
-                }
-
-                found_parameter = found_parameter->next;
-                // There should be no fewer arguments than parameters, otherwise call is malformed.
-                assert (found_argument);
-                found_argument = found_argument->next;
-            }
-        }
-
-        if (found_parameter && found_argument)
-        {
-            struct cushion_token_list_item_t *argument_token = found_argument->tokens_first;
-            while (argument_token)
-            {
-                macro_replacement_token_list_append (state, &context->sub_list, &argument_token->token,
-                                                     state->tokenization.file_name, context->replacement_line);
-                argument_token = argument_token->next;
-            }
-
-            return 1u;
-        }
-
-        // Just a regular identifier.
-        macro_replacement_token_list_append (state, &context->sub_list, &context->current_token->token,
-                                             state->tokenization.file_name, context->replacement_line);
-        return 0u;
-    }
+    case MACRO_INSTRUCTION_TYPE_ERROR:
+        cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context), "%s",
+                                          instruction->error_message);
+        break;
     }
 }
 
@@ -1478,191 +2039,80 @@ static void macro_replacement_context_append_sub_list (struct macro_replacement_
         {
             context->result.last->next = context->sub_list.first;
         }
-        else
-        {
-            context->result.first = context->sub_list.first;
-        }
-
-        context->result.last = context->sub_list.last;
-    }
-}
-
-static struct cushion_token_list_item_t *lex_do_macro_replacement (
-    struct cushion_lexer_file_state_t *state,
-    struct cushion_macro_node_t *macro,
-    struct lex_macro_argument_t *arguments,
-    struct cushion_token_list_item_t *wrapped_tokens,
-    // Replacement line is used to properly set file name and line marker information for replacement tokens.
-    unsigned int replacement_line)
-{
-    // Technically, full replacement pass is only needed for function-like macros as we need to properly process
-    // arguments. However, object-like macros can still use ## operation to merge tokens. It should be processed
-    // properly in lex_replacement_list function, but it would complicate that function with knowledge of arguments
-    // and would make it logic much more complicated. Therefore, we do full replacement for object-like macros too
-    // in this function.
-
-    struct macro_replacement_context_t context = {
-        .macro = macro,
-        .arguments = arguments,
-        .wrapped_tokens = wrapped_tokens,
-        .current_token = macro->replacement_list_first,
-        .replacement_line = replacement_line,
-        .result =
-            {
-                .first = NULL,
-                .last = NULL,
-            },
-        .sub_list =
-            {
-                .first = NULL,
-                .last = NULL,
-            },
-#if defined(CUSHION_EXTENSIONS)
-        .replacement_index = state->instance->macro_replacement_index++,
-#endif
-    };
-
-    while (context.current_token && !cushion_instance_is_error_signaled (state->instance))
-    {
-        switch (context.current_token->token.type)
-        {
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_IF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFDEF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFNDEF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFDEF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFNDEF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELSE:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_ENDIF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_INCLUDE:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_SYSTEM:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_DEFINE:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_UNDEF:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_LINE:
-        case CUSHION_TOKEN_TYPE_PREPROCESSOR_PRAGMA:
-        case CUSHION_TOKEN_TYPE_NEW_LINE:
-        case CUSHION_TOKEN_TYPE_COMMENT:
-        case CUSHION_TOKEN_TYPE_GLUE:
-        case CUSHION_TOKEN_TYPE_END_OF_FILE:
-            // Must never be a part of valid lexed macro.
-            assert (0);
-            break;
-
-        case CUSHION_TOKEN_TYPE_IDENTIFIER:
-        {
-            macro_replacement_context_process_identifier_into_sub_list (state, &context);
-            if (!cushion_instance_is_error_signaled (state->instance))
-            {
-                macro_replacement_context_append_sub_list (&context);
-            }
-
-            break;
-        }
-
-        case CUSHION_TOKEN_TYPE_PUNCTUATOR:
-            switch (context.current_token->token.punctuator_kind)
-            {
-            case CUSHION_PUNCTUATOR_KIND_HASH:
-            {
-                // Stringify next argument, skipping comments. Error if next token is not an argument.
-                context.current_token = context.current_token->next;
-                // Preprocessor, new line, glue, comment and end of file should never appear here anyway.
-
-                if (!context.current_token)
-                {
-                    cushion_instance_execution_error (
-                        state->instance, macro_replacement_error_context (state, &context),
-                        "Encountered \"#\" operator as a last token in macro replacement list.");
-                    break;
-                }
-
-                if (context.current_token->token.type != CUSHION_TOKEN_TYPE_IDENTIFIER)
-                {
-                    cushion_instance_execution_error (
-                        state->instance, macro_replacement_error_context (state, &context),
-                        "Non-comment token following \"#\" operator is not an identifier.");
-                    break;
-                }
+        else
+        {
+            context->result.first = context->sub_list.first;
+        }
 
-                if (!macro_replacement_context_process_identifier_into_sub_list (state, &context))
-                {
-                    cushion_instance_execution_error (
-                        state->instance, macro_replacement_error_context (state, &context),
-                        "Expected argument name, __VA_ARGS__ or __VA_OPT__ as \"#\" operand in "
-                        "replacement list, but got another identifier.");
-                    break;
-                }
+        context->result.last = context->sub_list.last;
+    }
+}
 
-                const unsigned int stringized_size =
-                    2u + lex_calculate_stringized_internal_size (context.sub_list.first);
+static void macro_replacement_context_stringize (struct cushion_lexer_file_state_t *state,
+                                                 struct macro_replacement_context_t *context)
+{
+    macro_replacement_context_execute_into_sub_list (state, context);
+    LEX_WHEN_ERROR (return)
 
-                struct cushion_token_t stringized_token;
-                stringized_token.type = CUSHION_TOKEN_TYPE_STRING_LITERAL;
-                stringized_token.begin =
-                    cushion_allocator_allocate (&state->instance->allocator, stringized_size + 1u, _Alignof (char),
-                                                CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    const unsigned int stringized_size = 2u + lex_calculate_stringized_internal_size (context->sub_list.first);
+    struct cushion_token_t stringized_token;
+    stringized_token.type = CUSHION_TOKEN_TYPE_STRING_LITERAL;
+    stringized_token.begin = cushion_allocator_allocate (&state->instance->allocator, stringized_size + 1u,
+                                                         _Alignof (char), CUSHION_ALLOCATION_CLASS_TRANSIENT);
 
-                stringized_token.end = stringized_token.begin + stringized_size;
-                *(char *) stringized_token.end = '\0';
+    stringized_token.end = stringized_token.begin + stringized_size;
+    *(char *) stringized_token.end = '\0';
 
-                stringized_token.symbolic_literal.encoding = CUSHION_TOKEN_SUBSEQUENCE_ENCODING_ORDINARY;
-                stringized_token.symbolic_literal.begin = stringized_token.begin + 1u;
-                stringized_token.symbolic_literal.end = stringized_token.end - 1u;
+    stringized_token.symbolic_literal.encoding = CUSHION_TOKEN_SUBSEQUENCE_ENCODING_ORDINARY;
+    stringized_token.symbolic_literal.begin = stringized_token.begin + 1u;
+    stringized_token.symbolic_literal.end = stringized_token.end - 1u;
 
 #if !defined(NDEBUG)
-                const char *output_end =
+    const char *output_end =
 #endif
-                    lex_write_stringized_internal_tokens (context.sub_list.first,
-                                                          (char *) stringized_token.symbolic_literal.begin);
-
-                assert (output_end <= stringized_token.symbolic_literal.end);
-                *(char *) stringized_token.begin = '"';
-                *(char *) stringized_token.symbolic_literal.end = '"';
-                macro_replacement_token_list_append (state, &context.result, &stringized_token,
-                                                     state->tokenization.file_name, context.replacement_line);
-                break;
-            }
-
-            case CUSHION_PUNCTUATOR_KIND_DOUBLE_HASH:
-            {
-                // Technically, we could optimize token-append operation by firstly calculating whole append sequence
-                // and then doing merge, but it makes implementation more complicated and should not affect performance
-                // that much, therefore simple merge is used right now.
+        lex_write_stringized_internal_tokens (context->sub_list.first,
+                                              (char *) stringized_token.symbolic_literal.begin);
+
+    assert (output_end <= stringized_token.symbolic_literal.end);
+    *(char *) stringized_token.begin = '"';
+    *(char *) stringized_token.symbolic_literal.end = '"';
+    macro_replacement_token_list_append (state, &context->result, &stringized_token, state->tokenization.file_name,
+                                         context->replacement_line);
+}
 
-                if (!context.result.last)
-                {
-                    cushion_instance_execution_error (
-                        state->instance, macro_replacement_error_context (state, &context),
-                        "Encountered \"##\" operator as a first token in macro replacement list.");
-                    break;
-                }
+static void macro_replacement_context_paste (struct cushion_lexer_file_state_t *state,
+                                             struct macro_replacement_context_t *context)
+{
+    // Technically, we could optimize token-append operation by firstly calculating whole append sequence and then
+    // doing merge, but it makes implementation more complicated and should not affect performance that much,
+    // therefore simple merge is used right now.
 
-                if (context.result.last->token.type != CUSHION_TOKEN_TYPE_IDENTIFIER)
-                {
-                    cushion_instance_execution_error (
-                        state->instance, macro_replacement_error_context (state, &context),
-                        "Encountered \"##\" operator after non-identifier token, which is "
-                        "currently not supported by Cushion (but possible in standard).");
-                    break;
-                }
+    if (!context->result.last)
+    {
+        cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context),
+                                          "Encountered \"##\" operator as a first token in macro replacement list.");
+        return;
+    }
 
-                // Identifiers can actually sometimes be resolved into empty token sequences.
-                // Therefore, we need a loop here.
+    if (context->result.last->token.type != CUSHION_TOKEN_TYPE_IDENTIFIER)
+    {
+        cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context),
+                                          "Encountered \"##\" operator after non-identifier token, which is "
+                                          "currently not supported by Cushion (but possible in standard).");
+        return;
+    }
 
-                while (1u)
-                {
-                    // Find next token for merging.
-                    context.current_token = context.current_token->next;
-                    // Preprocessor, new line, glue, comment and end of file should never appear here anyway.
+    const struct cushion_macro_program_t *program = context->program;
+    // Identifiers can actually sometimes be resolved into empty token sequences. Therefore, we need a loop here.
 
-                    if (!context.current_token)
-                    {
-                        cushion_instance_execution_error (
-                            state->instance, macro_replacement_error_context (state, &context),
-                            "Encountered \"##\" operator as a last token in macro replacement list.");
-                        break;
-                    }
+    while (1u)
+    {
+        if (context->instruction_index >= program->instructions_count)
+        {
+            cushion_instance_execution_error (state->instance, macro_replacement_error_context (state, context),
+                                              "Encountered \"##\" operator as a last token in macro replacement list.");
+            return;
+        }
 
 #define CHECK_APPENDED_TOKEN_TYPE(TYPE)                                                                                \
     switch (TYPE)                                                                                                      \
@@ -1675,81 +2125,156 @@ static struct cushion_token_list_item_t *lex_do_macro_replacement (
                                                                                                                        \
     default:                                                                                                           \
         cushion_instance_execution_error (                                                                             \
-            state->instance, macro_replacement_error_context (state, &context),                                        \
+            state->instance, macro_replacement_error_context (state, context),                                         \
             "Encountered \"##\" operator before token which is not an identifier and not an integer, "                 \
             "which is currently not supported by Cushion (but possible in standard).");                                \
-        break;                                                                                                         \
-    }                                                                                                                  \
-                                                                                                                       \
-    if (cushion_instance_is_error_signaled (state->instance))                                                          \
-    {                                                                                                                  \
-        break;                                                                                                         \
+        return;                                                                                                        \
     }
 
-                    CHECK_APPENDED_TOKEN_TYPE (context.current_token->token.type)
-                    macro_replacement_context_process_identifier_into_sub_list (state, &context);
+        const struct macro_instruction_t *instruction = &program->instructions[context->instruction_index];
+        if (instruction->type == MACRO_INSTRUCTION_TYPE_LITERALS)
+        {
+            // Only one literal is merged, the rest of them are appended as usual.
+            const unsigned int index = instruction->index + context->literal_offset;
+            CHECK_APPENDED_TOKEN_TYPE ((enum cushion_token_type_t) program->tokens[index].type)
 
-                    if (!context.sub_list.first)
-                    {
-                        // Empty sub list, check next identifier.
-                        continue;
-                    }
+            context->sub_list.first = NULL;
+            context->sub_list.last = NULL;
+            macro_replacement_token_list_append_program (state, &context->sub_list, program, index, index + 1u,
+                                                         context->replacement_line);
+
+            if (++context->literal_offset == instruction->count)
+            {
+                context->literal_offset = 0u;
+                ++context->instruction_index;
+            }
+        }
+        else
+        {
+            CHECK_APPENDED_TOKEN_TYPE (instruction->token_type)
+            macro_replacement_context_execute_into_sub_list (state, context);
+            LEX_WHEN_ERROR (return)
+
+            if (!context->sub_list.first)
+            {
+                // Empty sub list, check next instruction.
+                continue;
+            }
+        }
 
-                    CHECK_APPENDED_TOKEN_TYPE (context.sub_list.first->token.type)
+        CHECK_APPENDED_TOKEN_TYPE (context->sub_list.first->token.type)
 #undef CHECK_APPENDED_TOKEN_TYPE
 
-                    unsigned int base_identifier_length =
-                        (unsigned int) (context.result.last->token.end - context.result.last->token.begin);
+        unsigned int base_identifier_length =
+            (unsigned int) (context->result.last->token.end - context->result.last->token.begin);
 
-                    unsigned int append_identifier_length =
-                        (unsigned int) (context.sub_list.first->token.end - context.sub_list.first->token.begin);
+        unsigned int append_identifier_length =
+            (unsigned int) (context->sub_list.first->token.end - context->sub_list.first->token.begin);
 
-                    char *new_token_data = cushion_allocator_allocate (
-                        &state->instance->allocator, base_identifier_length + append_identifier_length + 1u,
-                        _Alignof (char), CUSHION_ALLOCATION_CLASS_TRANSIENT);
-                    char *new_token_data_end = new_token_data + base_identifier_length + append_identifier_length;
+        char *new_token_data = cushion_allocator_allocate (&state->instance->allocator,
+                                                           base_identifier_length + append_identifier_length + 1u,
+                                                           _Alignof (char), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+        char *new_token_data_end = new_token_data + base_identifier_length + append_identifier_length;
 
-                    memcpy (new_token_data, context.result.last->token.begin, base_identifier_length);
-                    memcpy (new_token_data + base_identifier_length, context.sub_list.first->token.begin,
-                            append_identifier_length);
-                    *new_token_data_end = '\0';
+        memcpy (new_token_data, context->result.last->token.begin, base_identifier_length);
+        memcpy (new_token_data + base_identifier_length, context->sub_list.first->token.begin,
+                append_identifier_length);
+        *new_token_data_end = '\0';
 
-                    context.result.last->token.begin = new_token_data;
-                    context.result.last->token.end = new_token_data_end;
-                    context.result.last->token.identifier_kind = lex_relculate_identifier_kind (
-                        context.result.last->token.begin, context.result.last->token.end);
+        const unsigned int new_symbol =
+            cushion_instance_symbol_intern (state->instance, new_token_data, new_token_data_end);
+        const struct cushion_symbol_t *symbol = cushion_instance_symbol_get (state->instance, new_symbol);
 
-                    context.sub_list.first = context.sub_list.first->next;
-                    macro_replacement_context_append_sub_list (&context);
-                    break;
-                }
+        context->result.last->token.begin = symbol->name;
+        context->result.last->token.end = symbol->name + symbol->name_length;
+        context->result.last->token.identifier_kind =
+            lex_relculate_identifier_kind (context->result.last->token.begin, context->result.last->token.end);
+        context->result.last->token.symbol = new_symbol;
 
-                break;
-            }
+        context->sub_list.first = context->sub_list.first->next;
+        macro_replacement_context_append_sub_list (context);
+        return;
+    }
+}
 
-            default:
-                macro_replacement_token_list_append (state, &context.result, &context.current_token->token,
-                                                     state->tokenization.file_name, context.replacement_line);
-                break;
-            }
+static struct cushion_token_list_item_t *lex_do_macro_replacement (
+    struct cushion_lexer_file_state_t *state,
+    struct cushion_macro_node_t *macro,
+    struct lex_macro_argument_t *arguments,
+    struct cushion_token_list_item_t *wrapped_tokens,
+    // Replacement line is used to properly set file name and line marker information for replacement tokens.
+    unsigned int replacement_line)
+{
+    // Technically, full replacement pass is only needed for function-like macros as we need to properly process
+    // arguments. However, object-like macros can still use ## operation to merge tokens. It should be processed
+    // properly in lex_replacement_list function, but it would complicate that function with knowledge of arguments
+    // and would make it logic much more complicated. Therefore, we do full replacement for object-like macros too
+    // in this function.
+
+    if (!macro->program)
+    {
+        macro->program = macro_program_compile (state->instance, macro);
+    }
+
+    struct macro_replacement_context_t context = {
+        .macro = macro,
+        .arguments = arguments,
+        .wrapped_tokens = wrapped_tokens,
+        .program = macro->program,
+        .instruction_index = 0u,
+        .literal_offset = 0u,
+        .replacement_line = replacement_line,
+        .result =
+            {
+                .first = NULL,
+                .last = NULL,
+            },
+        .sub_list =
+            {
+                .first = NULL,
+                .last = NULL,
+            },
+#if defined(CUSHION_EXTENSIONS)
+        .replacement_index = state->instance->macro_replacement_index++,
+#endif
+    };
+
+    const struct cushion_macro_program_t *program = context.program;
+    while (context.instruction_index < program->instructions_count &&
+           !cushion_instance_is_error_signaled (state->instance))
+    {
+        const struct macro_instruction_t *instruction = &program->instructions[context.instruction_index];
+        switch (instruction->type)
+        {
+        case MACRO_INSTRUCTION_TYPE_LITERALS:
+            // Literals might be partially consumed by the previous "##" operator.
+            macro_replacement_token_list_append_program (state, &context.result, program,
+                                                         instruction->index + context.literal_offset,
+                                                         instruction->index + instruction->count,
+                                                         context.replacement_line);
 
+            context.literal_offset = 0u;
+            ++context.instruction_index;
             break;
 
-        case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
-        case CUSHION_TOKEN_TYPE_NUMBER_FLOATING:
-        case CUSHION_TOKEN_TYPE_DIGIT_IDENTIFIER_SEQUENCE:
-        case CUSHION_TOKEN_TYPE_CHARACTER_LITERAL:
-        case CUSHION_TOKEN_TYPE_STRING_LITERAL:
-        case CUSHION_TOKEN_TYPE_OTHER:
-            macro_replacement_token_list_append (state, &context.result, &context.current_token->token,
-                                                 state->tokenization.file_name, context.replacement_line);
+        case MACRO_INSTRUCTION_TYPE_STRINGIZE:
+            ++context.instruction_index;
+            macro_replacement_context_stringize (state, &context);
             break;
-        }
 
-        // Tokens might be consumed internally in switch in rare cases, therefore we need to check for NULL again.
-        if (context.current_token)
-        {
-            context.current_token = context.current_token->next;
+        case MACRO_INSTRUCTION_TYPE_PASTE:
+            ++context.instruction_index;
+            macro_replacement_context_paste (state, &context);
+            break;
+
+        default:
+            macro_replacement_context_execute_into_sub_list (state, &context);
+            if (!cushion_instance_is_error_signaled (state->instance))
+            {
+                macro_replacement_context_append_sub_list (&context);
+            }
+
+            break;
         }
     }
 
@@ -1809,8 +2334,30 @@ struct lex_replace_macro_result_t
 {
     unsigned int replaced;
     struct cushion_token_list_item_t *tokens;
+
+    /// \brief Shared cached expansion that is used instead of tokens, its tokens should be pushed with given line.
+    const struct cushion_token_array_t *array;
+    unsigned int line;
+
+    /// \brief Rescan depth of replacement tokens, see lexer_token_stack_item_t::depth.
+    unsigned int depth;
 };
 
+static inline void lexer_file_state_push_replacement (struct cushion_lexer_file_state_t *state,
+                                                      const struct lex_replace_macro_result_t *result)
+{
+    if (result->array)
+    {
+        lexer_file_state_push_array (state, result->array, LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT, result->line,
+                                     result->depth);
+    }
+    else
+    {
+        lexer_file_state_push_tokens (state, result->tokens, LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT,
+                                      result->depth);
+    }
+}
+
 static struct lex_replace_macro_result_t lex_replace_identifier_if_macro (
     struct cushion_lexer_file_state_t *state,
     struct cushion_token_t *identifier_token,
@@ -2027,8 +2574,7 @@ static inline void lex_preprocessor_preserved_tail (
 
             if (replace_result.replaced)
             {
-                lexer_file_state_push_tokens (state, replace_result.tokens,
-                                              LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT);
+                lexer_file_state_push_replacement (state, &replace_result);
             }
             else
             {
@@ -2067,6 +2613,118 @@ static inline void lex_preprocessor_preserved_tail (
     }
 }
 
+enum macro_expansion_state_t
+{
+    /// \brief Macro was replaced once with current definition, replacement is cached on the next replacement.
+    MACRO_EXPANSION_STATE_SEEN = 0u,
+
+    MACRO_EXPANSION_STATE_CACHED,
+
+    /// \brief Replacement is different every time, for example it uses __CUSHION_REPLACEMENT_INDEX__.
+    MACRO_EXPANSION_STATE_UNCACHEABLE,
+};
+
+struct cushion_macro_expansion_t
+{
+    enum macro_expansion_state_t state;
+
+    /// \brief Macro generation of the symbol for which this expansion is valid.
+    unsigned int generation;
+
+    /// \brief Replacement tokens, shared by every replacement, therefore they are never modified after building.
+    /// \details Tokens are pushed as is and rescanned as usual, so nested macros use their own cached replacements.
+    ///          Location dependent identifiers like __LINE__ are resolved during rescan using stack item location.
+    const struct cushion_token_array_t *tokens;
+};
+
+/// \brief Returns replacement of object-like macro if it is cached for current definition of the macro.
+/// \details Replacement is cached on the second replacement with the same definition, so macros that are used once
+///          after being defined do not pay for caching. Returns NULL when regular replacement should be done instead.
+static struct cushion_macro_expansion_t *macro_expansion_cache_get (struct cushion_lexer_file_state_t *state,
+                                                                    struct cushion_macro_node_t *macro,
+                                                                    unsigned int replacement_line)
+{
+    struct cushion_instance_t *instance = state->instance;
+    struct cushion_macro_expansion_t *expansion = macro->expansion;
+    const unsigned int generation = instance->symbol_table.symbols[macro->symbol].macro_generation;
+
+    if (!expansion || expansion->generation != generation)
+    {
+        if (!expansion)
+        {
+            expansion = cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_macro_expansion_t),
+                                                    _Alignof (struct cushion_macro_expansion_t),
+                                                    CUSHION_ALLOCATION_CLASS_PERSISTENT);
+            macro->expansion = expansion;
+        }
+
+        expansion->state = MACRO_EXPANSION_STATE_SEEN;
+        expansion->generation = generation;
+        expansion->tokens = NULL;
+        return NULL;
+    }
+
+    switch (expansion->state)
+    {
+    case MACRO_EXPANSION_STATE_SEEN:
+        break;
+
+    case MACRO_EXPANSION_STATE_CACHED:
+#if defined(CUSHION_EXTENSIONS)
+        // Keep replacement index the same as if replacement was done.
+        ++instance->macro_replacement_index;
+#endif
+        return expansion;
+
+    case MACRO_EXPANSION_STATE_UNCACHEABLE:
+        return NULL;
+    }
+
+#if defined(CUSHION_EXTENSIONS)
+    if (macro->flags & (CUSHION_MACRO_FLAG_WRAPPED | CUSHION_MACRO_FLAG_SNIPPET))
+    {
+        expansion->state = MACRO_EXPANSION_STATE_UNCACHEABLE;
+        return NULL;
+    }
+#endif
+
+    if (!macro->program)
+    {
+        macro->program = macro_program_compile (state->instance, macro);
+    }
+
+    for (unsigned int index = 0u; index < macro->program->instructions_count; ++index)
+    {
+        // Replacement index differs for every replacement and errors should be reported by regular replacement.
+        if (macro->program->instructions[index].type != MACRO_INSTRUCTION_TYPE_LITERALS &&
+            macro->program->instructions[index].type != MACRO_INSTRUCTION_TYPE_PASTE)
+        {
+            expansion->state = MACRO_EXPANSION_STATE_UNCACHEABLE;
+            return NULL;
+        }
+    }
+
+    if (macro->program->instructions_count == 1u &&
+        macro->program->instructions[0u].type == MACRO_INSTRUCTION_TYPE_LITERALS)
+    {
+        // Only literals, replacement is exactly the same as replacement list.
+#if defined(CUSHION_EXTENSIONS)
+        ++instance->macro_replacement_index;
+#endif
+        expansion->state = MACRO_EXPANSION_STATE_CACHED;
+        expansion->tokens = macro->replacement_list;
+        return expansion;
+    }
+
+    struct cushion_token_list_item_t *tokens = lex_do_macro_replacement (state, macro, NULL, NULL, replacement_line);
+    LEX_WHEN_ERROR (return NULL)
+
+    // Replacement result is transient, but cached replacement must live as long as the macro.
+    expansion->state = MACRO_EXPANSION_STATE_CACHED;
+    expansion->tokens = cushion_save_token_list_to_array (instance, tokens, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    return expansion;
+}
+
 static struct lex_replace_macro_result_t lex_replace_identifier_if_macro (
     struct cushion_lexer_file_state_t *state,
     struct cushion_token_t *identifier_token,
@@ -2074,18 +2732,31 @@ static struct lex_replace_macro_result_t lex_replace_identifier_if_macro (
     enum lex_replace_identifier_if_macro_context_t context)
 {
     struct cushion_macro_node_t *macro =
-        cushion_instance_macro_search (state->instance, identifier_token->begin, identifier_token->end);
+        cushion_instance_macro_search_symbol (state->instance, identifier_token->symbol);
 
 #define RETURN_NOT_REPLACED                                                                                            \
     return (struct lex_replace_macro_result_t) { .replaced = 0u, .tokens = NULL }
 
-    if (!macro || (macro->flags & CUSHION_MACRO_FLAG_PRESERVED))
+    if (!macro || (macro->flags & CUSHION_MACRO_FLAG_PRESERVED) || cushion_instance_is_error_signaled (state->instance))
+    {
+        // No need to unwrap or lazy replacement list has failed to lex.
+        RETURN_NOT_REPLACED;
+    }
+
+    // Rescans are driven by token stack instead of recursion, so runaway self-referencing macros would loop forever.
+    if (identifier_token_meta->depth >= CUSHION_MACRO_EXPANSION_DEPTH_LIMIT)
     {
-        // No need to unwrap.
+        cushion_instance_lexer_error (state, identifier_token_meta,
+                                      "Reached macro expansion depth limit %u while replacing macro %s, it is most "
+                                      "likely recursive. Limit can be changed through "
+                                      "CUSHION_MACRO_EXPANSION_DEPTH_LIMIT build option.",
+                                      (unsigned int) CUSHION_MACRO_EXPANSION_DEPTH_LIMIT, macro->name);
         RETURN_NOT_REPLACED;
     }
 
     const unsigned int start_line = identifier_token_meta->line;
+    const unsigned int replacement_depth = identifier_token_meta->depth + 1u;
+
     switch (context)
     {
     case LEX_REPLACE_IDENTIFIER_IF_MACRO_CONTEXT_CODE:
@@ -2105,11 +2776,25 @@ static struct lex_replace_macro_result_t lex_replace_identifier_if_macro (
         break;
     }
 
+    if (!(macro->flags & CUSHION_MACRO_FLAG_FUNCTION))
+    {
+        struct cushion_macro_expansion_t *expansion = macro_expansion_cache_get (state, macro, start_line);
+        LEX_WHEN_ERROR (RETURN_NOT_REPLACED)
+
+        if (expansion)
+        {
+            return (struct lex_replace_macro_result_t) {.replaced = 1u,
+                                                        .tokens = NULL,
+                                                        .array = expansion->tokens,
+                                                        .line = start_line,
+                                                        .depth = replacement_depth};
+        }
+    }
+
     struct lex_macro_argument_t *arguments = NULL;
     if (macro->flags & CUSHION_MACRO_FLAG_FUNCTION)
     {
-        struct lex_macro_argument_read_context_t argument_context =
-            lex_macro_argument_read_context_init (macro, start_line);
+        struct lex_macro_argument_read_context_t argument_context = lex_macro_argument_read_context_init (macro);
 
         // Scan for the opening parenthesis.
         unsigned int skipping_until_significant = 1u;
@@ -2325,7 +3010,10 @@ static struct lex_replace_macro_result_t lex_replace_identifier_if_macro (
 #endif
 
     return (struct lex_replace_macro_result_t) {
-        .replaced = 1u, .tokens = lex_do_macro_replacement (state, macro, arguments, wrapped_tokens_first, start_line)};
+        .replaced = 1u,
+        .tokens = lex_do_macro_replacement (state, macro, arguments, wrapped_tokens_first, start_line),
+        .array = NULL,
+        .depth = replacement_depth};
 #undef RETURN_NOT_REPLACED
 }
 
@@ -2394,7 +3082,7 @@ static long long lex_do_defined_check (struct cushion_lexer_file_state_t *state,
             return 0u;
 
         default:
-            return cushion_instance_macro_search (state->instance, current_token->begin, current_token->end) ? 1u : 0u;
+            return cushion_instance_macro_is_defined (state->instance, current_token->symbol);
         }
 
         break;
@@ -2509,8 +3197,7 @@ static long long lex_preprocessor_evaluate_argument (struct cushion_lexer_file_s
                     return 0;
                 }
 
-                lexer_file_state_push_tokens (state, replace_result.tokens,
-                                              LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT);
+                lexer_file_state_push_replacement (state, &replace_result);
                 break;
             }
             }
@@ -3332,6 +4019,20 @@ static void lex_preprocessor_ifdef (struct cushion_lexer_file_state_t *state, un
     long long check_result = lex_do_defined_check (state, &current_token, &current_token_meta);
     LEX_WHEN_ERROR (return)
 
+    // First significant directive in file that is #ifndef is an include guard candidate.
+    // Name is copied right away as token data might be moved by input buffer refill.
+    const unsigned int include_guard_candidate =
+        reverse && state->include_guard_state == CUSHION_LEXER_INCLUDE_GUARD_STATE_START;
+    const char *include_guard_name_begin = NULL;
+    const char *include_guard_name_end = NULL;
+
+    if (include_guard_candidate)
+    {
+        include_guard_name_begin = cushion_instance_copy_char_sequence_inside (
+            state->instance, current_token.begin, current_token.end, CUSHION_ALLOCATION_CLASS_TRANSIENT);
+        include_guard_name_end = include_guard_name_begin + (current_token.end - current_token.begin);
+    }
+
     lex_preprocessor_expect_new_line (state);
     LEX_WHEN_ERROR (return)
 
@@ -3350,6 +4051,15 @@ static void lex_preprocessor_ifdef (struct cushion_lexer_file_state_t *state, un
 
     node->line = start_line;
     state->conditional_inclusion_node = node;
+
+    if (include_guard_candidate)
+    {
+        state->include_guard_state = CUSHION_LEXER_INCLUDE_GUARD_STATE_INSIDE;
+        state->include_guard_node = node;
+        state->include_guard_name_begin = include_guard_name_begin;
+        state->include_guard_name_end = include_guard_name_end;
+    }
+
     lex_update_tokenization_flags (state);
 }
 
@@ -3514,30 +4224,102 @@ static void lex_preprocessor_endif (struct cushion_lexer_file_state_t *state,
     lex_update_tokenization_flags (state);
 }
 
-static unsigned int lex_preprocessor_try_include (struct cushion_lexer_file_state_t *state,
-                                                  const struct cushion_token_t *header_token,
-                                                  const struct lexer_pop_token_meta_t *header_token_meta,
-                                                  struct cushion_include_node_t *include_node)
+/// \brief Checks whether header exists at path inside given directory and saves it into resolution if it does.
+/// \details Directory might be NULL, then header path is checked as is.
+static unsigned int lex_preprocessor_try_resolve_include (struct cushion_lexer_file_state_t *state,
+                                                          struct cushion_include_resolution_node_t *resolution,
+                                                          const char *directory,
+                                                          struct cushion_include_node_t *include_node,
+                                                          unsigned int use_directory_index)
+{
+    if (directory && use_directory_index &&
+        !cushion_instance_directory_index_may_contain (state->instance, directory, resolution->spelling_begin,
+                                                       resolution->spelling_end))
+    {
+        return 0u;
+    }
+
+    lexer_file_state_path_init (state, directory);
+    LEX_WHEN_ERROR (return 0u)
+
+    lexer_file_state_path_append_sequence (state, resolution->spelling_begin, resolution->spelling_end);
+    LEX_WHEN_ERROR (return 0u)
+
+    struct cushion_file_identity_t identity;
+    if (cushion_instance_file_identity_query (state->instance, state->path_buffer.data, &identity) !=
+        CUSHION_INTERNAL_RESULT_OK)
+    {
+        // File at this path does not exist or is not available.
+        return 0u;
+    }
+
+    cushion_instance_include_resolution_save (state->instance, resolution, state->path_buffer.data, include_node,
+                                              &identity);
+    return 1u;
+}
+
+/// \brief Searches for header and saves the result into resolution.
+/// \details When resolution from one of the previous jobs is validated, search is repeated using directory indices
+///          for every directory, because indices are validated once per job and are shared by all resolutions, so
+///          unchanged directories are not even touched. Found file identity is validated through identity cache.
+static void lex_preprocessor_resolve_include (struct cushion_lexer_file_state_t *state,
+                                              struct cushion_include_resolution_node_t *resolution,
+                                              unsigned int validation)
+{
+    if (resolution->search_start &&
+        lex_preprocessor_try_resolve_include (state, resolution, resolution->search_start, NULL, validation))
+    {
+        return;
+    }
+
+    LEX_WHEN_ERROR (return)
+    // Try absolute include. It is a rare case, but may happen.
+    if (lex_preprocessor_try_resolve_include (state, resolution, NULL, NULL, validation))
+    {
+        return;
+    }
+
+    LEX_WHEN_ERROR (return)
+    const unsigned int use_directory_index =
+        validation || cushion_instance_has_option (state->instance, CUSHION_OPTION_INDEX_INCLUDE_DIRECTORIES);
+    struct cushion_include_node_t *node = state->instance->includes_first;
+
+    while (node)
+    {
+        if (lex_preprocessor_try_resolve_include (state, resolution, node->path, node, use_directory_index))
+        {
+            return;
+        }
+
+        LEX_WHEN_ERROR (return)
+        node = node->next;
+    }
+
+    cushion_instance_include_resolution_save (state->instance, resolution, NULL, NULL, NULL);
+}
+
+enum lex_include_result_t
 {
-    if (include_node)
-    {
-        lexer_file_state_path_init (state, include_node->path);
-        LEX_WHEN_ERROR (return 1u)
-    }
-
-    lexer_file_state_path_append_sequence (state, header_token->header_path.begin, header_token->header_path.end);
-    FILE *input_file = fopen (state->path_buffer.data, "r");
+    LEX_INCLUDE_RESULT_NOT_FOUND = 0u,
+    LEX_INCLUDE_RESULT_SCAN,
+    LEX_INCLUDE_RESULT_FULL,
 
-    if (!input_file)
-    {
-        // File at this path does not exist or is not available.
-        return 0u;
-    }
+    /// \brief Include was resolved, but nothing was lexed, therefore there is nothing to mark in output.
+    /// \details Happens when file is marked with pragma once or its include guard is still active.
+    LEX_INCLUDE_RESULT_SKIPPED,
+};
 
+static enum lex_include_result_t lex_preprocessor_include_resolved (
+    struct cushion_lexer_file_state_t *state,
+    const struct lexer_pop_token_meta_t *header_token_meta,
+    const struct cushion_include_resolution_node_t *resolution)
+{
     enum cushion_lex_file_flags_t flags = CUSHION_LEX_FILE_FLAG_NONE;
-    if (include_node)
+    enum lex_include_result_t result = LEX_INCLUDE_RESULT_FULL;
+
+    if (resolution->include_node)
     {
-        switch (include_node->type)
+        switch (resolution->include_node->type)
         {
         case INCLUDE_TYPE_FULL:
             if (state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY)
@@ -3547,18 +4329,34 @@ static unsigned int lex_preprocessor_try_include (struct cushion_lexer_file_stat
                     "Include \"%s\" points to full include directory, but it is done from file which is under scan "
                     "only directory. It is considered an error as it makes handling includes much more complex. "
                     "Therefore, including files from full path from files from scan only path is forbidden.",
-                    state->path_buffer.data);
-                return 1u;
+                    resolution->path);
+                return LEX_INCLUDE_RESULT_FULL;
             }
 
             break;
 
         case INCLUDE_TYPE_SCAN:
             flags |= CUSHION_LEX_FILE_FLAG_SCAN_ONLY;
+            result = LEX_INCLUDE_RESULT_SCAN;
             break;
         }
     }
 
+    if (cushion_instance_pragma_once_contains (state->instance, &resolution->file) ||
+        cushion_instance_include_guard_is_active (state->instance, &resolution->file,
+                                                  (flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) ? 1u : 0u))
+    {
+        // Lexing would produce nothing anyway, depfile entry was already written during the first inclusion.
+        // Scan only includes are still preserved in code, so they are reported as usual.
+        return result == LEX_INCLUDE_RESULT_FULL ? LEX_INCLUDE_RESULT_SKIPPED : result;
+    }
+
+    FILE *input_file = fopen (resolution->path, "r");
+    if (!input_file)
+    {
+        return LEX_INCLUDE_RESULT_NOT_FOUND;
+    }
+
     // Update line mark in order to avoid situations where #line directive is not starting on new line.
     // Also, it makes it easier to debug what was included from where.
     if ((state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) == 0u)
@@ -3566,18 +4364,11 @@ static unsigned int lex_preprocessor_try_include (struct cushion_lexer_file_stat
         lex_update_line_mark (state, state->tokenization.file_name, state->tokenization.cursor_line);
     }
 
-    cushion_lex_file_from_handle (state->instance, input_file, state->path_buffer.data, flags);
+    cushion_lex_file_from_handle (state->instance, input_file, resolution->path, flags);
     fclose (input_file);
-    return 1u;
+    return result;
 }
 
-enum lex_include_result_t
-{
-    LEX_INCLUDE_RESULT_NOT_FOUND = 0u,
-    LEX_INCLUDE_RESULT_SCAN,
-    LEX_INCLUDE_RESULT_FULL,
-};
-
 static void lex_preprocessor_include (struct cushion_lexer_file_state_t *state)
 {
     lex_do_not_skip_regular (state);
@@ -3598,7 +4389,7 @@ static void lex_preprocessor_include (struct cushion_lexer_file_state_t *state)
         return;
     }
 
-    enum lex_include_result_t include_result = LEX_INCLUDE_RESULT_NOT_FOUND;
+    const char *search_start = NULL;
     if (current_token.type == CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER)
     {
         lexer_file_state_path_init (state, state->file_name);
@@ -3630,37 +4421,36 @@ static void lex_preprocessor_include (struct cushion_lexer_file_state_t *state)
             }
         }
 
-        if (lex_preprocessor_try_include (state, &current_token, &current_token_meta, NULL))
-        {
-            include_result = LEX_INCLUDE_RESULT_FULL;
-        }
+        search_start = state->path_buffer.data;
     }
 
-    // Try absolute include. It is a rare case, but may happen.
-    if (include_result == LEX_INCLUDE_RESULT_NOT_FOUND)
+    // Search results only depend on search start and configuration, therefore they're cached between jobs and are
+    // only validated once per job.
+    struct cushion_include_resolution_node_t *resolution = cushion_instance_include_resolution_search (
+        state->instance, search_start, current_token.header_path.begin, current_token.header_path.end);
+
+    if (!resolution)
     {
-        lexer_file_state_path_init (state, NULL);
-        LEX_WHEN_ERROR (return)
+        resolution = cushion_instance_include_resolution_add (
+            state->instance, search_start, current_token.header_path.begin, current_token.header_path.end);
 
-        if (lex_preprocessor_try_include (state, &current_token, &current_token_meta, NULL))
-        {
-            include_result = LEX_INCLUDE_RESULT_FULL;
-        }
+        lex_preprocessor_resolve_include (state, resolution, 0u);
+        LEX_WHEN_ERROR (return)
     }
-
-    struct cushion_include_node_t *node = state->instance->includes_first;
-    while (node && include_result == LEX_INCLUDE_RESULT_NOT_FOUND)
+    else if (resolution->validated_job != state->instance->job_index)
     {
-        if (lex_preprocessor_try_include (state, &current_token, &current_token_meta, node))
-        {
-            include_result = node->type == INCLUDE_TYPE_FULL ? LEX_INCLUDE_RESULT_FULL : LEX_INCLUDE_RESULT_SCAN;
-            break;
-        }
+        lex_preprocessor_resolve_include (state, resolution, 1u);
+        LEX_WHEN_ERROR (return)
+    }
 
-        node = node->next;
+    enum lex_include_result_t include_result = LEX_INCLUDE_RESULT_NOT_FOUND;
+    if (resolution->path)
+    {
+        include_result = lex_preprocessor_include_resolved (state, &current_token_meta, resolution);
     }
 
-    if (include_result != LEX_INCLUDE_RESULT_FULL && (state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) == 0u)
+    if (include_result != LEX_INCLUDE_RESULT_FULL && include_result != LEX_INCLUDE_RESULT_SKIPPED &&
+        (state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) == 0u)
     {
         // Include not found. Preserve it in code.
         lex_update_line_mark (state, state->tokenization.file_name, start_line);
@@ -3681,6 +4471,140 @@ static void lex_preprocessor_include (struct cushion_lexer_file_state_t *state)
     lex_update_tokenization_flags (state);
 }
 
+static void lex_preprocessor_define_lazy (struct cushion_lexer_file_state_t *state, struct cushion_macro_node_t *node)
+{
+    struct cushion_macro_lazy_replacement_t *lazy = cushion_allocator_allocate (
+        &state->instance->allocator, sizeof (struct cushion_macro_lazy_replacement_t),
+        _Alignof (struct cushion_macro_lazy_replacement_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    if (state->lazy_file_name_source != state->tokenization.file_name)
+    {
+        // File name only changes on line directives, so copy is usually shared by all macros of the file.
+        state->lazy_file_name_source = state->tokenization.file_name;
+        state->lazy_file_name = cushion_instance_copy_null_terminated_inside (
+            state->instance, state->tokenization.file_name, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    }
+
+    lazy->origin = CUSHION_MACRO_LAZY_ORIGIN_SCAN_ONLY;
+    lazy->file = state->lazy_file_name;
+    lazy->line = state->tokenization.cursor_line;
+    lazy->column = cushion_tokenization_state_get_cursor_column (&state->tokenization);
+
+    const char *text_begin = state->tokenization.cursor;
+    const char *text_end = lexer_file_state_skip_line (state);
+    lazy->text = cushion_instance_copy_char_sequence_inside (state->instance, text_begin, text_end,
+                                                             CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    node->flags |= CUSHION_MACRO_FLAG_LAZY;
+    node->lazy_replacement = lazy;
+}
+
+/// \brief Validates replacement list of configured define in the same way as it was done when defines were lexed
+///        before execution. Returns zero and reports error if define cannot be used.
+static unsigned int lex_lazy_macro_validate_arguments (struct cushion_instance_t *instance,
+                                                       struct cushion_macro_node_t *node,
+                                                       struct cushion_tokenization_state_t *tokenization_state,
+                                                       enum cushion_lex_replacement_list_result_t lex_result)
+{
+    const struct cushion_error_context_t error_context = {
+        .file = "<arguments>",
+        .line = 1u,
+        .column = UINT_MAX,
+    };
+
+    if (cushion_instance_is_error_signaled (instance))
+    {
+        cushion_instance_execution_error (instance, error_context, "Failed to lex object macro \"%s\" from arguments.",
+                                          node->name);
+        return 0u;
+    }
+
+    if (tokenization_state->cursor != tokenization_state->limit)
+    {
+        cushion_instance_execution_error (
+            instance, error_context,
+            "Object macro \"%s\" from arguments cannot be fully lexed: argument string contains new line in the "
+            "middle. It is a warning for most compilers (they just ignore everything after new line usually), but "
+            "Cushion thinks that it is an obvious error as arguments must be properly formatted.",
+            node->name);
+        return 0u;
+    }
+
+#if defined(CUSHION_EXTENSIONS)
+    if (node->flags & CUSHION_MACRO_FLAG_WRAPPED)
+    {
+        cushion_instance_execution_error (instance, error_context,
+                                          "Object macro \"%s\" from arguments cannot use __CUSHION_WRAPPED__, this "
+                                          "feature is only supported for macro defined in code.",
+                                          node->name);
+        return 0u;
+    }
+#endif
+
+    if (lex_result == CUSHION_LEX_REPLACEMENT_LIST_RESULT_PRESERVED)
+    {
+        cushion_instance_execution_error (
+            instance, error_context,
+            "Encountered __CUSHION_PRESERVE__ while lexing macro \"%s\" from arguments, which is not supported.",
+            node->name);
+        return 0u;
+    }
+
+    return 1u;
+}
+
+void cushion_lex_lazy_macro (struct cushion_instance_t *instance, struct cushion_macro_node_t *node)
+{
+    const struct cushion_macro_lazy_replacement_t *lazy = node->lazy_replacement;
+    node->flags &= ~CUSHION_MACRO_FLAG_LAZY;
+    node->replacement_list = NULL;
+
+    if (lazy->origin == CUSHION_MACRO_LAZY_ORIGIN_ARGUMENTS &&
+        cushion_instance_define_cache_restore (instance, lazy->text, &node->replacement_list))
+    {
+        return;
+    }
+
+    struct cushion_allocator_transient_marker_t transient_marker =
+        cushion_allocator_get_transient_marker (&instance->allocator);
+
+    // Tokenization state is too big to be put on stack in the middle of macro replacement.
+    struct cushion_tokenization_state_t *tokenization_state = cushion_allocator_allocate (
+        &instance->allocator, sizeof (struct cushion_tokenization_state_t),
+        _Alignof (struct cushion_tokenization_state_t), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+
+    cushion_tokenization_state_init_for_argument_string (tokenization_state, lazy->text, &instance->allocator,
+                                                         CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    tokenization_state->file_name = lazy->file;
+    tokenization_state->cursor_line = lazy->line;
+    tokenization_state->origin_column = lazy->column;
+
+    const enum cushion_lex_replacement_list_result_t lex_result = cushion_lex_replacement_list_from_tokenization (
+        instance, tokenization_state, &node->replacement_list, &node->flags);
+
+    switch (lazy->origin)
+    {
+    case CUSHION_MACRO_LAZY_ORIGIN_SCAN_ONLY:
+        if (lex_result == CUSHION_LEX_REPLACEMENT_LIST_RESULT_PRESERVED)
+        {
+            // Scan only files never output preserved tail, therefore there is nothing more to do.
+            node->flags |= CUSHION_MACRO_FLAG_PRESERVED;
+        }
+
+        break;
+
+    case CUSHION_MACRO_LAZY_ORIGIN_ARGUMENTS:
+        if (lex_lazy_macro_validate_arguments (instance, node, tokenization_state, lex_result))
+        {
+            cushion_instance_define_cache_add (instance, lazy->text, node->replacement_list);
+        }
+
+        break;
+    }
+
+    cushion_allocator_reset_transient (&instance->allocator, transient_marker);
+}
+
 static void lex_preprocessor_define (struct cushion_lexer_file_state_t *state)
 {
     lex_do_not_skip_regular (state);
@@ -3710,12 +4634,13 @@ static void lex_preprocessor_define (struct cushion_lexer_file_state_t *state)
         cushion_allocator_allocate (&state->instance->allocator, sizeof (struct cushion_macro_node_t),
                                     _Alignof (struct cushion_macro_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
 
-    node->name = cushion_instance_copy_char_sequence_inside (state->instance, current_token.begin, current_token.end,
-                                                             CUSHION_ALLOCATION_CLASS_PERSISTENT);
-
+    // Interned name lives until the end of the job just like macro node itself.
+    node->name = cushion_instance_symbol_get (state->instance, current_token.symbol)->name;
     node->flags = CUSHION_MACRO_FLAG_NONE;
-    node->replacement_list_first = NULL;
+    node->replacement_list = NULL;
     node->parameters_first = NULL;
+    node->program = NULL;
+    node->expansion = NULL;
 
     current_token_meta = lexer_file_state_pop_token (state, &current_token);
     LEX_WHEN_ERROR (return)
@@ -3741,8 +4666,7 @@ static void lex_preprocessor_define (struct cushion_lexer_file_state_t *state)
                     &state->instance->allocator, sizeof (struct cushion_macro_parameter_node_t),
                     _Alignof (struct cushion_macro_parameter_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
 
-                parameter->name = cushion_instance_copy_char_sequence_inside (
-                    state->instance, current_token.begin, current_token.end, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+                parameter->name = cushion_instance_symbol_get (state->instance, current_token.symbol)->name;
                 parameter->next = NULL;
 
                 if (parameters_last)
@@ -3831,11 +4755,18 @@ static void lex_preprocessor_define (struct cushion_lexer_file_state_t *state)
         node->flags |= CUSHION_MACRO_FLAG_PRESERVED | CUSHION_MACRO_FLAG_FROM_PRESERVED_SCOPE;
         lex_preprocessor_preserved_tail (state, CUSHION_TOKEN_TYPE_PREPROCESSOR_DEFINE, node);
     }
+    else if ((state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) && !state->token_stack_top &&
+             !state->tokenization.input_file_optional)
+    {
+        // Macros from scan only files are rarely expanded, so we only save raw replacement list text and lex it on
+        // demand. In full mode, replacement list must be lexed right away to know whether it is preserved.
+        lex_preprocessor_define_lazy (state, node);
+    }
     else
     {
         // Lex replacement list.
         enum cushion_lex_replacement_list_result_t lex_result = cushion_lex_replacement_list_from_lexer (
-            state->instance, state, &node->replacement_list_first, &node->flags);
+            state->instance, state, &node->replacement_list, &node->flags);
         LEX_WHEN_ERROR (return)
 
         switch (lex_result)
@@ -3870,21 +4801,22 @@ static void lex_preprocessor_undef (struct cushion_lexer_file_state_t *state)
         return;
     }
 
-    struct cushion_macro_node_t *node =
-        cushion_instance_macro_search (state->instance, current_token.begin, current_token.end);
-
-    if (!node || (node->flags & CUSHION_MACRO_FLAG_PRESERVED))
+    if ((state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) == 0u)
     {
-        // Preserve #undef as macro is either unknown or explicitly preserved.
-        if ((state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) == 0u)
+        struct cushion_macro_node_t *node =
+            cushion_instance_macro_search_symbol (state->instance, current_token.symbol);
+        LEX_WHEN_ERROR (return)
+
+        if (!node || (node->flags & CUSHION_MACRO_FLAG_PRESERVED))
         {
+            // Preserve #undef as macro is either unknown or explicitly preserved.
             lex_update_line_mark (state, state->tokenization.file_name, start_line);
             cushion_instance_output_null_terminated (state->instance, "#undef ");
             cushion_instance_output_sequence (state->instance, current_token.begin, current_token.end);
         }
     }
 
-    cushion_instance_macro_remove (state->instance, current_token.begin, current_token.end);
+    cushion_instance_macro_remove (state->instance, current_token.symbol);
     lex_preprocessor_expect_new_line (state);
     lex_update_tokenization_flags (state);
 }
@@ -4008,7 +4940,7 @@ static void lex_preprocessor_pragma (struct cushion_lexer_file_state_t *state)
 {
     lex_do_not_skip_regular (state);
     struct cushion_token_t current_token;
-    lex_skip_glue_and_comments (state, &current_token);
+    struct lexer_pop_token_meta_t current_token_meta = lex_skip_glue_and_comments (state, &current_token);
     LEX_WHEN_ERROR (return)
 
     if (current_token.type == CUSHION_TOKEN_TYPE_IDENTIFIER &&
@@ -4019,38 +4951,26 @@ static void lex_preprocessor_pragma (struct cushion_lexer_file_state_t *state)
         if ((state->flags & CUSHION_LEX_FILE_FLAG_PROCESSED_PRAGMA_ONCE) == 0u)
         {
             state->flags |= CUSHION_LEX_FILE_FLAG_PROCESSED_PRAGMA_ONCE;
-            const unsigned int path_hash = cushion_hash_djb2_null_terminated (state->file_name);
-
-            struct cushion_pragma_once_file_node_t *search_node =
-                state->instance->pragma_once_buckets[path_hash % CUSHION_PRAGMA_ONCE_BUCKETS];
+            struct cushion_file_identity_t identity;
 
-            while (search_node)
+            if (cushion_instance_file_identity_query (state->instance, state->file_name, &identity) !=
+                CUSHION_INTERNAL_RESULT_OK)
             {
-                if (search_node->path_hash == path_hash && strcmp (search_node->path, state->file_name) == 0)
-                {
-                    break;
-                }
-
-                search_node = search_node->next;
+                cushion_instance_lexer_error (state, &current_token_meta,
+                                              "Unable to query identity of file \"%s\" for #pragma once.",
+                                              state->file_name);
+                return;
             }
 
-            if (search_node)
+            if (cushion_instance_pragma_once_contains (state->instance, &identity))
             {
                 // End the lexing normally as file was already processed.
+                // Includes skip such files before opening them, but root files are still checked here.
                 state->lexing = 0u;
                 return;
             }
 
-            struct cushion_pragma_once_file_node_t *new_node = cushion_allocator_allocate (
-                &state->instance->allocator, sizeof (struct cushion_pragma_once_file_node_t),
-                _Alignof (struct cushion_pragma_once_file_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
-
-            new_node->path_hash = path_hash;
-            new_node->path = cushion_instance_copy_null_terminated_inside (state->instance, state->file_name,
-                                                                           CUSHION_ALLOCATION_CLASS_PERSISTENT);
-
-            new_node->next = state->instance->pragma_once_buckets[path_hash % CUSHION_PRAGMA_ONCE_BUCKETS];
-            state->instance->pragma_once_buckets[path_hash % CUSHION_PRAGMA_ONCE_BUCKETS] = new_node;
+            cushion_instance_pragma_once_add (state->instance, &identity);
         }
 
         lex_preprocessor_expect_new_line (state);
@@ -4096,21 +5016,121 @@ static inline struct lexer_pop_token_meta_t lex_skip_glue_comments_new_line (str
 
 #if defined(CUSHION_EXTENSIONS)
 
+/// \brief Appends line delta and injected macro replacement flag of injector content token as variable length
+///        integer, only calculates its size when output is NULL.
+/// \return Size of encoded value in bytes.
+static inline unsigned int lex_extension_injector_encode_line (uint8_t *output,
+                                                               unsigned int previous_line,
+                                                               unsigned int line,
+                                                               unsigned int injected_macro_replacement)
+{
+    // Delta is zigzag encoded as tokens from macro replacement take invocation line and might go backwards.
+    const int64_t delta = (int64_t) line - (int64_t) previous_line;
+    uint64_t value = ((uint64_t) delta << 1u) ^ (uint64_t) (delta >> 63u);
+    value = (value << 1u) | (injected_macro_replacement ? 1u : 0u);
+    unsigned int size = 0u;
+
+    do
+    {
+        if (output)
+        {
+            output[size] = (uint8_t) ((value & 0x7Fu) | (value > 0x7Fu ? 0x80u : 0u));
+        }
+
+        value >>= 7u;
+        ++size;
+    } while (value > 0u);
+
+    return size;
+}
+
+/// \brief Decodes line and injected macro replacement flag of the next injector content token.
+/// \return Pointer to the encoded line of the next token.
+static inline const uint8_t *lex_extension_injector_decode_line (const uint8_t *input,
+                                                                 unsigned int *line,
+                                                                 unsigned int *injected_macro_replacement)
+{
+    uint64_t value = 0u;
+    unsigned int shift = 0u;
+
+    do
+    {
+        value |= (uint64_t) (*input & 0x7Fu) << shift;
+        shift += 7u;
+    } while (*input++ & 0x80u);
+
+    *injected_macro_replacement = (unsigned int) (value & 1u);
+    value >>= 1u;
+    const int64_t delta = (int64_t) (value >> 1u) ^ -(int64_t) (value & 1u);
+    *line = (unsigned int) ((int64_t) *line + delta);
+    return input;
+}
+
+/// \brief Packs injector content token list into token array and encoded lines.
+static struct cushion_extension_injector_content_t lex_pack_extension_injector_content (
+    struct cushion_lexer_file_state_t *state,
+    const struct cushion_token_list_item_t *first,
+    unsigned int block_line,
+    enum cushion_allocation_class_t allocation_class)
+{
+    struct cushion_extension_injector_content_t content = {
+        .tokens = cushion_save_token_list_to_array (state->instance, first, allocation_class),
+        .lines = NULL,
+    };
+
+    if (!content.tokens)
+    {
+        return content;
+    }
+
+    size_t lines_size = 0u;
+    unsigned int previous_line = block_line;
+
+    for (const struct cushion_token_list_item_t *item = first; item; item = item->next)
+    {
+        lines_size += lex_extension_injector_encode_line (
+            NULL, previous_line, item->line, item->flags & CUSHION_TOKEN_LIST_ITEM_FLAG_INJECTED_MACRO_REPLACEMENT);
+        previous_line = item->line;
+    }
+
+    uint8_t *lines =
+        cushion_allocator_allocate (&state->instance->allocator, lines_size, _Alignof (uint8_t), allocation_class);
+    content.lines = lines;
+    previous_line = block_line;
+
+    for (const struct cushion_token_list_item_t *item = first; item; item = item->next)
+    {
+        lines += lex_extension_injector_encode_line (
+            lines, previous_line, item->line, item->flags & CUSHION_TOKEN_LIST_ITEM_FLAG_INJECTED_MACRO_REPLACEMENT);
+        previous_line = item->line;
+    }
+
+    return content;
+}
+
 /// \details Defers and statement accumulator pushes should have the same rules for their content,
-///          therefore they're called extensions injectors and this logic is for them.
-static struct cushion_token_list_item_t *lex_extension_injector_content (struct cushion_lexer_file_state_t *state,
-                                                                         const char *safe_to_use_file_name)
+///          therefore they're called extensions injectors and this logic is for them. Content tokens are gathered
+///          into transient list and then packed using given allocation class.
+static struct cushion_extension_injector_content_t lex_extension_injector_content (
+    struct cushion_lexer_file_state_t *state,
+    unsigned int block_line,
+    enum cushion_allocation_class_t allocation_class)
 {
+    struct cushion_extension_injector_content_t empty_content = {
+        .tokens = NULL,
+        .lines = NULL,
+    };
+
     struct cushion_token_t current_token;
     struct lexer_pop_token_meta_t current_token_meta = lex_skip_glue_comments_new_line (state, &current_token);
-    LEX_WHEN_ERROR (return NULL)
+    LEX_WHEN_ERROR (return empty_content)
 
     if (current_token.type != CUSHION_TOKEN_TYPE_PUNCTUATOR ||
         current_token.punctuator_kind != CUSHION_PUNCTUATOR_KIND_LEFT_CURLY_BRACE)
     {
         cushion_instance_lexer_error (state, &current_token_meta,
                                       "Expected \"{\" after CUSHION_STATEMENT_ACCUMULATOR_PUSH / CUSHION_DEFER.");
-        return NULL;
+        return empty_content;
     }
 
     unsigned int brace_count = 1u;
@@ -4122,7 +5142,7 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
         current_token_meta = lexer_file_state_pop_token (state, &current_token);
         if (cushion_instance_is_error_signaled (state->instance))
         {
-            return NULL;
+            return empty_content;
         }
 
         switch (current_token.type)
@@ -4149,7 +5169,7 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
                 "Encountered preprocessor directive while reading CUSHION_STATEMENT_ACCUMULATOR_PUSH / CUSHION_DEFER "
                 "code block. Preprocessor directives are not supported there as their support would make it possible "
                 "to introduce circular dependency in code generation.");
-            return NULL;
+            return empty_content;
 
         case CUSHION_TOKEN_TYPE_PUNCTUATOR:
             switch (current_token.punctuator_kind)
@@ -4191,7 +5211,7 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
                     state, &current_token_meta,
                     "Encountered cushion keywords in CUSHION_STATEMENT_ACCUMULATOR_PUSH / CUSHION_DEFER code block, "
                     "which is not supported as it might result in circular dependency in code generation.");
-                return NULL;
+                return empty_content;
 
             case CUSHION_IDENTIFIER_KIND_MACRO_PRAGMA:
                 // It is possible to support _Pragma here, but it is just a little bit of extra work that is not really
@@ -4199,7 +5219,7 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
                 cushion_instance_lexer_error (state, &current_token_meta,
                                               "Encountered _Pragma in CUSHION_STATEMENT_ACCUMULATOR_PUSH / "
                                               "CUSHION_DEFER code block, which is not supported right now.");
-                return NULL;
+                return empty_content;
 
             default:
             {
@@ -4208,8 +5228,7 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
 
                 if (replace_result.replaced)
                 {
-                    lexer_file_state_push_tokens (state, replace_result.tokens,
-                                                  LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT);
+                    lexer_file_state_push_replacement (state, &replace_result);
                 }
                 else
                 {
@@ -4231,15 +5250,15 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
             cushion_instance_lexer_error (
                 state, &current_token_meta,
                 "Got to the end of file while parsing CUSHION_STATEMENT_ACCUMULATOR_PUSH / CUSHION_DEFER code block.");
-            return NULL;
+            return empty_content;
 
         default:
         append_token:
         {
             struct cushion_token_list_item_t *new_token =
-                cushion_save_token_to_memory (state->instance, &current_token, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+                cushion_save_token_to_memory (state->instance, &current_token, CUSHION_ALLOCATION_CLASS_TRANSIENT);
 
-            new_token->file = safe_to_use_file_name;
+            // File is the same for the whole block, therefore it is not saved.
             new_token->line = current_token_meta.line;
 
             if (current_token_meta.flags & LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT)
@@ -4261,7 +5280,7 @@ static struct cushion_token_list_item_t *lex_extension_injector_content (struct
         }
     }
 
-    return token_first;
+    return lex_pack_extension_injector_content (state, token_first, block_line, allocation_class);
 }
 
 enum output_extension_injector_content_flags_t
@@ -4270,32 +5289,46 @@ enum output_extension_injector_content_flags_t
     OUTPUT_EXTENSION_INJECTOR_FLAGS_JUMP_FORBIDDEN = 1u << 0u,
 };
 
+/// \brief Outputs injector content, file and block line are the ones of the push or defer that has created it.
 static void output_extension_injector_content (struct cushion_instance_t *instance,
-                                               struct cushion_token_list_item_t *content,
+                                               const char *file,
+                                               unsigned int block_line,
+                                               const struct cushion_extension_injector_content_t *content,
                                                enum output_extension_injector_content_flags_t flags)
 {
-    if (!content || cushion_instance_is_error_signaled (instance))
+    if (!content->tokens || cushion_instance_is_error_signaled (instance))
     {
         return;
     }
 
+    const uint8_t *encoded_line = content->lines;
+    unsigned int line = block_line;
+    unsigned int is_macro;
+    encoded_line = lex_extension_injector_decode_line (encoded_line, &line, &is_macro);
+
     cushion_instance_output_null_terminated (instance, "\n");
-    cushion_instance_output_line_marker (instance, content->file, content->line);
+    cushion_instance_output_line_marker (instance, file, line);
 
-    const char *last_output_file = content->file;
-    unsigned int last_output_line = content->line;
+    unsigned int last_output_line = line;
     unsigned int previous_is_macro = 0u;
 
-    while (content && !cushion_instance_is_error_signaled (instance))
+    for (unsigned int index = 0u; index < content->tokens->count && !cushion_instance_is_error_signaled (instance);
+         ++index)
     {
-        if (last_output_line != content->line ||
-            (last_output_file != content->file && strcmp (last_output_file, content->file) != 0))
+        if (index > 0u)
+        {
+            encoded_line = lex_extension_injector_decode_line (encoded_line, &line, &is_macro);
+        }
+
+        struct cushion_token_t token;
+        cushion_token_array_get (instance, content->tokens, index, &token);
+
+        if (last_output_line != line)
         {
             const int max_lines_to_cover_with_new_line = 5u;
-            if (last_output_line < content->line &&
-                (int) content->line - (int) last_output_line < max_lines_to_cover_with_new_line)
+            if (last_output_line < line && (int) line - (int) last_output_line < max_lines_to_cover_with_new_line)
             {
-                int difference = (int) content->line - (int) last_output_line;
+                int difference = (int) line - (int) last_output_line;
                 while (difference)
                 {
                     cushion_instance_output_null_terminated (instance, "\n");
@@ -4305,11 +5338,10 @@ static void output_extension_injector_content (struct cushion_instance_t *instan
             else
             {
                 cushion_instance_output_null_terminated (instance, "\n");
-                cushion_instance_output_line_marker (instance, content->file, content->line);
+                cushion_instance_output_line_marker (instance, file, line);
             }
 
-            last_output_file = content->file;
-            last_output_line = content->line;
+            last_output_line = line;
         }
         else if (previous_is_macro)
         {
@@ -4317,7 +5349,7 @@ static void output_extension_injector_content (struct cushion_instance_t *instan
             cushion_instance_output_null_terminated (instance, " ");
         }
 
-        switch (content->token.type)
+        switch (token.type)
         {
         case CUSHION_TOKEN_TYPE_PREPROCESSOR_IF:
         case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFDEF:
@@ -4342,28 +5374,30 @@ static void output_extension_injector_content (struct cushion_instance_t *instan
             break;
 
         case CUSHION_TOKEN_TYPE_IDENTIFIER:
-            switch (content->token.identifier_kind)
+            switch (token.identifier_kind)
             {
             case CUSHION_IDENTIFIER_KIND_FILE:
                 cushion_instance_output_null_terminated (instance, "\"");
-                cushion_instance_output_null_terminated (instance, content->file);
+                cushion_instance_output_null_terminated (instance, file);
                 cushion_instance_output_null_terminated (instance, "\"");
                 break;
 
             case CUSHION_IDENTIFIER_KIND_LINE:
-                cushion_instance_output_formatted (instance, "%u", (unsigned int) content->line);
+                cushion_instance_output_unsigned (instance, line);
                 break;
 
             case CUSHION_IDENTIFIER_KIND_CUSHION_START_NS_X64:
                 if (cushion_instance_has_feature (instance, CUSHION_FEATURE_PREDEFINED_MACRO))
                 {
+                    // Output depends on execution time, therefore it cannot be restored from cache.
+                    instance->state_flags |= CUSHION_INSTANCE_STATE_FLAG_UNCACHEABLE;
                     cushion_instance_output_formatted (instance, PRIu64, instance->start_ns_x64);
                 }
                 else
                 {
                     struct cushion_error_context_t error_context = {
-                        .file = content->file,
-                        .line = content->line,
+                        .file = file,
+                        .line = line,
                         .column = UINT_MAX,
                     };
 
@@ -4385,8 +5419,8 @@ static void output_extension_injector_content (struct cushion_instance_t *instan
                 if (flags & OUTPUT_EXTENSION_INJECTOR_FLAGS_JUMP_FORBIDDEN)
                 {
                     struct cushion_error_context_t error_context = {
-                        .file = content->file,
-                        .line = content->line,
+                        .file = file,
+                        .line = line,
                         .column = UINT_MAX,
                     };
 
@@ -4417,12 +5451,11 @@ static void output_extension_injector_content (struct cushion_instance_t *instan
         case CUSHION_TOKEN_TYPE_GLUE:
         case CUSHION_TOKEN_TYPE_OTHER:
         output_token:
-            cushion_instance_output_sequence (instance, content->token.begin, content->token.end);
+            cushion_instance_output_sequence (instance, token.begin, token.end);
             break;
         }
 
-        previous_is_macro = content->flags & CUSHION_TOKEN_LIST_ITEM_FLAG_INJECTED_MACRO_REPLACEMENT;
-        content = content->next;
+        previous_is_macro = is_macro;
     }
 }
 
@@ -4490,7 +5523,7 @@ struct lex_defer_expression_t
 {
     const char *source_file;
     unsigned int source_line;
-    struct cushion_token_list_item_t *content_first;
+    struct cushion_extension_injector_content_t content;
 };
 
 struct lex_defer_event_t
@@ -4706,7 +5739,7 @@ static void lex_defer_generate_defers (struct cushion_lexer_file_state_t *state,
                 break;
 
             case LEX_DEFER_EVENT_TYPE_DEFER:
-                if (child_block_encountered && event->defer.content_first)
+                if (child_block_encountered && event->defer.content.tokens)
                 {
                     if (!any_defers && (statement_flags_at_generation & LEX_DEFER_STATEMENT_FLAG_LABELED))
                     {
@@ -4715,7 +5748,8 @@ static void lex_defer_generate_defers (struct cushion_lexer_file_state_t *state,
                     }
 
                     any_defers = 1u;
-                    output_extension_injector_content (state->instance, event->defer.content_first,
+                    output_extension_injector_content (state->instance, event->defer.source_file,
+                                                       event->defer.source_line, &event->defer.content,
                                                        OUTPUT_EXTENSION_INJECTOR_FLAGS_JUMP_FORBIDDEN);
                 }
 
@@ -5584,7 +6618,9 @@ static void lex_code_defer (struct cushion_lexer_file_state_t *state,
     const unsigned int line = state->last_token_line;
 
     // Defers only work in file context, not persistent context, therefore using last marked file is okay.
-    struct cushion_token_list_item_t *content = lex_extension_injector_content (state, file);
+    // Defer events are transient, so their content is transient too.
+    struct cushion_extension_injector_content_t content =
+        lex_extension_injector_content (state, line, CUSHION_ALLOCATION_CLASS_TRANSIENT);
     LEX_WHEN_ERROR (return)
 
     struct lex_defer_event_t *defer =
@@ -5594,7 +6630,7 @@ static void lex_code_defer (struct cushion_lexer_file_state_t *state,
     defer->type = LEX_DEFER_EVENT_TYPE_DEFER;
     defer->defer.source_file = file;
     defer->defer.source_line = line;
-    defer->defer.content_first = content;
+    defer->defer.content = content;
 
     defer->next = state->defer_feature->current_block->events_first;
     state->defer_feature->current_block->events_first = defer;
@@ -5640,34 +6676,55 @@ static struct cushion_statement_accumulator_ref_t *find_statement_accumulator_re
     return NULL;
 }
 
-static unsigned int lex_is_push_macro_list_equal (struct cushion_token_list_item_t *first_list,
-                                                  struct cushion_token_list_item_t *second_list)
+static unsigned int lex_is_push_content_equal (const struct cushion_extension_injector_content_t *first,
+                                               const struct cushion_extension_injector_content_t *second)
 {
-    while (first_list && second_list)
+    // Only tokens are compared, location of the push does not matter.
+    if (!first->tokens || !second->tokens)
+    {
+        return first->tokens == second->tokens;
+    }
+
+    if (first->tokens->count != second->tokens->count)
+    {
+        return 0u;
+    }
+
+    for (unsigned int index = 0u; index < first->tokens->count; ++index)
     {
-        if (first_list->token.type != second_list->token.type ||
-            (first_list->token.end - first_list->token.begin) != (second_list->token.end - second_list->token.begin) ||
-            strncmp (first_list->token.begin, second_list->token.begin,
-                     first_list->token.end - first_list->token.begin) != 0)
+        const struct cushion_token_array_token_t *first_record = &first->tokens->tokens[index];
+        const struct cushion_token_array_token_t *second_record = &second->tokens->tokens[index];
+
+        if (first_record->type != second_record->type)
         {
             return 0u;
         }
 
-        first_list = first_list->next;
-        second_list = second_list->next;
+        if (first_record->type == CUSHION_TOKEN_TYPE_IDENTIFIER)
+        {
+            if (first_record->value != second_record->value)
+            {
+                return 0u;
+            }
+        }
+        else if (first_record->end - first_record->begin != second_record->end - second_record->begin ||
+                 memcmp (first->tokens->text + first_record->begin, second->tokens->text + second_record->begin,
+                         first_record->end - first_record->begin) != 0)
+        {
+            return 0u;
+        }
     }
 
-    // Only returns true if both are NULL.
-    return first_list == second_list;
+    return 1u;
 }
 
-static inline unsigned int statement_accumulator_has_equal_entry (struct cushion_statement_accumulator_t *accumulator,
-                                                                  struct cushion_token_list_item_t *content)
+static inline unsigned int statement_accumulator_has_equal_entry (
+    struct cushion_statement_accumulator_t *accumulator, const struct cushion_extension_injector_content_t *content)
 {
     struct cushion_statement_accumulator_entry_t *other_entry = accumulator->entries_first;
     while (other_entry)
     {
-        if (lex_is_push_macro_list_equal (content, other_entry->content_first))
+        if (lex_is_push_content_equal (content, &other_entry->content))
         {
             return 1u;
         }
@@ -5693,7 +6750,7 @@ static void check_statement_accumulator_unordered_pushes (struct cushion_lexer_f
             strncmp (unordered_push->name, under_name, unordered_push->name_length) == 0)
         {
             if ((unordered_push->flags & CUSHION_STATEMENT_ACCUMULATOR_PUSH_FLAG_UNIQUE) == 0u ||
-                !statement_accumulator_has_equal_entry (accumulator, unordered_push->entry_template.content_first))
+                !statement_accumulator_has_equal_entry (accumulator, &unordered_push->entry_template.content))
             {
                 struct cushion_statement_accumulator_entry_t *entry = cushion_allocator_allocate (
                     &state->instance->allocator, sizeof (struct cushion_statement_accumulator_entry_t),
@@ -5977,13 +7034,14 @@ static void lex_code_statement_accumulator_push (struct cushion_lexer_file_state
     GUARDRAIL_RELEASE (statement_accumulator);
     const char *saved_file =
         cushion_instance_copy_null_terminated_inside (state->instance, file, CUSHION_ALLOCATION_CLASS_PERSISTENT);
-    struct cushion_token_list_item_t *content = lex_extension_injector_content (state, saved_file);
+    struct cushion_extension_injector_content_t content =
+        lex_extension_injector_content (state, line, CUSHION_ALLOCATION_CLASS_PERSISTENT);
     LEX_WHEN_ERROR (return)
 
     if (accumulator)
     {
         if ((flags & CUSHION_STATEMENT_ACCUMULATOR_PUSH_FLAG_UNIQUE) == 0u ||
-            !statement_accumulator_has_equal_entry (accumulator, content))
+            !statement_accumulator_has_equal_entry (accumulator, &content))
         {
             struct cushion_statement_accumulator_entry_t *entry = cushion_allocator_allocate (
                 &state->instance->allocator, sizeof (struct cushion_statement_accumulator_entry_t),
@@ -5992,7 +7050,7 @@ static void lex_code_statement_accumulator_push (struct cushion_lexer_file_state
             entry->next = NULL;
             entry->source_file = saved_file;
             entry->source_line = line;
-            entry->content_first = content;
+            entry->content = content;
 
             if (accumulator->entries_last)
             {
@@ -6020,7 +7078,7 @@ static void lex_code_statement_accumulator_push (struct cushion_lexer_file_state
         push->entry_template.source_file =
             cushion_instance_copy_null_terminated_inside (state->instance, file, CUSHION_ALLOCATION_CLASS_PERSISTENT);
         push->entry_template.source_line = line;
-        push->entry_template.content_first = content;
+        push->entry_template.content = content;
 
         if (state->instance->statement_unordered_push_last)
         {
@@ -6232,8 +7290,10 @@ static void lex_code_snippet (struct cushion_lexer_file_state_t *state)
                                                              CUSHION_ALLOCATION_CLASS_PERSISTENT);
 
     node->flags = CUSHION_MACRO_FLAG_SNIPPET;
-    node->replacement_list_first = NULL;
+    node->replacement_list = NULL;
     node->parameters_first = NULL;
+    node->program = NULL;
+    node->expansion = NULL;
 
     current_token_meta = lex_skip_glue_comments_new_line (state, &current_token);
     LEX_WHEN_ERROR (return)
@@ -6350,7 +7410,7 @@ static void lex_code_snippet (struct cushion_lexer_file_state_t *state)
         append_token:
         {
             struct cushion_token_list_item_t *new_token_item =
-                cushion_save_token_to_memory (state->instance, &current_token, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+                cushion_save_token_to_memory (state->instance, &current_token, CUSHION_ALLOCATION_CLASS_TRANSIENT);
 
             // We do not save file and line info in replacement lists as this is not how macros usually work.
             if (content_last)
@@ -6368,7 +7428,8 @@ static void lex_code_snippet (struct cushion_lexer_file_state_t *state)
         }
     }
 
-    node->replacement_list_first = content_first;
+    node->replacement_list =
+        cushion_save_token_list_to_array (state->instance, content_first, CUSHION_ALLOCATION_CLASS_PERSISTENT);
     cushion_instance_macro_add (state->instance, node, lex_error_context (state, &first_token_meta));
 }
 #endif
@@ -6604,6 +7665,7 @@ static unsigned int lex_code_identifier_is_replaced (struct cushion_lexer_file_s
     case CUSHION_IDENTIFIER_KIND_CUSHION_START_NS_X64:
         if (cushion_instance_has_feature (state->instance, CUSHION_FEATURE_PREDEFINED_MACRO))
         {
+            state->instance->state_flags |= CUSHION_INSTANCE_STATE_FLAG_UNCACHEABLE;
             struct cushion_token_t token = lex_create_unsigned_integer_token (state, state->instance->start_ns_x64);
             lexer_file_state_reinsert_token (state, &token);
         }
@@ -6629,7 +7691,7 @@ static unsigned int lex_code_identifier_is_replaced (struct cushion_lexer_file_s
 
     if (replace_result.replaced)
     {
-        lexer_file_state_push_tokens (state, replace_result.tokens, LEXER_TOKEN_STACK_ITEM_FLAG_MACRO_REPLACEMENT);
+        lexer_file_state_push_replacement (state, &replace_result);
         return 1u;
     }
 
@@ -6674,7 +7736,7 @@ void cushion_lex_root_file (struct cushion_instance_t *instance, const char *pat
     FILE *input_file = fopen (path, "r");
     if (!input_file)
     {
-        fprintf (stderr, "Failed to open input file \"%s\".\n", path);
+        cushion_instance_error_output (instance, "Failed to open input file \"%s\".\n", path);
         cushion_instance_signal_error (instance);
         return;
     }
@@ -6715,6 +7777,84 @@ static void make_lex_state_path_writeable_to_literal (struct cushion_lexer_file_
     *output = '\0';
 }
 
+static void lex_include_guard_observe (struct cushion_lexer_file_state_t *state,
+                                      const struct cushion_token_t *current_token)
+{
+    switch (current_token->type)
+    {
+    case CUSHION_TOKEN_TYPE_NEW_LINE:
+    case CUSHION_TOKEN_TYPE_GLUE:
+    case CUSHION_TOKEN_TYPE_COMMENT:
+    case CUSHION_TOKEN_TYPE_END_OF_FILE:
+        // Not significant for include guard detection.
+        return;
+
+    default:
+        break;
+    }
+
+    switch (state->include_guard_state)
+    {
+    case CUSHION_LEXER_INCLUDE_GUARD_STATE_START:
+        // Include guard candidate is registered by #ifndef processing, everything else breaks the pattern.
+        if (current_token->type != CUSHION_TOKEN_TYPE_PREPROCESSOR_IFNDEF)
+        {
+            state->include_guard_state = CUSHION_LEXER_INCLUDE_GUARD_STATE_INVALID;
+        }
+
+        break;
+
+    case CUSHION_LEXER_INCLUDE_GUARD_STATE_INSIDE:
+        if (state->conditional_inclusion_node == state->include_guard_node)
+        {
+            switch (current_token->type)
+            {
+            case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIF:
+            case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFDEF:
+            case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFNDEF:
+            case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELSE:
+                // Alternative branch is not excluded by guard macro, therefore it is not an include guard.
+                state->include_guard_state = CUSHION_LEXER_INCLUDE_GUARD_STATE_INVALID;
+                break;
+
+            case CUSHION_TOKEN_TYPE_PREPROCESSOR_ENDIF:
+                state->include_guard_state = CUSHION_LEXER_INCLUDE_GUARD_STATE_CLOSED;
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        break;
+
+    case CUSHION_LEXER_INCLUDE_GUARD_STATE_CLOSED:
+        // Something significant after guard #endif.
+        state->include_guard_state = CUSHION_LEXER_INCLUDE_GUARD_STATE_INVALID;
+        break;
+
+    case CUSHION_LEXER_INCLUDE_GUARD_STATE_INVALID:
+        break;
+    }
+}
+
+static void lex_include_guard_register (struct cushion_lexer_file_state_t *state, const char *path)
+{
+    if (state->include_guard_state != CUSHION_LEXER_INCLUDE_GUARD_STATE_CLOSED ||
+        cushion_instance_is_error_signaled (state->instance))
+    {
+        return;
+    }
+
+    struct cushion_file_identity_t identity;
+    if (cushion_instance_file_identity_query (state->instance, path, &identity) == CUSHION_INTERNAL_RESULT_OK)
+    {
+        cushion_instance_include_guard_add (state->instance, &identity, state->include_guard_name_begin,
+                                            state->include_guard_name_end,
+                                            (state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) ? 1u : 0u);
+    }
+}
+
 void cushion_lex_file_from_handle (struct cushion_instance_t *instance,
                                    FILE *input_file,
                                    const char *path,
@@ -6731,14 +7871,22 @@ void cushion_lex_file_from_handle (struct cushion_instance_t *instance,
     state->flags = flags;
     state->instance = instance;
     state->token_stack_top = NULL;
+    state->token_stack_free = NULL;
     state->stack_exit_file = NULL;
     state->stack_exit_line = 1u;
     state->last_marked_file = state->file_name;
     state->last_marked_line = 1u;
     state->last_token_line = 1u;
     state->conditional_inclusion_node = NULL;
+    state->include_guard_state = CUSHION_LEXER_INCLUDE_GUARD_STATE_START;
+    state->include_guard_node = NULL;
+    state->include_guard_name_begin = NULL;
+    state->include_guard_name_end = NULL;
+    state->lazy_file_name_source = NULL;
+    state->lazy_file_name = NULL;
 
 #if defined(CUSHION_EXTENSIONS)
+    state->evaluation_nesting = 0u;
     state->defer_feature = NULL;
 
     if ((state->flags & CUSHION_LEX_FILE_FLAG_SCAN_ONLY) == 0u &&
@@ -6780,8 +7928,18 @@ void cushion_lex_file_from_handle (struct cushion_instance_t *instance,
         cushion_instance_output_line_marker (instance, state->file_name, 1u);
     }
 
-    cushion_tokenization_state_init_for_file (&state->tokenization, state->file_name, input_file,
-                                              &state->instance->allocator, CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    if (cushion_instance_has_option (instance, CUSHION_OPTION_CACHE_TOKENS))
+    {
+        cushion_token_cache_init_tokenization (instance, &state->tokenization, state->file_name, input_file,
+                                               state->path_buffer.data, &state->instance->allocator,
+                                               CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    }
+    else
+    {
+        cushion_tokenization_state_init_for_file (&state->tokenization, state->file_name, input_file,
+                                                  &state->instance->allocator, CUSHION_ALLOCATION_CLASS_TRANSIENT);
+    }
+
     lex_update_tokenization_flags (state);
 
     struct cushion_token_t current_token;
@@ -6806,6 +7964,11 @@ void cushion_lex_file_from_handle (struct cushion_instance_t *instance,
             break;
         }
 
+        if (state->include_guard_state != CUSHION_LEXER_INCLUDE_GUARD_STATE_INVALID)
+        {
+            lex_include_guard_observe (state, &current_token);
+        }
+
         // Preprocessing pass: check directives and other things that might be omitted in the result.
         switch (current_token.type)
         {
@@ -6942,6 +8105,7 @@ void cushion_lex_file_from_handle (struct cushion_instance_t *instance,
                 cushion_instance_output_null_terminated (state->instance, "\n");
             }
 
+            lex_include_guard_register (state, path);
             break;
         }
 
@@ -7023,6 +8187,8 @@ void cushion_lex_file_from_handle (struct cushion_instance_t *instance,
         }
     }
 
+    cushion_tokenization_state_shutdown (&state->tokenization);
+
     // Currently there is no safe way to reset transient data except for the end of file lexing.
     // For the most cases, we would never use more than 1 or 2 pages for file (with 1mb pages),
     // so there is usually no need for aggressive memory reuse.
@@ -7065,7 +8231,8 @@ void cushion_lex_finalize_statement_accumulators (struct cushion_instance_t *ins
 
         while (entry)
         {
-            output_extension_injector_content (instance, entry->content_first, flags);
+            output_extension_injector_content (instance, entry->source_file, entry->source_line, &entry->content,
+                                               flags);
             entry = entry->next;
         }
 
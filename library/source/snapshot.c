@@ -0,0 +1,543 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "internal.h"
+
+/// \file
+/// \brief Macro snapshot: configured macros and files that were read to produce them, saved to skip lexing.
+/// \details Snapshot is a binary file that starts with a header with format tag, record layout, configuration
+///          fingerprint and counts of files and macros. Every file is listed with its content hash and size, pragma
+///          once mark, scan only include guard and path. Every macro is listed with its flags, name and parameters,
+///          followed by its replacement list in the same detached token array layout that define cache uses.
+///          Therefore, loading is one read of the whole file and copying of token arrays with interning of their
+///          identifiers, nothing is tokenized or lexed again. Records are written in native byte order and layout,
+///          so snapshot is not portable between platforms, but it is only a local build artifact anyway.
+///          Snapshot is only used when configuration fingerprint matches and every file has the same content.
+
+#define SNAPSHOT_FORMAT_TAG "cushion-snap-2"
+
+/// \brief Written as is to detect snapshots from platforms with different byte order.
+#define SNAPSHOT_BYTE_ORDER_MARK 0x01020304u
+
+/// \brief Only macros with these flags can be saved, other flags depend on lexer state or on output.
+#define SNAPSHOT_SUPPORTED_MACRO_FLAGS (CUSHION_MACRO_FLAG_FUNCTION | CUSHION_MACRO_FLAG_VARIADIC_PARAMETERS)
+
+/// \brief Every record and every block of data after it is aligned to this value.
+#define SNAPSHOT_ALIGNMENT 8u
+
+struct snapshot_header_t
+{
+    char tag[16u];
+    uint32_t byte_order_mark;
+    uint32_t token_record_size;
+    uint32_t files_count;
+    uint32_t macros_count;
+    struct cushion_hash_t fingerprint;
+};
+
+/// \brief File record, followed by null terminated path and guard macro name if there is one.
+struct snapshot_file_t
+{
+    struct cushion_hash_t content_hash;
+    uint64_t content_size;
+    uint32_t path_length;
+    /// \brief Zero if file has no scan only include guard.
+    uint32_t guard_length;
+    uint32_t pragma_once;
+    uint32_t padding;
+};
+
+/// \brief Macro record, followed by null terminated name and parameter names and then by detached replacement list
+///        content: number values, token records, text and identifier names.
+struct snapshot_macro_t
+{
+    uint32_t flags;
+    uint32_t name_length;
+    uint32_t parameters_count;
+    /// \brief Size of all parameter names with their terminators.
+    uint32_t parameters_size;
+    uint32_t tokens_count;
+    uint32_t number_values_count;
+    uint32_t text_size;
+    uint32_t names_size;
+};
+
+_Static_assert (sizeof (SNAPSHOT_FORMAT_TAG) <= sizeof (((struct snapshot_header_t *) NULL)->tag),
+                "Format tag must fit into snapshot header.");
+_Static_assert (sizeof (struct snapshot_header_t) % SNAPSHOT_ALIGNMENT == 0u &&
+                    sizeof (struct snapshot_file_t) % SNAPSHOT_ALIGNMENT == 0u &&
+                    sizeof (struct snapshot_macro_t) % SNAPSHOT_ALIGNMENT == 0u,
+                "Snapshot records must keep alignment of the data after them.");
+_Static_assert (SNAPSHOT_ALIGNMENT % _Alignof (unsigned long long) == 0u &&
+                    SNAPSHOT_ALIGNMENT % _Alignof (struct cushion_token_array_token_t) == 0u,
+                "Replacement list content must be properly aligned inside snapshot.");
+
+static inline size_t snapshot_align (size_t size)
+{
+    return (size + SNAPSHOT_ALIGNMENT - 1u) & ~(size_t) (SNAPSHOT_ALIGNMENT - 1u);
+}
+
+/// \brief Reads part of the snapshot of given size, advancing cursor to the aligned position after it.
+/// \return Pointer to the part or NULL if snapshot is too short.
+static const char *snapshot_read (const char **cursor, const char *limit, size_t size)
+{
+    const char *part = *cursor;
+    if ((size_t) (limit - part) < size)
+    {
+        return NULL;
+    }
+
+    const size_t aligned_size = snapshot_align (size);
+    *cursor = (size_t) (limit - part) < aligned_size ? limit : part + aligned_size;
+    return part;
+}
+
+/// \brief Checks that string of given length is followed by its terminator and has no terminators inside.
+static inline unsigned int snapshot_is_string_valid (const char *string, uint32_t length)
+{
+    return string[length] == '\0' && strlen (string) == length;
+}
+
+/// \brief Reads file record, when not applying checks that file content is the same, otherwise adds configured file.
+/// \return Zero on failure.
+static unsigned int snapshot_read_file (struct cushion_instance_t *instance,
+                                        const char **cursor,
+                                        const char *limit,
+                                        unsigned int apply)
+{
+    const struct snapshot_file_t *record =
+        (const struct snapshot_file_t *) snapshot_read (cursor, limit, sizeof (struct snapshot_file_t));
+
+    if (!record || record->path_length == 0u)
+    {
+        return 0u;
+    }
+
+    // Sizes are checked in 64 bits, so huge lengths from broken snapshot cannot wrap around.
+    const uint64_t strings_size =
+        (uint64_t) record->path_length + 1u + (record->guard_length ? (uint64_t) record->guard_length + 1u : 0u);
+    const char *path =
+        strings_size <= (uint64_t) (limit - *cursor) ? snapshot_read (cursor, limit, (size_t) strings_size) : NULL;
+
+    if (!path)
+    {
+        return 0u;
+    }
+
+    const char *guard = record->guard_length ? path + record->path_length + 1u : NULL;
+    if (!apply)
+    {
+        if (!snapshot_is_string_valid (path, record->path_length) ||
+            (guard && !snapshot_is_string_valid (guard, record->guard_length)))
+        {
+            return 0u;
+        }
+
+        // Size check is much cheaper than hashing and filters out most of the changed files.
+        struct cushion_file_status_t status;
+        struct cushion_hash_t current_hash;
+        unsigned long long current_size;
+
+        return cushion_file_status_query (path, &status) == CUSHION_INTERNAL_RESULT_OK &&
+               status.size == record->content_size &&
+               cushion_file_hash_content (path, &current_hash, &current_size) == CUSHION_INTERNAL_RESULT_OK &&
+               current_size == record->content_size && cushion_hash_equal (current_hash, record->content_hash);
+    }
+
+    cushion_instance_configured_file_add (instance, path, record->pragma_once ? 1u : 0u, guard);
+    return 1u;
+}
+
+/// \brief Checks that detached token records only point inside their array.
+static unsigned int snapshot_is_replacement_list_valid (const struct cushion_token_array_t *detached,
+                                                        uint32_t names_size)
+{
+    for (unsigned int index = 0u; index < detached->count; ++index)
+    {
+        const struct cushion_token_array_token_t *record = &detached->tokens[index];
+        if (record->type > CUSHION_TOKEN_TYPE_OTHER || record->begin > record->end)
+        {
+            return 0u;
+        }
+
+        switch ((enum cushion_token_type_t) record->type)
+        {
+        case CUSHION_TOKEN_TYPE_IDENTIFIER:
+            if (record->begin < detached->text_size || record->end == record->begin ||
+                record->end - detached->text_size > names_size)
+            {
+                return 0u;
+            }
+
+            continue;
+
+        case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
+            if (record->value >= detached->number_values_count)
+            {
+                return 0u;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+
+        if (record->end > detached->text_size ||
+            (unsigned int) record->subsequence_head + record->subsequence_tail > record->end - record->begin)
+        {
+            return 0u;
+        }
+    }
+
+    return 1u;
+}
+
+/// \brief Reads macro record, when not applying only checks it, otherwise registers macro.
+/// \return Zero on failure.
+static unsigned int snapshot_read_macro (struct cushion_instance_t *instance,
+                                         const char **cursor,
+                                         const char *limit,
+                                         unsigned int macro_index,
+                                         unsigned int apply)
+{
+    const struct snapshot_macro_t *record =
+        (const struct snapshot_macro_t *) snapshot_read (cursor, limit, sizeof (struct snapshot_macro_t));
+
+    if (!record || (record->flags & ~(uint32_t) SNAPSHOT_SUPPORTED_MACRO_FLAGS) != 0u || record->name_length == 0u)
+    {
+        return 0u;
+    }
+
+    const uint64_t strings_size = (uint64_t) record->name_length + 1u + record->parameters_size;
+    const char *name =
+        strings_size <= (uint64_t) (limit - *cursor) ? snapshot_read (cursor, limit, (size_t) strings_size) : NULL;
+
+    if (!name)
+    {
+        return 0u;
+    }
+
+    const char *parameters = name + record->name_length + 1u;
+    struct cushion_token_array_t detached = {
+        .count = record->tokens_count,
+        .number_values_count = record->number_values_count,
+        .text_size = record->text_size,
+    };
+
+    const uint64_t content_size = (uint64_t) record->number_values_count * sizeof (unsigned long long) +
+                                  (uint64_t) record->tokens_count * sizeof (struct cushion_token_array_token_t) +
+                                  record->text_size + record->names_size;
+
+    const char *content = content_size <= (uint64_t) (limit - *cursor) ?
+                              snapshot_read (cursor, limit, (size_t) content_size) :
+                              NULL;
+
+    if (!content)
+    {
+        return 0u;
+    }
+
+    cushion_token_array_bind_content (&detached, (void *) content);
+    if (!apply)
+    {
+        if (!snapshot_is_string_valid (name, record->name_length) ||
+            (record->parameters_size > 0u && parameters[record->parameters_size - 1u] != '\0') ||
+            (uint64_t) record->text_size + record->names_size > UINT32_MAX ||
+            !snapshot_is_replacement_list_valid (&detached, record->names_size))
+        {
+            return 0u;
+        }
+
+        uint32_t terminators = 0u;
+        for (uint32_t offset = 0u; offset < record->parameters_size; ++offset)
+        {
+            if (parameters[offset] == '\0')
+            {
+                if (offset == 0u || parameters[offset - 1u] == '\0')
+                {
+                    // Parameter names cannot be empty.
+                    return 0u;
+                }
+
+                ++terminators;
+            }
+        }
+
+        return terminators == record->parameters_count;
+    }
+
+    struct cushion_macro_node_t *node =
+        cushion_allocator_allocate (&instance->allocator, sizeof (struct cushion_macro_node_t),
+                                    _Alignof (struct cushion_macro_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+    node->name = cushion_instance_copy_char_sequence_inside (instance, name, name + record->name_length,
+                                                             CUSHION_ALLOCATION_CLASS_PERSISTENT);
+    node->flags = (enum cushion_macro_flags_t) record->flags;
+    node->replacement_list =
+        detached.count > 0u ?
+            cushion_token_array_attach (instance, &detached, CUSHION_ALLOCATION_CLASS_PERSISTENT) :
+            NULL;
+    node->parameters_first = NULL;
+    node->program = NULL;
+    node->expansion = NULL;
+    struct cushion_macro_parameter_node_t *parameters_last = NULL;
+
+    for (uint32_t index = 0u; index < record->parameters_count; ++index)
+    {
+        struct cushion_macro_parameter_node_t *parameter = cushion_allocator_allocate (
+            &instance->allocator, sizeof (struct cushion_macro_parameter_node_t),
+            _Alignof (struct cushion_macro_parameter_node_t), CUSHION_ALLOCATION_CLASS_PERSISTENT);
+
+        parameter->name =
+            cushion_instance_copy_null_terminated_inside (instance, parameters, CUSHION_ALLOCATION_CLASS_PERSISTENT);
+        parameter->next = NULL;
+
+        if (parameters_last)
+        {
+            parameters_last->next = parameter;
+        }
+        else
+        {
+            node->parameters_first = parameter;
+        }
+
+        parameters_last = parameter;
+        parameters += strlen (parameters) + 1u;
+    }
+
+    // There are no lines in binary snapshot, so errors point to the macro by its index instead.
+    cushion_instance_macro_add (instance, node,
+                                (struct cushion_error_context_t) {
+                                    .file = instance->macro_snapshot_path,
+                                    .line = macro_index + 1u,
+                                    .column = UINT_MAX,
+                                });
+
+    return !cushion_instance_is_error_signaled (instance);
+}
+
+/// \brief Reads files and macros of the snapshot, either checking them or applying them.
+static unsigned int snapshot_read_content (struct cushion_instance_t *instance,
+                                           const char *cursor,
+                                           const char *limit,
+                                           const struct snapshot_header_t *header,
+                                           unsigned int apply)
+{
+    for (uint32_t index = 0u; index < header->files_count; ++index)
+    {
+        if (!snapshot_read_file (instance, &cursor, limit, apply))
+        {
+            return 0u;
+        }
+    }
+
+    for (uint32_t index = 0u; index < header->macros_count; ++index)
+    {
+        if (!snapshot_read_macro (instance, &cursor, limit, index, apply))
+        {
+            return 0u;
+        }
+    }
+
+    return cursor == limit;
+}
+
+unsigned int cushion_snapshot_load (struct cushion_instance_t *instance)
+{
+    size_t size;
+    // Content is allocated by malloc, therefore it is aligned enough for all the records.
+    char *content = cushion_file_read_content (instance->macro_snapshot_path, "rb", &size);
+
+    if (!content)
+    {
+        // Snapshot was not created yet.
+        return 0u;
+    }
+
+    const char *limit = content + size;
+    const char *cursor = content;
+    const struct snapshot_header_t *header =
+        (const struct snapshot_header_t *) snapshot_read (&cursor, limit, sizeof (struct snapshot_header_t));
+    unsigned int loaded = 0u;
+
+    // Everything is checked before applying, so broken or outdated snapshot does not leave partial state.
+    if (header && strncmp (header->tag, SNAPSHOT_FORMAT_TAG, sizeof (header->tag)) == 0 &&
+        header->byte_order_mark == SNAPSHOT_BYTE_ORDER_MARK &&
+        header->token_record_size == sizeof (struct cushion_token_array_token_t) &&
+        cushion_hash_equal (header->fingerprint, instance->configuration_fingerprint) &&
+        snapshot_read_content (instance, cursor, limit, header, 0u))
+    {
+        loaded = snapshot_read_content (instance, cursor, limit, header, 1u);
+    }
+
+    free (content);
+    return loaded;
+}
+
+/// \brief Appends padding after data of given size to keep snapshot alignment.
+static void snapshot_write_padding (struct cushion_output_writer_t *writer, size_t size)
+{
+    static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+    cushion_output_writer_append (writer, padding, snapshot_align (size) - size);
+}
+
+void cushion_snapshot_save (struct cushion_instance_t *instance)
+{
+    struct cushion_symbol_table_t *table = &instance->symbol_table;
+    struct snapshot_header_t header = {
+        .tag = SNAPSHOT_FORMAT_TAG,
+        .byte_order_mark = SNAPSHOT_BYTE_ORDER_MARK,
+        .token_record_size = sizeof (struct cushion_token_array_token_t),
+        .files_count = 0u,
+        .macros_count = 0u,
+        .fingerprint = instance->configuration_fingerprint,
+    };
+
+    for (unsigned int symbol = CUSHION_SYMBOL_NONE + 1u; symbol < table->symbols_count; ++symbol)
+    {
+        // Lazy macros from prefix scan headers are lexed here as snapshot stores their tokens and checks their flags.
+        struct cushion_macro_node_t *node = cushion_instance_macro_search_symbol (instance, symbol);
+        if (cushion_instance_is_error_signaled (instance))
+        {
+            return;
+        }
+
+        if (!node)
+        {
+            continue;
+        }
+
+        if (node->flags & ~SNAPSHOT_SUPPORTED_MACRO_FLAGS)
+        {
+            cushion_instance_error_output (instance,
+                                           "Macro snapshot is not saved: macro \"%s\" is preserved or uses extension "
+                                           "that depends on lexer state.\n",
+                                           node->name);
+            return;
+        }
+
+        ++header.macros_count;
+    }
+
+    struct cushion_configured_file_t *file = instance->configured_files_first;
+    while (file)
+    {
+        ++header.files_count;
+        file = file->next;
+    }
+
+    // Output writer is not used before jobs, it writes through temporary file and keeps unchanged snapshot untouched.
+    struct cushion_output_writer_t *writer = &instance->output;
+    if (cushion_output_writer_open (writer, instance->macro_snapshot_path, CUSHION_OUTPUT_WRITER_FLAG_ONLY_CHANGED) !=
+        CUSHION_INTERNAL_RESULT_OK)
+    {
+        cushion_instance_error_output (instance, "Failed to open macro snapshot \"%s\" for writing.\n",
+                                       instance->macro_snapshot_path);
+        return;
+    }
+
+    cushion_output_writer_append (writer, (const char *) &header, sizeof (header));
+    file = instance->configured_files_first;
+
+    while (file)
+    {
+        struct snapshot_file_t record = {
+            .path_length = (uint32_t) strlen (file->path),
+            .guard_length = file->guard_macro ? (uint32_t) strlen (file->guard_macro) : 0u,
+            .pragma_once = file->pragma_once ? 1u : 0u,
+            .padding = 0u,
+        };
+
+        unsigned long long content_size;
+        if (cushion_file_hash_content (file->path, &record.content_hash, &content_size) != CUSHION_INTERNAL_RESULT_OK)
+        {
+            // Writer is marked as failed, so incomplete snapshot never replaces the previous one.
+            cushion_instance_error_output (instance, "Macro snapshot is not saved: failed to read \"%s\".\n",
+                                           file->path);
+            writer->failed = 1u;
+            break;
+        }
+
+        record.content_size = content_size;
+        cushion_output_writer_append (writer, (const char *) &record, sizeof (record));
+        cushion_output_writer_append (writer, file->path, record.path_length + 1u);
+        size_t strings_size = record.path_length + 1u;
+
+        if (file->guard_macro)
+        {
+            cushion_output_writer_append (writer, file->guard_macro, record.guard_length + 1u);
+            strings_size += record.guard_length + 1u;
+        }
+
+        snapshot_write_padding (writer, strings_size);
+        file = file->next;
+    }
+
+    for (unsigned int symbol = CUSHION_SYMBOL_NONE + 1u; symbol < table->symbols_count && !writer->failed; ++symbol)
+    {
+        struct cushion_macro_node_t *node = table->symbols[symbol].macro;
+        if (!node)
+        {
+            continue;
+        }
+
+        const struct cushion_token_array_t *replacement_list = node->replacement_list;
+        struct snapshot_macro_t record = {
+            .flags = (uint32_t) node->flags,
+            .name_length = (uint32_t) strlen (node->name),
+            .parameters_count = 0u,
+            .parameters_size = 0u,
+            .tokens_count = replacement_list ? replacement_list->count : 0u,
+            .number_values_count = replacement_list ? replacement_list->number_values_count : 0u,
+            .text_size = replacement_list ? replacement_list->text_size : 0u,
+            .names_size =
+                replacement_list ? (uint32_t) cushion_token_array_get_names_size (instance, replacement_list) : 0u,
+        };
+
+        struct cushion_macro_parameter_node_t *parameter = node->parameters_first;
+        while (parameter)
+        {
+            ++record.parameters_count;
+            record.parameters_size += (uint32_t) strlen (parameter->name) + 1u;
+            parameter = parameter->next;
+        }
+
+        cushion_output_writer_append (writer, (const char *) &record, sizeof (record));
+        cushion_output_writer_append (writer, node->name, record.name_length + 1u);
+        parameter = node->parameters_first;
+
+        while (parameter)
+        {
+            cushion_output_writer_append (writer, parameter->name, strlen (parameter->name) + 1u);
+            parameter = parameter->next;
+        }
+
+        snapshot_write_padding (writer, (size_t) record.name_length + 1u + record.parameters_size);
+        if (!replacement_list)
+        {
+            continue;
+        }
+
+        struct cushion_allocator_transient_marker_t transient_marker =
+            cushion_allocator_get_transient_marker (&instance->allocator);
+
+        const size_t array_size = cushion_token_array_size (record.tokens_count, record.number_values_count,
+                                                            record.text_size);
+        struct cushion_token_array_t *detached =
+            cushion_allocator_allocate (&instance->allocator, array_size + record.names_size,
+                                        cushion_token_array_alignment (), CUSHION_ALLOCATION_CLASS_TRANSIENT);
+
+        cushion_token_array_detach (instance, replacement_list, detached);
+        const size_t content_size = array_size - sizeof (struct cushion_token_array_t) + record.names_size;
+        cushion_output_writer_append (writer, (const char *) detached->number_values, content_size);
+        snapshot_write_padding (writer, content_size);
+        cushion_allocator_reset_transient (&instance->allocator, transient_marker);
+    }
+
+    const unsigned int failed = writer->failed;
+    if (cushion_output_writer_close (writer) != CUSHION_INTERNAL_RESULT_OK && !failed)
+    {
+        cushion_instance_error_output (instance, "Failed to save macro snapshot to \"%s\".\n",
+                                       instance->macro_snapshot_path);
+    }
+}
@@ -0,0 +1,542 @@
+#include <time.h>
+
+#include "internal.h"
+
+/// \file
+/// \brief Token cache: token streams of files that are replayed instead of tokenizing files again.
+/// \details File is tokenized as a whole once, without skipping anything, and its tokens are stored as compact
+///          records with offsets into file content that is kept in memory. Replay walks these records: in skip
+///          regular mode it only looks at record types until the next directive, so it never touches skipped text.
+///          Tokens point into cached content, so the lexer sees exactly the same text as with usual tokenization.
+
+_Static_assert (CUSHION_TOKEN_TYPE_OTHER <= UINT8_MAX, "Token type must fit into token cache record.");
+_Static_assert (CUSHION_IDENTIFIER_KIND_DEFAULT <= UINT8_MAX, "Identifier kind must fit into token cache record.");
+_Static_assert (CUSHION_PUNCTUATOR_KIND_BITWISE_XOR_ASSIGN <= UINT8_MAX,
+                "Punctuator kind must fit into token cache record.");
+_Static_assert (CUSHION_TOKEN_SUBSEQUENCE_ENCODING_WIDE <= UINT8_MAX,
+                "Literal encoding must fit into token cache record.");
+
+#define TOKEN_CACHE_INITIAL_TOKENS_CAPACITY 1024u
+#define TOKEN_CACHE_INITIAL_NUMBER_VALUES_CAPACITY 64u
+
+static void token_cache_entry_free (struct cushion_token_cache_entry_t *entry)
+{
+    free (entry->content);
+    free (entry->tokens);
+    free (entry->number_values);
+    free (entry);
+}
+
+void cushion_token_cache_entry_release (struct cushion_token_cache_entry_t *entry)
+{
+    assert (entry->users > 0u);
+    --entry->users;
+
+    if (entry->detached && entry->users == 0u)
+    {
+        token_cache_entry_free (entry);
+    }
+}
+
+/// \brief Removes entry from cache, entry is freed right away unless it is still being replayed.
+static void token_cache_entry_detach (struct cushion_instance_t *instance,
+                                      struct cushion_token_cache_entry_t **link,
+                                      struct cushion_token_cache_entry_t *entry)
+{
+    *link = entry->next;
+    instance->token_cache_size -= entry->memory_size;
+
+    if (entry->users > 0u)
+    {
+        entry->detached = 1u;
+    }
+    else
+    {
+        token_cache_entry_free (entry);
+    }
+}
+
+void cushion_token_cache_clear (struct cushion_instance_t *instance)
+{
+    for (unsigned int bucket = 0u; bucket < CUSHION_TOKEN_CACHE_BUCKETS; ++bucket)
+    {
+        while (instance->token_cache_buckets[bucket])
+        {
+            token_cache_entry_detach (instance, &instance->token_cache_buckets[bucket],
+                                      instance->token_cache_buckets[bucket]);
+        }
+    }
+
+    assert (instance->token_cache_size == 0u);
+}
+
+/// \brief Queries file identity and status that are used to validate entries.
+static unsigned int token_cache_query_file (const char *path,
+                                            char *path_buffer,
+                                            struct cushion_file_identity_t *identity,
+                                            struct cushion_file_status_t *status)
+{
+    return cushion_file_identity_query (path, path_buffer, identity) == CUSHION_INTERNAL_RESULT_OK &&
+           cushion_file_status_query (path, status) == CUSHION_INTERNAL_RESULT_OK;
+}
+
+/// \brief Grows array to fit one more item.
+/// \return New array or NULL on allocation failure, in which case old array is left intact.
+static void *token_cache_reserve (void *array,
+                                  unsigned int *capacity,
+                                  unsigned int count,
+                                  unsigned int initial_capacity,
+                                  size_t item_size)
+{
+    if (count < *capacity)
+    {
+        return array;
+    }
+
+    const unsigned int new_capacity = *capacity ? *capacity * 2u : initial_capacity;
+    if (new_capacity <= *capacity)
+    {
+        return NULL;
+    }
+
+    void *new_array = realloc (array, (size_t) new_capacity * item_size);
+    if (new_array)
+    {
+        *capacity = new_capacity;
+    }
+
+    return new_array;
+}
+
+/// \brief Tokenizes whole file content into entry tokens.
+/// \return Zero if file cannot be recorded due to tokenization error or record limits.
+static unsigned int token_cache_record (struct cushion_instance_t *instance,
+                                        struct cushion_tokenization_state_t *state,
+                                        struct cushion_token_cache_entry_t *entry)
+{
+    const char *content = state->input_file_content;
+    const size_t content_size = (size_t) (state->limit - content);
+
+    if (content_size >= UINT32_MAX)
+    {
+        return 0u;
+    }
+
+    unsigned int tokens_capacity = 0u;
+    unsigned int number_values_capacity = 0u;
+    state->flags = CUSHION_TOKENIZATION_FLAGS_RECORDING;
+
+    struct cushion_token_t token;
+    // Hash punctuator for unknown directive keeps previous begin, so it should point to content from the start.
+    token.begin = content;
+    token.end = content;
+
+    while (1u)
+    {
+        cushion_tokenization_next_token (instance, state, &token);
+        if ((state->flags & CUSHION_TOKENIZATION_FLAGS_RECORDING_FAILED) || token.begin < content ||
+            token.end < token.begin || token.end > state->limit)
+        {
+            return 0u;
+        }
+
+        struct cushion_token_cache_token_t *tokens =
+            token_cache_reserve (entry->tokens, &tokens_capacity, entry->tokens_count,
+                                 TOKEN_CACHE_INITIAL_TOKENS_CAPACITY, sizeof (struct cushion_token_cache_token_t));
+
+        if (!tokens)
+        {
+            return 0u;
+        }
+
+        entry->tokens = tokens;
+
+        struct cushion_token_cache_token_t *record = &entry->tokens[entry->tokens_count];
+        record->begin = (uint32_t) (token.begin - content);
+        record->end = (uint32_t) (token.end - content);
+        record->line = state->cursor_line;
+        record->type = (uint8_t) token.type;
+        record->kind = 0u;
+        record->subsequence_head = 0u;
+        record->subsequence_tail = 0u;
+        record->value = 0u;
+
+        struct cushion_token_subsequence_t literal_content;
+        const struct cushion_token_subsequence_t *subsequence = NULL;
+
+        switch (token.type)
+        {
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_SYSTEM:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER:
+            subsequence = &token.header_path;
+            break;
+
+        case CUSHION_TOKEN_TYPE_IDENTIFIER:
+            record->kind = (uint8_t) token.identifier_kind;
+            record->value = token.symbol;
+            break;
+
+        case CUSHION_TOKEN_TYPE_PUNCTUATOR:
+            record->kind = (uint8_t) token.punctuator_kind;
+            break;
+
+        case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
+        {
+            unsigned long long *number_values = token_cache_reserve (
+                entry->number_values, &number_values_capacity, entry->number_values_count,
+                TOKEN_CACHE_INITIAL_NUMBER_VALUES_CAPACITY, sizeof (unsigned long long));
+
+            if (!number_values)
+            {
+                return 0u;
+            }
+
+            entry->number_values = number_values;
+            record->value = entry->number_values_count;
+            entry->number_values[entry->number_values_count++] = token.unsigned_number_value;
+            break;
+        }
+
+        case CUSHION_TOKEN_TYPE_CHARACTER_LITERAL:
+        case CUSHION_TOKEN_TYPE_STRING_LITERAL:
+            record->kind = (uint8_t) token.symbolic_literal.encoding;
+            literal_content.begin = token.symbolic_literal.begin;
+            literal_content.end = token.symbolic_literal.end;
+            subsequence = &literal_content;
+            break;
+
+        default:
+            break;
+        }
+
+        if (subsequence)
+        {
+            if (subsequence->begin < token.begin || subsequence->end > token.end ||
+                subsequence->begin - token.begin > UINT8_MAX || token.end - subsequence->end > UINT8_MAX)
+            {
+                return 0u;
+            }
+
+            record->subsequence_head = (uint8_t) (subsequence->begin - token.begin);
+            record->subsequence_tail = (uint8_t) (token.end - subsequence->end);
+        }
+
+        ++entry->tokens_count;
+        if (token.type == CUSHION_TOKEN_TYPE_END_OF_FILE)
+        {
+            break;
+        }
+    }
+
+    entry->symbols_job = instance->job_index;
+    entry->content_size = content_size;
+    entry->memory_size += content_size + entry->tokens_count * sizeof (struct cushion_token_cache_token_t) +
+                          entry->number_values_count * sizeof (unsigned long long);
+    return 1u;
+}
+
+/// \brief Initializes tokenization state for replaying entry instead of reading the file.
+/// \details Tokenization pointers are moved to entry content, so columns for error messages are still calculated.
+static void token_cache_start_replay (struct cushion_instance_t *instance,
+                                      struct cushion_tokenization_state_t *state,
+                                      const char *path,
+                                      struct cushion_token_cache_entry_t *entry)
+{
+    if (entry->symbols_job != instance->job_index)
+    {
+        // Symbols are reset between jobs, identifiers are interned again when they are replayed.
+        for (unsigned int index = 0u; index < entry->tokens_count; ++index)
+        {
+            if (entry->tokens[index].type == CUSHION_TOKEN_TYPE_IDENTIFIER)
+            {
+                entry->tokens[index].value = CUSHION_SYMBOL_NONE;
+            }
+        }
+
+        entry->symbols_job = instance->job_index;
+    }
+
+    ++entry->users;
+    state->replay_entry = entry;
+    state->replay_index = 0u;
+    state->replay_line = 1u;
+
+    state->file_name = path;
+    state->state = CUSHION_TOKENIZATION_MODE_NEW_LINE;
+    state->flags = CUSHION_TOKENIZATION_FLAGS_NONE;
+    state->limit = entry->content + entry->content_size;
+    state->cursor = entry->content;
+    state->marker = entry->content;
+    state->token = entry->content;
+    state->cursor_line = 1u;
+    state->marker_line = 1u;
+    state->saved = NULL;
+    state->saved_line = 1u;
+    state->origin = entry->content;
+    state->origin_column = 1u;
+
+#if defined(CUSHION_EXTENSIONS)
+    state->guardrail_defer = NULL;
+    state->guardrail_defer_base = NULL;
+
+    state->guardrail_statement_accumulator = NULL;
+    state->guardrail_statement_accumulator_base = NULL;
+#endif
+
+    // Tokenizer is never called during replay, therefore there is no need for its tags.
+    state->tags = NULL;
+    state->input_file_optional = NULL;
+    state->input_file_content = NULL;
+}
+
+void cushion_token_cache_init_tokenization (struct cushion_instance_t *instance,
+                                            struct cushion_tokenization_state_t *state,
+                                            const char *path,
+                                            FILE *file,
+                                            char *path_buffer,
+                                            struct cushion_allocator_t *allocator,
+                                            enum cushion_allocation_class_t allocation_class)
+{
+    const unsigned int path_hash = cushion_hash_djb2_null_terminated (path);
+    struct cushion_token_cache_entry_t **link = &instance->token_cache_buckets[path_hash % CUSHION_TOKEN_CACHE_BUCKETS];
+    struct cushion_token_cache_entry_t *entry = *link;
+
+    while (entry && (entry->path_hash != path_hash || strcmp (entry->path, path) != 0))
+    {
+        link = &entry->next;
+        entry = *link;
+    }
+
+    struct cushion_file_identity_t identity;
+    struct cushion_file_status_t status;
+    // Time is captured before reading, so changes made during reading are never hidden by equal status.
+    const long long recorded_time = (long long) time (NULL);
+    unsigned int file_queried = 0u;
+
+    if (entry && entry->validated_job != instance->job_index)
+    {
+        file_queried = 1u;
+        if (token_cache_query_file (path, path_buffer, &identity, &status) &&
+            cushion_file_identity_equals (&identity, &entry->identity) &&
+            status.modification_time == entry->status.modification_time && status.size == entry->status.size &&
+            entry->status.modification_time < entry->recorded_time)
+        {
+            entry->validated_job = instance->job_index;
+        }
+        else
+        {
+            token_cache_entry_detach (instance, link, entry);
+            entry = NULL;
+        }
+    }
+
+    if (entry && entry->content)
+    {
+        token_cache_start_replay (instance, state, path, entry);
+        return;
+    }
+
+    cushion_tokenization_state_init_for_file (state, path, file, allocator, allocation_class);
+    if (entry || !state->input_file_content || instance->token_cache_size >= CUSHION_TOKEN_CACHE_MAX_SIZE ||
+        (!file_queried && !token_cache_query_file (path, path_buffer, &identity, &status)))
+    {
+        return;
+    }
+
+    const size_t path_length = strlen (path);
+    const size_t identity_path_length = identity.path ? strlen (identity.path) : 0u;
+    const size_t entry_size = sizeof (struct cushion_token_cache_entry_t) + path_length + 1u +
+                              (identity.path ? identity_path_length + 1u : 0u);
+
+    entry = malloc (entry_size);
+    if (!entry)
+    {
+        return;
+    }
+
+    char *strings = (char *) (entry + 1u);
+    memcpy (strings, path, path_length + 1u);
+    entry->path = strings;
+    entry->path_hash = path_hash;
+    entry->identity = identity;
+
+    if (identity.path)
+    {
+        memcpy (strings + path_length + 1u, identity.path, identity_path_length + 1u);
+        entry->identity.path = strings + path_length + 1u;
+    }
+
+    entry->status = status;
+    entry->recorded_time = recorded_time;
+    entry->validated_job = instance->job_index;
+    entry->symbols_job = instance->job_index;
+    entry->users = 0u;
+    entry->detached = 0u;
+    entry->content = NULL;
+    entry->content_size = 0u;
+    entry->tokens = NULL;
+    entry->tokens_count = 0u;
+    entry->number_values = NULL;
+    entry->number_values_count = 0u;
+    entry->memory_size = entry_size;
+
+    if (token_cache_record (instance, state, entry))
+    {
+        // Content ownership is moved to the entry and file is replayed from the start.
+        entry->content = state->input_file_content;
+        state->input_file_content = NULL;
+        token_cache_start_replay (instance, state, path, entry);
+    }
+    else
+    {
+        // Entry without content remembers that file cannot be recorded until it is changed.
+        free (entry->tokens);
+        free (entry->number_values);
+        entry->tokens = NULL;
+        entry->tokens_count = 0u;
+        entry->number_values = NULL;
+        entry->number_values_count = 0u;
+        entry->memory_size = entry_size;
+
+        char *content = state->input_file_content;
+        state->state = CUSHION_TOKENIZATION_MODE_NEW_LINE;
+        state->flags = CUSHION_TOKENIZATION_FLAGS_NONE;
+        state->cursor = content;
+        state->marker = content;
+        state->token = content;
+        state->cursor_line = 1u;
+        state->marker_line = 1u;
+        state->saved = NULL;
+        state->saved_line = 1u;
+        state->origin = content;
+        state->origin_column = 1u;
+    }
+
+    entry->next = instance->token_cache_buckets[path_hash % CUSHION_TOKEN_CACHE_BUCKETS];
+    instance->token_cache_buckets[path_hash % CUSHION_TOKEN_CACHE_BUCKETS] = entry;
+    instance->token_cache_size += entry->memory_size;
+}
+
+/// \brief Whether token is emitted by tokenizer in CUSHION_TOKENIZATION_FLAGS_SKIP_REGULAR mode.
+static inline unsigned int token_cache_is_emitted_when_skipping (uint8_t type)
+{
+    switch ((enum cushion_token_type_t) type)
+    {
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_IF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFDEF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_IFNDEF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFDEF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELIFNDEF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_ELSE:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_ENDIF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_INCLUDE:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_DEFINE:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_UNDEF:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_LINE:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_PRAGMA:
+    case CUSHION_TOKEN_TYPE_END_OF_FILE:
+        return 1u;
+
+    default:
+        // Header paths are not emitted too, as include mode falls back to skipping.
+        return 0u;
+    }
+}
+
+void cushion_token_cache_next_token (struct cushion_instance_t *instance,
+                                     struct cushion_tokenization_state_t *state,
+                                     struct cushion_token_t *output)
+{
+    struct cushion_token_cache_entry_t *entry = state->replay_entry;
+    unsigned int index = state->replay_index;
+
+    if (state->flags & CUSHION_TOKENIZATION_FLAGS_SKIP_REGULAR)
+    {
+        // Last token is always end of file, so this loop always stops.
+        while (!token_cache_is_emitted_when_skipping (entry->tokens[index].type))
+        {
+            ++index;
+        }
+    }
+
+    struct cushion_token_cache_token_t *record = &entry->tokens[index];
+    // End of file is returned again if more tokens are requested, like with the tokenizer.
+    state->replay_index = record->type == CUSHION_TOKEN_TYPE_END_OF_FILE ? index : index + 1u;
+    state->cursor_line += record->line - state->replay_line;
+    state->replay_line = record->line;
+    state->token = entry->content + record->begin;
+    state->cursor = entry->content + record->end;
+
+    output->type = (enum cushion_token_type_t) record->type;
+    output->begin = state->token;
+    output->end = state->cursor;
+
+    switch (output->type)
+    {
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_SYSTEM:
+    case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER:
+        output->header_path.begin = output->begin + record->subsequence_head;
+        output->header_path.end = output->end - record->subsequence_tail;
+        break;
+
+    case CUSHION_TOKEN_TYPE_IDENTIFIER:
+        if (record->value == CUSHION_SYMBOL_NONE)
+        {
+            record->value = cushion_instance_symbol_intern (instance, output->begin, output->end);
+        }
+
+        output->identifier_kind = (enum cushion_identifier_kind_t) record->kind;
+        output->symbol = record->value;
+        break;
+
+    case CUSHION_TOKEN_TYPE_PUNCTUATOR:
+        output->punctuator_kind = (enum cushion_punctuator_kind_t) record->kind;
+        break;
+
+    case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
+        output->unsigned_number_value = entry->number_values[record->value];
+        break;
+
+    case CUSHION_TOKEN_TYPE_CHARACTER_LITERAL:
+    case CUSHION_TOKEN_TYPE_STRING_LITERAL:
+        output->symbolic_literal.encoding = (enum cushion_token_subsequence_encoding_t) record->kind;
+        output->symbolic_literal.begin = output->begin + record->subsequence_head;
+        output->symbolic_literal.end = output->end - record->subsequence_tail;
+        break;
+
+    default:
+        break;
+    }
+}
+
+const char *cushion_token_cache_skip_line (struct cushion_tokenization_state_t *state)
+{
+    struct cushion_token_cache_entry_t *entry = state->replay_entry;
+    unsigned int index = state->replay_index;
+
+    // Last token is always end of file, so this loop always stops.
+    while (entry->tokens[index].type != CUSHION_TOKEN_TYPE_NEW_LINE &&
+           entry->tokens[index].type != CUSHION_TOKEN_TYPE_END_OF_FILE)
+    {
+        ++index;
+    }
+
+    const struct cushion_token_cache_token_t *record = &entry->tokens[index];
+    const char *line_end = entry->content + record->begin;
+
+    if (record->type == CUSHION_TOKEN_TYPE_END_OF_FILE)
+    {
+        // End of file is left to be replayed as usual.
+        state->replay_index = index;
+        state->cursor = line_end;
+        return line_end;
+    }
+
+    state->replay_index = index + 1u;
+    state->cursor_line += record->line - state->replay_line;
+    state->replay_line = record->line;
+    state->token = line_end;
+    state->cursor = entry->content + record->end;
+    return line_end;
+}
@@ -10,15 +10,21 @@ static inline void cushion_instance_tokenization_error (struct cushion_instance_
                                                         const char *format,
                                                         ...)
 {
+    if (tokenization->flags & CUSHION_TOKENIZATION_FLAGS_RECORDING)
+    {
+        tokenization->flags |= CUSHION_TOKENIZATION_FLAGS_RECORDING_FAILED;
+        return;
+    }
+
     va_list variadic_arguments;
     va_start (variadic_arguments, format);
-    cushion_instance_execution_error_internal (instance,
-                                               (struct cushion_error_context_t) {
-                                                   .file = tokenization->file_name,
-                                                   .line = tokenization->cursor_line,
-                                                   .column = tokenization->cursor_column,
-                                               },
-                                               format, variadic_arguments);
+    const struct cushion_error_context_t error_context = {
+        .file = tokenization->file_name,
+        .line = tokenization->cursor_line,
+        .column = cushion_tokenization_state_get_cursor_column (tokenization),
+    };
+
+    cushion_instance_execution_error_internal (instance, error_context, format, variadic_arguments);
     va_end (variadic_arguments);
 }
 
@@ -47,19 +53,44 @@ void cushion_tokenization_state_init_for_argument_string (struct cushion_tokeniz
 #endif
 
     state->cursor_line = 1u;
-    state->cursor_column = 1u;
     state->marker_line = 1u;
-    state->marker_column = 1u;
 
     state->saved = NULL;
     state->saved_line = 1u;
-    state->saved_column = 1u;
+    state->origin = string;
+    state->origin_column = 1u;
     state->input_file_optional = NULL;
+    state->input_file_content = NULL;
+    state->replay_entry = NULL;
+    state->replay_index = 0u;
+    state->replay_line = 1u;
 
     state->tags = cushion_allocator_allocate (allocator, sizeof (struct re2c_tags_t), _Alignof (struct re2c_tags_t),
                                               allocation_class);
 }
 
+/// \brief Returns size of the file if it is a regular file or SIZE_MAX otherwise.
+static size_t tokenization_query_regular_file_size (FILE *file)
+{
+#if defined(CUSHION_FILE_STAT_WINDOWS)
+    struct _stat64 file_stat;
+    if (_fstat64 (_fileno (file), &file_stat) == 0 && (file_stat.st_mode & _S_IFMT) == _S_IFREG &&
+        (unsigned long long) file_stat.st_size < (unsigned long long) SIZE_MAX)
+    {
+        return (size_t) file_stat.st_size;
+    }
+#elif defined(CUSHION_FILE_STAT_UNIX)
+    struct stat file_stat;
+    if (fstat (fileno (file), &file_stat) == 0 && S_ISREG (file_stat.st_mode) &&
+        (unsigned long long) file_stat.st_size < (unsigned long long) SIZE_MAX)
+    {
+        return (size_t) file_stat.st_size;
+    }
+#endif
+
+    return SIZE_MAX;
+}
+
 void cushion_tokenization_state_init_for_file (struct cushion_tokenization_state_t *state,
                                                const char *path,
                                                FILE *file,
@@ -85,17 +116,88 @@ void cushion_tokenization_state_init_for_file (struct cushion_tokenization_state
 #endif
 
     state->cursor_line = 1u;
-    state->cursor_column = 1u;
     state->marker_line = 1u;
-    state->marker_column = 1u;
 
     state->saved = NULL;
     state->saved_line = 1u;
-    state->saved_column = 1u;
+    state->origin = state->cursor;
+    state->origin_column = 1u;
     state->input_file_optional = file;
+    state->input_file_content = NULL;
+    state->replay_entry = NULL;
+    state->replay_index = 0u;
+    state->replay_line = 1u;
 
     state->tags = cushion_allocator_allocate (allocator, sizeof (struct re2c_tags_t), _Alignof (struct re2c_tags_t),
                                               allocation_class);
+
+    // Regular files are read as a whole and tokenized in place: it makes refills and their memory moves unnecessary
+    // and removes lexeme size limit. Content is read into separate heap allocation as it can be bigger than page.
+    const size_t file_size = tokenization_query_regular_file_size (file);
+    if (file_size != SIZE_MAX)
+    {
+        char *content = malloc (file_size + 1u);
+        if (content)
+        {
+            // Read size might be less than file size due to new line conversion in text mode.
+            const size_t read = fread (content, 1u, file_size, file);
+            if (ferror (file))
+            {
+                // Fall back to streaming from the beginning.
+                free (content);
+                clearerr (file);
+                rewind (file);
+            }
+            else
+            {
+                content[read] = '\0';
+                state->input_file_content = content;
+                state->input_file_optional = NULL;
+
+                state->limit = content + read;
+                state->cursor = content;
+                state->marker = content;
+                state->token = content;
+                state->origin = content;
+            }
+        }
+    }
+}
+
+void cushion_tokenization_state_shutdown (struct cushion_tokenization_state_t *state)
+{
+    if (state->input_file_content)
+    {
+        free (state->input_file_content);
+        state->input_file_content = NULL;
+    }
+
+    if (state->replay_entry)
+    {
+        cushion_token_cache_entry_release (state->replay_entry);
+        state->replay_entry = NULL;
+    }
+}
+
+static unsigned int tokenization_get_column (const struct cushion_tokenization_state_t *state, const char *position)
+{
+    const char *line_start = position;
+    while (line_start > state->origin && line_start[-1] != '\n')
+    {
+        --line_start;
+    }
+
+    if (line_start == state->origin)
+    {
+        return state->origin_column + (unsigned int) (position - state->origin);
+    }
+
+    return 1u + (unsigned int) (position - line_start);
+}
+
+unsigned int cushion_tokenization_state_get_cursor_column (const struct cushion_tokenization_state_t *state)
+{
+    return tokenization_get_column (state, state->cursor);
 }
 
 static enum cushion_internal_result_t re2c_refill_buffer (struct cushion_instance_t *instance,
@@ -157,6 +259,8 @@ static enum cushion_internal_result_t re2c_refill_buffer (struct cushion_instanc
     }
 
     // Shift buffer contents (discard everything up to the current token).
+    state->origin_column = tokenization_get_column (state, preserve_from);
+    state->origin = state->input_buffer;
     memmove (state->input_buffer, preserve_from, used);
     state->limit -= shift;
     state->cursor -= shift;
@@ -221,49 +325,219 @@ static enum cushion_internal_result_t re2c_refill_buffer (struct cushion_instanc
 
 static inline void re2c_yyskip (struct cushion_tokenization_state_t *state)
 {
-    if (*state->cursor == '\n')
-    {
-        ++state->cursor_line;
-        state->cursor_column = 0u;
-    }
-
+    // Columns are calculated on demand, so only lines are counted here.
+    state->cursor_line += *state->cursor == '\n' ? 1u : 0u;
     ++state->cursor;
-    ++state->cursor_column;
 }
 
 static inline void re2c_yybackup (struct cushion_tokenization_state_t *state)
 {
     state->marker = state->cursor;
     state->marker_line = state->cursor_line;
-    state->marker_column = state->cursor_column;
 }
 
 static inline void re2c_yyrestore (struct cushion_tokenization_state_t *state)
 {
     state->cursor = state->marker;
     state->cursor_line = state->marker_line;
-    state->cursor_column = state->marker_column;
 }
 
 static inline void re2c_save_cursor (struct cushion_tokenization_state_t *state)
 {
     state->saved = state->cursor;
     state->saved_line = state->cursor_line;
-    state->saved_column = state->cursor_column;
 }
 
 static inline void re2c_clear_saved_cursor (struct cushion_tokenization_state_t *state)
 {
     state->saved = NULL;
     state->saved_line = 0u;
-    state->saved_column = 0u;
 }
 
 static inline void re2c_restore_saved_cursor (struct cushion_tokenization_state_t *state)
 {
     state->cursor = state->saved;
     state->cursor_line = state->saved_line;
-    state->cursor_column = state->saved_column;
+}
+
+/// \brief Moves cursor forward to given position, counting passed lines in bulk.
+static inline void tokenization_advance_cursor (struct cushion_tokenization_state_t *state, const char *target)
+{
+    const char *new_line = memchr (state->cursor, '\n', target - state->cursor);
+    while (new_line)
+    {
+        ++state->cursor_line;
+        new_line = memchr (new_line + 1u, '\n', target - new_line - 1u);
+    }
+
+    state->cursor = target;
+}
+
+/// \brief Skips regular code in skip regular mode until the beginning of the next line that can start a directive.
+/// \details Jumps from new line to new line using memchr, which is vectorized by C libraries, and only looks at
+///          every character of the line when it contains slash, as only these lines can start comments. Multiline
+///          comments and line continuations are skipped as a whole, so lines inside them are never treated as
+///          directives. Unless single line is requested, skipping continues through every line which first non-blank
+///          character is not "#", so tokenizer is only entered at possible directives and lines are counted in bulk.
+///          Returns zero if no line start was reached in current buffer: for in-memory input cursor is moved to the
+///          limit in that case, for streamed input cursor is left intact, so byte-by-byte routine can properly refill
+///          the buffer.
+static unsigned int tokenization_skip_regular_fast (struct cushion_tokenization_state_t *state,
+                                                    unsigned int single_line)
+{
+    const char *const begin = state->cursor;
+    const char *const limit = state->limit;
+    const char *cursor = begin;
+    const char *last_line_begin = NULL;
+    unsigned int inside_line_comment = 0u;
+
+    while (1u)
+    {
+        const char *line_end = memchr (cursor, '\n', limit - cursor);
+        if (!line_end)
+        {
+            goto reached_limit;
+        }
+
+        if (!inside_line_comment && memchr (cursor, '/', line_end - cursor))
+        {
+            // Literals are tracked only to avoid treating their content as comments.
+            const char *scan = cursor;
+            while (scan < line_end)
+            {
+                switch (*scan)
+                {
+                case '"':
+                case '\'':
+                {
+                    const char quote = *scan;
+                    ++scan;
+
+                    while (scan < line_end && *scan != quote)
+                    {
+                        scan += *scan == '\\' && scan + 1u < line_end ? 2u : 1u;
+                    }
+
+                    scan += scan < line_end ? 1u : 0u;
+                    break;
+                }
+
+                case '/':
+                    if (scan + 1u < line_end && scan[1u] == '/')
+                    {
+                        inside_line_comment = 1u;
+                        scan = line_end;
+                    }
+                    else if (scan + 1u < line_end && scan[1u] == '*')
+                    {
+                        // Search for comment end can go through any count of lines.
+                        const char *comment_cursor = scan + 2u;
+                        while (1u)
+                        {
+                            const char *star = memchr (comment_cursor, '*', limit - comment_cursor);
+                            if (!star || star + 1u >= limit)
+                            {
+                                goto reached_limit;
+                            }
+
+                            if (star[1u] == '/')
+                            {
+                                scan = star + 2u;
+                                break;
+                            }
+
+                            comment_cursor = star + 1u;
+                        }
+
+                        if (scan > line_end)
+                        {
+                            // Comment has ended on other line, which continues the same line for the preprocessor.
+                            cursor = scan;
+                            goto next_line_part;
+                        }
+                    }
+                    else
+                    {
+                        ++scan;
+                    }
+
+                    break;
+
+                default:
+                    ++scan;
+                    break;
+                }
+            }
+        }
+
+        {
+            const char *before_new_line = line_end > begin && line_end[-1] == '\r' ? line_end - 1u : line_end;
+            const unsigned int continued = before_new_line > begin && before_new_line[-1] == '\\';
+            cursor = line_end + 1u;
+
+            if (!continued)
+            {
+                if (single_line)
+                {
+                    tokenization_advance_cursor (state, cursor);
+                    return 1u;
+                }
+
+                const char *peek = cursor;
+                while (peek < limit && (*peek == ' ' || *peek == '\t'))
+                {
+                    ++peek;
+                }
+
+                if (peek >= limit || *peek == '#')
+                {
+                    tokenization_advance_cursor (state, cursor);
+                    return 1u;
+                }
+
+                last_line_begin = cursor;
+                inside_line_comment = 0u;
+                cursor = peek;
+            }
+
+            // Continued line comment consumes the next line too, therefore inside line comment flag is kept.
+        }
+
+    next_line_part:
+        continue;
+    }
+
+reached_limit:
+    if (!state->input_file_optional)
+    {
+        // In-memory input: there is no next line, everything till the end is skipped.
+        tokenization_advance_cursor (state, limit);
+    }
+    else if (last_line_begin)
+    {
+        // Streamed input: keep already skipped lines, so byte-by-byte routine only handles the last one.
+        tokenization_advance_cursor (state, last_line_begin);
+        return 1u;
+    }
+
+    return 0u;
+}
+
+const char *cushion_tokenization_skip_line (struct cushion_tokenization_state_t *state)
+{
+    assert (!state->input_file_optional);
+    const char *const begin = state->cursor;
+
+    if (tokenization_skip_regular_fast (state, 1u))
+    {
+        // Cursor is right after the new line, so it is the same as if new line token was just emitted.
+        state->state = CUSHION_TOKENIZATION_MODE_NEW_LINE;
+        const char *line_end = state->cursor - 1u;
+        return line_end > begin && line_end[-1] == '\r' ? line_end - 1u : line_end;
+    }
+
+    // Reached end of the input, cursor is at the limit.
+    return state->cursor;
 }
 
 /*!re2c
@@ -319,9 +593,19 @@ struct cushion_token_list_item_t *cushion_save_token_to_memory (struct cushion_i
 #endif
 
     target->token.type = token->type;
-    target->token.begin =
-        cushion_instance_copy_char_sequence_inside (instance, token->begin, token->end, allocation_class);
-    target->token.end = target->token.begin + (token->end - token->begin);
+    if (token->type == CUSHION_TOKEN_TYPE_IDENTIFIER)
+    {
+        // Interned name lives until the end of the job, therefore there is no need to copy identifiers.
+        const struct cushion_symbol_t *symbol = cushion_instance_symbol_get (instance, token->symbol);
+        target->token.begin = symbol->name;
+        target->token.end = symbol->name + symbol->name_length;
+    }
+    else
+    {
+        target->token.begin =
+            cushion_instance_copy_char_sequence_inside (instance, token->begin, token->end, allocation_class);
+        target->token.end = target->token.begin + (token->end - token->begin);
+    }
 
     // Now properly recalculate subsequences to make sure that they point to copied out text.
     switch (token->type)
@@ -356,6 +640,7 @@ struct cushion_token_list_item_t *cushion_save_token_to_memory (struct cushion_i
 
     case CUSHION_TOKEN_TYPE_IDENTIFIER:
         target->token.identifier_kind = token->identifier_kind;
+        target->token.symbol = token->symbol;
         break;
 
     case CUSHION_TOKEN_TYPE_PUNCTUATOR:
@@ -377,6 +662,113 @@ struct cushion_token_list_item_t *cushion_save_token_to_memory (struct cushion_i
     return target;
 }
 
+struct cushion_token_array_t *cushion_save_token_list_to_array (struct cushion_instance_t *instance,
+                                                                const struct cushion_token_list_item_t *first,
+                                                                enum cushion_allocation_class_t allocation_class)
+{
+    unsigned int count = 0u;
+    unsigned int number_values_count = 0u;
+    size_t text_size = 0u;
+
+    for (const struct cushion_token_list_item_t *item = first; item; item = item->next)
+    {
+        ++count;
+        if (item->token.type == CUSHION_TOKEN_TYPE_NUMBER_INTEGER)
+        {
+            ++number_values_count;
+        }
+
+        // Identifiers are interned and their text is taken from symbol name.
+        if (item->token.type != CUSHION_TOKEN_TYPE_IDENTIFIER)
+        {
+            text_size += (size_t) (item->token.end - item->token.begin);
+        }
+    }
+
+    if (count == 0u)
+    {
+        return NULL;
+    }
+
+    assert (text_size <= UINT32_MAX);
+    struct cushion_token_array_t *array = cushion_allocator_allocate (
+        &instance->allocator, cushion_token_array_size (count, number_values_count, (unsigned int) text_size),
+        cushion_token_array_alignment (), allocation_class);
+
+    array->count = count;
+    array->number_values_count = number_values_count;
+    array->text_size = (unsigned int) text_size;
+    cushion_token_array_bind (array);
+
+    struct cushion_token_array_token_t *record = array->tokens;
+    unsigned int number_index = 0u;
+    uint32_t text_offset = 0u;
+
+    for (const struct cushion_token_list_item_t *item = first; item; item = item->next, ++record)
+    {
+        record->begin = 0u;
+        record->end = 0u;
+        record->type = (uint8_t) item->token.type;
+        record->kind = 0u;
+        record->subsequence_head = 0u;
+        record->subsequence_tail = 0u;
+        record->value = 0u;
+
+        const struct cushion_token_subsequence_t *subsequence = NULL;
+        struct cushion_token_subsequence_t literal_content;
+
+        switch (item->token.type)
+        {
+        case CUSHION_TOKEN_TYPE_IDENTIFIER:
+            record->kind = (uint8_t) item->token.identifier_kind;
+            record->value = item->token.symbol;
+            continue;
+
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_SYSTEM:
+        case CUSHION_TOKEN_TYPE_PREPROCESSOR_HEADER_USER:
+            subsequence = &item->token.header_path;
+            break;
+
+        case CUSHION_TOKEN_TYPE_PUNCTUATOR:
+            record->kind = (uint8_t) item->token.punctuator_kind;
+            break;
+
+        case CUSHION_TOKEN_TYPE_NUMBER_INTEGER:
+            record->value = number_index;
+            array->number_values[number_index++] = item->token.unsigned_number_value;
+            break;
+
+        case CUSHION_TOKEN_TYPE_CHARACTER_LITERAL:
+        case CUSHION_TOKEN_TYPE_STRING_LITERAL:
+            record->kind = (uint8_t) item->token.symbolic_literal.encoding;
+            literal_content.begin = item->token.symbolic_literal.begin;
+            literal_content.end = item->token.symbolic_literal.end;
+            subsequence = &literal_content;
+            break;
+
+        default:
+            break;
+        }
+
+        if (subsequence)
+        {
+            // Only encoding prefix and quotes or brackets are outside of subsequence, they always fit.
+            assert (subsequence->begin - item->token.begin <= UINT8_MAX);
+            assert (item->token.end - subsequence->end <= UINT8_MAX);
+            record->subsequence_head = (uint8_t) (subsequence->begin - item->token.begin);
+            record->subsequence_tail = (uint8_t) (item->token.end - subsequence->end);
+        }
+
+        const size_t size = (size_t) (item->token.end - item->token.begin);
+        memcpy (array->text + text_offset, item->token.begin, size);
+        record->begin = text_offset;
+        text_offset += (uint32_t) size;
+        record->end = text_offset;
+    }
+
+    return array;
+}
+
 static enum cushion_internal_result_t tokenize_decimal_value (const char *begin,
                                                               const char *end,
                                                               unsigned long long *output)
@@ -572,6 +964,7 @@ start_next_token:
 
 #define PREPROCESSOR_EMIT_TOKEN_IDENTIFIER(KIND)                                                                       \
     output->identifier_kind = KIND;                                                                                    \
+    output->symbol = cushion_instance_symbol_intern (instance, state->token, state->cursor);                           \
     PREPROCESSOR_EMIT_TOKEN (CUSHION_TOKEN_TYPE_IDENTIFIER)
 
 #define PREPROCESSOR_EMIT_TOKEN_PUNCTUATOR(KIND)                                                                       \
@@ -599,6 +992,13 @@ start_next_token:
         {
             // Separate routine for breezing through anything that is not a preprocessor directive.
         skip_regular_routine:
+            if (tokenization_skip_regular_fast (state, 0u))
+            {
+                state->state = CUSHION_TOKENIZATION_MODE_NEW_LINE;
+                goto start_next_token;
+            }
+
+            // Fast routine has reached the limit: process the rest byte by byte, handling refill and end of file.
             state->token = state->cursor;
 
             /*!re2c
@@ -0,0 +1,602 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <errno.h>
+#include <time.h>
+
+#include "internal.h"
+
+/// \brief Time in milliseconds to wait for other events after the first one, as saving usually produces several.
+#define WATCH_SETTLE_MS 20
+
+enum cushion_internal_result_t cushion_watch_init (struct cushion_instance_t *instance, struct cushion_watch_t *watch)
+{
+    watch->jobs_count = 0u;
+    struct cushion_job_node_t *job_node = instance->jobs_first;
+
+    while (job_node)
+    {
+        ++watch->jobs_count;
+        job_node = job_node->next;
+    }
+
+    watch->jobs = malloc (sizeof (struct cushion_watch_job_t) * watch->jobs_count);
+    watch->dirty_jobs_count = watch->jobs_count;
+    watch->round_start_time = 0;
+    job_node = instance->jobs_first;
+
+    for (unsigned int index = 0u; index < watch->jobs_count; ++index)
+    {
+        struct cushion_watch_job_t *watch_job = &watch->jobs[index];
+        watch_job->job = job_node;
+        watch_job->dirty = 1u;
+        watch_job->dependencies_count = 0u;
+        watch_job->dependencies = NULL;
+
+        job_node->watch_job = watch_job;
+        job_node = job_node->next;
+    }
+
+    for (unsigned int index = 0u; index < CUSHION_DEPFILE_BUCKETS; ++index)
+    {
+        watch->path_buckets[index] = NULL;
+    }
+
+#if defined(CUSHION_WATCH_INOTIFY)
+    watch->directories_first = NULL;
+    watch->inotify_descriptor = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watch->inotify_descriptor < 0)
+    {
+        cushion_instance_error_output (instance, "Failed to initialize inotify: %s.\n", strerror (errno));
+        cushion_watch_shutdown (watch);
+        return CUSHION_INTERNAL_RESULT_FAILED;
+    }
+#endif
+
+    return CUSHION_INTERNAL_RESULT_OK;
+}
+
+static void watch_job_clear_dependencies (struct cushion_watch_job_t *watch_job)
+{
+    for (unsigned int index = 0u; index < watch_job->dependencies_count; ++index)
+    {
+        free (watch_job->dependencies[index]);
+    }
+
+    free (watch_job->dependencies);
+    watch_job->dependencies_count = 0u;
+    watch_job->dependencies = NULL;
+}
+
+static char *copy_string_to_heap (const char *string)
+{
+    const size_t length = strlen (string);
+    char *copied = malloc (length + 1u);
+    memcpy (copied, string, length + 1u);
+    return copied;
+}
+
+void cushion_watch_record_job (struct cushion_instance_t *instance, struct cushion_watch_job_t *watch_job)
+{
+    watch_job_clear_dependencies (watch_job);
+    unsigned int count = 0u;
+    struct cushion_input_node_t *input_node = watch_job->job->inputs_first;
+
+    while (input_node)
+    {
+        ++count;
+        input_node = input_node->next;
+    }
+
+    struct cushion_depfile_dependency_node_t *dependency = instance->dependencies_first;
+    while (dependency)
+    {
+        ++count;
+        dependency = dependency->next_dependency;
+    }
+
+    watch_job->dependencies = malloc (sizeof (char *) * (count > 0u ? count : 1u));
+    input_node = watch_job->job->inputs_first;
+
+    // Inputs are added separately, because job that failed to read its input has not recorded it as dependency.
+    while (input_node)
+    {
+        char absolute_path[CUSHION_PATH_MAX];
+        if (cushion_convert_path_to_absolute (input_node->path, absolute_path) == CUSHION_INTERNAL_RESULT_OK)
+        {
+            watch_job->dependencies[watch_job->dependencies_count++] = copy_string_to_heap (absolute_path);
+        }
+
+        input_node = input_node->next;
+    }
+
+    dependency = instance->dependencies_first;
+    while (dependency)
+    {
+        watch_job->dependencies[watch_job->dependencies_count++] = copy_string_to_heap (dependency->path);
+        dependency = dependency->next_dependency;
+    }
+}
+
+static void watch_mark_path_dirty (struct cushion_watch_t *watch, struct cushion_watch_path_t *path)
+{
+    for (unsigned int index = 0u; index < path->jobs_count; ++index)
+    {
+        struct cushion_watch_job_t *watch_job = &watch->jobs[path->jobs[index]];
+        if (!watch_job->dirty)
+        {
+            watch_job->dirty = 1u;
+            ++watch->dirty_jobs_count;
+        }
+    }
+}
+
+static void watch_mark_everything_dirty (struct cushion_watch_t *watch)
+{
+    for (unsigned int index = 0u; index < watch->jobs_count; ++index)
+    {
+        watch->jobs[index].dirty = 1u;
+    }
+
+    watch->dirty_jobs_count = watch->jobs_count;
+}
+
+static struct cushion_watch_path_t *watch_path_find (struct cushion_watch_path_t **buckets, const char *path)
+{
+    const unsigned int path_hash = cushion_hash_djb2_null_terminated (path);
+    struct cushion_watch_path_t *node = buckets[path_hash % CUSHION_DEPFILE_BUCKETS];
+
+    while (node)
+    {
+        if (node->path_hash == path_hash && strcmp (node->path, path) == 0)
+        {
+            return node;
+        }
+
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+static void watch_paths_clear (struct cushion_watch_path_t **buckets)
+{
+    for (unsigned int bucket = 0u; bucket < CUSHION_DEPFILE_BUCKETS; ++bucket)
+    {
+        struct cushion_watch_path_t *node = buckets[bucket];
+        while (node)
+        {
+            struct cushion_watch_path_t *next = node->next;
+            free (node->path);
+            free (node->jobs);
+            free (node);
+            node = next;
+        }
+
+        buckets[bucket] = NULL;
+    }
+}
+
+#if defined(CUSHION_WATCH_INOTIFY)
+static void watch_directory_add (struct cushion_watch_t *watch, struct cushion_watch_directory_t *directory)
+{
+    directory->descriptor =
+        inotify_add_watch (watch->inotify_descriptor, directory->path,
+                           IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+}
+
+static struct cushion_watch_directory_t *watch_directory_get (struct cushion_instance_t *instance,
+                                                              struct cushion_watch_t *watch,
+                                                              const char *path,
+                                                              size_t path_length)
+{
+    struct cushion_watch_directory_t *directory = watch->directories_first;
+    while (directory)
+    {
+        if (strlen (directory->path) == path_length && strncmp (directory->path, path, path_length) == 0)
+        {
+            directory->used = 1u;
+            if (directory->descriptor < 0)
+            {
+                // Watch was lost or has never been added, directory might be available again. Changes made before
+                // watch was added again are unknown, therefore it is treated in the same way as new directory.
+                watch_directory_add (watch, directory);
+                directory->fresh = directory->descriptor >= 0 ? 1u : 0u;
+            }
+
+            return directory;
+        }
+
+        directory = directory->next;
+    }
+
+    directory = malloc (sizeof (struct cushion_watch_directory_t));
+    directory->path = malloc (path_length + 1u);
+    memcpy (directory->path, path, path_length);
+    directory->path[path_length] = '\0';
+    directory->used = 1u;
+    directory->fresh = 1u;
+    watch_directory_add (watch, directory);
+
+    if (directory->descriptor < 0)
+    {
+        // Not critical: dependencies in this directory are just not watched. Adding watch is retried on every
+        // subscription, but failure is only reported once.
+        cushion_instance_error_output (instance, "Failed to watch directory \"%s\": %s.\n", directory->path,
+                                       strerror (errno));
+    }
+
+    directory->next = watch->directories_first;
+    watch->directories_first = directory;
+    return directory;
+}
+#endif
+
+void cushion_watch_subscribe (struct cushion_instance_t *instance, struct cushion_watch_t *watch)
+{
+#if defined(CUSHION_WATCH_POLL)
+    // Instance is only needed to report failures of directory watches.
+    (void) instance;
+#endif
+
+    // Previous paths are kept until the new ones are built in order to carry their state over.
+    struct cushion_watch_path_t *previous_buckets[CUSHION_DEPFILE_BUCKETS];
+    for (unsigned int bucket = 0u; bucket < CUSHION_DEPFILE_BUCKETS; ++bucket)
+    {
+        previous_buckets[bucket] = watch->path_buckets[bucket];
+        watch->path_buckets[bucket] = NULL;
+    }
+
+    for (unsigned int index = 0u; index < watch->jobs_count; ++index)
+    {
+        watch->jobs[index].dirty = 0u;
+    }
+
+    watch->dirty_jobs_count = 0u;
+
+#if defined(CUSHION_WATCH_INOTIFY)
+    struct cushion_watch_directory_t *directory = watch->directories_first;
+    while (directory)
+    {
+        directory->used = 0u;
+        directory->fresh = 0u;
+        directory = directory->next;
+    }
+#endif
+
+    for (unsigned int job_index = 0u; job_index < watch->jobs_count; ++job_index)
+    {
+        struct cushion_watch_job_t *watch_job = &watch->jobs[job_index];
+        for (unsigned int dependency_index = 0u; dependency_index < watch_job->dependencies_count; ++dependency_index)
+        {
+            const char *dependency = watch_job->dependencies[dependency_index];
+            struct cushion_watch_path_t *path = watch_path_find (watch->path_buckets, dependency);
+
+            if (!path)
+            {
+                path = malloc (sizeof (struct cushion_watch_path_t));
+                path->path_hash = cushion_hash_djb2_null_terminated (dependency);
+                path->path = copy_string_to_heap (dependency);
+                path->jobs_count = 0u;
+                path->jobs_capacity = 0u;
+                path->jobs = NULL;
+
+                path->next = watch->path_buckets[path->path_hash % CUSHION_DEPFILE_BUCKETS];
+                watch->path_buckets[path->path_hash % CUSHION_DEPFILE_BUCKETS] = path;
+
+#if defined(CUSHION_WATCH_INOTIFY)
+                const char *separator = dependency;
+                for (const char *cursor = dependency; *cursor; ++cursor)
+                {
+                    if (*cursor == '/')
+                    {
+                        separator = cursor;
+                    }
+                }
+
+                // Directories that were watched during the round have already caught all the changes.
+                path->directory =
+                    watch_directory_get (instance, watch, dependency, (size_t) (separator - dependency) + 1u);
+                path->fresh = path->directory->fresh;
+#elif defined(CUSHION_WATCH_POLL)
+                // Status from previous round is kept, so changes made during the round are found by the next poll.
+                struct cushion_watch_path_t *previous = watch_path_find (previous_buckets, dependency);
+                path->fresh = previous ? 0u : 1u;
+
+                if (previous)
+                {
+                    path->status_known = previous->status_known;
+                    path->status = previous->status;
+                }
+#endif
+            }
+
+            if (path->jobs_count == path->jobs_capacity)
+            {
+                path->jobs_capacity = path->jobs_capacity > 0u ? path->jobs_capacity * 2u : 4u;
+                path->jobs = realloc (path->jobs, sizeof (unsigned int) * path->jobs_capacity);
+            }
+
+            path->jobs[path->jobs_count++] = job_index;
+        }
+    }
+
+    watch_paths_clear (previous_buckets);
+
+#if defined(CUSHION_WATCH_INOTIFY)
+    struct cushion_watch_directory_t **directory_pointer = &watch->directories_first;
+    while (*directory_pointer)
+    {
+        directory = *directory_pointer;
+        if (directory->used)
+        {
+            directory_pointer = &directory->next;
+            continue;
+        }
+
+        if (directory->descriptor >= 0)
+        {
+            inotify_rm_watch (watch->inotify_descriptor, directory->descriptor);
+        }
+
+        *directory_pointer = directory->next;
+        free (directory->path);
+        free (directory);
+    }
+#endif
+
+    // Fresh path might have been modified during the round after it was read, but before it became watched. Time
+    // has seconds precision, therefore files modified during the same second as round start are treated as modified.
+    for (unsigned int bucket = 0u; bucket < CUSHION_DEPFILE_BUCKETS; ++bucket)
+    {
+        struct cushion_watch_path_t *path = watch->path_buckets[bucket];
+        while (path)
+        {
+            if (path->fresh)
+            {
+                struct cushion_file_status_t status = {0};
+                const unsigned int status_known =
+                    cushion_file_status_query (path->path, &status) == CUSHION_INTERNAL_RESULT_OK;
+
+                if (status_known && status.modification_time >= watch->round_start_time)
+                {
+                    watch_mark_path_dirty (watch, path);
+                }
+
+#if defined(CUSHION_WATCH_POLL)
+                path->status_known = status_known;
+                path->status = status;
+#endif
+            }
+
+            path = path->next;
+        }
+    }
+}
+
+#if defined(CUSHION_WATCH_INOTIFY)
+static void watch_process_events (struct cushion_watch_t *watch, const char *events, size_t size)
+{
+    char path_buffer[CUSHION_PATH_MAX];
+    const char *cursor = events;
+
+    while (cursor < events + size)
+    {
+        const struct inotify_event *event = (const struct inotify_event *) cursor;
+        cursor += sizeof (struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+            // Events are lost, there is no way to find affected jobs precisely.
+            watch_mark_everything_dirty (watch);
+            continue;
+        }
+
+        struct cushion_watch_directory_t *directory = watch->directories_first;
+        while (directory && directory->descriptor != event->wd)
+        {
+            directory = directory->next;
+        }
+
+        if (!directory)
+        {
+            continue;
+        }
+
+        if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+        {
+            // Directory is gone or its watch was removed. Moved directory is still watched under the old path, so
+            // its watch is removed explicitly. Watch is added again during the next subscription.
+            if (event->mask & IN_MOVE_SELF)
+            {
+                inotify_rm_watch (watch->inotify_descriptor, directory->descriptor);
+            }
+
+            directory->descriptor = -1;
+            watch_mark_everything_dirty (watch);
+            continue;
+        }
+
+        if (event->len == 0u)
+        {
+            continue;
+        }
+
+        const size_t directory_length = strlen (directory->path);
+        const size_t name_length = strlen (event->name);
+
+        if (directory_length + name_length + 1u > CUSHION_PATH_MAX)
+        {
+            continue;
+        }
+
+        memcpy (path_buffer, directory->path, directory_length);
+        memcpy (path_buffer + directory_length, event->name, name_length + 1u);
+        struct cushion_watch_path_t *path = watch_path_find (watch->path_buckets, path_buffer);
+
+        if (path)
+        {
+            watch_mark_path_dirty (watch, path);
+        }
+    }
+}
+
+/// \brief Tries to add watches that were lost or were never added, for example for removed and recreated directories.
+/// \details Changes made before watch was added are unknown, therefore everything is marked dirty on success.
+static void watch_retry_lost_directories (struct cushion_watch_t *watch)
+{
+    struct cushion_watch_directory_t *directory = watch->directories_first;
+    while (directory)
+    {
+        if (directory->descriptor < 0)
+        {
+            watch_directory_add (watch, directory);
+            if (directory->descriptor >= 0)
+            {
+                watch_mark_everything_dirty (watch);
+            }
+        }
+
+        directory = directory->next;
+    }
+}
+
+/// \brief Reads and processes events that are available without blocking.
+static void watch_read_events (struct cushion_watch_t *watch)
+{
+    _Alignas (struct inotify_event) char events[sizeof (struct inotify_event) * 64u + CUSHION_PATH_MAX];
+    while (1)
+    {
+        const ssize_t size = read (watch->inotify_descriptor, events, sizeof (events));
+        if (size <= 0)
+        {
+            break;
+        }
+
+        watch_process_events (watch, events, (size_t) size);
+    }
+}
+#elif defined(CUSHION_WATCH_POLL)
+static void watch_sleep (unsigned int milliseconds)
+{
+#    if defined(CUSHION_THREADS_WINDOWS)
+    Sleep (milliseconds);
+#    else
+    struct timespec duration = {
+        .tv_sec = milliseconds / 1000u,
+        .tv_nsec = (long) (milliseconds % 1000u) * 1000000L,
+    };
+
+    nanosleep (&duration, NULL);
+#    endif
+}
+
+static void watch_poll_statuses (struct cushion_watch_t *watch)
+{
+    for (unsigned int bucket = 0u; bucket < CUSHION_DEPFILE_BUCKETS; ++bucket)
+    {
+        struct cushion_watch_path_t *path = watch->path_buckets[bucket];
+        while (path)
+        {
+            struct cushion_file_status_t status = {0};
+            const unsigned int status_known = cushion_file_status_query (path->path, &status) ==
+                                              CUSHION_INTERNAL_RESULT_OK;
+
+            if (status_known != path->status_known ||
+                (status_known && (status.modification_time != path->status.modification_time ||
+                                  status.size != path->status.size)))
+            {
+                path->status_known = status_known;
+                path->status = status;
+                watch_mark_path_dirty (watch, path);
+            }
+
+            path = path->next;
+        }
+    }
+}
+#endif
+
+unsigned int cushion_watch_wait (struct cushion_watch_t *watch, cushion_watch_callback_t callback, void *user_data)
+{
+    while (watch->dirty_jobs_count == 0u)
+    {
+#if defined(CUSHION_WATCH_INOTIFY)
+        struct pollfd descriptor = {
+            .fd = watch->inotify_descriptor,
+            .events = POLLIN,
+        };
+
+        if (poll (&descriptor, 1u, CUSHION_WATCH_INTERVAL_MS) > 0)
+        {
+            watch_read_events (watch);
+            descriptor.revents = 0;
+
+            while (poll (&descriptor, 1u, WATCH_SETTLE_MS) > 0)
+            {
+                watch_read_events (watch);
+                descriptor.revents = 0;
+            }
+
+            if (watch->dirty_jobs_count > 0u)
+            {
+                break;
+            }
+        }
+
+        watch_retry_lost_directories (watch);
+        if (watch->dirty_jobs_count > 0u)
+        {
+            break;
+        }
+#elif defined(CUSHION_WATCH_POLL)
+        watch_sleep (CUSHION_WATCH_INTERVAL_MS);
+        watch_poll_statuses (watch);
+
+        if (watch->dirty_jobs_count > 0u)
+        {
+            // Give writer a chance to finish, so job does not read half written file.
+            watch_sleep (WATCH_SETTLE_MS);
+            break;
+        }
+#endif
+
+        if (!callback (user_data))
+        {
+            return 0u;
+        }
+    }
+
+    return 1u;
+}
+
+void cushion_watch_shutdown (struct cushion_watch_t *watch)
+{
+    watch_paths_clear (watch->path_buckets);
+    for (unsigned int index = 0u; index < watch->jobs_count; ++index)
+    {
+        watch_job_clear_dependencies (&watch->jobs[index]);
+        watch->jobs[index].job->watch_job = NULL;
+    }
+
+    free (watch->jobs);
+    watch->jobs = NULL;
+    watch->jobs_count = 0u;
+
+#if defined(CUSHION_WATCH_INOTIFY)
+    while (watch->directories_first)
+    {
+        struct cushion_watch_directory_t *next = watch->directories_first->next;
+        free (watch->directories_first->path);
+        free (watch->directories_first);
+        watch->directories_first = next;
+    }
+
+    if (watch->inotify_descriptor >= 0)
+    {
+        close (watch->inotify_descriptor);
+        watch->inotify_descriptor = -1;
+    }
+#endif
+}
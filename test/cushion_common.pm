@@ -5,7 +5,7 @@ use strict;
 use warnings FATAL => 'all';
 
 use base "Exporter";
-our @EXPORT = ('fix_line_directive', 'fix_depfile_line');
+our @EXPORT = ('fix_line_directive', 'fix_depfile_line', 'check_result', 'check_depfile', 'read_file');
 
 # Fix line directive for using in expectation saved in version control by removing user-specific path part.
 sub fix_line_directive {
@@ -33,4 +33,62 @@ sub fix_depfile_line {
     return $line;
 }
 
+# Compare lines of two files after passing result lines through given fix function, dies on the first difference.
+sub compare_lines {
+    my ($result_path, $expectation_path, $kind, $fix) = @_;
+    open my $result_handle, '<', $result_path or die "Failed to open test result $kind.";
+    open my $expectation_handle, '<', $expectation_path or die "Failed to open test expectation $kind.";
+
+    while (1) {
+        my $result_line = <$result_handle>;
+        my $expectation_line = <$expectation_handle>;
+
+        last unless defined $result_line || defined $expectation_line;
+        die "Result $kind has less lines than expectation." unless defined $result_line;
+        die "Result $kind has more lines than expectation." unless defined $expectation_line;
+
+        $result_line = $fix->($result_line);
+        if ($result_line ne $expectation_line) {
+            print "Line #$. is different in result $kind and expectation $kind.\n";
+            print "    Result     : $result_line\n";
+            print "    Expectation: $expectation_line\n";
+            die "Found difference in result and expectation."
+        }
+    }
+
+    close $result_handle;
+    close $expectation_handle;
+}
+
+# Check test result against expectation, user-specific parts of paths under any of given directories are removed.
+sub check_result {
+    my ($result_path, $expectation_path, @directories) = @_;
+    compare_lines $result_path, $expectation_path, "output", sub {
+        my ($line) = @_;
+        $line = fix_line_directive $_, $line foreach @directories;
+        return $line;
+    };
+}
+
+# Check test result depfile against expectation, user-specific parts of paths under any of given directories are
+# removed.
+sub check_depfile {
+    my ($result_path, $expectation_path, @directories) = @_;
+    compare_lines $result_path, $expectation_path, "depfile", sub {
+        my ($line) = @_;
+        $line = fix_depfile_line $_, $line foreach @directories;
+        return $line;
+    };
+}
+
+# Read the whole file content into string.
+sub read_file {
+    my ($path) = @_;
+    open my $handle, '<', $path or die "Failed to open \"$path\" for read.";
+    local $/;
+    my $content = <$handle>;
+    close $handle;
+    return $content;
+}
+
 1;
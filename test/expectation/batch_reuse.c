@@ -0,0 +1,12 @@
+#line 1 "source/batch_reuse.c"
+#line 1 "source/batch_reuse.h"
+
+
+int function_1 ();
+int function_2 ();
+#line 2 "source/batch_reuse.c"
+
+int main (int argc, char **argv)
+{
+    return function_1 ( ) + function_2 ( ) + 1 ;
+}
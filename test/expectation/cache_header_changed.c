@@ -0,0 +1,4 @@
+#line 1 "source/cache_header_changed.c"
+#include <cache_header_changed.h>
+
+int value = 2 ;
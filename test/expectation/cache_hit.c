@@ -0,0 +1,4 @@
+#line 1 "source/cache_hit.c"
+#include <cache_hit.h>
+
+int value = 1 ;
@@ -0,0 +1,6 @@
+#line 1 "source/comments_long.c"
+
+int main (int argc, char **argv)
+{
+    return 0;
+}
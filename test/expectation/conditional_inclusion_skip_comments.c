@@ -0,0 +1,8 @@
+#line 1 "source/conditional_inclusion_skip_comments.c"
+int main (int argc, char **argv)
+{
+#line 13 "source/conditional_inclusion_skip_comments.c"
+    return 1;
+
+    return 0;
+}
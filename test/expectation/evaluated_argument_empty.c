@@ -0,0 +1,12 @@
+#line 1 "source/evaluated_argument_empty.c"
+
+#line 7 "source/evaluated_argument_empty.c"
+int main (int argc, char **argv)
+{
+    const char *empty = "" ;
+    const char *empty_after_replacement = "" ;
+    exit ( ) ;
+    exit ( ) ;
+    fprintf ( , ) ;
+    return 0;
+}
@@ -0,0 +1,22 @@
+#line 1 "source/include_guard.c"
+#line 1 "include/include_full/guarded.h"
+
+
+
+
+int guarded_function ();
+#line 2 "source/include_guard.c"
+
+#line 7 "source/include_guard.c"
+#line 1 "include/include_full/guarded.h"
+
+
+
+
+int guarded_function ();
+#line 8 "source/include_guard.c"
+
+int main (int argc, char **argv)
+{
+    return guarded_function ();
+}
@@ -0,0 +1,18 @@
+#line 1 "source/include_indexed.c"
+#include <stdio.h>
+#line 1 "include/include_full/trivial.h"
+
+
+int function_1 ();
+int function_2 ();
+#line 3 "source/include_indexed.c"
+#include <include_full/missing.h>
+#include <include_scan_only/recursive_level_3.h>
+
+int main (int argc, char **argv)
+{
+
+    printf ("Found through index.\n");
+
+    return function_1 ( ) + function_2 ( ) ;
+}
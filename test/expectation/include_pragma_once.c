@@ -5,19 +5,8 @@
 int function_1 ();
 int function_2 ();
 #line 2 "source/include_pragma_once.c"
-#line 1 "include/include_full/trivial.h"
-#line 3 "source/include_pragma_once.c"
-#line 1 "include/include_full/trivial.h"
-#line 4 "source/include_pragma_once.c"
-#line 1 "include/include_full/trivial.h"
-#line 5 "source/include_pragma_once.c"
-#line 1 "include/include_full/trivial.h"
-#line 6 "source/include_pragma_once.c"
-#line 1 "include/include_full/trivial.h"
-#line 7 "source/include_pragma_once.c"
-#line 1 "include/include_full/trivial.h"
-#line 8 "source/include_pragma_once.c"
 
+#line 9 "source/include_pragma_once.c"
 int main (int argc, char **argv)
 {
     return function_1 ( ) + function_2 ( ) ;
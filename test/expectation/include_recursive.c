@@ -19,8 +19,7 @@ int another_function ();
 int some_function ();
 #line 4 "source/include_recursive.c"
 
-#line 1 "include/include_full/recursive_level_3.h"
-#line 6 "source/include_recursive.c"
+
 
 int main (int argc, char **argv)
 {
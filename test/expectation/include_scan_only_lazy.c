@@ -0,0 +1,10 @@
+#line 1 "source/include_scan_only_lazy.c"
+#include <include_scan_only/lazy_macros.h>
+
+int value_object = 1 + 2 ;
+int value_function = ( ( 1 + 2 ) * ( 4 ) ) ;
+const char *value_string = "// Not a comment." ;
+int value_preserved = LAZY_PRESERVED;
+
+
+int all_checks_passed = 1;
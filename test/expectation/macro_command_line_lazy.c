@@ -0,0 +1,8 @@
+#line 1 "source/macro_command_line_lazy.c"
+
+
+int invalid_is_defined = 1;
+
+
+int x = 1 + ( 2 * 3 ) ;
+int y = ( 2 * 3 ) * ( 2 * 3 ) ;
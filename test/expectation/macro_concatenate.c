@@ -11,5 +11,7 @@ int main (int argc, char **argv)
     int variable_EXISTENT_MACRO ;
 
     int tricky_tricky_replacement_should_work = 42 ;
+
+    int numbered1 ; int numbered007 ; int numbered10u ;
     return 0;
 }
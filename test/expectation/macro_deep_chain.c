@@ -0,0 +1,4 @@
+#line 1 "source/macro_deep_chain.c"
+
+#line 4100 "source/macro_deep_chain.c"
+int value =  41 + 1 ;
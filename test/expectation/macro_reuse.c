@@ -0,0 +1,23 @@
+#line 1 "source/macro_reuse.c"
+
+
+
+
+int first_a = ( 2 * 2 ) ;
+int first_b = ( 2 * 2 ) ;
+int first_c = ( 2 * 2 ) ;
+#line 12 "source/macro_reuse.c"
+int second_a = ( 3 * 2 ) ;
+int second_b = ( 3 * 2 ) ;
+#line 18 "source/macro_reuse.c"
+int third_a = ( 3 + 3 ) ;
+int third_b = ( 3 + 3 ) ;
+
+
+
+int fourth_a = ( VALUE_BASE + VALUE_BASE ) ;
+int fourth_b = ( VALUE_BASE + VALUE_BASE ) ;
+
+int line_a =  26 ;
+int line_b =  27 ;
+int line_c =  28 ;
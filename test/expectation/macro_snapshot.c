@@ -0,0 +1,2 @@
+#line 1 "source/macro_snapshot.c"
+int value = 1 ;
@@ -0,0 +1,2 @@
+#line 1 "source/macro_snapshot_rebuild.c"
+int value = 2 ;
@@ -0,0 +1,4 @@
+#line 1 "source/server.c"
+#include <server.h>
+
+int value = 2 ;
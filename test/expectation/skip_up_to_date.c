@@ -0,0 +1,4 @@
+#line 1 "source/skip_up_to_date.c"
+#include <skip_up_to_date.h>
+
+int value = 1 ;
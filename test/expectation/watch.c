@@ -0,0 +1,4 @@
+#line 1 "source/watch.c"
+#include <watch.h>
+
+int value = 2 ;
@@ -0,0 +1,4 @@
+#line 1 "source/write_only_changed.c"
+#include <write_only_changed.h>
+
+int value = 2 ;
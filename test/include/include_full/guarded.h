@@ -0,0 +1,8 @@
+// Include guard with comments around it is still detected.
+#ifndef INCLUDE_FULL_GUARDED_H
+#define INCLUDE_FULL_GUARDED_H
+
+int guarded_function ();
+
+#endif
+// Trailing comment.
@@ -0,0 +1,18 @@
+#ifndef LAZY_MACROS_H
+#define LAZY_MACROS_H
+
+#define LAZY_OBJECT 1 + \
+    2
+
+#define LAZY_FUNCTION(X, Y) ((X) /* Multiline comment
+                                    inside replacement list. */ * (Y))
+
+#define LAZY_STRING "// Not a comment." // Comment after replacement list.
+#define LAZY_UNUSED never_called (1, 2, 3)
+#define LAZY_PRESERVED __CUSHION_PRESERVE__ preserved_value
+
+#define LAZY_REDEFINED 1
+#undef LAZY_REDEFINED
+#define LAZY_REDEFINED 3
+
+#endif
@@ -0,0 +1,6 @@
+#include "batch_reuse.h"
+
+int main (int argc, char **argv)
+{
+    return BATCH_MACRO - IN_1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+int function_1 ();
+int function_2 ();
+
+#define BATCH_MACRO function_1 () + function_2 ()
@@ -0,0 +1,3 @@
+#include <cache_header_changed.h>
+
+int value = GENERATED_VALUE;
@@ -0,0 +1,3 @@
+#include <cache_hit.h>
+
+int value = GENERATED_VALUE;
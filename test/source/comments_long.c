@@ -0,0 +1,5 @@
+/* Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. Long comment that is bigger than streaming input buffer. */
+int main (int argc, char **argv)
+{
+    return 0;
+}
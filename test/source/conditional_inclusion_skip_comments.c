@@ -0,0 +1,16 @@
+int main (int argc, char **argv)
+{
+#if 0
+    /* Lines inside comments of excluded code are not directives:
+#else
+    */
+    int a = 1; // Continued line comment \
+#else
+    const char *text = "/* not a comment";
+    int b = 2 / 3; \
+#else
+#else
+    return 1;
+#endif
+    return 0;
+}
@@ -0,0 +1,15 @@
+#define STRINGIZE(ARG) #__CUSHION_EVALUATED_ARGUMENT__(ARG)
+#define CALL(FUNCTION, ARG) FUNCTION (__CUSHION_EVALUATED_ARGUMENT__(ARG))
+#define CALL_TWO(FUNCTION, FIRST, SECOND) FUNCTION (__CUSHION_EVALUATED_ARGUMENT__(FIRST), SECOND)
+
+#define NOTHING
+
+int main (int argc, char **argv)
+{
+    const char *empty = STRINGIZE ();
+    const char *empty_after_replacement = STRINGIZE (NOTHING);
+    CALL (exit, );
+    CALL (exit, NOTHING);
+    CALL_TWO (fprintf, , NOTHING);
+    return 0;
+}
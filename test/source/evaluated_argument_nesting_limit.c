@@ -0,0 +1,5 @@
+// Evaluated argument replaces the same macro again, therefore evaluation must stop with nesting limit error.
+#define EVALUATE(ARG) __CUSHION_EVALUATED_ARGUMENT__(ARG)
+#define EVALUATE_FOREVER(ARG) EVALUATE (EVALUATE_FOREVER (ARG))
+
+int value = EVALUATE_FOREVER (1);
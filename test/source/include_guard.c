@@ -0,0 +1,12 @@
+#include <include_full/guarded.h>
+#include <include_full/guarded.h>
+#include <include_full/guarded.h>
+
+// Guard is no longer active after undef, therefore file is lexed again.
+#undef INCLUDE_FULL_GUARDED_H
+#include <include_full/guarded.h>
+
+int main (int argc, char **argv)
+{
+    return guarded_function ();
+}
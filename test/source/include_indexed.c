@@ -0,0 +1,12 @@
+#include <stdio.h>
+#include <include_full/trivial.h>
+#include <include_full/missing.h>
+#include <include_scan_only/recursive_level_3.h>
+
+int main (int argc, char **argv)
+{
+#if defined(MACRO_LEVEL_3)
+    printf ("Found through index.\n");
+#endif
+    return SOME_MACRO;
+}
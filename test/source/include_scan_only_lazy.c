@@ -0,0 +1,10 @@
+#include <include_scan_only/lazy_macros.h>
+
+int value_object = LAZY_OBJECT;
+int value_function = LAZY_FUNCTION (LAZY_OBJECT, 4);
+const char *value_string = LAZY_STRING;
+int value_preserved = LAZY_PRESERVED;
+
+#if defined(LAZY_UNUSED) && LAZY_REDEFINED == 3 && LAZY_FUNCTION (1, 2) == 2
+int all_checks_passed = 1;
+#endif
@@ -0,0 +1,7 @@
+// Invalid define is never expanded, therefore it must not be lexed and must not fail the execution.
+#if defined(UNUSED_INVALID)
+int invalid_is_defined = 1;
+#endif
+
+int x = IN_1 + MACRO_WITH_VALUE;
+int y = MACRO_WITH_VALUE * MACRO_WITH_VALUE;
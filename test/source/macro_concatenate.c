@@ -10,5 +10,7 @@ int main (int argc, char **argv)
     DEFINE_VARIABLE (EXISTENT_MACRO)
 #define variable_trick tricky_tricky_replacement_should_work = 42
     DEFINE_VARIABLE (trick)
+#define DEFINE_NUMBERED(NAME) int NAME##1; int NAME##007; int NAME##10u;
+    DEFINE_NUMBERED (numbered)
     return 0;
 }
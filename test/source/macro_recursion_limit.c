@@ -0,0 +1,4 @@
+// Cushion does not paint self-referencing macros blue, therefore expansion must stop with depth limit error.
+#define SELF_REFERENCING SELF_REFERENCING
+
+int value = SELF_REFERENCING;
@@ -0,0 +1,28 @@
+#define VALUE_BASE 2
+#define VALUE_DOUBLE (VALUE_BASE * 2)
+#define VALUE_LINE __LINE__
+
+int first_a = VALUE_DOUBLE;
+int first_b = VALUE_DOUBLE;
+int first_c = VALUE_DOUBLE;
+
+#undef VALUE_BASE
+#define VALUE_BASE 3
+
+int second_a = VALUE_DOUBLE;
+int second_b = VALUE_DOUBLE;
+
+#undef VALUE_DOUBLE
+#define VALUE_DOUBLE (VALUE_BASE + VALUE_BASE)
+
+int third_a = VALUE_DOUBLE;
+int third_b = VALUE_DOUBLE;
+
+#undef VALUE_BASE
+
+int fourth_a = VALUE_DOUBLE;
+int fourth_b = VALUE_DOUBLE;
+
+int line_a = VALUE_LINE;
+int line_b = VALUE_LINE;
+int line_c = VALUE_LINE;
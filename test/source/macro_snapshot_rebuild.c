@@ -0,0 +1 @@
+int value = GENERATED_VALUE;
@@ -0,0 +1,3 @@
+#include <server.h>
+
+int value = GENERATED_VALUE;
@@ -0,0 +1,3 @@
+#include <skip_up_to_date.h>
+
+int value = GENERATED_VALUE;
@@ -0,0 +1,3 @@
+#include <watch.h>
+
+int value = GENERATED_VALUE;
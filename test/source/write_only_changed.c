@@ -0,0 +1,3 @@
+#include <write_only_changed.h>
+
+int value = GENERATED_VALUE;